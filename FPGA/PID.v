@@ -0,0 +1,160 @@
+// PID.v
+// Position loop of one axis in fixed point, with the structure of the 20-sim
+// PID1 and SignalLimiter2 blocks (Pi/controller/*/..._xxmodel.c) at a fixed
+// sample time T:
+//   uD  = a*uD' + b*(e - e') + c*e    a = tauD*beta / (T + tauD*beta)
+//   uI  = uI' + d*uD                  b = kp*tauD / (T + tauD*beta)
+//   out = limit(uI + uD)              c = kp*T / (T + tauD*beta),  d = T / tauI
+// e is the setpoint minus the position in encoder counts, saturated at 24
+// bits, and out is in duty cycle units: the Pi folds the radian and duty
+// scales into b and c (Pi/fpga_pid.c). a, b and c are signed Q7.24, d is
+// unsigned Q0.32; uD, uI and out are Q15.16, saturated at 32 bits. Products
+// are rounded towards minus infinity.
+//
+// The iCE40 has no multipliers: the four products of an update go one after
+// the other through a shift-add multiplier, 33 clk each, so an update ends
+// ~135 clk after its sample strobe. Pi/fpga_pid.c is the bit-exact model of
+// this block.
+module PID #(
+  parameter COUNTER_W  = 12,
+  parameter SAMPLE_DIV = 1            // Sample strobes per update
+) (
+  input  wire                  clk,
+  input  wire                  reset,      // active-high
+  input  wire                  enable,     // 0: states cleared, no updates
+  input  wire                  sample,     // One-cycle strobe, e.g. end of a PWM period
+  input  wire signed [31:0]    position,
+  input  wire signed [31:0]    setpoint,
+  input  wire signed [31:0]    coef_a,
+  input  wire signed [31:0]    coef_b,
+  input  wire signed [31:0]    coef_c,
+  input  wire        [31:0]    coef_d,
+  input  wire [COUNTER_W-1:0]  limit,      // Output magnitude limit, duty cycle units
+  output reg  [COUNTER_W-1:0]  duty      = {COUNTER_W{1'b0}},
+  output reg                   direction = 1'b0, // 1: out < 0
+  output reg                   valid     = 1'b0  // One-cycle strobe with each new output
+);
+
+  localparam signed [31:0] E_MAX = 32'sd8388607;
+
+  function signed [31:0] sat32;
+    input signed [65:0] v;
+    sat32 = (v > 66'sd2147483647)  ? 32'sh7FFFFFFF :
+            (v < -66'sd2147483648) ? 32'sh80000000 : v[31:0];
+  endfunction
+
+  function signed [65:0] sext66;
+    input signed [31:0] v;
+    sext66 = v;
+  endfunction
+
+  function [31:0] abs32;
+    input signed [31:0] v;
+    abs32 = v[31] ? -v : v;
+  endfunction
+
+  // Error of this sample, and its change since the previous one
+  wire signed [32:0] e_raw  = {setpoint[31], setpoint} - {position[31], position};
+  wire signed [31:0] e_next = (e_raw > E_MAX) ? E_MAX : (e_raw < -E_MAX) ? -E_MAX : e_raw[31:0];
+
+  reg signed [31:0] e = 32'sd0, e_prev = 32'sd0;
+  reg signed [31:0] ud = 32'sd0, ud_prev = 32'sd0, ui_prev = 32'sd0;
+  wire signed [31:0] de = e - e_prev;
+
+  // Shift-add multiplier on magnitudes, the sign is applied to the result
+  reg        [63:0] m_x   = 64'd0;  // |x|, shifted left every cycle
+  reg        [31:0] m_y   = 32'd0;  // |y|, shifted right every cycle
+  reg        [63:0] m_acc = 64'd0;
+  reg               m_neg = 1'b0;
+  reg         [5:0] m_cnt = 6'd0;   // Bits done, 32: product ready
+  wire signed [64:0] m_prod = m_neg ? -$signed({1'b0, m_acc}) : $signed({1'b0, m_acc});
+
+  localparam [2:0] IDLE = 3'd0, MUL_A = 3'd1, MUL_B = 3'd2, MUL_C = 3'd3, MUL_D = 3'd4;
+  reg [2:0] state   = IDLE;
+  reg [7:0] div_cnt = 8'd0;
+  reg signed [65:0] acc = 66'sd0;
+
+  wire signed [31:0] lim = {{(16 - COUNTER_W){1'b0}}, limit, 16'd0};
+
+  // Results of the last step of an update, blocking temporaries
+  reg signed [31:0] ud_next, ui_next, out_next, out_lim, out_mag;
+
+  always @(posedge clk) begin
+    valid <= 1'b0;
+    if (reset || !enable) begin
+      state     <= IDLE;
+      div_cnt   <= 8'd0;
+      e_prev    <= 32'sd0;
+      ud_prev   <= 32'sd0;
+      ui_prev   <= 32'sd0;
+      duty      <= {COUNTER_W{1'b0}};
+      direction <= 1'b0;
+    end else if (state == IDLE) begin
+      if (sample) begin
+        if (div_cnt == SAMPLE_DIV - 1) begin
+          div_cnt <= 8'd0;
+          e       <= e_next;
+          // a * uD'
+          m_x   <= {32'd0, abs32(coef_a)};
+          m_y   <= abs32(ud_prev);
+          m_neg <= coef_a[31] ^ ud_prev[31];
+          m_acc <= 64'd0;
+          m_cnt <= 6'd0;
+          state <= MUL_A;
+        end else begin
+          div_cnt <= div_cnt + 8'd1;
+        end
+      end
+    end else if (m_cnt != 6'd32) begin
+      if (m_y[0])
+        m_acc <= m_acc + m_x;
+      m_x   <= m_x << 1;
+      m_y   <= m_y >> 1;
+      m_cnt <= m_cnt + 6'd1;
+    end else begin
+      m_acc <= 64'd0;
+      m_cnt <= 6'd0;
+      case (state)
+        MUL_A: begin
+          acc   <= m_prod >>> 24;
+          // b * (e - e')
+          m_x   <= {32'd0, abs32(coef_b)};
+          m_y   <= abs32(de);
+          m_neg <= coef_b[31] ^ de[31];
+          state <= MUL_B;
+        end
+        MUL_B: begin
+          acc   <= acc + (m_prod >>> 8);
+          // c * e
+          m_x   <= {32'd0, abs32(coef_c)};
+          m_y   <= abs32(e);
+          m_neg <= coef_c[31] ^ e[31];
+          state <= MUL_C;
+        end
+        MUL_C: begin
+          ud_next = sat32(acc + (m_prod >>> 8));
+          ud <= ud_next;
+          // d * uD, d unsigned
+          m_x   <= {32'd0, coef_d};
+          m_y   <= abs32(ud_next);
+          m_neg <= ud_next[31];
+          state <= MUL_D;
+        end
+        default: begin // MUL_D
+          ui_next  = sat32(sext66(ui_prev) + (m_prod >>> 32));
+          out_next = sat32(sext66(ui_next) + ud);
+          out_lim  = (out_next > lim) ? lim : (out_next < -lim) ? -lim : out_next;
+          out_mag  = out_lim[31] ? -out_lim : out_lim;
+          duty      <= out_mag[16 +: COUNTER_W];
+          direction <= out_lim[31];
+          valid     <= 1'b1;
+          e_prev  <= e;
+          ud_prev <= ud;
+          ui_prev <= ui_next;
+          state   <= IDLE;
+        end
+      endcase
+    end
+  end
+
+endmodule
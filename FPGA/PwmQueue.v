@@ -0,0 +1,85 @@
+// PwmQueue.v
+// Queue of timestamped PWM words, played back on PWM period boundaries so
+// that the motor commands stay periodic whatever the timing of the Pi.
+// Entries {at, pitch word, yaw word} are written into block RAM by the SPI
+// slave in the SPI clock domain (the iCE40 RAMs have separate read and write
+// clocks), into free slots only, and become part of the queue when commit
+// moves wr_index past them. The entries are numbered by a 16-bit index like
+// the samples of SampleFifo. At each tick (end of a PWM period) the oldest
+// entry is applied once the timestamp has reached its time; a late entry is
+// applied at the next tick. Once an entry has been applied, a queue that
+// stays empty for timeout clk cycles is an underrun: it is counted and, if
+// brake is set, both axes are braked; otherwise they hold the last words.
+module PwmQueue #(
+  parameter ADDR_W = 8                      // 2^ADDR_W entries
+) (
+  input  wire              clk,
+  input  wire              reset,           // active-high, also empties the queue
+  input  wire              config_we,       // One-cycle strobe: empties the queue, loads the settings
+  input  wire              config_brake,
+  input  wire [23:0]       config_timeout,  // clk cycles, 0: no underrun detection
+  input  wire              commit,          // One-cycle strobe: wr_index <= commit_to
+  input  wire [15:0]       commit_to,
+  input  wire              tick,            // PWM period boundary
+  input  wire [31:0]       timestamp,       // Free-running clk cycle count
+  output reg  [15:0]       wr_index  = 16'd0,
+  output reg  [15:0]       rd_index  = 16'd0,
+  output reg  [7:0]        underruns = 8'd0,  // wraps
+  output reg               brake_on  = 1'b0,
+  output reg  [23:0]       timeout   = 24'd0,
+  output reg               apply     = 1'b0,  // One-cycle strobe with the words of an entry
+  output reg  [15:0]       pitch_word = 16'h0000,
+  output reg  [15:0]       yaw_word   = 16'h0000,
+  output reg               brake     = 1'b0,  // One-cycle strobe: underrun with brake_on
+  // Write port, wclk domain
+  input  wire              wclk,
+  input  wire              we,
+  input  wire [ADDR_W-1:0] waddr,
+  input  wire [63:0]       wdata            // {at[31:0], pitch word, yaw word}
+);
+
+  reg [63:0] mem [0:(1 << ADDR_W) - 1];
+  reg [63:0] head;                          // Entry at rd_index, one clk later
+  reg        active  = 1'b0;                // An entry was applied, no underrun since
+  reg [31:0] last_at = 32'd0;               // Time the last entry was applied
+
+  wire [15:0] level = wr_index - rd_index;
+  wire [31:0] late  = timestamp - head[63:32];
+
+  always @(posedge clk) begin
+    apply <= 1'b0;
+    brake <= 1'b0;
+    if (reset || config_we) begin
+      wr_index  <= 16'd0;
+      rd_index  <= 16'd0;
+      underruns <= 8'd0;
+      active    <= 1'b0;
+      brake_on  <= reset ? 1'b0 : config_brake;
+      timeout   <= reset ? 24'd0 : config_timeout;
+    end else begin
+      if (commit)
+        wr_index <= commit_to;
+      if (tick && level != 16'd0 && !late[31]) begin
+        apply      <= 1'b1;
+        pitch_word <= head[31:16];
+        yaw_word   <= head[15:0];
+        rd_index   <= rd_index + 16'd1;
+        active     <= 1'b1;
+        last_at    <= timestamp;
+      end else if (active && level == 16'd0 && timeout != 24'd0 && timestamp - last_at >= {8'd0, timeout}) begin
+        active    <= 1'b0;
+        underruns <= underruns + 8'd1;
+        brake     <= brake_on;
+      end
+    end
+  end
+
+  // Kept apart from the control logic so that it maps onto block RAM
+  always @(posedge wclk)
+    if (we)
+      mem[waddr] <= wdata;
+
+  always @(posedge clk)
+    head <= mem[rd_index[ADDR_W-1:0]];
+
+endmodule
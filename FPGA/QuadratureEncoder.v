@@ -5,12 +5,17 @@ module QuadratureEncoder(
   input  wire ENCA_raw,
   input  wire ENCB_raw,
   output reg [1:0] DIR, // direction: 01=CW, 11=CCW, 00=idle
-  output reg signed [31:0] position // signed position count
+  output reg signed [31:0] position, // signed position count
+  // Velocity estimators, both signed by the direction of the edges:
+  output reg signed [31:0] period,       // clk cycles between the last two edges, at least
+                                         // the time since the last one; 0 when idle or reversing
+  output reg signed [15:0] window_count  // net edges in the last VEL_WINDOW cycles
 );
 
   // Parameters
   parameter integer CLK_FREQ = 50_000_000;
   parameter integer NO_MOVEMENT_THRESHOLD = CLK_FREQ / 100;      // ≈10 ms
+  parameter integer VEL_WINDOW = CLK_FREQ / 1000;                // 1 ms edge counting window
 
   // Encoders synchronization to avoid metastability issues
   reg [1:0] syncA = 2'b00, syncB = 2'b00;
@@ -51,10 +56,15 @@ function [1:0] code_lut(input [1:0] new_enc, input [1:0] old_enc, input [1:0] ol
   end
 endfunction
 
-  // idle counter
+  // idle counter, also the time since the last edge
   reg [31:0] idle_cnt = 0;
   reg [1:0] next_dir;
 
+  // edge counting window
+  reg [31:0] win_cnt = 0;
+  reg signed [15:0] win_acc = 0;
+  reg signed [1:0] step;
+
   // Main sequence logic
   always @(posedge clk or posedge reset) begin
     if (reset) begin
@@ -62,7 +72,12 @@ endfunction
       DIR <= 2'b00;
       position <= 32'sd0;
       idle_cnt <= 0;
+      period <= 32'sd0;
+      window_count <= 16'sd0;
+      win_cnt <= 0;
+      win_acc <= 16'sd0;
     end else begin
+      step = 2'sd0;
       if (change) begin
         idle_cnt <= 0;
         // Compute next_dir
@@ -70,14 +85,36 @@ endfunction
         DIR <= next_dir;
 
         // Update position based on next_dir
-        if (next_dir == 2'b01) position <= position + 1;
-        else if (next_dir == 2'b11) position <= position - 1;
+        if (next_dir == 2'b01) step = 2'sd1;
+        else if (next_dir == 2'b11) step = -2'sd1;
+        position <= position + step;
+
+        // Edge period, if the previous edge went the same way and the
+        // axis was not idle in between
+        if (next_dir == 2'b01 && DIR == 2'b01) period <= idle_cnt + 1;
+        else if (next_dir == 2'b11 && DIR == 2'b11) period <= -(idle_cnt + 1);
+        else period <= 32'sd0;
 
         old_enc <= enc;
       end else if (idle_cnt < NO_MOVEMENT_THRESHOLD) begin
         idle_cnt <= idle_cnt + 1;
-        if (idle_cnt + 1 >= NO_MOVEMENT_THRESHOLD)
+        if (idle_cnt + 1 >= NO_MOVEMENT_THRESHOLD) begin
           DIR <= 2'b00;  // no movement
+          period <= 32'sd0;
+        end
+        // Slowing down: the next period is at least the time already waited
+        else if (period > 0 && idle_cnt + 1 > period) period <= idle_cnt + 1;
+        else if (period < 0 && idle_cnt + 1 > -period) period <= -(idle_cnt + 1);
+      end
+
+      // Net edges per window, published at the end of each window
+      if (win_cnt >= VEL_WINDOW - 1) begin
+        window_count <= win_acc + step;
+        win_acc <= 16'sd0;
+        win_cnt <= 0;
+      end else begin
+        win_acc <= win_acc + step;
+        win_cnt <= win_cnt + 1;
       end
     end
   end
@@ -0,0 +1,126 @@
+`timescale 1ns / 1ps
+
+// Replays the vectors of Pi/tools/pid_vectors (the pitch loop of the
+// simulated gimbal, from the bit-exact model Pi/fpga_pid.c) and compares
+// every update of PID.v with them:
+//   cd Pi && gcc tools/pid_vectors.c fpga_pid.c sim/sim_plant.c -lm -o pid_vectors && \
+//   ./pid_vectors ../FPGA/testbenches/PID/pid_gains.hex ../FPGA/testbenches/PID/pid_vectors.hex
+module PID_tb;
+
+    localparam CLK_PERIOD_NS = 40;      // 25 MHz FPGA clock
+    localparam SAMPLE_CLKS   = 200;     // Between sample strobes, an update takes ~135
+    localparam MAX_VECTORS   = 4000;
+
+    reg clk = 0;
+    reg reset = 1;
+    reg enable = 0;
+    reg sample = 0;
+    reg  signed [31:0] position = 0, setpoint = 0;
+    reg  [31:0] gains [0:4];            // a, b, c, d, limit
+    reg  [79:0] vectors [0:MAX_VECTORS-1];
+    wire [11:0] duty;
+    wire direction, valid;
+
+    PID #(.COUNTER_W(12), .SAMPLE_DIV(1)) dut (
+        .clk(clk), .reset(reset), .enable(enable), .sample(sample),
+        .position(position), .setpoint(setpoint),
+        .coef_a(gains[0]), .coef_b(gains[1]), .coef_c(gains[2]), .coef_d(gains[3]),
+        .limit(gains[4][11:0]),
+        .duty(duty), .direction(direction), .valid(valid)
+    );
+
+    initial begin
+        forever #(CLK_PERIOD_NS / 2) clk = ~clk;
+    end
+
+    integer failures = 0;
+
+    task check;
+        input ok;
+        input [8*64-1:0] what;
+        begin
+            if (ok)
+                $display("PASSED: %0s", what);
+            else begin
+                $display("FAILED: %0s", what);
+                failures = failures + 1;
+            end
+        end
+    endtask
+
+    // One update: inputs applied, strobe, then the output of that update
+    task update;
+        input signed [31:0] pos;
+        input signed [31:0] sp;
+        integer wait_clks;
+        begin
+            @(negedge clk);
+            position = pos;
+            setpoint = sp;
+            sample   = 1'b1;
+            @(negedge clk);
+            sample   = 1'b0;
+            wait_clks = 0;
+            while (!valid && wait_clks < SAMPLE_CLKS) begin
+                @(posedge clk);
+                #1;
+                wait_clks = wait_clks + 1;
+            end
+            repeat (SAMPLE_CLKS - wait_clks) @(posedge clk);
+        end
+    endtask
+
+    integer i, n, mismatches, updates_seen;
+    reg [11:0] want_duty;
+    reg        want_dir;
+    always @(posedge clk)
+        if (valid) updates_seen = updates_seen + 1;
+
+    initial begin
+        $readmemh("pid_gains.hex", gains);
+        $readmemh("pid_vectors.hex", vectors);
+        updates_seen = 0;
+
+        #(CLK_PERIOD_NS * 5);
+        reset = 0;
+
+        // Test 1: disabled, strobes give no update
+        $display("TEST 1: Disabled Loop");
+        update(0, 1000);
+        check(updates_seen == 0 && duty == 0, "No update while disabled");
+
+        // Test 2: every vector, bit-exact
+        $display("TEST 2: Model Vectors");
+        enable = 1;
+        mismatches = 0;
+        n = 0;
+        for (i = 0; i < MAX_VECTORS && ^vectors[i] !== 1'bx; i = i + 1) begin
+            update(vectors[i][79:48], vectors[i][47:16]);
+            want_dir  = vectors[i][12];
+            want_duty = vectors[i][11:0];
+            if (duty !== want_duty || direction !== want_dir) begin
+                if (mismatches < 10)
+                    $display("  vector %0d: duty %0d dir %0d, expected %0d %0d", i, duty, direction, want_duty, want_dir);
+                mismatches = mismatches + 1;
+            end
+            n = n + 1;
+        end
+        check(n > 0 && updates_seen == n, "One update per sample strobe");
+        check(n > 0 && mismatches == 0, "Outputs match the model");
+
+        // Test 3: disabling clears the output and the states
+        $display("TEST 3: Disable Clears");
+        @(negedge clk);
+        enable = 0;
+        @(negedge clk);
+        check(duty == 0 && direction == 0, "Output cleared");
+        enable = 1;
+        update(0, 0);
+        check(duty == 0, "Restarts from cleared states");
+
+        #(CLK_PERIOD_NS * 10);
+        $display("All tests finished, %0d failed.", failures);
+        $finish;
+    end
+
+endmodule
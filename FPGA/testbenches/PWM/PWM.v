@@ -1,4 +1,20 @@
 // PWM.v
+// The compare value of each period, duty_cycle * PERIOD / 2^COUNTER_W, is
+// computed in register stages ahead and latched when the period starts,
+// so the counter only has a compare against a register on its path and a
+// period never sees two duty cycles. Duty changes take effect from the next
+// period; disabling brakes at once. The counter runs whether or not the
+// output is enabled, so cycle_end keeps marking the periods for what is
+// timed on them (the PWM queue, the position loops) while the axis brakes;
+// enabling drives the rest of the current period with the duty cycle
+// written with the enable, the output held low for the two clk the compare
+// takes to reach it.
+//
+// When PERIOD is under 2^COUNTER_W counts, the fraction of a count the
+// compare value leaves out is carried from period to period (first-order
+// dither): a period gets one more high count whenever the fractions add up
+// to one, so the average over periods keeps every step of the duty cycle,
+// e.g. all 12 bits at 40 kHz from a 100 MHz clock (2500 counts).
 module PWM #(
   parameter CLK_FREQ    = 50_000_000,
   parameter PWM_FREQ    = 20_000,
@@ -11,38 +27,70 @@ module PWM #(
   input  wire                  direction,   // 0=CW, 1=CCW
   output reg                   ina,
   output reg                   inb,
-  output reg                   pwm_out
+  output reg                   pwm_out,
+  output reg                   cycle_end    // One-cycle strobe at the end of each period
 );
 
   localparam integer PERIOD = CLK_FREQ / PWM_FREQ;
-  reg [31:0] counter;
+  localparam integer PERIOD_W = $clog2(PERIOD + 1);
+  reg [PERIOD_W-1:0] counter;
+
+  // Compare value of the current duty cycle, and the one of this period.
+  // whole/fraction split the scaled duty cycle; residue is the fraction
+  // carried by the periods so far, next_* what the next period takes.
+  reg [PERIOD_W+COUNTER_W-1:0] scaled = 0;
+  reg [PERIOD_W-1:0]  whole = 0, next_compare = 0, compare = 0;
+  reg [COUNTER_W:0]   fraction = 0;
+  reg [COUNTER_W-1:0] residue = 0, next_residue = 0;
+  reg [1:0]           enabled = 2'b00;  // enable of the last two clk
+  always @(posedge clk) begin
+    scaled       <= duty_cycle * PERIOD;
+    whole        <= scaled >> COUNTER_W;
+    fraction     <= residue + scaled[COUNTER_W-1:0];
+    next_compare <= whole + fraction[COUNTER_W];
+    next_residue <= fraction[COUNTER_W-1:0];
+  end
 
   always @(posedge clk or posedge reset) begin
     if (reset) begin
       counter  <= 0;
+      compare  <= 0;
+      residue  <= 0;
       pwm_out  <= 0;
       ina      <= 0;
       inb      <= 0;
-    end else if (enable) begin
+      cycle_end <= 0;
+      enabled  <= 2'b00;
+    end else begin
       // PWM generator
-      // Increment counter
+      // Increment counter, next compare value at the period boundary
       if (counter < PERIOD-1) counter <= counter + 1;
-      else                   counter <= 0;
+      else                    counter <= 0;
+      enabled <= {enabled[0], enable};
+      if (!enable || !enabled[1]) begin
+        compare <= scaled >> COUNTER_W; // Used by the first period once enabled
+        residue <= 0;
+      end else if (counter == PERIOD-1) begin
+        compare <= next_compare;
+        residue <= next_residue;
+      end
+      cycle_end <= (counter == PERIOD-1);
 
-      // Generate PWM output based on duty cycle
-      pwm_out <= (counter < (duty_cycle * PERIOD) >> COUNTER_W) ? 1 : 0;
+      if (enable) begin
+        // Generate PWM output based on duty cycle
+        pwm_out <= (enabled[1] && counter < compare) ? 1 : 0;
 
-      // Drive direction lines
-      ina <= direction;
-      inb <= ~direction;
-    end else begin
-      // disable outputs
-      counter <= 0;
-      pwm_out <= 0;
-      // Brake
-      ina     <= 0;
-      inb     <= 0;
+        // Drive direction lines
+        ina <= direction;
+        inb <= ~direction;
+      end else begin
+        // disable outputs
+        pwm_out <= 0;
+        // Brake
+        ina     <= 0;
+        inb     <= 0;
+      end
     end
   end
 
-endmodule
\ No newline at end of file
+endmodule
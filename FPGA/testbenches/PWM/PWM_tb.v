@@ -22,6 +22,7 @@ module PWM_tb;
   wire ina;
   wire inb;
   wire pwm_out;
+  wire cycle_end;
 
   // Instantiate DUT
   PWM #(
@@ -36,9 +37,22 @@ module PWM_tb;
     .direction(direction),
     .ina(ina),
     .inb(inb),
-    .pwm_out(pwm_out)
+    .pwm_out(pwm_out),
+    .cycle_end(cycle_end)
   );
 
+  // High cycles of each PWM period: duty_cycle * PWM_PERIOD_CYCLES / 2^COUNTER_W
+  // of the duty cycle at its start (625 for 25%), whatever it changes to during it
+  integer high_cycles = 0;
+  always @(posedge clk) begin
+    if (cycle_end) begin
+      $display("  period: %0d high cycles", high_cycles + pwm_out);
+      high_cycles <= 0;
+    end else if (pwm_out) begin
+      high_cycles <= high_cycles + 1;
+    end
+  end
+
   // Clock Generator
   initial begin
     clk = 0;
@@ -77,7 +91,7 @@ module PWM_tb;
     // 3) Enable module with 75% duty cycle, CCW
     $display("Test: 75%% duty cycle, CCW");
     direction = 1; // CCW
-    duty_cycle = 3 * (1 << (COUNTER_W - 2)); // 75% = 3/4 * 2^10 = 3072
+    duty_cycle = 3 * (1 << (COUNTER_W - 2)); // 75% = 3/4 * 2^10 = 3072, from the next period on
     #(PWM_PERIOD_CYCLES * CLK_PERIOD * 3);
 
     // 3) Enable module with 0% duty cycle
@@ -90,7 +104,14 @@ module PWM_tb;
     duty_cycle = {COUNTER_W{1'b1}}; // 4095
     # (PWM_PERIOD_CYCLES * CLK_PERIOD * 2);
 
-    // 5) Disable module again
+    // 5) Smallest duty cycle: 2500 counts per period as 40 kHz from 100 MHz,
+    //    so 1/4096 is 0.61 counts; the dither gives periods of 0 and 1 high
+    //    cycles, about 3 in 5 of them high
+    $display("Test: 1/4096 duty cycle, dithered");
+    duty_cycle = 1;
+    # (PWM_PERIOD_CYCLES * CLK_PERIOD * 6);
+
+    // 6) Disable module again
     $display("Test: Disable module");
     enable = 0;
     # (PWM_PERIOD_CYCLES * CLK_PERIOD * 2);
@@ -16,6 +16,8 @@ module QuadratureEncoder_tb;
 
   wire [1:0] DIR;
   wire signed [31:0] position;
+  wire signed [31:0] period;
+  wire signed [15:0] window_count;
 
   // Instantiate the DUT
   QuadratureEncoder #(
@@ -26,23 +28,28 @@ module QuadratureEncoder_tb;
     .ENCA_raw(ENCA_raw),
     .ENCB_raw(ENCB_raw),
     .DIR(DIR),
-    .position(position)
+    .position(position),
+    .period(period),
+    .window_count(window_count)
   );
 
+  localparam VEL_WINDOW = CLK_FREQ / 1000; // Encoder default
+
   // Clock generator
   initial begin
     clk = 0;
     forever #(CLK_PERIOD / 2) clk = ~clk;
   end
 
-  // Task to simulate one step of a CW rotation
+  // Task to simulate one step of a CW rotation, in the order code_lut
+  // counts up: 00, 10, 11, 01
   task rotate_cw_step;
     begin
       case ({ENCA_raw, ENCB_raw})
-        2'b00: {ENCA_raw, ENCB_raw} = 2'b01;
-        2'b01: {ENCA_raw, ENCB_raw} = 2'b11;
-        2'b11: {ENCA_raw, ENCB_raw} = 2'b10;
-        2'b10: {ENCA_raw, ENCB_raw} = 2'b00;
+        2'b00: {ENCA_raw, ENCB_raw} = 2'b10;
+        2'b10: {ENCA_raw, ENCB_raw} = 2'b11;
+        2'b11: {ENCA_raw, ENCB_raw} = 2'b01;
+        2'b01: {ENCA_raw, ENCB_raw} = 2'b00;
         default: {ENCA_raw, ENCB_raw} = 2'b00;
       endcase
       #(CLK_PERIOD * 5000); // wait between steps
@@ -53,16 +60,63 @@ module QuadratureEncoder_tb;
   task rotate_ccw_step;
     begin
       case ({ENCA_raw, ENCB_raw})
-        2'b00: {ENCA_raw, ENCB_raw} = 2'b10;
-        2'b10: {ENCA_raw, ENCB_raw} = 2'b11;
-        2'b11: {ENCA_raw, ENCB_raw} = 2'b01;
-        2'b01: {ENCA_raw, ENCB_raw} = 2'b00;
+        2'b00: {ENCA_raw, ENCB_raw} = 2'b01;
+        2'b01: {ENCA_raw, ENCB_raw} = 2'b11;
+        2'b11: {ENCA_raw, ENCB_raw} = 2'b10;
+        2'b10: {ENCA_raw, ENCB_raw} = 2'b00;
         default: {ENCA_raw, ENCB_raw} = 2'b00;
       endcase
       #(CLK_PERIOD * 5000); // wait between steps
     end
   endtask
 
+  // Task to simulate n steps, one every `spacing` clock cycles
+  task rotate_steps;
+    input integer n;
+    input integer cw;
+    input integer spacing;
+    integer i;
+    begin
+      for (i = 0; i < n; i = i + 1) begin
+        if (cw) begin
+          case ({ENCA_raw, ENCB_raw})
+            2'b00: {ENCA_raw, ENCB_raw} = 2'b10;
+            2'b10: {ENCA_raw, ENCB_raw} = 2'b11;
+            2'b11: {ENCA_raw, ENCB_raw} = 2'b01;
+            default: {ENCA_raw, ENCB_raw} = 2'b00;
+          endcase
+        end else begin
+          case ({ENCA_raw, ENCB_raw})
+            2'b00: {ENCA_raw, ENCB_raw} = 2'b01;
+            2'b01: {ENCA_raw, ENCB_raw} = 2'b11;
+            2'b11: {ENCA_raw, ENCB_raw} = 2'b10;
+            default: {ENCA_raw, ENCB_raw} = 2'b00;
+          endcase
+        end
+        #(CLK_PERIOD * spacing);
+      end
+    end
+  endtask
+
+  // Runs steps at a constant rate for 3 windows and checks both estimators:
+  // the exact period, and spacing per window edges (+-1 for the window phase)
+  task check_rate;
+    input integer cw;
+    input integer spacing;
+    integer expected_period, expected_window;
+    begin
+      rotate_steps(3 * VEL_WINDOW / spacing, cw, spacing);
+      expected_period = cw ? spacing : -spacing;
+      expected_window = (cw ? VEL_WINDOW : -VEL_WINDOW) / spacing;
+      if (period == expected_period && window_count >= expected_window - 1 && window_count <= expected_window + 1)
+        $display("PASSED: %0s every %0d cycles: period %0d, window count %0d.", cw ? "CW" : "CCW", spacing,
+                 period, window_count);
+      else
+        $display("FAILED: %0s every %0d cycles: period %0d (expected %0d), window count %0d (expected %0d).",
+                 cw ? "CW" : "CCW", spacing, period, expected_period, window_count, expected_window);
+    end
+  endtask
+
   // Test Sequence
   initial begin
     $display("Starting Quadrature Encoder Testbench...");
@@ -98,10 +152,49 @@ module QuadratureEncoder_tb;
       rotate_cw_step();
     end
     #(CLK_PERIOD * 10000);
+    if (DIR != 2'b00)
+      $display("PASSED: DIR reports movement within the idle threshold.");
+    else
+      $display("FAILED: DIR reports idle too early");
 
     // 3) Test idle timeout
     $display("Test: Waiting for idle timeout...");
     #(CLK_PERIOD * 1000000);
+    if (DIR == 2'b00)
+      $display("PASSED: DIR reports idle after NO_MOVEMENT_THRESHOLD.");
+    else
+      $display("FAILED: Expected DIR 00, got %b", DIR);
+    if (period == 0 && window_count == 0)
+      $display("PASSED: Velocity reads 0 when idle.");
+    else
+      $display("FAILED: Idle velocity: period %0d, window count %0d", period, window_count);
+
+    // 5) Velocity at varying edge rates, both directions
+    $display("Test: Velocity estimators at varying edge rates...");
+    check_rate(1, 5000);
+    check_rate(1, 500);
+    check_rate(1, 20000);
+    check_rate(0, 2000);
+    check_rate(0, 250);
+
+    // Slowing down: the period grows with the time since the last edge
+    rotate_steps(1, 0, 30000);
+    if (period <= -29996 && period >= -30000)
+      $display("PASSED: Period follows a slowdown before the next edge (%0d).", period);
+    else
+      $display("FAILED: Period %0d after 30000 cycles without an edge.", period);
+
+    // Reversal: no period across it, then the new direction's
+    rotate_steps(1, 1, 100);
+    if (period == 0)
+      $display("PASSED: No period across a reversal.");
+    else
+      $display("FAILED: Period %0d across a reversal.", period);
+    rotate_steps(1, 1, 100);
+    if (period == 100)
+      $display("PASSED: Period after the reversal.");
+    else
+      $display("FAILED: Period %0d after the reversal, expected 100.", period);
 
 
 
@@ -0,0 +1,651 @@
+// SpiSlave.v
+// SPI mode 0 slave clocked by SPI_CLK itself, so the bus clock is not
+// limited by oversampling with clk. Shift registers, counters and CRCs run
+// in the SPI clock domain; the clk domain only exchanges data with them
+// while they are frozen by CS:
+//  - the readable state is copied into a snapshot on every clk cycle while
+//    CS is high and frozen while it is low. The SPI side first reads it when
+//    the command byte is complete, 8 SPI clocks after CS falls, by which
+//    time the 2-stage CS synchronizer has stopped the copies. The timestamp
+//    is copied on the same clk edge as the positions.
+//  - a received frame is decoded in the clk domain once it sees CS rise;
+//    the SPI registers it reads do not change before the next command byte.
+//    CS has to stay high for at least 3 clk cycles between frames.
+//  - sample bursts (0x60) read the sample RAM through its SPI-clocked
+//    port; the samples below the snapshot index were all written before
+//    the snapshot froze. Frame bursts (0x64) read the frame ring and
+//    histogram bursts (0x65) the interval bins the same way.
+//  - PWM queue entries (0x63) are written into the queue RAM through its
+//    SPI-clocked port as they arrive, into the slots free in the snapshot
+//    (the queue only frees more while CS is low); the clk domain commits
+//    them when the frame is decoded.
+//  - register reads (0x70/0x71) of the writable registers read the clk
+//    domain outputs below directly: they only change when a frame is
+//    decoded, after CS has risen.
+//
+// Commands: 0x10/0x11/0x12 write PWM words, 0x13 those of a range of
+// axes, 0x20/0x21/0x22 read positions followed by their timestamp, 0x24
+// those of a range of axes, 0x23 positions and movement, 0x25 positions
+// and velocities, 0x30 PWM status, 0x40 positions read while the PWM words
+// are written, 0x50/0x51 load the pitch/yaw PID gains, 0x52 positions read
+// while the PID setpoints and enables are written, 0x60 reads a burst of
+// samples, 0x61 sets the sample period, 0x62 sets up the PWM queue, 0x63
+// adds entries to it, 0x64 reads a burst of frame-sync snapshots, 0x65 a
+// burst of interval histogram bins, 0x70/0x71 read/write a burst of
+// registers. Bit 7 set: checked frame (see below).
+//
+// Sample bursts (0x60): bytes 1-2 of the command give the index of the first
+// sample wanted and byte 3 the number of samples N, so the frame has
+// L = 5 + 12 N bytes. The response carries the index the next sample will
+// get (bytes 1-2) and the dropped-sample count (byte 3), then from byte 5
+// the samples {pitch, yaw, timestamp} of the requested indexes; the ones at
+// or past the next index are not valid. Applying the command frees the
+// samples before the first index, so a burst sent again still reads the
+// same ones.
+//
+// PWM queue (PwmQueue.v): 0x62 byte 1 bit 0 brakes on underrun, bytes 2-4
+// give the underrun timeout in clk cycles; it empties the queue. 0x63 bytes
+// 1-2 give the index of the first entry sent and byte 3 the number of
+// entries N, so the frame has L = 6 + 8 N bytes; from byte 6 the entries
+// {at, pitch word {hi, lo}, yaw word}, 8 bytes each. Entries below the
+// queue write index are already queued and skipped, so a frame sent again
+// adds nothing twice; the queue takes the ones that follow on from it and
+// fit. The response carries the write index (bytes 1-2), the read index
+// (bytes 3-4) and the underrun count (byte 5) before the frame.
+//
+// Frame bursts (0x64) are laid out as 0x60 ones, for the snapshots taken on
+// the camera frame strobe (FrameSync.v): bytes 1-2 of the response carry
+// the index the next frame will get, byte 3 is 0, and the frames at or
+// past it, or more than 15 below it, are not valid: the ring holds 16 and
+// a strobe during the burst overwrites the oldest. Nothing is freed.
+//
+// Histogram bursts (0x65) are laid out as 0x60 ones too, for the bins of
+// the intervals between frame starts (IntervalHistogram.v): entry k holds
+// bins 4 k .. 4 k + 3, 24 bits each, and bytes 1-4 of the response are 0.
+// Every frame is reported to the histogram once decoded (cmd_done), with
+// the timestamp of its snapshot, taken when CS fell; registers 0x1E/0x1F
+// set it up and 0x20-0x23 hold its statistics.
+//
+// Axis commands, for NUM_AXES channels (axis 0 pitch, 1 yaw): byte 1 is
+// the first axis and byte 2 the number of axes N. 0x13 carries N PWM words
+// {lo, hi} as 0x12 from byte 3 (L = 3 + 2 N); 0x24 returns N positions from
+// byte 3 followed by their timestamp (L = 7 + 4 N). Axes at or past
+// NUM_AXES read 0 and are not written.
+//
+// Register bursts (0x70 read, 0x71 write): byte 1 of the command is the
+// first register and byte 2 the number of registers N, so the frame has
+// L = 3 + 4 N bytes. Registers are 32 bits, big-endian from byte 3, and
+// the address moves on after each one (wrapping at 0xFF); unmapped ones
+// read 0. A write burst sends back the values before the write, which
+// are applied together when the frame is decoded: a written PWM word,
+// setpoint, enable, sampler, free or queue register acts as the command that
+// carries it, writing GAIN_LOAD loads the gain registers into the loop
+// of its axis, and writing either histogram register sets up (and
+// clears) the histogram with both.
+//   0x00 ID (MAP_ID)        0x10 PWM word pitch {16'h0, hi, lo}
+//   0x01 position pitch     0x11 PWM word yaw
+//   0x02 position yaw       0x12 setpoint pitch
+//   0x03 timestamp          0x13 setpoint yaw
+//   0x04 motion (0x23)      0x14 PID enable {yaw, pitch}
+//   0x05 PWM status (0x30)  0x15 sample period
+//   0x06 period pitch       0x16 free samples up to
+//   0x07 period yaw         0x17 PWM queue setup {7'h0, brake, timeout}
+//   0x08 windows {p, y}     0x18-0x1B gains a, b, c, d
+//   0x09 samples {index, overflows, 8'h0}
+//                           0x1C gain limit
+//   0x0A rejected frames    0x1D GAIN_LOAD: axis (0: pitch, 1: yaw)
+//   0x0B PWM queue {write index, read index}
+//   0x0C PWM queue underruns
+//   0x0D NUM_AXES
+//   0x0E frames {index, 16'h0}
+//                           0x1E histogram {filter, origin}
+//   0x20 interval min       0x1F histogram {3'h0, shift, deadline}
+//   0x21 interval max
+//   0x22 intervals over the deadline
+//   0x23 intervals
+// The registers 0x10-0x1F read back the values last applied.
+module SpiSlave #(
+    parameter NUM_AXES = 2              // 2..8
+  ) (
+    input  wire        clk,
+    // SPI bus
+    input  wire        SPI_CLK,
+    input  wire        SPI_PICO,
+    input  wire        SPI_CS,          // active-low
+    output wire        SPI_POCI,
+    // Readable state, clk domain
+    input  wire [32*NUM_AXES-1:0] positions, // Axis k at [32 k +: 32]: pitch, yaw, then the further axes
+    input  wire [7:0]  motion,          // 0x23 byte 9
+    input  wire [31:0] pwm_status,      // 0x30 bytes 1-4
+    input  wire [31:0] timestamp,       // Free-running clk cycle count
+    input  wire [95:0] velocity,        // 0x25 bytes 9-20: pitch and yaw periods, then window counts
+    input  wire [15:0] sample_index,    // 0x60 bytes 1-2: index of the next sample (SampleFifo)
+    input  wire [7:0]  sample_overflows,// 0x60 byte 3
+    // SampleFifo read port, SPI domain
+    output reg  [7:0]  sample_raddr = 8'h00,
+    input  wire [95:0] sample_rdata,
+    input  wire [15:0] frame_index,     // 0x64 bytes 1-2: index of the next frame (FrameSync)
+    input  wire [95:0] frame_rdata,     // FrameSync read port, at sample_raddr[3:0]
+    input  wire [127:0] hist_stats,     // Registers 0x20-0x23: {min, max, missed, updates}
+    input  wire [95:0] hist_rdata,      // IntervalHistogram read port, at sample_raddr[3:0]
+    input  wire [15:0] queue_wr_index,  // 0x63 bytes 1-4: PwmQueue indexes
+    input  wire [15:0] queue_rd_index,
+    input  wire [7:0]  queue_underruns, // 0x63 byte 5
+    input  wire        queue_brake_on,  // Settings, read back by register 0x17
+    input  wire [23:0] queue_timeout,
+    // PwmQueue write port, SPI domain
+    output wire        queue_we,
+    output wire [7:0]  queue_waddr,
+    output wire [63:0] queue_wdata,
+    // PWM words received, clk domain: {hi, lo} with hi = {en, dir, duty[11:8], 2'b00}
+    output reg         pitch_we = 1'b0, // One-cycle strobes
+    output reg         yaw_we   = 1'b0,
+    output reg  [15:0] pitch_word = 16'h0000,
+    output reg  [15:0] yaw_word   = 16'h0000,
+    // 0x13 for the axes from 2 on, bits of axis k at k (axes 0 and 1 use the pitch/yaw outputs)
+    output reg  [NUM_AXES-1:0]    axis_we    = {NUM_AXES{1'b0}},
+    output reg  [16*NUM_AXES-1:0] axis_words = {16*NUM_AXES{1'b0}},
+    // PID loads, clk domain: gains {a, b, c, d, limit} (PID.v), setpoints {pitch, yaw}
+    output reg         gains_we    = 1'b0,  // One-cycle strobes
+    output reg         gains_axis  = 1'b0,  // 0: pitch, 1: yaw
+    output reg [143:0] gains       = 144'h0,
+    output reg         setpoint_we = 1'b0,
+    output reg  [63:0] setpoints   = 64'h0,
+    output reg   [1:0] pid_enable  = 2'b00, // {yaw, pitch}
+    // Sampler, clk domain
+    output reg         sampler_we      = 1'b0,  // One-cycle strobes
+    output reg  [23:0] sampler_period  = 24'h0, // clk cycles, 0: stopped
+    output reg         samples_free    = 1'b0,
+    output reg  [15:0] samples_free_to = 16'h0,
+    // PWM queue, clk domain
+    output reg         queue_config_we = 1'b0,  // One-cycle strobes
+    output reg         queue_brake     = 1'b0,
+    output reg  [23:0] queue_timeout_cfg = 24'h0,
+    output reg         queue_commit    = 1'b0,
+    output reg  [15:0] queue_commit_to = 16'h0,
+    // Interval histogram, clk domain: every frame decoded, and the setup
+    output reg         cmd_done      = 1'b0,    // One-cycle strobes
+    output reg  [6:0]  cmd_op        = 7'h00,
+    output reg  [31:0] cmd_start     = 32'h0,   // timestamp when CS fell
+    output reg         hist_we       = 1'b0,
+    output reg  [7:0]  hist_filter   = 8'h00,   // bit 7: only command [6:0]
+    output reg  [23:0] hist_origin   = 24'h0,
+    output reg  [4:0]  hist_shift    = 5'd0,
+    output reg  [23:0] hist_deadline = 24'h0
+  );
+
+  localparam integer MAX_BYTES = 24;    // Bytes kept: 0x25 (21 bytes) + 3 check bytes
+
+  // Checked frames: command byte with bit 7 set. A command of L bytes is
+  // followed by a sequence byte (L) and the CRC-8 of bytes 0..L (L+1). The
+  // response carries the rejected-frame count (L), the CRC-8 of its bytes
+  // 1..L (L+1) and an ack (L+2): the sequence byte if the command CRC
+  // matched, its complement otherwise. Writes of a checked frame are only
+  // applied when its CRC matched, unchecked ones when the frame had exactly
+  // L bytes (so a checked frame that lost bit 7 is not taken for one).
+  localparam [7:0] CRC_INIT = 8'hFF;
+
+  localparam [31:0] MAP_ID = 32'h474D_0001; // "GM", register map version 1
+  localparam [15:0] QUEUE_DEPTH = 16'd256;  // PwmQueue entries
+
+  // CRC-8, polynomial x^8 + x^2 + x + 1, MSB first
+  function [7:0] crc8;
+    input [7:0] crc;
+    input [7:0] data;
+    integer b;
+    begin
+      crc8 = crc ^ data;
+      for (b = 0; b < 8; b = b + 1)
+        crc8 = crc8[7] ? ({crc8[6:0], 1'b0} ^ 8'h07) : {crc8[6:0], 1'b0};
+    end
+  endfunction
+
+  // Unchecked length of each command
+  function [4:0] cmd_len;
+    input [6:0] cmd;
+    case (cmd)
+      7'h10, 7'h11:        cmd_len = 5'd3;
+      7'h20, 7'h21, 7'h40: cmd_len = 5'd9;
+      7'h23:               cmd_len = 5'd10;
+      7'h22:               cmd_len = 5'd13;
+      7'h50, 7'h51:        cmd_len = 5'd19;
+      7'h52:               cmd_len = 5'd10;
+      7'h25:               cmd_len = 5'd21;
+      7'h13, 7'h24,
+      7'h70, 7'h71:        cmd_len = 5'd3;  // until their count byte
+      default:             cmd_len = 5'd5;  // 0x12, 0x30, 0x61, 0x62; 0x60/0x63/0x64/0x65 until their count byte
+    endcase
+  endfunction
+
+
+  // 1) clk domain: snapshot of the readable state, frozen while CS is low
+  reg [2:0]  cs_sync = 3'b111;
+  always @(posedge clk)
+    cs_sync <= {cs_sync[1:0], SPI_CS};
+  wire cs_idle = cs_sync[1];
+  wire cs_end  = (cs_sync[2:1] == 2'b01);
+
+  reg [32*NUM_AXES-1:0] snap_positions;
+  wire [31:0] snap_pitch = snap_positions[31:0], snap_yaw = snap_positions[63:32];
+  reg [31:0] snap_pwm, snap_time;
+  reg [7:0]  snap_motion;
+  reg [95:0] snap_velocity;
+  reg [15:0] snap_index, snap_frames;
+  reg [7:0]  snap_overflows;
+  reg [15:0] snap_qwr, snap_qrd;
+  reg [7:0]  snap_qunder;
+  reg [127:0] snap_hist;
+  always @(posedge clk) begin
+    if (cs_idle) begin
+      snap_hist      <= hist_stats;
+      snap_qwr       <= queue_wr_index;
+      snap_qrd       <= queue_rd_index;
+      snap_qunder    <= queue_underruns;
+      snap_index     <= sample_index;
+      snap_frames    <= frame_index;
+      snap_overflows <= sample_overflows;
+      snap_positions <= positions;
+      snap_motion   <= motion;
+      snap_pwm      <= pwm_status;
+      snap_time     <= timestamp;
+      snap_velocity <= velocity;
+    end
+  end
+
+
+  // 2) SPI domain, rising edge: shift in. The counters are held in reset
+  //    while CS is high. Bursts run up to 3068 bytes.
+  reg [2:0]  bit_cnt  = 3'd0;   // 0..7
+  reg [11:0] byte_cnt = 12'd0;  // saturates at 4095
+  always @(posedge SPI_CLK or posedge SPI_CS) begin
+    if (SPI_CS) begin
+      bit_cnt  <= 3'd0;
+      byte_cnt <= 12'd0;
+    end else begin
+      bit_cnt <= bit_cnt + 3'd1;
+      if (bit_cnt == 3'd7 && byte_cnt != 12'hFFF)
+        byte_cnt <= byte_cnt + 12'd1;
+    end
+  end
+
+  // Frame registers, kept after CS rises for the clk domain
+  reg [6:0] rx_shift;
+  wire [7:0] rx_byte = {rx_shift, SPI_PICO};
+  reg [7:0] rx_buf[0:MAX_BYTES-1];
+  reg [6:0] op           = 7'h00; // command byte without the checked flag
+  reg       checked      = 1'b0;  // current frame is checked
+  reg       frame_ok     = 1'b0;  // its command CRC matched
+  reg       len_ok       = 1'b0;  // exactly L bytes so far
+  reg       frame_toggle = 1'b0;  // flips with every command byte
+  reg [11:0] frame_len   = 12'd0; // L
+  reg [7:0] rx_crc;               // running CRC of the received bytes
+  reg [7:0] rx_seq       = 8'h00; // sequence byte of a checked frame
+  reg [7:0] ack          = 8'h00;
+  reg [7:0] crc_errors   = 8'h00; // rejected checked frames, wraps
+  reg [95:0] burst_word  = 96'h0;  // 0x60/0x64/0x65: sample, frame or bins being sent
+  reg [3:0]  burst_b     = 4'd0;   // its byte being sent, 0..11
+  reg [7:0]  reg_addr    = 8'h00;  // 0x70/0x71: register being sent/received
+  reg [23:0] reg_shift   = 24'h0;  // its first 3 bytes received
+  reg [31:0] reg_stage[0:15];      // 0x71: registers 0x10-0x1F received
+  reg [15:0] reg_dirty   = 16'h0;  // and which of them were
+  reg [15:0] q_idx       = 16'h0;  // 0x63: index of the entry being received
+  reg [15:0] q_end       = 16'h0;  // queue write index after the entries taken
+  reg [55:0] q_shift     = 56'h0;  // first 7 bytes of the entry
+
+  always @(posedge SPI_CLK) begin
+    if (~SPI_CS) begin
+      rx_shift <= rx_byte[6:0];
+
+      if (bit_cnt == 3'd7) begin
+        // got a full byte
+        if (byte_cnt < MAX_BYTES)
+          rx_buf[byte_cnt] <= rx_byte;
+        rx_crc <= crc8(byte_cnt == 12'd0 ? CRC_INIT : rx_crc, rx_byte);
+        len_ok <= (byte_cnt != 12'd0) && (byte_cnt + 12'd1 == frame_len);
+
+        if (byte_cnt == 12'd0) begin
+          op           <= rx_byte[6:0];
+          checked      <= rx_byte[7];
+          frame_ok     <= 1'b0;
+          reg_dirty    <= 16'h0;
+          frame_len    <= {7'd0, cmd_len(rx_byte[6:0])};
+          frame_toggle <= ~frame_toggle;
+        end
+
+        // 0x60/0x64/0x65: the sample count sets the length. The read port
+        // address runs one sample ahead of the one being sent.
+        if (op == 7'h60 || op == 7'h64 || op == 7'h65) begin
+          if (byte_cnt == 12'd3) begin
+            frame_len    <= 12'd5 + 12'd12 * rx_byte;
+            sample_raddr <= rx_buf[2];
+          end else if (byte_cnt == 12'd4 || (byte_cnt > 12'd4 && burst_b == 4'd11)) begin
+            burst_word   <= (op == 7'h64) ? frame_rdata : (op == 7'h65) ? hist_rdata : sample_rdata;
+            burst_b      <= 4'd0;
+            sample_raddr <= sample_raddr + 8'd1;
+          end else if (byte_cnt > 12'd4) begin
+            burst_b      <= burst_b + 4'd1;
+          end
+        end
+
+        // 0x70/0x71: the count byte sets the length. The address moves
+        // on after the last byte of each register (byte_cnt % 4 == 2).
+        if (op == 7'h70 || op == 7'h71) begin
+          if (byte_cnt == 12'd1) begin
+            reg_addr  <= rx_byte;
+          end else if (byte_cnt == 12'd2) begin
+            frame_len <= 12'd3 + {2'b00, rx_byte, 2'b00};
+          end else if (byte_cnt >= 12'd3 && byte_cnt < frame_len) begin
+            reg_shift <= {reg_shift[15:0], rx_byte};
+            if (byte_cnt[1:0] == 2'd2) begin
+              reg_addr <= reg_addr + 8'd1;
+              if (op == 7'h71 && reg_addr[7:4] == 4'h1) begin
+                reg_stage[reg_addr[3:0]] <= {reg_shift, rx_byte};
+                reg_dirty[reg_addr[3:0]] <= 1'b1;
+              end
+            end
+          end
+        end
+
+        // 0x13/0x24: the axis count sets the length. The axis moves on
+        // after each PWM word (hi byte, byte_cnt even) or position.
+        if (op == 7'h13 || op == 7'h24) begin
+          if (byte_cnt == 12'd1) begin
+            reg_addr  <= rx_byte;
+          end else if (byte_cnt == 12'd2) begin
+            frame_len <= (op == 7'h13) ? 12'd3 + {3'b000, rx_byte, 1'b0} : 12'd7 + {2'b00, rx_byte, 2'b00};
+          end else if (byte_cnt >= 12'd3 && byte_cnt < frame_len) begin
+            reg_shift <= {reg_shift[15:0], rx_byte};
+            if (op == 7'h13 && byte_cnt[0] == 1'b0) begin
+              reg_addr <= reg_addr + 8'd1;
+              if (reg_addr < NUM_AXES) begin
+                reg_stage[reg_addr[3:0]] <= {16'h0, rx_byte, reg_shift[7:0]};
+                reg_dirty[reg_addr[3:0]] <= 1'b1;
+              end
+            end
+            if (op == 7'h24 && byte_cnt[1:0] == 2'd2)
+              reg_addr <= reg_addr + 8'd1;
+          end
+        end
+
+        // 0x63: the count byte sets the length. An entry is taken when
+        // its last byte arrives (byte_cnt % 8 == 5), through queue_we.
+        if (op == 7'h63) begin
+          if (byte_cnt == 12'd2) begin
+            q_idx <= {rx_buf[1], rx_byte};
+            q_end <= snap_qwr;
+          end else if (byte_cnt == 12'd3) begin
+            frame_len <= 12'd6 + {1'b0, rx_byte, 3'b000};
+          end else if (byte_cnt >= 12'd6 && byte_cnt < frame_len) begin
+            q_shift <= {q_shift[47:0], rx_byte};
+            if (byte_cnt[2:0] == 3'd5) begin
+              q_idx <= q_idx + 16'd1;
+              if (queue_we)
+                q_end <= q_end + 16'd1;
+            end
+          end
+        end
+
+        // checked frame: CRC byte received, ack it in the next byte
+        if (byte_cnt == frame_len)
+          rx_seq <= rx_byte;
+        if (checked && byte_cnt == frame_len + 12'd1) begin
+          frame_ok <= (rx_byte == rx_crc);
+          ack      <= (rx_byte == rx_crc) ? rx_seq : ~rx_seq;
+          if (rx_byte != rx_crc)
+            crc_errors <= crc_errors + 8'd1;
+        end
+      end
+    end
+  end
+
+
+  // Entry write, on the rising edge that completes it: the one following
+  // on from the queue, into a free slot
+  wire [15:0] q_used = q_idx - snap_qrd;
+  assign queue_we    = ~SPI_CS && op == 7'h63 && bit_cnt == 3'd7 && byte_cnt >= 12'd6 && byte_cnt < frame_len &&
+                       byte_cnt[2:0] == 3'd5 && q_idx == q_end && q_used < QUEUE_DEPTH;
+  assign queue_waddr = q_idx[7:0];
+  assign queue_wdata = {q_shift, rx_byte};
+
+
+  // 3) SPI domain, falling edge: shift out. Byte 0 is the 0x01 dummy, the
+  //    response bytes come from the snapshot, then the check bytes.
+  reg [159:0] read_data;
+  always @(*) begin
+    case (op)
+      7'h20:        read_data = {snap_pitch, snap_time, 96'h0};
+      7'h21:        read_data = {snap_yaw, snap_time, 96'h0};
+      7'h22:        read_data = {snap_pitch, snap_yaw, snap_time, 64'h0};
+      7'h23, 7'h40: read_data = {snap_pitch, snap_yaw, snap_motion, 88'h0};
+      7'h52:        read_data = {snap_pitch, snap_yaw, 96'h0};
+      7'h25:        read_data = {snap_pitch, snap_yaw, snap_velocity};
+      7'h30:        read_data = {snap_pwm, 128'h0};
+      default:      read_data = 160'h0;
+    endcase
+  end
+
+  reg [31:0] reg_value;
+  always @(*) begin
+    case (reg_addr)
+      8'h00:   reg_value = MAP_ID;
+      8'h01:   reg_value = snap_pitch;
+      8'h02:   reg_value = snap_yaw;
+      8'h03:   reg_value = snap_time;
+      8'h04:   reg_value = {24'h0, snap_motion};
+      8'h05:   reg_value = snap_pwm;
+      8'h06:   reg_value = snap_velocity[95:64];
+      8'h07:   reg_value = snap_velocity[63:32];
+      8'h08:   reg_value = snap_velocity[31:0];
+      8'h09:   reg_value = {snap_index, snap_overflows, 8'h0};
+      8'h0A:   reg_value = {24'h0, crc_errors};
+      8'h0B:   reg_value = {snap_qwr, snap_qrd};
+      8'h0C:   reg_value = {24'h0, snap_qunder};
+      8'h0D:   reg_value = NUM_AXES;
+      8'h0E:   reg_value = {snap_frames, 16'h0};
+      8'h10:   reg_value = {16'h0, pitch_word};
+      8'h11:   reg_value = {16'h0, yaw_word};
+      8'h12:   reg_value = setpoints[63:32];
+      8'h13:   reg_value = setpoints[31:0];
+      8'h14:   reg_value = {30'h0, pid_enable};
+      8'h15:   reg_value = {8'h0, sampler_period};
+      8'h16:   reg_value = {16'h0, samples_free_to};
+      8'h17:   reg_value = {7'h0, queue_brake_on, queue_timeout};
+      8'h18:   reg_value = gains[143:112];
+      8'h19:   reg_value = gains[111:80];
+      8'h1A:   reg_value = gains[79:48];
+      8'h1B:   reg_value = gains[47:16];
+      8'h1C:   reg_value = {16'h0, gains[15:0]};
+      8'h1D:   reg_value = {31'h0, gains_axis};
+      8'h1E:   reg_value = {hist_filter, hist_origin};
+      8'h1F:   reg_value = {3'h0, hist_shift, hist_deadline};
+      8'h20:   reg_value = snap_hist[127:96];
+      8'h21:   reg_value = snap_hist[95:64];
+      8'h22:   reg_value = snap_hist[63:32];
+      8'h23:   reg_value = snap_hist[31:0];
+      default: reg_value = 32'h0;
+    endcase
+  end
+
+  // 0x24: the positions, then the timestamp in the last 4 bytes
+  wire [31:0] axis_value = (byte_cnt + 12'd4 >= frame_len) ? snap_time :
+                           (reg_addr < NUM_AXES)           ? snap_positions[32 * reg_addr[2:0] +: 32] : 32'h0;
+
+  wire [7:0] read_byte = (byte_cnt >= 12'd1 && byte_cnt <= 12'd20) ? read_data[8 * (21 - byte_cnt) - 1 -: 8] : 8'h00;
+  wire [1:0] reg_left  = 2'd2 - byte_cnt[1:0];  // bytes of the register after this one
+  wire [7:0] reg_byte  = (byte_cnt >= 12'd3 && byte_cnt < frame_len) ? reg_value[8 * reg_left +: 8] : 8'h00;
+  wire [7:0] axis_byte = (byte_cnt >= 12'd3 && byte_cnt < frame_len) ? axis_value[8 * reg_left +: 8] : 8'h00;
+  wire [15:0] burst_index = (op == 7'h64) ? snap_frames : (op == 7'h65) ? 16'h0 : snap_index;
+  wire [7:0] burst_byte = (byte_cnt == 12'd1) ? burst_index[15:8] :
+                          (byte_cnt == 12'd2) ? burst_index[7:0] :
+                          (byte_cnt == 12'd3) ? ((op == 7'h60) ? snap_overflows : 8'h00) :
+                          (byte_cnt == 12'd4) ? 8'h00 : burst_word[8 * (11 - burst_b) +: 8];
+  wire [7:0] queue_byte = (byte_cnt == 12'd1) ? snap_qwr[15:8] :
+                          (byte_cnt == 12'd2) ? snap_qwr[7:0] :
+                          (byte_cnt == 12'd3) ? snap_qrd[15:8] :
+                          (byte_cnt == 12'd4) ? snap_qrd[7:0] :
+                          (byte_cnt == 12'd5) ? snap_qunder : 8'h00;
+  wire [7:0] tx_next   = (checked && byte_cnt == frame_len)          ? crc_errors :
+                         (checked && byte_cnt == frame_len + 12'd2)  ? ack :
+                         (op == 7'h60 || op == 7'h64 || op == 7'h65) ? burst_byte :
+                         (op == 7'h63)                               ? queue_byte :
+                         (op == 7'h24)                               ? axis_byte :
+                         (op == 7'h70 || op == 7'h71)                ? reg_byte : read_byte;
+  wire       tx_is_crc = checked && byte_cnt == frame_len + 12'd1;
+
+  reg [7:0] tx_shift = 8'h01;
+  reg [7:0] tx_crc;             // running CRC of the sent bytes
+  assign SPI_POCI = tx_shift[7];
+
+  always @(negedge SPI_CLK or posedge SPI_CS) begin
+    if (SPI_CS)
+      tx_shift <= 8'h01;
+    else if (bit_cnt == 3'd0)   // previous byte complete, byte_cnt is the next one
+      tx_shift <= tx_is_crc ? tx_crc : tx_next;
+    else
+      tx_shift <= {tx_shift[6:0], 1'b0};
+  end
+
+  always @(negedge SPI_CLK) begin
+    if (~SPI_CS && bit_cnt == 3'd0 && ~tx_is_crc)
+      tx_crc <= crc8(byte_cnt == 12'd1 ? CRC_INIT : tx_crc, tx_next);
+  end
+
+
+  // 4) clk domain: decode the frame once CS has risen
+  reg frame_seen = 1'b0;
+  integer a;
+  always @(posedge clk) begin
+    pitch_we    <= 1'b0;
+    yaw_we      <= 1'b0;
+    axis_we     <= {NUM_AXES{1'b0}};
+    gains_we    <= 1'b0;
+    setpoint_we <= 1'b0;
+    sampler_we  <= 1'b0;
+    samples_free <= 1'b0;
+    queue_config_we <= 1'b0;
+    queue_commit    <= 1'b0;
+    cmd_done        <= 1'b0;
+    hist_we         <= 1'b0;
+    if (cs_end && frame_toggle != frame_seen) begin
+      frame_seen <= frame_toggle;
+      // timed whether applied or not: snap_time still holds the CS fall
+      cmd_done   <= 1'b1;
+      cmd_op     <= op;
+      cmd_start  <= snap_time;
+      if (checked ? frame_ok : len_ok) begin
+        case (op)
+          7'h10: begin
+            pitch_we   <= 1'b1;
+            pitch_word <= {rx_buf[2], rx_buf[1]};
+          end
+          7'h11: begin
+            yaw_we     <= 1'b1;
+            yaw_word   <= {rx_buf[2], rx_buf[1]};
+          end
+          7'h12,
+          7'h40: begin // 0x40: PWM words received while the positions were sent
+            pitch_we   <= 1'b1;
+            pitch_word <= {rx_buf[2], rx_buf[1]};
+            yaw_we     <= 1'b1;
+            yaw_word   <= {rx_buf[4], rx_buf[3]};
+          end
+          7'h13: begin // every axis received, at once
+            if (reg_dirty[0]) begin
+              pitch_we   <= 1'b1;
+              pitch_word <= reg_stage[0][15:0];
+            end
+            if (reg_dirty[1]) begin
+              yaw_we     <= 1'b1;
+              yaw_word   <= reg_stage[1][15:0];
+            end
+            for (a = 2; a < NUM_AXES; a = a + 1) begin
+              if (reg_dirty[a]) begin
+                axis_we[a]             <= 1'b1;
+                axis_words[16*a +: 16] <= reg_stage[a][15:0];
+              end
+            end
+          end
+          7'h50,
+          7'h51: begin
+            gains_we   <= 1'b1;
+            gains_axis <= op[0];
+            gains      <= {rx_buf[1], rx_buf[2], rx_buf[3], rx_buf[4], rx_buf[5], rx_buf[6],
+                           rx_buf[7], rx_buf[8], rx_buf[9], rx_buf[10], rx_buf[11], rx_buf[12],
+                           rx_buf[13], rx_buf[14], rx_buf[15], rx_buf[16], rx_buf[17], rx_buf[18]};
+          end
+          7'h52: begin // setpoints received while the positions were sent
+            setpoint_we <= 1'b1;
+            setpoints   <= {rx_buf[1], rx_buf[2], rx_buf[3], rx_buf[4], rx_buf[5], rx_buf[6], rx_buf[7], rx_buf[8]};
+            pid_enable  <= rx_buf[9][1:0];
+          end
+          7'h60: begin // the samples before the first one requested were received
+            samples_free    <= 1'b1;
+            samples_free_to <= {rx_buf[1], rx_buf[2]};
+          end
+          7'h61: begin
+            sampler_we     <= 1'b1;
+            sampler_period <= {rx_buf[1], rx_buf[2], rx_buf[3]};
+          end
+          7'h62: begin
+            queue_config_we   <= 1'b1;
+            queue_brake       <= rx_buf[1][0];
+            queue_timeout_cfg <= {rx_buf[2], rx_buf[3], rx_buf[4]};
+          end
+          7'h63: begin // the entries taken while they arrived
+            queue_commit    <= 1'b1;
+            queue_commit_to <= q_end;
+          end
+          7'h71: begin // every register received, at once
+            if (reg_dirty[4'h0]) begin
+              pitch_we   <= 1'b1;
+              pitch_word <= reg_stage[4'h0][15:0];
+            end
+            if (reg_dirty[4'h1]) begin
+              yaw_we     <= 1'b1;
+              yaw_word   <= reg_stage[4'h1][15:0];
+            end
+            if (|reg_dirty[4'h4:4'h2])
+              setpoint_we <= 1'b1;
+            if (reg_dirty[4'h2]) setpoints[63:32] <= reg_stage[4'h2];
+            if (reg_dirty[4'h3]) setpoints[31:0]  <= reg_stage[4'h3];
+            if (reg_dirty[4'h4]) pid_enable       <= reg_stage[4'h4][1:0];
+            if (reg_dirty[4'h5]) begin
+              sampler_we     <= 1'b1;
+              sampler_period <= reg_stage[4'h5][23:0];
+            end
+            if (reg_dirty[4'h6]) begin
+              samples_free    <= 1'b1;
+              samples_free_to <= reg_stage[4'h6][15:0];
+            end
+            if (reg_dirty[4'h7]) begin
+              queue_config_we   <= 1'b1;
+              queue_brake       <= reg_stage[4'h7][24];
+              queue_timeout_cfg <= reg_stage[4'h7][23:0];
+            end
+            if (reg_dirty[4'h8]) gains[143:112] <= reg_stage[4'h8];
+            if (reg_dirty[4'h9]) gains[111:80]  <= reg_stage[4'h9];
+            if (reg_dirty[4'hA]) gains[79:48]   <= reg_stage[4'hA];
+            if (reg_dirty[4'hB]) gains[47:16]   <= reg_stage[4'hB];
+            if (reg_dirty[4'hC]) gains[15:0]    <= reg_stage[4'hC][15:0];
+            if (reg_dirty[4'hD]) begin
+              gains_we   <= 1'b1;
+              gains_axis <= reg_stage[4'hD][0];
+            end
+            if (|reg_dirty[4'hF:4'hE])
+              hist_we <= 1'b1;
+            if (reg_dirty[4'hE]) begin
+              hist_filter <= reg_stage[4'hE][31:24];
+              hist_origin <= reg_stage[4'hE][23:0];
+            end
+            if (reg_dirty[4'hF]) begin
+              hist_shift    <= reg_stage[4'hF][28:24];
+              hist_deadline <= reg_stage[4'hF][23:0];
+            end
+          end
+          default: ; // read-only commands
+        endcase
+      end
+    end
+  end
+
+endmodule
@@ -0,0 +1,564 @@
+`timescale 1ns / 1ps
+
+module SpiSlave_tb;
+
+    // Simulation timing constants
+    localparam CLK_PERIOD_NS = 40;      // 25 MHz FPGA clock
+    localparam CS_GAP_CLKS   = 3;       // Shortest CS high time between frames
+
+    real spi_half_ns = 25.0;            // Half SPI clock period, set per test
+
+    // DUT I/O
+    reg clk = 0;
+    reg SPI_CLK = 0;
+    reg SPI_PICO = 0;
+    reg SPI_CS = 1;
+    wire SPI_POCI;
+    reg  [31:0] position_pitch = 32'h0;
+    wire [31:0] position_yaw = ~position_pitch;
+    reg  [7:0]  motion = 8'h00;
+    reg  [31:0] pwm_status = 32'h0;
+    wire [31:0] timestamp = position_pitch + 32'd5;
+    reg  [95:0] velocity = 96'h0;
+    wire pitch_we, yaw_we;
+    wire [15:0] pitch_word, yaw_word;
+    wire [3:0]  axis_we;
+    wire [63:0] axis_words;
+    wire gains_we, gains_axis, setpoint_we;
+    wire [143:0] gains;
+    wire [63:0] setpoints;
+    wire [1:0] pid_enable;
+    reg  [15:0] sample_index = 16'd0;
+    wire [7:0]  sample_raddr;
+    reg  [95:0] sample_rdata = 96'h0;
+    reg  [95:0] sample_ram [0:255];
+    wire sampler_we, samples_free;
+    wire [23:0] sampler_period;
+    wire [15:0] samples_free_to;
+    reg  [15:0] queue_wr_index = 16'd0, queue_rd_index = 16'd0;
+    wire queue_we, queue_config_we, queue_brake, queue_commit;
+    wire [7:0]  queue_waddr;
+    wire [63:0] queue_wdata;
+    wire [23:0] queue_timeout_cfg;
+    wire [15:0] queue_commit_to;
+    reg  [63:0] queue_ram [0:255];
+    reg  [95:0] hist_rdata = 96'h0;
+    wire cmd_done, hist_we;
+    wire [6:0]  cmd_op;
+    wire [31:0] cmd_start;
+    wire [7:0]  hist_filter;
+    wire [23:0] hist_origin, hist_deadline;
+    wire [4:0]  hist_shift;
+
+    // Instantiate the DUT
+    // Four axes, the further two standing still
+    SpiSlave #(
+        .NUM_AXES(4)
+    ) dut (
+        .clk(clk),
+        .SPI_CLK(SPI_CLK), .SPI_PICO(SPI_PICO), .SPI_CS(SPI_CS), .SPI_POCI(SPI_POCI),
+        .positions({32'hA0A0_0003, 32'hA0A0_0002, position_yaw, position_pitch}),
+        .motion(motion), .pwm_status(pwm_status), .timestamp(timestamp), .velocity(velocity),
+        .pitch_we(pitch_we), .yaw_we(yaw_we),
+        .pitch_word(pitch_word), .yaw_word(yaw_word),
+        .axis_we(axis_we), .axis_words(axis_words),
+        .gains_we(gains_we), .gains_axis(gains_axis), .gains(gains),
+        .setpoint_we(setpoint_we), .setpoints(setpoints), .pid_enable(pid_enable),
+        .sample_index(sample_index), .sample_overflows(8'h07),
+        .sample_raddr(sample_raddr), .sample_rdata(sample_rdata),
+        .sampler_we(sampler_we), .sampler_period(sampler_period),
+        .samples_free(samples_free), .samples_free_to(samples_free_to),
+        .queue_wr_index(queue_wr_index), .queue_rd_index(queue_rd_index), .queue_underruns(8'h02),
+        .queue_brake_on(1'b1), .queue_timeout(24'd5000),
+        .queue_we(queue_we), .queue_waddr(queue_waddr), .queue_wdata(queue_wdata),
+        .queue_config_we(queue_config_we), .queue_brake(queue_brake), .queue_timeout_cfg(queue_timeout_cfg),
+        .queue_commit(queue_commit), .queue_commit_to(queue_commit_to),
+        .hist_stats({32'd1180, 32'd1320, 32'd2, 32'd500}), .hist_rdata(hist_rdata),
+        .cmd_done(cmd_done), .cmd_op(cmd_op), .cmd_start(cmd_start),
+        .hist_we(hist_we), .hist_filter(hist_filter), .hist_origin(hist_origin),
+        .hist_shift(hist_shift), .hist_deadline(hist_deadline)
+    );
+
+    // Queue RAM write port, as PwmQueue; a commit moves the write index
+    always @(posedge SPI_CLK)
+        if (queue_we)
+            queue_ram[queue_waddr] <= queue_wdata;
+    always @(posedge clk)
+        if (queue_commit)
+            queue_wr_index <= queue_commit_to;
+
+    // Sample RAM read port, as SampleFifo: sample i holds {i, ~i, i + 100}
+    integer r;
+    initial
+        for (r = 0; r < 256; r = r + 1)
+            sample_ram[r] = {r[31:0], ~r[31:0], r[31:0] + 32'd100};
+    always @(posedge SPI_CLK)
+        sample_rdata <= sample_ram[sample_raddr];
+
+    // Histogram read port, as IntervalHistogram: word k holds the bins
+    // {0x00kk, 0x01kk, 0x02kk, 0x03kk}
+    always @(posedge SPI_CLK)
+        hist_rdata <= {16'h0000, sample_raddr, 16'h0001, sample_raddr, 16'h0002, sample_raddr, 16'h0003, sample_raddr};
+
+    // Clock generator, the pitch position changes on every cycle so that a
+    // torn snapshot shows up as yaw != ~pitch or timestamp != pitch + 5
+    initial begin
+        forever #(CLK_PERIOD_NS / 2) clk = ~clk;
+    end
+    always @(posedge clk)
+        position_pitch <= position_pitch + 32'd1;
+
+    // Strobes seen in the clk domain
+    integer pitch_writes = 0, yaw_writes = 0, gains_writes = 0, setpoint_writes = 0;
+    integer sampler_writes = 0, frees = 0, queue_configs = 0, commits = 0, axis_writes = 0;
+    integer cmds_done = 0, hist_writes = 0;
+    reg [6:0]  last_cmd_op = 7'h00;
+    reg [31:0] last_cmd_start = 32'h0;
+    reg [15:0] last_free_to = 16'h0;
+    reg [15:0] last_pitch_word = 16'h0, last_yaw_word = 16'h0;
+    always @(posedge clk) begin
+        if (pitch_we) begin
+            pitch_writes    = pitch_writes + 1;
+            last_pitch_word = pitch_word;
+        end
+        if (yaw_we) begin
+            yaw_writes    = yaw_writes + 1;
+            last_yaw_word = yaw_word;
+        end
+        if (gains_we)    gains_writes    = gains_writes + 1;
+        if (setpoint_we) setpoint_writes = setpoint_writes + 1;
+        if (sampler_we)  sampler_writes  = sampler_writes + 1;
+        if (queue_config_we) queue_configs = queue_configs + 1;
+        if (queue_commit)    commits       = commits + 1;
+        if (axis_we != 4'b0000) axis_writes = axis_writes + 1;
+        if (hist_we)            hist_writes = hist_writes + 1;
+        if (cmd_done) begin
+            cmds_done      = cmds_done + 1;
+            last_cmd_op    = cmd_op;
+            last_cmd_start = cmd_start;
+        end
+        if (samples_free) begin
+            frees        = frees + 1;
+            last_free_to = samples_free_to;
+        end
+    end
+
+    // Testbench variables for SPI and results
+    reg [7:0] tb_tx_packet [0:63];
+    reg [7:0] tb_rx_packet [0:63];
+    reg [31:0] pitch_at_cs;
+    integer received_pitch, received_yaw, received_stamp;
+    integer writes_before;
+    integer failures = 0;
+    integer k;
+
+    // CRC-8 of packet bytes [first, last], as SpiSlave computes it
+    function [7:0] packet_crc;
+        input integer from_rx;
+        input integer first;
+        input integer last;
+        integer n, b;
+        begin
+            packet_crc = 8'hFF;
+            for (n = first; n <= last; n = n + 1) begin
+                packet_crc = packet_crc ^ (from_rx ? tb_rx_packet[n] : tb_tx_packet[n]);
+                for (b = 0; b < 8; b = b + 1)
+                    packet_crc = packet_crc[7] ? ({packet_crc[6:0], 1'b0} ^ 8'h07) : {packet_crc[6:0], 1'b0};
+            end
+        end
+    endfunction
+
+    // SPI mode 0 master: PICO driven on the falling edge, POCI sampled on the
+    // rising edge. CS stays high for gap_clks FPGA clocks afterwards.
+    task spi_transaction;
+        input integer num_bytes;
+        input integer gap_clks;
+        integer i, j;
+        begin
+            SPI_CS = 1'b0;
+            pitch_at_cs = position_pitch;
+            for (i = 0; i < num_bytes; i = i + 1) begin
+                for (j = 7; j >= 0; j = j - 1) begin
+                    SPI_PICO = tb_tx_packet[i][j];
+                    #(spi_half_ns);
+                    tb_rx_packet[i][j] = SPI_POCI;
+                    SPI_CLK = 1'b1;
+                    #(spi_half_ns);
+                    SPI_CLK = 1'b0;
+                end
+            end
+            #(spi_half_ns);
+            SPI_CS = 1'b1;
+            #(CLK_PERIOD_NS * gap_clks);
+        end
+    endtask
+
+    task check;
+        input ok;
+        input [8*64-1:0] what;
+        begin
+            if (ok)
+                $display("PASSED: %0s", what);
+            else begin
+                $display("FAILED: %0s", what);
+                failures = failures + 1;
+            end
+        end
+    endtask
+
+    task clear_packet;
+        begin
+            for (k = 0; k < 64; k = k + 1) tb_tx_packet[k] = 8'h00;
+        end
+    endtask
+
+    // Main Test Sequence
+    initial begin
+        $display("Starting SpiSlave Testbench...");
+        // $dumpfile("spi_slave_signals.vcd");
+        // $dumpvars(0, SpiSlave_tb);
+        #(CLK_PERIOD_NS * 10);
+
+        // Test 1: PWM write, 20 MHz
+        $display("TEST 1: Write PWM at 20 MHz");
+        spi_half_ns = 25.0;
+        clear_packet;
+        tb_tx_packet[0] = 8'h12;
+        tb_tx_packet[1] = 8'h00; tb_tx_packet[2] = 8'hA0; // Pitch: duty=0x800, en=1, dir=0
+        tb_tx_packet[3] = 8'h00; tb_tx_packet[4] = 8'hD0; // Yaw:   duty=0x400, en=1, dir=1
+        spi_transaction(5, 10);
+        check(tb_rx_packet[0] == 8'h01, "Dummy byte 0x01 first");
+        check(pitch_writes == 1 && yaw_writes == 1, "One strobe per axis");
+        check(last_pitch_word == 16'hA000 && last_yaw_word == 16'hD000, "PWM words received");
+
+        // Test 2: positions, 25 MHz, from one snapshot taken when CS fell
+        $display("TEST 2: Read Positions at 25 MHz");
+        spi_half_ns = 20.0;
+        clear_packet;
+        tb_tx_packet[0] = 8'h22;
+        spi_transaction(13, 10);
+        received_pitch = {tb_rx_packet[1], tb_rx_packet[2], tb_rx_packet[3], tb_rx_packet[4]};
+        received_yaw   = {tb_rx_packet[5], tb_rx_packet[6], tb_rx_packet[7], tb_rx_packet[8]};
+        received_stamp = {tb_rx_packet[9], tb_rx_packet[10], tb_rx_packet[11], tb_rx_packet[12]};
+        check(received_yaw == ~received_pitch, "Pitch and yaw from the same snapshot");
+        check(received_stamp == received_pitch + 5, "Timestamp latched with the positions");
+        check(received_pitch - pitch_at_cs >= 0 && received_pitch - pitch_at_cs <= 3, "Snapshot frozen at CS fall");
+
+        // Test 3: movement and PWM status, 30 MHz
+        $display("TEST 3: Movement and Status at 30 MHz");
+        spi_half_ns = 16.6;
+        motion = 8'h31;
+        pwm_status = 32'hC834_8CFF;
+        clear_packet;
+        tb_tx_packet[0] = 8'h23;
+        spi_transaction(10, 10);
+        received_pitch = {tb_rx_packet[1], tb_rx_packet[2], tb_rx_packet[3], tb_rx_packet[4]};
+        received_yaw   = {tb_rx_packet[5], tb_rx_packet[6], tb_rx_packet[7], tb_rx_packet[8]};
+        check(received_yaw == ~received_pitch && tb_rx_packet[9] == 8'h31, "Positions and movement byte");
+
+        tb_tx_packet[0] = 8'h30;
+        spi_transaction(5, 10);
+        check({tb_rx_packet[1], tb_rx_packet[2], tb_rx_packet[3], tb_rx_packet[4]} == 32'hC834_8CFF, "PWM status");
+
+        // Longest command, checked: 21 bytes + 3 check bytes
+        velocity = 96'h0000_1388_FFFF_FE0C_000A_FFFE;
+        clear_packet;
+        tb_tx_packet[0] = 8'hA5;
+        tb_tx_packet[21] = 8'h33; // Sequence
+        tb_tx_packet[22] = packet_crc(0, 0, 21);
+        spi_transaction(24, 10);
+        check({tb_rx_packet[9], tb_rx_packet[10], tb_rx_packet[11], tb_rx_packet[12], tb_rx_packet[13], tb_rx_packet[14],
+               tb_rx_packet[15], tb_rx_packet[16], tb_rx_packet[17], tb_rx_packet[18], tb_rx_packet[19], tb_rx_packet[20]}
+              == 96'h0000_1388_FFFF_FE0C_000A_FFFE, "Velocities");
+        check(tb_rx_packet[22] == packet_crc(1, 1, 21) && tb_rx_packet[23] == 8'h33, "Checked 24-byte frame CRC and ack");
+
+        // Test 4: combined exchange, 30 MHz
+        $display("TEST 4: Combined Read Positions and Write PWM at 30 MHz");
+        clear_packet;
+        tb_tx_packet[0] = 8'h40;
+        tb_tx_packet[1] = 8'h34; tb_tx_packet[2] = 8'hC8; // Pitch: duty=0x234, en=1, dir=1
+        tb_tx_packet[3] = 8'hFF; tb_tx_packet[4] = 8'h8C; // Yaw:   duty=0x3FF, en=1, dir=0
+        spi_transaction(9, 10);
+        received_pitch = {tb_rx_packet[1], tb_rx_packet[2], tb_rx_packet[3], tb_rx_packet[4]};
+        received_yaw   = {tb_rx_packet[5], tb_rx_packet[6], tb_rx_packet[7], tb_rx_packet[8]};
+        check(received_yaw == ~received_pitch, "Positions returned by the exchange");
+        check(pitch_writes == 2 && last_pitch_word == 16'hC834 && last_yaw_word == 16'h8CFF, "Exchange PWM applied");
+
+        // Test 5: checked frames, 30 MHz
+        $display("TEST 5: Checked Frames at 30 MHz");
+        clear_packet;
+        tb_tx_packet[0] = 8'hA2; // Read All Positions, checked
+        tb_tx_packet[13] = 8'h5C; // Sequence
+        tb_tx_packet[14] = packet_crc(0, 0, 13);
+        spi_transaction(16, 10);
+        received_pitch = {tb_rx_packet[1], tb_rx_packet[2], tb_rx_packet[3], tb_rx_packet[4]};
+        received_yaw   = {tb_rx_packet[5], tb_rx_packet[6], tb_rx_packet[7], tb_rx_packet[8]};
+        received_stamp = {tb_rx_packet[9], tb_rx_packet[10], tb_rx_packet[11], tb_rx_packet[12]};
+        check(received_yaw == ~received_pitch && received_stamp == received_pitch + 5 && tb_rx_packet[13] == 8'h00,
+              "Checked read positions and timestamp, no errors");
+        check(tb_rx_packet[14] == packet_crc(1, 1, 13) && tb_rx_packet[15] == 8'h5C, "Checked read CRC and ack");
+
+        // Corrupted write: nacked, not applied, counted
+        clear_packet;
+        tb_tx_packet[0] = 8'h92; // Write All PWM, checked
+        tb_tx_packet[1] = 8'h00; tb_tx_packet[2] = 8'hA0;
+        tb_tx_packet[3] = 8'h00; tb_tx_packet[4] = 8'hD0;
+        tb_tx_packet[5] = 8'h11; // Sequence
+        tb_tx_packet[6] = ~packet_crc(0, 0, 5);
+        writes_before = pitch_writes;
+        spi_transaction(8, 10);
+        check(tb_rx_packet[7] == 8'hEE && pitch_writes == writes_before, "Corrupted write nacked and not applied");
+
+        tb_tx_packet[5] = 8'h12;
+        tb_tx_packet[6] = packet_crc(0, 0, 5);
+        spi_transaction(8, 10);
+        check(tb_rx_packet[5] == 8'h01 && tb_rx_packet[6] == packet_crc(1, 1, 5) && tb_rx_packet[7] == 8'h12,
+              "Checked write acked, error counted");
+        check(pitch_writes == writes_before + 1 && last_pitch_word == 16'hA000, "Checked write applied");
+
+        // Test 6: an unchecked write one byte short is ignored
+        $display("TEST 6: Short Unchecked Write");
+        clear_packet;
+        tb_tx_packet[0] = 8'h12;
+        tb_tx_packet[1] = 8'h55; tb_tx_packet[2] = 8'h80;
+        writes_before = pitch_writes;
+        spi_transaction(4, 10);
+        check(pitch_writes == writes_before, "Short write ignored");
+
+        // Test 7: back-to-back frames with the shortest CS gap, 30 MHz
+        $display("TEST 7: Back-to-Back Frames at 30 MHz");
+        writes_before = yaw_writes;
+        clear_packet;
+        tb_tx_packet[0] = 8'h11;
+        tb_tx_packet[1] = 8'h01; tb_tx_packet[2] = 8'h80;
+        spi_transaction(3, CS_GAP_CLKS);
+        tb_tx_packet[1] = 8'h02;
+        spi_transaction(3, CS_GAP_CLKS);
+        tb_tx_packet[0] = 8'h22;
+        spi_transaction(9, 10);
+        received_pitch = {tb_rx_packet[1], tb_rx_packet[2], tb_rx_packet[3], tb_rx_packet[4]};
+        received_yaw   = {tb_rx_packet[5], tb_rx_packet[6], tb_rx_packet[7], tb_rx_packet[8]};
+        check(yaw_writes == writes_before + 2 && last_yaw_word == 16'h8002, "Both writes applied in order");
+        check(received_yaw == ~received_pitch && received_pitch - pitch_at_cs >= 0 && received_pitch - pitch_at_cs <= 3,
+              "Read after short gaps sees a fresh snapshot");
+
+        // Test 8: PID gains and setpoints, 20 MHz
+        $display("TEST 8: PID Gains and Setpoints at 20 MHz");
+        spi_half_ns = 25.0;
+        clear_packet;
+        tb_tx_packet[0] = 8'h51;
+        for (k = 1; k <= 18; k = k + 1) tb_tx_packet[k] = k;
+        spi_transaction(19, 10);
+        check(gains_writes == 1 && gains_axis == 1'b1 && gains[143:136] == 8'h01 && gains[7:0] == 8'h12,
+              "Yaw gains loaded");
+        clear_packet;
+        tb_tx_packet[0] = 8'h52;
+        tb_tx_packet[1] = 8'h00; tb_tx_packet[2] = 8'h00; tb_tx_packet[3] = 8'h01; tb_tx_packet[4] = 8'h2C;
+        tb_tx_packet[5] = 8'hFF; tb_tx_packet[6] = 8'hFF; tb_tx_packet[7] = 8'hFF; tb_tx_packet[8] = 8'h38;
+        tb_tx_packet[9] = 8'h03;
+        spi_transaction(10, 10);
+        received_pitch = {tb_rx_packet[1], tb_rx_packet[2], tb_rx_packet[3], tb_rx_packet[4]};
+        received_yaw   = {tb_rx_packet[5], tb_rx_packet[6], tb_rx_packet[7], tb_rx_packet[8]};
+        check(received_yaw == ~received_pitch, "Setpoint exchange reads positions");
+        check(setpoint_writes == 1 && setpoints == 64'h0000012C_FFFFFF38 && pid_enable == 2'b11,
+              "Setpoints and enables applied");
+        tb_tx_packet[0] = 8'h52;
+        spi_transaction(9, 10);
+        check(setpoint_writes == 1, "Short setpoint frame ignored");
+
+        // Test 9: sampler period, then a burst of 3 samples from index 254
+        // (across the end of the RAM), unchecked and checked, 20 MHz
+        $display("TEST 9: Sample Bursts at 20 MHz");
+        clear_packet;
+        tb_tx_packet[0] = 8'h61;
+        tb_tx_packet[1] = 8'h00; tb_tx_packet[2] = 8'h09; tb_tx_packet[3] = 8'hC4;
+        spi_transaction(5, 10);
+        check(sampler_writes == 1 && sampler_period == 24'd2500, "Sample period set");
+        sample_index = 16'd258;
+        clear_packet;
+        tb_tx_packet[0] = 8'h60;
+        tb_tx_packet[1] = 8'h00; tb_tx_packet[2] = 8'hFE; tb_tx_packet[3] = 8'd3;
+        spi_transaction(41, 10);
+        check({tb_rx_packet[1], tb_rx_packet[2]} == 16'd258 && tb_rx_packet[3] == 8'h07, "Burst header");
+        check({tb_rx_packet[5], tb_rx_packet[6], tb_rx_packet[7], tb_rx_packet[8]} == 32'd254 &&
+              {tb_rx_packet[13], tb_rx_packet[14], tb_rx_packet[15], tb_rx_packet[16]} == 32'd354 &&
+              {tb_rx_packet[17], tb_rx_packet[18], tb_rx_packet[19], tb_rx_packet[20]} == 32'd255 &&
+              {tb_rx_packet[29], tb_rx_packet[30], tb_rx_packet[31], tb_rx_packet[32]} == 32'd0 &&
+              {tb_rx_packet[37], tb_rx_packet[38], tb_rx_packet[39], tb_rx_packet[40]} == 32'd100,
+              "Burst samples in order");
+        check(frees == 1 && last_free_to == 16'h00FE, "Samples before the first one freed");
+        tb_tx_packet[0] = 8'hE0;
+        tb_tx_packet[41] = 8'h5A;
+        tb_tx_packet[42] = packet_crc(0, 0, 41);
+        spi_transaction(44, 10);
+        check(tb_rx_packet[42] == packet_crc(1, 1, 41) && tb_rx_packet[43] == 8'h5A, "Checked burst acked");
+        check({tb_rx_packet[29], tb_rx_packet[30], tb_rx_packet[31], tb_rx_packet[32]} == 32'd0 && frees == 2,
+              "Checked burst samples");
+
+        // Test 10: register bursts, 20 MHz. Read ID, positions and
+        // timestamp; write PWM words, setpoints and enables in one frame;
+        // load pitch gains with a checked write; read the writes back.
+        $display("TEST 10: Register Bursts at 20 MHz");
+        clear_packet;
+        tb_tx_packet[0] = 8'h70;
+        tb_tx_packet[1] = 8'h00; tb_tx_packet[2] = 8'd4;
+        spi_transaction(19, 10);
+        received_pitch = {tb_rx_packet[7], tb_rx_packet[8], tb_rx_packet[9], tb_rx_packet[10]};
+        received_yaw   = {tb_rx_packet[11], tb_rx_packet[12], tb_rx_packet[13], tb_rx_packet[14]};
+        received_stamp = {tb_rx_packet[15], tb_rx_packet[16], tb_rx_packet[17], tb_rx_packet[18]};
+        check({tb_rx_packet[3], tb_rx_packet[4], tb_rx_packet[5], tb_rx_packet[6]} == 32'h474D_0001, "Map ID");
+        check(received_yaw == ~received_pitch && received_stamp == received_pitch + 5,
+              "Positions and timestamp from the same snapshot");
+
+        clear_packet;
+        tb_tx_packet[0] = 8'h71;
+        tb_tx_packet[1] = 8'h10; tb_tx_packet[2] = 8'd5;
+        tb_tx_packet[5]  = 8'hC8; tb_tx_packet[6]  = 8'h34;   // 0x10 pitch word
+        tb_tx_packet[9]  = 8'h8C; tb_tx_packet[10] = 8'hFF;   // 0x11 yaw word
+        tb_tx_packet[14] = 8'h64;                             // 0x12 setpoint pitch = 100
+        tb_tx_packet[15] = 8'hFF; tb_tx_packet[16] = 8'hFF;   // 0x13 setpoint yaw = -100
+        tb_tx_packet[17] = 8'hFF; tb_tx_packet[18] = 8'h9C;
+        tb_tx_packet[22] = 8'h01;                             // 0x14 pitch loop on
+        writes_before = pitch_writes;
+        spi_transaction(23, 10);
+        check({tb_rx_packet[5], tb_rx_packet[6]} == 16'hA000 && {tb_rx_packet[21], tb_rx_packet[22]} == 16'h0003,
+              "Write burst returns the previous values");
+        check(pitch_writes == writes_before + 1 && last_pitch_word == 16'hC834 && last_yaw_word == 16'h8CFF,
+              "PWM registers applied");
+        check(setpoint_writes == 2 && setpoints == 64'h00000064_FFFFFF9C && pid_enable == 2'b01,
+              "Setpoint registers applied");
+
+        clear_packet;
+        tb_tx_packet[0] = 8'hF1;
+        tb_tx_packet[1] = 8'h18; tb_tx_packet[2] = 8'd6;
+        for (k = 3; k < 23; k = k + 1) tb_tx_packet[k] = k;
+        tb_tx_packet[26] = 8'h00;                             // 0x1D load pitch
+        tb_tx_packet[27] = 8'h77;
+        tb_tx_packet[28] = packet_crc(0, 0, 27);
+        spi_transaction(30, 10);
+        check(tb_rx_packet[28] == packet_crc(1, 1, 27) && tb_rx_packet[29] == 8'h77, "Checked register write acked");
+        check(gains_writes == 2 && gains_axis == 1'b0 && gains[143:136] == 8'h03 && gains[15:0] == 16'h1516,
+              "Gain registers loaded into the pitch loop");
+
+        clear_packet;
+        tb_tx_packet[0] = 8'h70;
+        tb_tx_packet[1] = 8'h10; tb_tx_packet[2] = 8'd14;
+        spi_transaction(59, 10);
+        check({tb_rx_packet[5], tb_rx_packet[6]} == 16'hC834 &&
+              {tb_rx_packet[15], tb_rx_packet[16], tb_rx_packet[17], tb_rx_packet[18]} == 32'hFFFF_FF9C &&
+              {tb_rx_packet[35], tb_rx_packet[36], tb_rx_packet[37], tb_rx_packet[38]} == 32'h0304_0506 &&
+              {tb_rx_packet[55], tb_rx_packet[56], tb_rx_packet[57], tb_rx_packet[58]} == 32'h0,
+              "Registers read back");
+
+        // Test 11: PWM queue set up, then 3 entries from index 0 with the
+        // queue holding 254 (read index 2): the third one does not fit.
+        // The same frame sent again adds nothing.
+        $display("TEST 11: PWM Queue at 20 MHz");
+        clear_packet;
+        tb_tx_packet[0] = 8'h62;
+        tb_tx_packet[1] = 8'h01; tb_tx_packet[2] = 8'h00; tb_tx_packet[3] = 8'h13; tb_tx_packet[4] = 8'h88;
+        spi_transaction(5, 10);
+        check(queue_configs == 1 && queue_brake == 1'b1 && queue_timeout_cfg == 24'd5000, "Queue set up");
+        queue_wr_index = 16'd256;
+        queue_rd_index = 16'd2;
+        clear_packet;
+        tb_tx_packet[0] = 8'h63;
+        tb_tx_packet[1] = 8'h01; tb_tx_packet[2] = 8'h00; tb_tx_packet[3] = 8'd3;
+        for (k = 6; k < 30; k = k + 1) tb_tx_packet[k] = k;
+        spi_transaction(30, 10);
+        check({tb_rx_packet[1], tb_rx_packet[2]} == 16'd256 && {tb_rx_packet[3], tb_rx_packet[4]} == 16'd2 &&
+              tb_rx_packet[5] == 8'h02, "Queue header");
+        check(commits == 1 && queue_commit_to == 16'd258, "Two entries taken");
+        check(queue_ram[0] == 64'h0607_0809_0A0B_0C0D && queue_ram[1] == 64'h0E0F_1011_1213_1415,
+              "Entries written in order");
+        tb_tx_packet[0] = 8'hE3;
+        tb_tx_packet[30] = 8'h42;
+        tb_tx_packet[31] = packet_crc(0, 0, 30);
+        queue_ram[0] = 64'h0;
+        spi_transaction(33, 10);
+        check(tb_rx_packet[33 - 1] == 8'h42 && commits == 2 && queue_commit_to == 16'd258 && queue_ram[0] == 64'h0,
+              "Frame sent again adds nothing");
+
+        // Test 12: axis commands, 20 MHz. Positions of axes 0-4 (4 is past
+        // NUM_AXES) and their timestamp; PWM words of axes 1-4, checked.
+        $display("TEST 12: Axis Commands at 20 MHz");
+        clear_packet;
+        tb_tx_packet[0] = 8'h24;
+        tb_tx_packet[1] = 8'd0; tb_tx_packet[2] = 8'd5;
+        spi_transaction(27, 10);
+        received_pitch = {tb_rx_packet[3], tb_rx_packet[4], tb_rx_packet[5], tb_rx_packet[6]};
+        received_yaw   = {tb_rx_packet[7], tb_rx_packet[8], tb_rx_packet[9], tb_rx_packet[10]};
+        received_stamp = {tb_rx_packet[23], tb_rx_packet[24], tb_rx_packet[25], tb_rx_packet[26]};
+        check(received_yaw == ~received_pitch && received_stamp == received_pitch + 5,
+              "Axis positions and timestamp from the same snapshot");
+        check({tb_rx_packet[11], tb_rx_packet[12], tb_rx_packet[13], tb_rx_packet[14]} == 32'hA0A0_0002 &&
+              {tb_rx_packet[15], tb_rx_packet[16], tb_rx_packet[17], tb_rx_packet[18]} == 32'hA0A0_0003 &&
+              {tb_rx_packet[19], tb_rx_packet[20], tb_rx_packet[21], tb_rx_packet[22]} == 32'h0,
+              "Further axes, none past NUM_AXES");
+
+        clear_packet;
+        tb_tx_packet[0] = 8'h93;
+        tb_tx_packet[1] = 8'd1; tb_tx_packet[2] = 8'd4;
+        tb_tx_packet[3] = 8'h05; tb_tx_packet[4] = 8'h80;     // Axis 1 (yaw): duty=0x005, en=1
+        tb_tx_packet[5] = 8'h22; tb_tx_packet[6] = 8'hC4;     // Axis 2: duty=0x122, en=1, dir=1
+        tb_tx_packet[7] = 8'h33; tb_tx_packet[8] = 8'h88;     // Axis 3: duty=0x233, en=1
+        tb_tx_packet[9] = 8'h44; tb_tx_packet[10] = 8'h8C;    // Axis 4: not written
+        tb_tx_packet[11] = 8'h21;
+        tb_tx_packet[12] = packet_crc(0, 0, 11);
+        writes_before = pitch_writes;
+        spi_transaction(14, 10);
+        check(tb_rx_packet[13] == 8'h21, "Checked axis write acked");
+        check(pitch_writes == writes_before && last_yaw_word == 16'h8005, "Axis 1 written as yaw");
+        check(axis_writes == 1 && axis_words[47:32] == 16'hC422 && axis_words[63:48] == 16'h8833,
+              "Further axes written together");
+
+        // Test 13: interval histogram. Every frame is reported with the
+        // timestamp of its snapshot (CS fall + synchronizer); set up by
+        // registers 0x1E/0x1F written together, statistics read back with
+        // them, bins read by a 0x65 burst of entries 3-4.
+        $display("TEST 13: Interval Histogram at 20 MHz");
+        clear_packet;
+        tb_tx_packet[0] = 8'h40;
+        writes_before = cmds_done;
+        spi_transaction(9, 10);
+        check(cmds_done == writes_before + 1 && last_cmd_op == 7'h40, "Frame reported with its command");
+        check(last_cmd_start >= pitch_at_cs + 5 && last_cmd_start <= pitch_at_cs + 5 + 4,
+              "Frame start stamped when CS fell");
+
+        clear_packet;
+        tb_tx_packet[0] = 8'h71;
+        tb_tx_packet[1] = 8'h1E; tb_tx_packet[2] = 8'd2;
+        tb_tx_packet[3] = 8'hC0; tb_tx_packet[5] = 8'h04; tb_tx_packet[6] = 8'hB0;  // only 0x40, origin 1200
+        tb_tx_packet[7] = 8'h03; tb_tx_packet[9] = 8'h05; tb_tx_packet[10] = 8'h14; // 8-cycle bins, deadline 1300
+        spi_transaction(11, 10);
+        check(hist_writes == 1 && hist_filter == 8'hC0 && hist_origin == 24'd1200 && hist_shift == 5'd3 &&
+              hist_deadline == 24'd1300, "Histogram set up once by both registers");
+
+        clear_packet;
+        tb_tx_packet[0] = 8'h70;
+        tb_tx_packet[1] = 8'h1E; tb_tx_packet[2] = 8'd6;
+        spi_transaction(27, 10);
+        check({tb_rx_packet[3], tb_rx_packet[4], tb_rx_packet[5], tb_rx_packet[6]} == 32'hC000_04B0 &&
+              {tb_rx_packet[7], tb_rx_packet[8], tb_rx_packet[9], tb_rx_packet[10]} == 32'h0300_0514,
+              "Histogram setup read back");
+        check({tb_rx_packet[11], tb_rx_packet[12], tb_rx_packet[13], tb_rx_packet[14]} == 32'd1180 &&
+              {tb_rx_packet[23], tb_rx_packet[24], tb_rx_packet[25], tb_rx_packet[26]} == 32'd500,
+              "Interval statistics");
+
+        clear_packet;
+        tb_tx_packet[0] = 8'h65;
+        tb_tx_packet[1] = 8'h00; tb_tx_packet[2] = 8'd3; tb_tx_packet[3] = 8'd2;
+        spi_transaction(29, 10);
+        check({tb_rx_packet[1], tb_rx_packet[2], tb_rx_packet[3], tb_rx_packet[4]} == 32'h0, "Histogram header");
+        check({tb_rx_packet[5], tb_rx_packet[6], tb_rx_packet[7]} == 24'h000003 &&
+              {tb_rx_packet[14], tb_rx_packet[15], tb_rx_packet[16]} == 24'h000303 &&
+              {tb_rx_packet[17], tb_rx_packet[18], tb_rx_packet[19]} == 24'h000004 &&
+              {tb_rx_packet[26], tb_rx_packet[27], tb_rx_packet[28]} == 24'h000304,
+              "Histogram bins from the first entry asked");
+
+        #(CLK_PERIOD_NS * 10);
+        $display("All tests finished, %0d failed.", failures);
+        $finish;
+    end
+
+endmodule
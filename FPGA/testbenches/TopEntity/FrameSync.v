@@ -0,0 +1,50 @@
+// FrameSync.v
+// Snapshots taken on the camera frame strobe (FRAME_SYNC pin, e.g. VSYNC),
+// kept in a small ring in block RAM and read by the SPI slave in the SPI
+// clock domain. The strobe is synchronized into clk and each active edge
+// stores the data of that clk cycle, 3 clk after the pin moved. Frames
+// are numbered by a 16-bit index: index is the one the next frame gets.
+// The ring always takes a new frame, over the oldest one: it holds frames
+// index - 2^ADDR_W .. index - 1, and the oldest of them can be overwritten
+// while it is being read.
+module FrameSync #(
+  parameter ADDR_W = 4,                   // 2^ADDR_W frames
+  parameter DATA_W = 96,
+  parameter RISING = 1                    // 1: rising edge of the strobe, 0: falling edge
+) (
+  input  wire              clk,
+  input  wire              reset,       // active-high, also restarts the index
+  input  wire              strobe_raw,
+  input  wire [DATA_W-1:0] data,
+  output reg  [15:0]       index = 16'd0,
+  // Read port, rclk domain: rdata is the frame at raddr one rclk later
+  input  wire              rclk,
+  input  wire [ADDR_W-1:0] raddr,
+  output reg  [DATA_W-1:0] rdata
+);
+
+  // Starts at the idle level of a pulled-up pin, so that power-up and an
+  // unconnected pin take no frame
+  reg [2:0] sync = 3'b111;
+  always @(posedge clk)
+    sync <= {sync[1:0], strobe_raw};
+  wire take = RISING ? (sync[2:1] == 2'b01) : (sync[2:1] == 2'b10);
+
+  reg [DATA_W-1:0] mem [0:(1 << ADDR_W) - 1];
+
+  always @(posedge clk) begin
+    if (reset)
+      index <= 16'd0;
+    else if (take)
+      index <= index + 16'd1;
+  end
+
+  // Kept apart from the control logic so that it maps onto block RAM
+  always @(posedge clk)
+    if (take && !reset)
+      mem[index[ADDR_W-1:0]] <= data;
+
+  always @(posedge rclk)
+    rdata <= mem[raddr];
+
+endmodule
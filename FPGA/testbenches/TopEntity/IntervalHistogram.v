@@ -0,0 +1,141 @@
+// IntervalHistogram.v
+// Intervals between the starts (CS falling edges) of consecutive SPI
+// frames, as the FPGA sees them: a measurement of the cadence of the Pi
+// control loop that the Pi itself does not disturb. The SPI slave reports
+// each frame once CS has risen, with its command and the timestamp taken
+// when CS fell; only the frames of the filter command are timed, or all of
+// them when the filter is off, so the loop command (e.g. 0x40) can be timed
+// while other programs use the bus.
+//
+// Each interval updates min, max, the count of intervals over the deadline
+// (0: no deadline) and the count of intervals, and adds one to its bin: bin
+// b counts the intervals in [origin + b 2^shift, origin + (b + 1) 2^shift)
+// clk cycles, bin 0 also those below and the last bin those above. Counts
+// saturate at 2^24 - 1. Setting up (config_we) or reset clears it all over
+// the next 2^BINS_W clk cycles, and the first frame after that only starts
+// the first interval.
+//
+// The bins are kept twice in block RAM: one copy for the read-modify-write
+// of the clk domain, and one read by the SPI slave in the SPI clock domain,
+// four 24-bit bins per 96-bit word (bins 4 k .. 4 k + 3 in word k, bin 4 k in
+// the top 24 bits). A bin read while it is being written may be old.
+module IntervalHistogram #(
+  parameter BINS_W = 6                    // 2^BINS_W bins
+) (
+  input  wire              clk,
+  input  wire              reset,         // active-high, also clears
+  // Setup, applied by the one-cycle config_we strobe
+  input  wire              config_we,
+  input  wire [7:0]        config_filter,   // bit 7: time only the frames of command [6:0]
+  input  wire [23:0]       config_origin,   // clk cycles
+  input  wire [4:0]        config_shift,    // log2 of the bin width in clk cycles
+  input  wire [23:0]       config_deadline, // clk cycles, 0: none
+  // Frames, from the SPI slave: one-cycle strobe
+  input  wire              frame,
+  input  wire [6:0]        frame_cmd,
+  input  wire [31:0]       frame_start,   // timestamp when CS fell
+  // Statistics, clk cycles
+  output reg  [31:0]       min     = 32'hFFFF_FFFF,
+  output reg  [31:0]       max     = 32'h0,
+  output reg  [31:0]       missed  = 32'h0,
+  output reg  [31:0]       updates = 32'h0,
+  // Read port, rclk domain: rdata is the bin word at raddr one rclk later
+  input  wire              rclk,
+  input  wire [BINS_W-3:0] raddr,
+  output reg  [95:0]       rdata
+);
+
+  localparam integer BINS = 1 << BINS_W;
+
+  reg [7:0]  filter   = 8'h00;
+  reg [23:0] origin   = 24'h0;
+  reg [4:0]  shift    = 5'd0;
+  reg [23:0] deadline = 24'h0;
+
+  reg              clearing  = 1'b1;  // Clears from power-up
+  reg [BINS_W-1:0] clear_bin = {BINS_W{1'b0}};
+
+  // Pipeline: interval ready (p1), its bin (p2), its count read (p3), then
+  // written.
+  // Frames are always several clk cycles apart (CS stays high for at least
+  // 3 of them), so a count is written before the next one is read.
+  reg              have_last = 1'b0;
+  reg [31:0]       last_start;
+  reg [31:0]       interval;
+  reg              p1 = 1'b0, p2 = 1'b0, p3 = 1'b0;
+  reg [BINS_W-1:0] bin;
+  reg [23:0]       count_q;
+
+  wire        timed  = frame && (!filter[7] || frame_cmd == filter[6:0]);
+  wire [31:0] scaled = (interval - {8'h0, origin}) >> shift;
+
+  always @(posedge clk) begin
+    p1 <= 1'b0;
+    p2 <= p1;
+    p3 <= p2;
+    if (reset || config_we) begin
+      if (config_we) begin
+        filter   <= config_filter;
+        origin   <= config_origin;
+        shift    <= config_shift;
+        deadline <= config_deadline;
+      end
+      clearing  <= 1'b1;
+      clear_bin <= {BINS_W{1'b0}};
+      have_last <= 1'b0;
+      p2        <= 1'b0;
+      p3        <= 1'b0;
+      min       <= 32'hFFFF_FFFF;
+      max       <= 32'h0;
+      missed    <= 32'h0;
+      updates   <= 32'h0;
+    end else if (clearing) begin
+      clear_bin <= clear_bin + 1'b1;
+      if (clear_bin == BINS - 1)
+        clearing <= 1'b0;
+    end else begin
+      if (timed) begin
+        last_start <= frame_start;
+        have_last  <= 1'b1;
+        interval   <= frame_start - last_start;
+        p1         <= have_last;
+      end
+      if (p1) begin
+        bin <= (interval < {8'h0, origin})  ? {BINS_W{1'b0}} :
+               (scaled >= BINS - 1)         ? {BINS_W{1'b1}} : scaled[BINS_W-1:0];
+        if (interval < min) min <= interval;
+        if (interval > max) max <= interval;
+        if (deadline != 24'h0 && interval > {8'h0, deadline})
+          missed <= missed + 32'd1;
+        updates <= updates + 32'd1;
+      end
+    end
+  end
+
+  // Kept apart from the control logic so that they map onto block RAM
+  reg [23:0] counts [0:BINS-1];
+  reg [95:0] words  [0:BINS/4-1];
+
+  wire              bin_we    = clearing || p3;
+  wire [BINS_W-1:0] bin_waddr = clearing ? clear_bin : bin;
+  wire [23:0]       bin_wdata = clearing ? 24'h0 : (count_q == 24'hFF_FFFF) ? count_q : count_q + 24'd1;
+
+  always @(posedge clk) begin
+    if (bin_we) begin
+      counts[bin_waddr] <= bin_wdata;
+      case (bin_waddr[1:0])
+        2'd0: words[bin_waddr[BINS_W-1:2]][95:72] <= bin_wdata;
+        2'd1: words[bin_waddr[BINS_W-1:2]][71:48] <= bin_wdata;
+        2'd2: words[bin_waddr[BINS_W-1:2]][47:24] <= bin_wdata;
+        2'd3: words[bin_waddr[BINS_W-1:2]][23:0]  <= bin_wdata;
+      endcase
+    end
+  end
+
+  always @(posedge clk)
+    count_q <= counts[bin];
+
+  always @(posedge rclk)
+    rdata <= words[raddr];
+
+endmodule
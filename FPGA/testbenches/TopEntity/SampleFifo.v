@@ -0,0 +1,60 @@
+// SampleFifo.v
+// Ring of timestamped encoder samples in block RAM, written in the clk
+// domain and read by the SPI slave in the SPI clock domain (the iCE40 RAMs
+// have separate read and write clocks). The samples are numbered by a 16-bit
+// index: wr_index is the index the next sample gets, rd_index the oldest one
+// still held. The reader frees samples by moving rd_index forward (free),
+// so a burst that has to be sent again still finds its samples. When the
+// ring is full new samples are dropped and counted in overflows.
+module SampleFifo #(
+  parameter ADDR_W = 8,                   // 2^ADDR_W samples
+  parameter DATA_W = 96
+) (
+  input  wire              clk,
+  input  wire              reset,       // active-high, also empties the ring
+  input  wire              clear,       // empties the ring, clears overflows
+  input  wire              push,        // One-cycle strobe
+  input  wire [DATA_W-1:0] push_data,
+  input  wire              free,        // One-cycle strobe: rd_index <= free_to
+  input  wire [15:0]       free_to,     // ignored outside rd_index..wr_index
+  output reg  [15:0]       wr_index  = 16'd0,
+  output reg  [15:0]       rd_index  = 16'd0,
+  output reg  [7:0]        overflows = 8'd0,  // Dropped samples, wraps
+  // Read port, rclk domain: rdata is the sample at raddr one rclk later
+  input  wire              rclk,
+  input  wire [ADDR_W-1:0] raddr,
+  output reg  [DATA_W-1:0] rdata
+);
+
+  localparam [15:0] DEPTH = 16'd1 << ADDR_W;
+
+  reg [DATA_W-1:0] mem [0:(1 << ADDR_W) - 1];
+
+  wire [15:0] level   = wr_index - rd_index;
+  wire [15:0] free_n  = free_to - rd_index;
+  wire        do_push = push && !reset && !clear && level != DEPTH;
+
+  always @(posedge clk) begin
+    if (reset || clear) begin
+      wr_index  <= 16'd0;
+      rd_index  <= 16'd0;
+      overflows <= 8'd0;
+    end else begin
+      if (free && free_n <= level)
+        rd_index <= free_to;
+      if (do_push)
+        wr_index <= wr_index + 16'd1;
+      else if (push)
+        overflows <= overflows + 8'd1;
+    end
+  end
+
+  // Kept apart from the control logic so that it maps onto block RAM
+  always @(posedge clk)
+    if (do_push)
+      mem[wr_index[ADDR_W-1:0]] <= push_data;
+
+  always @(posedge rclk)
+    rdata <= mem[raddr];
+
+endmodule
@@ -1,8 +1,18 @@
 // TopEntity.v
 module TopEntity #(
-    parameter CLK_FREQ  = 25000000,   // 25 MHz
+    parameter CLK_FREQ  = 25000000,   // 25 MHz board clock
+    parameter USE_PLL   = 0,            // 1: fabric clocked by the PLL below instead of clk
+    parameter PLL_DIVR  = 0,            // PLL settings (icepll -i 25 -o 100): 100 MHz
+    parameter PLL_DIVF  = 31,
+    parameter PLL_DIVQ  = 3,
+    parameter PLL_FILTER = 2,
     parameter PWM_FREQ  = 20000,       // 20 kHz
-    parameter COUNTER_W = 12            // 12-bit duty cycle resolution
+    parameter COUNTER_W = 12,           // 12-bit duty cycle resolution
+    parameter IDLE_US   = 2000,         // No encoder edge for 2 ms: axis reported idle (0x23)
+    parameter VEL_WINDOW_US = 1000,     // Edge counting window of the velocity estimate (0x25)
+    parameter PID_DIV   = 1,            // PWM periods per PID update: 20 kHz
+    parameter NUM_AXES  = 2,            // Encoder/PWM channels, 2..8: pitch, yaw, then further axes
+    parameter FRAME_SYNC_RISING = 1     // Camera frame strobe edge: 1 rising, 0 falling
   )
   (
     input  wire         clk,
@@ -12,37 +22,63 @@ module TopEntity #(
     input  wire         SPI_PICO,       // MOSI
     input  wire         SPI_CS,         // CS (active-low)
     output wire         SPI_POCI,       // MISO
-    // Encoders & PWM signals
-    input  wire         PITCH_ENC_A,
-    input  wire         PITCH_ENC_B,
-    output  wire         PITCH_DIRA,
-    output  wire         PITCH_DIRB,
-    output wire         PITCH_PWM_VAL,
-    input  wire         YAW_ENC_A,
-    input  wire         YAW_ENC_B,
-    output  wire         YAW_DIRA,
-    output  wire         YAW_DIRB,
-    output wire         YAW_PWM_VAL,
+    // Encoders & PWM signals, bit k for axis k: 0 pitch, 1 yaw
+    input  wire [NUM_AXES-1:0] ENC_A,
+    input  wire [NUM_AXES-1:0] ENC_B,
+    output wire [NUM_AXES-1:0] DIRA,
+    output wire [NUM_AXES-1:0] DIRB,
+    output wire [NUM_AXES-1:0] PWM_VAL,
+    input  wire         FRAME_SYNC,     // Camera frame strobe / VSYNC, optional (pulled up)
     output reg          led1 = 1'b0,
     output reg          led2 = 1'b0,
     output reg          led3 = 1'b0
   );
 
-  // 1) Instantiate Encoders and PWM
-  wire [1:0] dir_pitch, dir_yaw;
-  wire signed [31:0] position_pitch, position_yaw;
+  // 0) Fabric clock: clk, or the PLL output when USE_PLL is set, for a finer
+  //    PWM (PERIOD = SYS_FREQ / PWM_FREQ counts; 12 bits need 4096). Every
+  //    count of the SPI protocol (timestamps, sample period, queue times and
+  //    timeout) is then in SYS_FREQ cycles: the Pi is built with FPGA_CLK_HZ
+  //    set to SYS_FREQ. The logic is held in reset until the PLL locks.
+  localparam integer SYS_FREQ = USE_PLL ? CLK_FREQ / (PLL_DIVR + 1) * (PLL_DIVF + 1) / (1 << PLL_DIVQ) : CLK_FREQ;
+  wire sys_clk, pll_lock;
 
-  QuadratureEncoder pitch_encoder (
-    .clk(clk), .reset(btn1),
-    .ENCA_raw(PITCH_ENC_A), .ENCB_raw(PITCH_ENC_B),
-    .DIR(dir_pitch), .position(position_pitch)
-  );
+  generate
+    if (USE_PLL) begin : pll
+      SB_PLL40_CORE #(
+        .FEEDBACK_PATH("SIMPLE"),
+        .DIVR(PLL_DIVR), .DIVF(PLL_DIVF), .DIVQ(PLL_DIVQ),
+        .FILTER_RANGE(PLL_FILTER)
+      ) core (
+        .REFERENCECLK(clk), .PLLOUTGLOBAL(sys_clk), .LOCK(pll_lock),
+        .RESETB(1'b1), .BYPASS(1'b0)
+      );
+    end else begin : pll
+      assign sys_clk = clk, pll_lock = 1'b1;
+    end
+  endgenerate
 
-  QuadratureEncoder yaw_encoder (
-    .clk(clk), .reset(btn1),
-    .ENCA_raw(YAW_ENC_A), .ENCB_raw(YAW_ENC_B),
-    .DIR(dir_yaw), .position(position_yaw)
-  );
+  wire reset = btn1 | ~pll_lock;
+
+  // 1) Encoder and PWM channel of each axis. Axes 0 and 1 are pitch and
+  //    yaw, which the position loops and the PWM queue below also drive;
+  //    the further ones are only driven by the indexed PWM writes (0x13).
+  //    All positions are read together by 0x24.
+  wire [32*NUM_AXES-1:0] positions;
+  wire [2*NUM_AXES-1:0]  dirs;
+  wire [32*NUM_AXES-1:0] periods;
+  wire [16*NUM_AXES-1:0] windows;
+  wire [NUM_AXES-1:0]    cycle_ends;
+
+  wire [1:0] dir_pitch = dirs[1:0], dir_yaw = dirs[3:2];
+  wire signed [31:0] position_pitch = positions[31:0], position_yaw = positions[63:32];
+  wire signed [31:0] period_pitch = periods[31:0], period_yaw = periods[63:32];
+  wire signed [15:0] window_pitch = windows[15:0], window_yaw = windows[31:16];
+  wire pitch_cycle_end = cycle_ends[0], yaw_cycle_end = cycle_ends[1];
+
+  // Idle threshold shortened from the 10 ms default, so that homing sees a
+  // stall within a few ms
+  localparam integer IDLE_CYCLES = (SYS_FREQ / 1000000) * IDLE_US;
+  localparam integer VEL_WINDOW  = (SYS_FREQ / 1000000) * VEL_WINDOW_US;
 
   reg                  enable_pitch      = 1'b0;
   reg                  direction_pitch   = 1'b0;
@@ -52,173 +88,308 @@ module TopEntity #(
   reg                  direction_yaw     = 1'b0;
   reg [COUNTER_W-1:0]  duty_cycle_yaw    = {COUNTER_W{1'b0}};
 
-  PWM #(
-    .CLK_FREQ(CLK_FREQ), .PWM_FREQ(PWM_FREQ), .COUNTER_W(COUNTER_W)
-  ) pitch_pwm (
-    .clk(clk), .reset(btn1),
-    .enable(enable_pitch),
-    .duty_cycle(duty_cycle_pitch),
-    .direction(direction_pitch),
-    .ina(PITCH_DIRA), .inb(PITCH_DIRB),
-    .pwm_out(PITCH_PWM_VAL)
-  );
+  wire [NUM_AXES-1:0]    axis_we;     // 0x13 writes of the axes from 2 on
+  wire [16*NUM_AXES-1:0] axis_words;
+
+  genvar i;
+  generate
+    for (i = 0; i < NUM_AXES; i = i + 1) begin : axis
+      wire                 enable, direction;
+      wire [COUNTER_W-1:0] duty_cycle;
+
+      if (i == 0) begin : drive
+        assign enable = enable_pitch, direction = direction_pitch, duty_cycle = duty_cycle_pitch;
+      end else if (i == 1) begin : drive
+        assign enable = enable_yaw, direction = direction_yaw, duty_cycle = duty_cycle_yaw;
+      end else begin : drive
+        reg                 enable_r    = 1'b0;
+        reg                 direction_r = 1'b0;
+        reg [COUNTER_W-1:0] duty_r      = {COUNTER_W{1'b0}};
+        always @(posedge sys_clk) begin
+          if (axis_we[i]) begin
+            enable_r    <= axis_words[16*i + 15];
+            direction_r <= axis_words[16*i + 14];
+            duty_r      <= {axis_words[16*i + 10 +: 4], axis_words[16*i +: 8]};
+          end
+        end
+        assign enable = enable_r, direction = direction_r, duty_cycle = duty_r;
+      end
+
+      QuadratureEncoder #(
+        .CLK_FREQ(SYS_FREQ), .NO_MOVEMENT_THRESHOLD(IDLE_CYCLES), .VEL_WINDOW(VEL_WINDOW)
+      ) encoder (
+        .clk(sys_clk), .reset(reset),
+        .ENCA_raw(ENC_A[i]), .ENCB_raw(ENC_B[i]),
+        .DIR(dirs[2*i +: 2]), .position(positions[32*i +: 32]),
+        .period(periods[32*i +: 32]), .window_count(windows[16*i +: 16])
+      );
 
-  PWM #(
-    .CLK_FREQ(CLK_FREQ), .PWM_FREQ(PWM_FREQ), .COUNTER_W(COUNTER_W)
-  ) yaw_pwm (
-    .clk(clk), .reset(btn1),
-    .enable(enable_yaw),
-    .duty_cycle(duty_cycle_yaw),
-    .direction(direction_yaw),
-    .ina(YAW_DIRA), .inb(YAW_DIRB),
-    .pwm_out(YAW_PWM_VAL)
+      PWM #(
+        .CLK_FREQ(SYS_FREQ), .PWM_FREQ(PWM_FREQ), .COUNTER_W(COUNTER_W)
+      ) pwm (
+        .clk(sys_clk), .reset(reset),
+        .enable(enable),
+        .duty_cycle(duty_cycle),
+        .direction(direction),
+        .ina(DIRA[i]), .inb(DIRB[i]),
+        .pwm_out(PWM_VAL[i]),
+        .cycle_end(cycle_ends[i])
+      );
+    end
+  endgenerate
+
+
+  // Free-running sys_clk cycle count, the SPI slave latches it together with
+  // the positions so that the Pi gets the exact sample times (wraps after
+  // 171 s at 25 MHz, 43 s at 100 MHz)
+  reg [31:0] timestamp = 32'd0;
+  always @(posedge sys_clk)
+    timestamp <= timestamp + 32'd1;
+
+  // 2) SPI slave, clocked by SPI_CLK. The PWM words it receives come back
+  //    into the clk domain as one-cycle strobes.
+  wire        pitch_we, yaw_we;
+  wire [15:0] pitch_word, yaw_word;
+  wire         gains_we, gains_axis, setpoint_we;
+  wire [143:0] gains;
+  wire [63:0]  setpoints;
+  wire [1:0]   pid_enable;
+  wire         sampler_we, samples_free;
+  wire [23:0]  sampler_period;
+  wire [15:0]  samples_free_to, sample_index;
+  wire [7:0]   sample_overflows, sample_raddr;
+  wire [95:0]  sample_rdata, frame_rdata;
+  wire [15:0]  frame_index;
+  wire         queue_config_we, queue_brake, queue_commit, queue_we, queue_brake_on;
+  wire [23:0]  queue_timeout_cfg, queue_timeout;
+  wire [15:0]  queue_commit_to, queue_wr_index, queue_rd_index;
+  wire [7:0]   queue_underruns, queue_waddr;
+  wire [63:0]  queue_wdata;
+  wire         cmd_done, hist_we;
+  wire [6:0]   cmd_op;
+  wire [31:0]  cmd_start;
+  wire [7:0]   hist_filter;
+  wire [23:0]  hist_origin, hist_deadline;
+  wire [4:0]   hist_shift;
+  wire [127:0] hist_stats;
+  wire [95:0]  hist_rdata;
+
+  SpiSlave #(
+    .NUM_AXES(NUM_AXES)
+  ) spi (
+    .clk(sys_clk),
+    .SPI_CLK(SPI_CLK), .SPI_PICO(SPI_PICO), .SPI_CS(SPI_CS), .SPI_POCI(SPI_POCI),
+    .positions(positions),
+    // encoder DIR codes (01 = counting up, 11 = counting down, 00 = idle)
+    .motion({2'b00, dir_yaw, 2'b00, dir_pitch}),
+    .pwm_status({enable_pitch, direction_pitch, duty_cycle_pitch[11:8], /* don't care */ 2'b00, duty_cycle_pitch[7:0],
+                 enable_yaw, direction_yaw, duty_cycle_yaw[11:8], /* don't care */ 2'b00, duty_cycle_yaw[7:0]}),
+    .timestamp(timestamp),
+    .velocity({period_pitch, period_yaw, window_pitch, window_yaw}),
+    .sample_index(sample_index), .sample_overflows(sample_overflows),
+    .sample_raddr(sample_raddr), .sample_rdata(sample_rdata),
+    .frame_index(frame_index), .frame_rdata(frame_rdata),
+    .hist_stats(hist_stats), .hist_rdata(hist_rdata),
+    .queue_wr_index(queue_wr_index), .queue_rd_index(queue_rd_index), .queue_underruns(queue_underruns),
+    .queue_brake_on(queue_brake_on), .queue_timeout(queue_timeout),
+    .queue_we(queue_we), .queue_waddr(queue_waddr), .queue_wdata(queue_wdata),
+    .pitch_we(pitch_we), .yaw_we(yaw_we),
+    .pitch_word(pitch_word), .yaw_word(yaw_word),
+    .axis_we(axis_we), .axis_words(axis_words),
+    .gains_we(gains_we), .gains_axis(gains_axis), .gains(gains),
+    .setpoint_we(setpoint_we), .setpoints(setpoints), .pid_enable(pid_enable),
+    .sampler_we(sampler_we), .sampler_period(sampler_period),
+    .samples_free(samples_free), .samples_free_to(samples_free_to),
+    .queue_config_we(queue_config_we), .queue_brake(queue_brake), .queue_timeout_cfg(queue_timeout_cfg),
+    .queue_commit(queue_commit), .queue_commit_to(queue_commit_to),
+    .cmd_done(cmd_done), .cmd_op(cmd_op), .cmd_start(cmd_start),
+    .hist_we(hist_we), .hist_filter(hist_filter), .hist_origin(hist_origin),
+    .hist_shift(hist_shift), .hist_deadline(hist_deadline)
   );
 
+  //    Interval histogram: the sys_clk cycles between the starts of
+  //    consecutive frames (of one command, or all), binned on chip with
+  //    min, max and a missed-deadline count, so that the Pi loop cadence is
+  //    measured from outside the Pi. Set up (and cleared) by registers
+  //    0x1E/0x1F, read by 0x65 bursts through the sample read address.
+  IntervalHistogram #(
+    .BINS_W(6)
+  ) intervals (
+    .clk(sys_clk), .reset(reset),
+    .config_we(hist_we), .config_filter(hist_filter), .config_origin(hist_origin),
+    .config_shift(hist_shift), .config_deadline(hist_deadline),
+    .frame(cmd_done), .frame_cmd(cmd_op), .frame_start(cmd_start),
+    .min(hist_stats[127:96]), .max(hist_stats[95:64]), .missed(hist_stats[63:32]), .updates(hist_stats[31:0]),
+    .rclk(SPI_CLK), .raddr(sample_raddr[3:0]), .rdata(hist_rdata)
+  );
 
-  // 2) SPI Slave Mechanism (single‐CS reads) – unified into one block
-  // edge detectors
-  reg [2:0] SPI_CLKr, SPI_CSr;
-  always @(posedge clk) begin
-    SPI_CLKr <= {SPI_CLKr[1:0], SPI_CLK};
-    SPI_CSr  <= {SPI_CSr[1:0], SPI_CS};
+  // 3) Sampler: both positions and their timestamp are stored every
+  //    sample_period clk cycles (0x61, 0: stopped), independently of the
+  //    SPI traffic, and read by the Pi in bursts (0x60). Setting the period
+  //    empties the ring.
+  reg [23:0] sample_period = 24'd0;
+  reg [23:0] sample_cnt    = 24'd0;
+  reg        sample_push   = 1'b0;
+  always @(posedge sys_clk) begin
+    sample_push <= 1'b0;
+    if (reset) begin
+      sample_period <= 24'd0;
+      sample_cnt    <= 24'd0;
+    end else if (sampler_we) begin
+      sample_period <= sampler_period;
+      sample_cnt    <= 24'd0;
+    end else if (sample_period != 24'd0) begin
+      if (sample_cnt == sample_period - 24'd1) begin
+        sample_cnt  <= 24'd0;
+        sample_push <= 1'b1;
+      end else begin
+        sample_cnt  <= sample_cnt + 24'd1;
+      end
+    end
   end
-  wire SPI_CLK_risingedge  = (SPI_CLKr[2:1] == 2'b01);
-  wire SPI_CLK_fallingedge = (SPI_CLKr[2:1] == 2'b10);
-  wire SPI_CS_active       = ~SPI_CSr[1];            // low = active
-  wire SPI_CS_startmessage = (SPI_CSr[2:1] == 2'b10);
-  wire SPI_CS_endmessage   = (SPI_CSr[2:1] == 2'b01);
-
-  // synchronize MOSI avoiding metastability issues
-  reg [1:0] SPI_PICOr;
-  always @(posedge clk)
-    SPI_PICOr <= {SPI_PICOr[0], SPI_PICO};
-  wire SPI_PICO_data = SPI_PICOr[1];
-
-  // buffers & counters
-  localparam integer MAX_BYTES = 10;
-  reg [7:0] rx_buf[0:MAX_BYTES-1], tx_buf[0:MAX_BYTES-1];
-  reg [2:0]  bit_cnt   = 3'b000;   // 0..7
-  reg [3:0]  byte_cnt  = 4'h0;     // 0..MAX_BYTES-1
-  reg [7:0] rx_shift, tx_shift;
-
-  assign SPI_POCI = tx_shift[7];
-
-  // unified SPI handling
-  always @(posedge clk) begin
-    // end‐of‐transaction: handle writes
-    if (SPI_CS_endmessage) begin
-      case (rx_buf[0])
-        8'h10: begin
-          led2 <= 1'b1; // indicate we received a write command
-          enable_pitch     <= rx_buf[2][7];
-          direction_pitch  <= rx_buf[2][6];
-          duty_cycle_pitch <= {rx_buf[2][5:2], rx_buf[1]};
-        end
-        8'h11: begin
-          led1 <= 1'b1; // indicate we received a write command
-          enable_yaw       <= rx_buf[2][7];
-          direction_yaw    <= rx_buf[2][6];
-          duty_cycle_yaw   <= {rx_buf[2][5:2], rx_buf[1]};
-        end
-        8'h12: begin
-          led1 <= 1'b1; // indicate we received a write command
-          enable_pitch     <= rx_buf[2][7];
-          direction_pitch  <= rx_buf[2][6];
-          duty_cycle_pitch <= {rx_buf[2][5:2], rx_buf[1]};
-          enable_yaw       <= rx_buf[4][7];
-          direction_yaw    <= rx_buf[4][6];
-          duty_cycle_yaw   <= {rx_buf[4][5:2], rx_buf[3]};
-        end
-        default: ; // read‐only commands already handled
-      endcase
-      byte_cnt <= 4'h0;
+
+  SampleFifo #(
+    .ADDR_W(8), .DATA_W(96)
+  ) samples (
+    .clk(sys_clk), .reset(reset), .clear(sampler_we),
+    .push(sample_push), .push_data({position_pitch, position_yaw, timestamp}),
+    .free(samples_free), .free_to(samples_free_to),
+    .wr_index(sample_index), .rd_index(), .overflows(sample_overflows),
+    .rclk(SPI_CLK), .raddr(sample_raddr), .rdata(sample_rdata)
+  );
+
+  //    Frame sync: both positions and their timestamp are also stored on
+  //    each camera frame strobe, into a 16-frame ring read by 0x64 bursts
+  //    through the same read address, so that the vision result of a
+  //    frame is paired with the pose at its exposure.
+  FrameSync #(
+    .ADDR_W(4), .DATA_W(96), .RISING(FRAME_SYNC_RISING)
+  ) frames (
+    .clk(sys_clk), .reset(reset),
+    .strobe_raw(FRAME_SYNC), .data({position_pitch, position_yaw, timestamp}),
+    .index(frame_index),
+    .rclk(SPI_CLK), .raddr(sample_raddr[3:0]), .rdata(frame_rdata)
+  );
+
+  // 4) PWM queue: timestamped PWM words (0x63) played back at the end of
+  //    the PWM periods, as 0x12 writes; set up by 0x62. The pitch PWM
+  //    counts its periods while braked, so the queue also plays from a
+  //    disabled axis, after a zero-duty entry and after an underrun.
+  wire        queue_apply, queue_underrun_brake;
+  wire [15:0] queue_pitch_word, queue_yaw_word;
+
+  PwmQueue #(
+    .ADDR_W(8)
+  ) pwm_queue (
+    .clk(sys_clk), .reset(reset),
+    .config_we(queue_config_we), .config_brake(queue_brake), .config_timeout(queue_timeout_cfg),
+    .commit(queue_commit), .commit_to(queue_commit_to),
+    .tick(pitch_cycle_end), .timestamp(timestamp),
+    .wr_index(queue_wr_index), .rd_index(queue_rd_index), .underruns(queue_underruns),
+    .brake_on(queue_brake_on), .timeout(queue_timeout),
+    .apply(queue_apply), .pitch_word(queue_pitch_word), .yaw_word(queue_yaw_word),
+    .brake(queue_underrun_brake),
+    .wclk(SPI_CLK), .we(queue_we), .waddr(queue_waddr), .wdata(queue_wdata)
+  );
+
+  // PWM words from the SPI slave, or else from the queue
+  wire        pitch_write      = pitch_we | queue_apply;
+  wire        yaw_write        = yaw_we | queue_apply;
+  wire [15:0] pitch_write_word = pitch_we ? pitch_word : queue_pitch_word;
+  wire [15:0] yaw_write_word   = yaw_we ? yaw_word : queue_yaw_word;
+
+  // 5) Position loops closed in the FPGA, enabled per axis by 0x52. Each
+  //    updates once every PID_DIV periods of its PWM and drives its duty
+  //    cycle and direction; a PWM write (0x10/0x11/0x12/0x40, or a queued
+  //    one) takes the axis back. The gains are {a, b, c, d, limit} as PID.v
+  //    takes them.
+  reg  [143:0]        gains_pitch    = 144'h0, gains_yaw = 144'h0;
+  reg  signed [31:0]  setpoint_pitch = 32'sd0, setpoint_yaw = 32'sd0;
+  reg                 pid_on_pitch   = 1'b0,   pid_on_yaw = 1'b0;
+  wire [COUNTER_W-1:0] pid_duty_pitch, pid_duty_yaw;
+  wire                pid_dir_pitch, pid_dir_yaw, pid_valid_pitch, pid_valid_yaw;
+
+  PID #(
+    .COUNTER_W(COUNTER_W), .SAMPLE_DIV(PID_DIV)
+  ) pitch_pid (
+    .clk(sys_clk), .reset(reset), .enable(pid_on_pitch), .sample(pitch_cycle_end),
+    .position(position_pitch), .setpoint(setpoint_pitch),
+    .coef_a(gains_pitch[143:112]), .coef_b(gains_pitch[111:80]), .coef_c(gains_pitch[79:48]),
+    .coef_d(gains_pitch[47:16]), .limit(gains_pitch[COUNTER_W-1:0]),
+    .duty(pid_duty_pitch), .direction(pid_dir_pitch), .valid(pid_valid_pitch)
+  );
+
+  PID #(
+    .COUNTER_W(COUNTER_W), .SAMPLE_DIV(PID_DIV)
+  ) yaw_pid (
+    .clk(sys_clk), .reset(reset), .enable(pid_on_yaw), .sample(yaw_cycle_end),
+    .position(position_yaw), .setpoint(setpoint_yaw),
+    .coef_a(gains_yaw[143:112]), .coef_b(gains_yaw[111:80]), .coef_c(gains_yaw[79:48]),
+    .coef_d(gains_yaw[47:16]), .limit(gains_yaw[COUNTER_W-1:0]),
+    .duty(pid_duty_yaw), .direction(pid_dir_yaw), .valid(pid_valid_yaw)
+  );
+
+  always @(posedge sys_clk) begin
+    if (pid_valid_pitch) begin
+      duty_cycle_pitch <= pid_duty_pitch;
+      direction_pitch  <= pid_dir_pitch;
+    end
+    if (pid_valid_yaw) begin
+      duty_cycle_yaw   <= pid_duty_yaw;
+      direction_yaw    <= pid_dir_yaw;
     end
 
-    if (~SPI_CS_active) begin
-      // Reset on CS deassert
-      bit_cnt   <= 3'b000;
-      byte_cnt  <= 4'h0;
-      rx_shift  <= 8'h00;
-      tx_shift  <= 8'h00;
-    end else begin
-      // Clear LEDs at start of a new transaction
-      if (SPI_CS_startmessage) begin
-        tx_buf[0] <= 8'h01; // send dummy byte first
+    if (gains_we) begin
+      if (gains_axis) gains_yaw   <= gains;
+      else            gains_pitch <= gains;
+    end
+    if (setpoint_we) begin
+      setpoint_pitch <= setpoints[63:32];
+      setpoint_yaw   <= setpoints[31:0];
+      pid_on_pitch   <= pid_enable[0];
+      pid_on_yaw     <= pid_enable[1];
+      // Switched on: PWM running from 0 until the first update. Switched off: brake.
+      if (pid_enable[0] != pid_on_pitch) begin
+        enable_pitch     <= pid_enable[0];
+        duty_cycle_pitch <= {COUNTER_W{1'b0}};
       end
-
-      // SHIFT IN received data on rising edge
-      if (SPI_CLK_risingedge) begin
-        bit_cnt  <= bit_cnt + 1;
-        rx_shift <= {rx_shift[6:0], SPI_PICO_data};
-
-        if (bit_cnt == 3'b111) begin
-          // got a full byte
-          rx_buf[byte_cnt] <= {rx_shift[6:0], SPI_PICO_data};
-          byte_cnt         <= byte_cnt + 1;
-
-          // decode first byte immediately
-          if (byte_cnt == 4'h0) begin
-            // load tx_buf with data in case of read commands
-            case ({rx_shift[6:0], SPI_PICO_data})
-              8'h20: begin
-                tx_buf[1] <= position_pitch[31:24];
-                tx_buf[2] <= position_pitch[23:16];
-                tx_buf[3] <= position_pitch[15: 8];
-                tx_buf[4] <= position_pitch[ 7: 0];
-              end
-              8'h21: begin
-                tx_buf[1] <= position_yaw[31:24];
-                tx_buf[2] <= position_yaw[23:16];
-                tx_buf[3] <= position_yaw[15: 8];
-                tx_buf[4] <= position_yaw[ 7: 0];
-              end
-              8'h22: begin
-                tx_buf[1]  <= position_pitch[31:24];
-                tx_buf[2]  <= position_pitch[23:16];
-                tx_buf[3]  <= position_pitch[15: 8];
-                tx_buf[4]  <= position_pitch[ 7: 0];
-                tx_buf[5]  <= position_yaw[31:24];
-                tx_buf[6]  <= position_yaw[23:16];
-                tx_buf[7]  <= position_yaw[15: 8];
-                tx_buf[8]  <= position_yaw[ 7: 0];
-              end
-              8'h30: begin
-                tx_buf[1]  <= {enable_pitch, direction_pitch, duty_cycle_pitch[11:8], /* don't care */ 2'b00};
-                tx_buf[2]  <= duty_cycle_pitch[7:0];
-                tx_buf[3]  <= {enable_yaw, direction_yaw, duty_cycle_yaw[11:8], /* don't care */ 2'b00};
-                tx_buf[4]  <= duty_cycle_yaw[7:0];
-              end
-              default: begin
-                // no‐care defaults
-                tx_buf[1] <= 8'h00;
-                tx_buf[2] <= 8'h00;
-                tx_buf[3] <= 8'h00;
-                tx_buf[4] <= 8'h00;
-              end
-            endcase
-          end
-        end
+      if (pid_enable[1] != pid_on_yaw) begin
+        enable_yaw       <= pid_enable[1];
+        duty_cycle_yaw   <= {COUNTER_W{1'b0}};
       end
+    end
 
-      // SHIFT OUT tx buffer on falling edge
-      if (SPI_CLK_fallingedge) begin
-        if (bit_cnt == 3'b000)
-          tx_shift <= tx_buf[byte_cnt];
-        else
-          tx_shift <= {tx_shift[6:0], 1'b0};
-      end
+    if (queue_underrun_brake) begin
+      enable_pitch     <= 1'b0;
+      enable_yaw       <= 1'b0;
+    end
+
+    if (pitch_write) begin
+      pid_on_pitch     <= 1'b0;
+      if (~yaw_write)
+        led2 <= 1'b1; // indicate we received a pitch write command
+      enable_pitch     <= pitch_write_word[15];
+      direction_pitch  <= pitch_write_word[14];
+      duty_cycle_pitch <= {pitch_write_word[13:10], pitch_write_word[7:0]};
+    end
+    if (yaw_write) begin
+      pid_on_yaw       <= 1'b0;
+      led1 <= 1'b1; // indicate we received a write command
+      enable_yaw       <= yaw_write_word[15];
+      direction_yaw    <= yaw_write_word[14];
+      duty_cycle_yaw   <= {yaw_write_word[13:10], yaw_write_word[7:0]};
     end
   end
 
-  // 3) led3: blink to show core is alive
+  // 6) led3: blink to show core is alive
   reg [31:0] led3_counter = 32'd0;
-  always @(posedge clk) begin
-    if (btn1) begin
+  always @(posedge sys_clk) begin
+    if (reset) begin
       led3_counter <= 0;
       led3         <= 0;
     end else begin
       led3_counter <= led3_counter + 1;
-      if (led3_counter >= CLK_FREQ) begin
+      if (led3_counter >= SYS_FREQ) begin
         led3         <= ~led3;
         led3_counter <= 0;
       end
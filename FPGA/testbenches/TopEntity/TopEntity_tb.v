@@ -6,10 +6,13 @@ module TopEntity_tb;
     parameter CLK_FREQ  = 25000000;
     parameter PWM_FREQ  = 20000;
     parameter COUNTER_W = 12;
+    parameter IDLE_US   = 20;   // Short idle time to keep the simulation fast
+    parameter VEL_WINDOW_US = 20; // 500-cycle velocity window
+    parameter SPI_FREQ  = 25000000; // e.g. iverilog -P TopEntity_tb.SPI_FREQ=30000000
 
     // Simulation timing constants
     localparam CLK_PERIOD_NS     = 1000000000/CLK_FREQ; // 25 MHz FPGA clock
-    localparam SPI_CLK_PERIOD_NS = 400; // 25 MHz SPI clock
+    localparam real SPI_CLK_PERIOD_NS = 1.0e9 / SPI_FREQ;
 
     // DUT I/O
     reg clk = 0;
@@ -21,6 +24,7 @@ module TopEntity_tb;
     reg PITCH_ENC_B;
     reg YAW_ENC_A;
     reg YAW_ENC_B;
+    reg FRAME_SYNC;
     wire SPI_POCI;
     wire PITCH_DIRA, PITCH_DIRB, PITCH_PWM_VAL;
     wire YAW_DIRA, YAW_DIRB, YAW_PWM_VAL;
@@ -30,13 +34,15 @@ module TopEntity_tb;
     TopEntity #(
         .CLK_FREQ(CLK_FREQ),
         .PWM_FREQ(PWM_FREQ),
-        .COUNTER_W(COUNTER_W)
+        .COUNTER_W(COUNTER_W),
+        .IDLE_US(IDLE_US),
+        .VEL_WINDOW_US(VEL_WINDOW_US)
     ) dut (
         .clk(clk), .btn1(btn1), .SPI_CLK(SPI_CLK), .SPI_PICO(SPI_PICO),
-        .SPI_CS(SPI_CS), .SPI_POCI(SPI_POCI), .PITCH_ENC_A(PITCH_ENC_A),
-        .PITCH_ENC_B(PITCH_ENC_B), .PITCH_DIRA(PITCH_DIRA), .PITCH_DIRB(PITCH_DIRB),
-        .PITCH_PWM_VAL(PITCH_PWM_VAL), .YAW_ENC_A(YAW_ENC_A), .YAW_ENC_B(YAW_ENC_B),
-        .YAW_DIRA(YAW_DIRA), .YAW_DIRB(YAW_DIRB), .YAW_PWM_VAL(YAW_PWM_VAL),
+        .SPI_CS(SPI_CS), .SPI_POCI(SPI_POCI),
+        .ENC_A({YAW_ENC_A, PITCH_ENC_A}), .ENC_B({YAW_ENC_B, PITCH_ENC_B}),
+        .DIRA({YAW_DIRA, PITCH_DIRA}), .DIRB({YAW_DIRB, PITCH_DIRB}),
+        .PWM_VAL({YAW_PWM_VAL, PITCH_PWM_VAL}), .FRAME_SYNC(FRAME_SYNC),
         .led1(led1), .led2(led2), .led3(led3)
     );
 
@@ -46,12 +52,32 @@ module TopEntity_tb;
     end
     
     // Testbench variables for SPI and results
-    reg [7:0] tb_tx_packet [0:8];
-    reg [7:0] tb_rx_packet [0:8];
+    reg [7:0] tb_tx_packet [0:31];
+    reg [7:0] tb_rx_packet [0:31];
     integer received_pitch;
     integer received_yaw;
     integer i;
     integer k;
+    reg [7:0] crc;
+    reg [31:0] stamp;
+    time cs_fall_time, first_read_time;
+    integer expected_cycles;
+
+    // CRC-8 of packet bytes [first, last], as TopEntity computes it
+    function [7:0] packet_crc;
+        input integer from_rx;
+        input integer first;
+        input integer last;
+        integer n, b;
+        begin
+            packet_crc = 8'hFF;
+            for (n = first; n <= last; n = n + 1) begin
+                packet_crc = packet_crc ^ (from_rx ? tb_rx_packet[n] : tb_tx_packet[n]);
+                for (b = 0; b < 8; b = b + 1)
+                    packet_crc = packet_crc[7] ? ({packet_crc[6:0], 1'b0} ^ 8'h07) : {packet_crc[6:0], 1'b0};
+            end
+        end
+    endfunction
 
     // SPI Master transaction task
     task spi_transaction;
@@ -61,6 +87,7 @@ module TopEntity_tb;
         begin
             // Assert CS low to start transaction
             SPI_CS <= 1'b0; 
+            cs_fall_time = $time;
             SPI_CLK <= 1'b0;
             #(SPI_CLK_PERIOD_NS); 
             for (i = 0; i < num_bytes; i = i + 1) begin
@@ -100,6 +127,7 @@ module TopEntity_tb;
         SPI_CS = 1'b1; SPI_PICO = 1'b0;
         PITCH_ENC_A = 1'b0; PITCH_ENC_B = 1'b0;
         YAW_ENC_A = 1'b0; YAW_ENC_B = 1'b0;
+        FRAME_SYNC = 1'b0;
         #(CLK_PERIOD_NS * 20);
         btn1 = 1'b0;
         #(CLK_PERIOD_NS * 20);
@@ -155,6 +183,327 @@ module TopEntity_tb;
                 (123*4), (-456*4), received_pitch, received_yaw);
         end
 
+        // Test 3: Movement status, yaw moving while pitch is idle
+        $display("TEST 3: Read Positions and Movement Status");
+        for (i = 0; i < 10; i = i + 1) begin
+            {YAW_ENC_A, YAW_ENC_B} <= 2'b01; #(CLK_PERIOD_NS * 10);
+            {YAW_ENC_A, YAW_ENC_B} <= 2'b11; #(CLK_PERIOD_NS * 10);
+            {YAW_ENC_A, YAW_ENC_B} <= 2'b10; #(CLK_PERIOD_NS * 10);
+            {YAW_ENC_A, YAW_ENC_B} <= 2'b00; #(CLK_PERIOD_NS * 10);
+        end
+
+        for (k = 1; k < 10; k = k + 1) tb_tx_packet[k] = 8'h00;
+        tb_tx_packet[0] = 8'h23; // Read Positions and Movement Status
+        spi_transaction(10);
+
+        received_yaw = $signed({tb_rx_packet[5], tb_rx_packet[6], tb_rx_packet[7], tb_rx_packet[8]});
+        if (tb_rx_packet[9] == {2'b00, 2'b11, 2'b00, 2'b00} && received_yaw == (-466 * 4))
+            $display("PASSED: Yaw reported counting down, pitch idle.");
+        else
+            $display("FAILED: Movement status mismatch. Got %b, yaw %d", tb_rx_packet[9], received_yaw);
+
+        // Once IDLE_US has passed without an edge, both axes report idle
+        #(IDLE_US * 1000 + CLK_PERIOD_NS * 100);
+        {PITCH_ENC_A, PITCH_ENC_B} <= 2'b10; #(CLK_PERIOD_NS * 10);
+        spi_transaction(10);
+
+        if (tb_rx_packet[9] == {2'b00, 2'b00, 2'b00, 2'b01})
+            $display("PASSED: Yaw idle after IDLE_US, pitch counting up.");
+        else
+            $display("FAILED: Idle status mismatch. Got %b", tb_rx_packet[9]);
+
+        #(IDLE_US * 1000 + CLK_PERIOD_NS * 100);
+        spi_transaction(10);
+
+        if (tb_rx_packet[9] == 8'h00)
+            $display("PASSED: Both axes idle.");
+        else
+            $display("FAILED: Expected both axes idle. Got %b", tb_rx_packet[9]);
+
+        // Test 4: Positions read and PWM written in the same transaction
+        $display("TEST 4: Combined Read Positions and Write PWM");
+        for (k = 0; k < 10; k = k + 1) tb_tx_packet[k] = 8'h00;
+        tb_tx_packet[0] = 8'h40;
+        tb_tx_packet[1] = 8'h34; tb_tx_packet[2] = 8'hC8; // Pitch: duty=0x234, en=1, dir=1
+        tb_tx_packet[3] = 8'hFF; tb_tx_packet[4] = 8'h8C; // Yaw:   duty=0x3FF, en=1, dir=0
+        spi_transaction(9);
+
+        received_pitch = $signed({tb_rx_packet[1], tb_rx_packet[2], tb_rx_packet[3], tb_rx_packet[4]});
+        received_yaw   = $signed({tb_rx_packet[5], tb_rx_packet[6], tb_rx_packet[7], tb_rx_packet[8]});
+        if (received_pitch == (123 * 4 + 1) && received_yaw == (-466 * 4))
+            $display("PASSED: Positions returned by the combined transaction.");
+        else
+            $display("FAILED: Combined transaction positions. Got P:%d Y:%d", received_pitch, received_yaw);
+
+        tb_tx_packet[0] = 8'h30; // Check PWM Status
+        spi_transaction(5);
+
+        if ({tb_rx_packet[1], tb_rx_packet[2]} == {8'hC8, 8'h34} && {tb_rx_packet[3], tb_rx_packet[4]} == {8'h8C, 8'hFF})
+            $display("PASSED: PWM applied at the end of the combined transaction.");
+        else
+            $display("FAILED: PWM Status mismatch after the combined transaction.");
+
+        // Test 5: Checked frames, sequence byte and CRC-8 on both directions
+        $display("TEST 5: Checked Frames");
+        for (k = 0; k < 16; k = k + 1) tb_tx_packet[k] = 8'h00;
+        tb_tx_packet[0] = 8'hA2; // Read All Positions (with the timestamp), checked
+        tb_tx_packet[13] = 8'h5C; // Sequence
+        tb_tx_packet[14] = packet_crc(0, 0, 13);
+        spi_transaction(16);
+
+        received_pitch = $signed({tb_rx_packet[1], tb_rx_packet[2], tb_rx_packet[3], tb_rx_packet[4]});
+        received_yaw   = $signed({tb_rx_packet[5], tb_rx_packet[6], tb_rx_packet[7], tb_rx_packet[8]});
+        if (received_pitch == (123 * 4 + 1) && received_yaw == (-466 * 4) && tb_rx_packet[13] == 8'h00 &&
+            tb_rx_packet[14] == packet_crc(1, 1, 13) && tb_rx_packet[15] == 8'h5C)
+            $display("PASSED: Checked read returns the positions, a valid CRC and the sequence ack.");
+        else
+            $display("FAILED: Checked read. Got P:%d Y:%d errors %h CRC %h ack %h", received_pitch, received_yaw,
+                tb_rx_packet[13], tb_rx_packet[14], tb_rx_packet[15]);
+
+        // Corrupted write: rejected, nacked with the complement of the sequence
+        for (k = 0; k < 16; k = k + 1) tb_tx_packet[k] = 8'h00;
+        tb_tx_packet[0] = 8'h92; // Write All PWM, checked
+        tb_tx_packet[1] = 8'h00; tb_tx_packet[2] = 8'hA0;
+        tb_tx_packet[3] = 8'h00; tb_tx_packet[4] = 8'hD0;
+        tb_tx_packet[5] = 8'h11; // Sequence
+        crc = packet_crc(0, 0, 5);
+        tb_tx_packet[6] = ~crc;
+        spi_transaction(8);
+
+        if (tb_rx_packet[7] == 8'hEE)
+            $display("PASSED: Corrupted write nacked.");
+        else
+            $display("FAILED: Corrupted write ack %h", tb_rx_packet[7]);
+
+        tb_tx_packet[0] = 8'h30; // Check PWM Status, unchecked
+        spi_transaction(5);
+        if ({tb_rx_packet[1], tb_rx_packet[2]} == {8'hC8, 8'h34} && {tb_rx_packet[3], tb_rx_packet[4]} == {8'h8C, 8'hFF})
+            $display("PASSED: Corrupted write not applied.");
+        else
+            $display("FAILED: Corrupted write was applied.");
+
+        // Same write with its CRC: applied, acked, error count reported
+        tb_tx_packet[0] = 8'h92;
+        tb_tx_packet[5] = 8'h12;
+        tb_tx_packet[6] = packet_crc(0, 0, 5);
+        spi_transaction(8);
+
+        if (tb_rx_packet[5] == 8'h01 && tb_rx_packet[6] == packet_crc(1, 1, 5) && tb_rx_packet[7] == 8'h12)
+            $display("PASSED: Checked write acked.");
+        else
+            $display("FAILED: Checked write. Errors %h CRC %h ack %h", tb_rx_packet[5], tb_rx_packet[6], tb_rx_packet[7]);
+
+        tb_tx_packet[0] = 8'h30;
+        spi_transaction(5);
+        if ({tb_rx_packet[1], tb_rx_packet[2]} == {8'hA0, 8'h00} && {tb_rx_packet[3], tb_rx_packet[4]} == {8'hD0, 8'h00})
+            $display("PASSED: Checked write applied.");
+        else
+            $display("FAILED: Checked write not applied.");
+
+        // Test 6: the timestamps of two reads are as far apart as their CS falls
+        $display("TEST 6: Position Timestamps");
+        for (k = 0; k < 16; k = k + 1) tb_tx_packet[k] = 8'h00;
+        tb_tx_packet[0] = 8'h22;
+        spi_transaction(13);
+        stamp = {tb_rx_packet[9], tb_rx_packet[10], tb_rx_packet[11], tb_rx_packet[12]};
+        first_read_time = cs_fall_time;
+        #(CLK_PERIOD_NS * 1000);
+        tb_tx_packet[0] = 8'h20; // Pitch only, the timestamp follows the position
+        spi_transaction(9);
+        stamp = {tb_rx_packet[5], tb_rx_packet[6], tb_rx_packet[7], tb_rx_packet[8]} - stamp;
+        expected_cycles = (cs_fall_time - first_read_time) / CLK_PERIOD_NS;
+        if (stamp >= expected_cycles - 1 && stamp <= expected_cycles + 1)
+            $display("PASSED: Timestamps %0d cycles apart.", stamp);
+        else
+            $display("FAILED: Timestamps %0d cycles apart, expected %0d.", stamp, expected_cycles);
+
+        // Test 7: velocities, pitch counting up every 10 cycles, yaw idle
+        $display("TEST 7: Read Positions and Velocities");
+        for (i = 0; i < 50; i = i + 1) begin
+            {PITCH_ENC_A, PITCH_ENC_B} <= 2'b11; #(CLK_PERIOD_NS * 10);
+            {PITCH_ENC_A, PITCH_ENC_B} <= 2'b01; #(CLK_PERIOD_NS * 10);
+            {PITCH_ENC_A, PITCH_ENC_B} <= 2'b00; #(CLK_PERIOD_NS * 10);
+            {PITCH_ENC_A, PITCH_ENC_B} <= 2'b10; #(CLK_PERIOD_NS * 10);
+        end
+        for (k = 0; k < 21; k = k + 1) tb_tx_packet[k] = 8'h00;
+        tb_tx_packet[0] = 8'h25;
+        spi_transaction(21);
+
+        if ($signed({tb_rx_packet[9], tb_rx_packet[10], tb_rx_packet[11], tb_rx_packet[12]}) == 10 &&
+            {tb_rx_packet[13], tb_rx_packet[14], tb_rx_packet[15], tb_rx_packet[16]} == 32'h0 &&
+            $signed({tb_rx_packet[17], tb_rx_packet[18]}) >= 49 && $signed({tb_rx_packet[17], tb_rx_packet[18]}) <= 51 &&
+            {tb_rx_packet[19], tb_rx_packet[20]} == 16'h0)
+            $display("PASSED: Pitch period 10 cycles, 50 edges per window, yaw idle.");
+        else
+            $display("FAILED: Velocities. Periods %h%h%h%h %h%h%h%h, windows %h%h %h%h",
+                tb_rx_packet[9], tb_rx_packet[10], tb_rx_packet[11], tb_rx_packet[12],
+                tb_rx_packet[13], tb_rx_packet[14], tb_rx_packet[15], tb_rx_packet[16],
+                tb_rx_packet[17], tb_rx_packet[18], tb_rx_packet[19], tb_rx_packet[20]);
+
+        // Test 8: a synthetic frame strobe stores the positions and timestamp
+        // of its rising edge, before the pitch moves on
+        $display("TEST 8: Frame Sync Snapshot");
+        for (k = 0; k < 17; k = k + 1) tb_tx_packet[k] = 8'h00;
+        tb_tx_packet[0] = 8'h22;
+        spi_transaction(13);
+        received_pitch = $signed({tb_rx_packet[1], tb_rx_packet[2], tb_rx_packet[3], tb_rx_packet[4]});
+        received_yaw   = $signed({tb_rx_packet[5], tb_rx_packet[6], tb_rx_packet[7], tb_rx_packet[8]});
+        stamp = {tb_rx_packet[9], tb_rx_packet[10], tb_rx_packet[11], tb_rx_packet[12]};
+        first_read_time = cs_fall_time;
+        #(CLK_PERIOD_NS * 500);
+        FRAME_SYNC = 1'b1;
+        expected_cycles = ($time - first_read_time) / CLK_PERIOD_NS;
+        #(CLK_PERIOD_NS * 20);
+        FRAME_SYNC = 1'b0;
+        {PITCH_ENC_A, PITCH_ENC_B} <= 2'b11; #(CLK_PERIOD_NS * 10);
+
+        tb_tx_packet[0] = 8'h64; // Frame burst: first frame 0, 1 frame
+        tb_tx_packet[3] = 8'h01;
+        spi_transaction(17);
+        stamp = {tb_rx_packet[13], tb_rx_packet[14], tb_rx_packet[15], tb_rx_packet[16]} - stamp;
+        if ({tb_rx_packet[1], tb_rx_packet[2]} == 16'd1 &&
+            $signed({tb_rx_packet[5], tb_rx_packet[6], tb_rx_packet[7], tb_rx_packet[8]}) == received_pitch &&
+            $signed({tb_rx_packet[9], tb_rx_packet[10], tb_rx_packet[11], tb_rx_packet[12]}) == received_yaw &&
+            stamp >= expected_cycles - 1 && stamp <= expected_cycles + 4)
+            $display("PASSED: Frame 0 holds the pose at the strobe, %0d cycles after the read.", stamp);
+        else
+            $display("FAILED: Frame snapshot. Next %0d, P:%0d Y:%0d, %0d cycles after the read, expected %0d.",
+                {tb_rx_packet[1], tb_rx_packet[2]},
+                $signed({tb_rx_packet[5], tb_rx_packet[6], tb_rx_packet[7], tb_rx_packet[8]}),
+                $signed({tb_rx_packet[9], tb_rx_packet[10], tb_rx_packet[11], tb_rx_packet[12]}),
+                stamp, expected_cycles);
+
+        // Test 9: interval histogram. Only the 0x22 frames are timed, in
+        // 16-cycle bins with a 600-cycle deadline: their starts 500 and 808
+        // cycles apart, with a 0x30 frame in between that is not timed.
+        // Expected values, worked out by hand from IntervalHistogram.v:
+        //   0x1E = 0xA2000000: filter 0x80 | 0x22 (time 0x22 only), origin 0
+        //   0x1F = 0x04000258: shift 4 (16-cycle bins), deadline 0x258 = 600
+        //   intervals 500 and 808 cycles, +-1 for the CS synchronizer:
+        //   min 499-501, max 807-809, missed 1 (808 > 600), count 2
+        //   bins: 499-501 >> 4 = 31, 807-809 >> 4 = 50; four bins per
+        //   entry, bin 4 k first (bytes 5-7), so bin 31 = 4 * 7 + 3 is
+        //   bytes 14-16 of entry 7 and bin 50 = 4 * 12 + 2 bytes 11-13 of
+        //   entry 12, both 1, with bins 48-49 (bytes 5-10) 0
+        $display("TEST 9: Interval Histogram");
+        for (k = 0; k < 24; k = k + 1) tb_tx_packet[k] = 8'h00;
+        tb_tx_packet[0] = 8'h71;
+        tb_tx_packet[1] = 8'h1E; tb_tx_packet[2] = 8'd2;
+        tb_tx_packet[3] = 8'hA2;                              // only 0x22, origin 0
+        tb_tx_packet[7] = 8'h04; tb_tx_packet[9] = 8'h02; tb_tx_packet[10] = 8'h58; // shift 4, deadline 600
+        spi_transaction(11);
+        #(CLK_PERIOD_NS * 100);                               // Cleared
+
+        for (k = 0; k < 24; k = k + 1) tb_tx_packet[k] = 8'h00;
+        tb_tx_packet[0] = 8'h22;
+        spi_transaction(13);
+        first_read_time = cs_fall_time;
+        tb_tx_packet[0] = 8'h30;
+        spi_transaction(5);
+        #(CLK_PERIOD_NS * 500 - ($time - first_read_time));
+        tb_tx_packet[0] = 8'h22;
+        spi_transaction(13);
+        first_read_time = cs_fall_time;
+        #(CLK_PERIOD_NS * 808 - ($time - first_read_time));
+        spi_transaction(13);
+
+        tb_tx_packet[0] = 8'h70;
+        tb_tx_packet[1] = 8'h20; tb_tx_packet[2] = 8'd4;
+        spi_transaction(19);
+        if ({tb_rx_packet[3], tb_rx_packet[4], tb_rx_packet[5], tb_rx_packet[6]} >= 499 &&
+            {tb_rx_packet[3], tb_rx_packet[4], tb_rx_packet[5], tb_rx_packet[6]} <= 501 &&
+            {tb_rx_packet[7], tb_rx_packet[8], tb_rx_packet[9], tb_rx_packet[10]} >= 807 &&
+            {tb_rx_packet[7], tb_rx_packet[8], tb_rx_packet[9], tb_rx_packet[10]} <= 809 &&
+            {tb_rx_packet[11], tb_rx_packet[12], tb_rx_packet[13], tb_rx_packet[14]} == 32'd1 &&
+            {tb_rx_packet[15], tb_rx_packet[16], tb_rx_packet[17], tb_rx_packet[18]} == 32'd2)
+            $display("PASSED: Intervals %0d and %0d cycles, one over the deadline.",
+                {tb_rx_packet[3], tb_rx_packet[4], tb_rx_packet[5], tb_rx_packet[6]},
+                {tb_rx_packet[7], tb_rx_packet[8], tb_rx_packet[9], tb_rx_packet[10]});
+        else
+            $display("FAILED: Interval statistics. Min %0d, max %0d, missed %0d, count %0d.",
+                {tb_rx_packet[3], tb_rx_packet[4], tb_rx_packet[5], tb_rx_packet[6]},
+                {tb_rx_packet[7], tb_rx_packet[8], tb_rx_packet[9], tb_rx_packet[10]},
+                {tb_rx_packet[11], tb_rx_packet[12], tb_rx_packet[13], tb_rx_packet[14]},
+                {tb_rx_packet[15], tb_rx_packet[16], tb_rx_packet[17], tb_rx_packet[18]});
+
+        // Bin 31 (496-511 cycles) is the last of entry 7, bin 50 (800-815)
+        // the third of entry 12
+        for (k = 0; k < 24; k = k + 1) tb_tx_packet[k] = 8'h00;
+        tb_tx_packet[0] = 8'h65;
+        tb_tx_packet[2] = 8'd7; tb_tx_packet[3] = 8'd1;
+        spi_transaction(17);
+        stamp = {8'h00, tb_rx_packet[14], tb_rx_packet[15], tb_rx_packet[16]};
+        tb_tx_packet[2] = 8'd12;
+        spi_transaction(17);
+        if (stamp == 32'd1 && {tb_rx_packet[11], tb_rx_packet[12], tb_rx_packet[13]} == 24'd1 &&
+            {tb_rx_packet[5], tb_rx_packet[6], tb_rx_packet[7], tb_rx_packet[8], tb_rx_packet[9], tb_rx_packet[10]} == 48'h0)
+            $display("PASSED: One interval in bins 31 and 50.");
+        else
+            $display("FAILED: Histogram bins. Bin 31: %0d, bin 50: %0d.",
+                stamp, {tb_rx_packet[11], tb_rx_packet[12], tb_rx_packet[13]});
+
+        // Test 10: PWM queue played from a braked pitch axis. Three entries
+        // due at once, the second one braking both axes (zero duty), are
+        // applied on three consecutive PWM period ends: the periods go on
+        // while the axis is disabled.
+        $display("TEST 10: PWM Queue from a Disabled Axis");
+        for (k = 0; k < 32; k = k + 1) tb_tx_packet[k] = 8'h00;
+        tb_tx_packet[0] = 8'h12;                              // Both axes disabled
+        spi_transaction(5);
+        tb_tx_packet[0] = 8'h62;                              // Hold, no underrun timeout
+        spi_transaction(5);
+        tb_tx_packet[0] = 8'h63;                              // Entries 0..2, all due at once
+        tb_tx_packet[3] = 8'd3;
+        tb_tx_packet[10] = 8'h84; tb_tx_packet[11] = 8'h23;   // Pitch: duty=0x123, en=1, dir=0
+        tb_tx_packet[26] = 8'h90; tb_tx_packet[27] = 8'h56;   // Pitch: duty=0x456, en=1, dir=0
+        spi_transaction(30);
+        #(CLK_PERIOD_NS * (CLK_FREQ / PWM_FREQ) * 4);
+
+        for (k = 0; k < 32; k = k + 1) tb_tx_packet[k] = 8'h00;
+        tb_tx_packet[0] = 8'h70;
+        tb_tx_packet[1] = 8'h0B; tb_tx_packet[2] = 8'd1;      // Queue {write index, read index}
+        spi_transaction(7);
+        stamp = {tb_rx_packet[3], tb_rx_packet[4], tb_rx_packet[5], tb_rx_packet[6]};
+        tb_tx_packet[0] = 8'h30;
+        spi_transaction(5);
+        if (stamp == 32'h0003_0003 && {tb_rx_packet[1], tb_rx_packet[2]} == {8'h90, 8'h56} &&
+            {tb_rx_packet[3], tb_rx_packet[4]} == 16'h0000)
+            $display("PASSED: All three entries applied, the last one drives the pitch.");
+        else
+            $display("FAILED: PWM queue stalled. Indexes %h, pitch %h%h, yaw %h%h.",
+                stamp, tb_rx_packet[1], tb_rx_packet[2], tb_rx_packet[3], tb_rx_packet[4]);
+
+        // Test 11: sampler every 100 cycles; ~350 cycles later a burst of
+        // samples 0-1 holds the standing positions, 100 cycles apart, and
+        // the next sample index is 3
+        $display("TEST 11: Sample Burst");
+        for (k = 0; k < 32; k = k + 1) tb_tx_packet[k] = 8'h00;
+        tb_tx_packet[0] = 8'h22;
+        spi_transaction(13);
+        received_pitch = $signed({tb_rx_packet[1], tb_rx_packet[2], tb_rx_packet[3], tb_rx_packet[4]});
+        received_yaw   = $signed({tb_rx_packet[5], tb_rx_packet[6], tb_rx_packet[7], tb_rx_packet[8]});
+        for (k = 0; k < 32; k = k + 1) tb_tx_packet[k] = 8'h00;
+        tb_tx_packet[0] = 8'h61;
+        tb_tx_packet[3] = 8'd100;
+        spi_transaction(5);
+        #(CLK_PERIOD_NS * 350);
+        tb_tx_packet[0] = 8'h60;                              // First sample 0, 2 samples
+        tb_tx_packet[3] = 8'd2;
+        spi_transaction(29);
+        stamp = {tb_rx_packet[25], tb_rx_packet[26], tb_rx_packet[27], tb_rx_packet[28]} -
+                {tb_rx_packet[13], tb_rx_packet[14], tb_rx_packet[15], tb_rx_packet[16]};
+        if ({tb_rx_packet[1], tb_rx_packet[2]} == 16'd3 && stamp == 32'd100 &&
+            $signed({tb_rx_packet[5], tb_rx_packet[6], tb_rx_packet[7], tb_rx_packet[8]}) == received_pitch &&
+            $signed({tb_rx_packet[9], tb_rx_packet[10], tb_rx_packet[11], tb_rx_packet[12]}) == received_yaw &&
+            $signed({tb_rx_packet[17], tb_rx_packet[18], tb_rx_packet[19], tb_rx_packet[20]}) == received_pitch &&
+            $signed({tb_rx_packet[21], tb_rx_packet[22], tb_rx_packet[23], tb_rx_packet[24]}) == received_yaw)
+            $display("PASSED: Samples 0 and 1 hold the positions, 100 cycles apart.");
+        else
+            $display("FAILED: Sample burst. Next %0d, %0d cycles apart, P:%0d Y:%0d.",
+                {tb_rx_packet[1], tb_rx_packet[2]}, stamp,
+                $signed({tb_rx_packet[5], tb_rx_packet[6], tb_rx_packet[7], tb_rx_packet[8]}),
+                $signed({tb_rx_packet[9], tb_rx_packet[10], tb_rx_packet[11], tb_rx_packet[12]}));
+
         #(CLK_PERIOD_NS * 100);
         $display("All tests finished.");
         $finish;
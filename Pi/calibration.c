@@ -0,0 +1,86 @@
+// Filename : calibration.c
+// Authors : Luis Moreno (s3608255), Luca Provenzano (s3487636)
+// Group : 43
+// License : N.A. or open source license like LGPL
+// Description : Persisted homing calibration, versioned file with CRC
+//==============================================================
+#include "calibration.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+/*********************************************
+* @brief Bitwise CRC-32, the file is a few bytes so no table is needed
+*
+* @param [in] data bytes
+* @param [in] len  number of bytes
+*
+* @return CRC-32 of the bytes
+*********************************************/
+uint32_t CalibCrc32(const void *data, unsigned len) {
+    const uint8_t *p = (const uint8_t *)data;
+    uint32_t crc = 0xFFFFFFFFu;
+    for (unsigned i = 0; i < len; i++) {
+        crc ^= p[i];
+        for (int b = 0; b < 8; b++) crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+    }
+    return ~crc;
+}
+
+/*********************************************
+* @brief Saves the calibration. A temporary file is renamed over the old
+*        one, so a crash never leaves a half-written calibration.
+*
+* @param [in] path file path
+* @param [in] c    calibration
+*
+* @return 0: saved; -1: I/O error
+*********************************************/
+int CalibSave(const char *path, const Calibration *c) {
+    CalibFile f;
+    memset(&f, 0, sizeof(f));
+    f.magic   = CALIB_MAGIC;
+    f.version = CALIB_VERSION;
+    f.size    = sizeof(CalibFile);
+    f.calib   = *c;
+    f.crc     = CalibCrc32(&f, offsetof(CalibFile, crc));
+
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *fp = fopen(tmp, "wb");
+    if (fp == NULL) {
+        perror("CalibSave");
+        return -1;
+    }
+    int ok = fwrite(&f, sizeof(f), 1, fp) == 1;
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok || rename(tmp, path) != 0) {
+        perror("CalibSave");
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/*********************************************
+* @brief Loads and validates the calibration
+*
+* @param [in]  path file path
+* @param [out] c    calibration, only written on success
+*
+* @return 0: loaded; CALIB_ERR_MISSING, CALIB_ERR_FORMAT or CALIB_ERR_CRC
+*********************************************/
+int CalibLoad(const char *path, Calibration *c) {
+    CalibFile f;
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) return CALIB_ERR_MISSING;
+    size_t n = fread(&f, 1, sizeof(f), fp);
+    fclose(fp);
+
+    if (n != sizeof(f)) return CALIB_ERR_MISSING;
+    if (f.magic != CALIB_MAGIC || f.version != CALIB_VERSION || f.size != sizeof(CalibFile)) return CALIB_ERR_FORMAT;
+    if (f.crc != CalibCrc32(&f, offsetof(CalibFile, crc))) return CALIB_ERR_CRC;
+
+    *c = f.calib;
+    return 0;
+}
@@ -0,0 +1,54 @@
+// Filename : calibration.h
+// Authors : Luis Moreno (s3608255), Luca Provenzano (s3487636)
+// Group : 43
+// License : N.A. or open source license like LGPL
+// Description : header file for the persisted homing calibration
+//==============================================================
+
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define CALIB_MAGIC     0x42494c43u // "CLIB"
+#define CALIB_VERSION   1
+
+// Homing results, in raw FPGA encoder counts. They stay valid as long as the
+// FPGA keeps counting, i.e. across restarts of the program.
+typedef struct Calibration {
+    int32_t  pitch_offset, yaw_offset;      // Counter value at the lower end stops
+    uint32_t pitch_max_steps, yaw_max_steps; // Counts between the end stops
+} Calibration;
+
+// On-disk layout: fixed-size little-endian record protected by a CRC-32.
+typedef struct CalibFile {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;          // sizeof(CalibFile)
+    Calibration calib;
+    uint32_t crc;           // CRC-32 of all the previous bytes
+} CalibFile;
+
+// Error codes of CalibLoad.
+#define CALIB_ERR_MISSING  -1 // File cannot be opened or is short
+#define CALIB_ERR_FORMAT   -2 // Bad magic, version or size
+#define CALIB_ERR_CRC      -3 // Corrupted contents
+
+// Writes the calibration atomically (temporary file + rename). Returns 0 or -1.
+int CalibSave(const char *path, const Calibration *c);
+
+// Reads and validates the calibration. Returns 0 or a CALIB_ERR_* code.
+int CalibLoad(const char *path, Calibration *c);
+
+// CRC-32 (IEEE 802.3, reflected), as used by zlib.
+uint32_t CalibCrc32(const void *data, unsigned len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
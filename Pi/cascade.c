@@ -0,0 +1,191 @@
+// Filename : cascade.c
+// Authors : Luis Moreno (s3608255), Luca Provenzano (s3487636)
+// Group : 43
+// License : N.A. or open source license like LGPL
+// Description : Cascaded multi-rate controller, inner velocity PI at the loop rate and outer position P at a divided rate
+//==============================================================
+#include "cascade.h"
+#include <string.h>
+
+/*********************************************
+* @brief Clamps a value to [-limit, limit]
+*
+* @param [in] x     value
+* @param [in] limit symmetric limit
+*
+* @return clamped value
+*********************************************/
+static double Clamp(double x, double limit) {
+    return x > limit ? limit : (x < -limit ? -limit : x);
+}
+
+/*********************************************
+* @brief Fills in the default gains, tuned on the simulated plant
+*
+* @param [out] pitch pitch axis gains
+* @param [out] yaw   yaw axis gains
+*
+* @return None.
+*********************************************/
+void CascadeDefaultGains(CascadeGains *pitch, CascadeGains *yaw) {
+    CascadeGains base = {
+        .kp_pos  = 8.0,
+        .v_max   = 2.5,
+        .kp_vel  = 0.4,
+        .ki_vel  = 4.0,
+        .kv_ff   = 0.35,
+        .out_max = 0.99,
+    };
+    *yaw = base;
+    *pitch = base;
+}
+
+/*********************************************
+* @brief Resets a velocity estimator
+*
+* @param [out] e      estimator
+* @param [in]  window samples differenced, clamped to [1, VEL_WINDOW_MAX - 1]
+*
+* @return None.
+*********************************************/
+void VelocityInit(VelocityEstimator *e, unsigned window) {
+    memset(e, 0, sizeof(*e));
+    if (window < 1) window = 1;
+    if (window > VEL_WINDOW_MAX - 1) window = VEL_WINDOW_MAX - 1;
+    e->window = window;
+}
+
+/*********************************************
+* @brief Adds a position sample and returns the velocity over the window.
+*        Until the window is full, the oldest available sample is used.
+*
+* @param [inout] e   estimator
+* @param [in]    pos position [rad]
+* @param [in]    dt  time since the previous sample [s]
+*
+* @return velocity estimate [rad/s]
+*********************************************/
+double VelocityUpdate(VelocityEstimator *e, double pos, double dt) {
+    e->time += dt;
+    e->head = (e->head + 1) % VEL_WINDOW_MAX;
+    e->pos[e->head] = pos;
+    e->t[e->head] = e->time;
+    if (e->filled < e->window) e->filled++;
+
+    unsigned back = e->filled < e->window ? e->filled - 1 : e->window;
+    if (back == 0) return e->vel;
+
+    unsigned old = (e->head + VEL_WINDOW_MAX - back) % VEL_WINDOW_MAX;
+    double span = e->t[e->head] - e->t[old];
+    if (span > 0.0) e->vel = (pos - e->pos[old]) / span;
+    return e->vel;
+}
+
+/*********************************************
+* @brief Initializes the cascaded controller
+*
+* @param [out] c               controller
+* @param [in]  pitch           pitch gains
+* @param [in]  yaw             yaw gains
+* @param [in]  vel_window      velocity estimation window in inner ticks
+* @param [in]  outer_divider   inner ticks per outer loop run (>= 1)
+* @param [in]  inner_budget_ns time allowed to an inner loop run, 0: unlimited
+* @param [in]  outer_budget_ns time allowed to an outer loop run, 0: unlimited
+*
+* @return None.
+*********************************************/
+void CascadeInit(Cascade *c, const CascadeGains *pitch, const CascadeGains *yaw, unsigned vel_window,
+                 unsigned outer_divider, int64_t inner_budget_ns, int64_t outer_budget_ns) {
+    memset(c, 0, sizeof(*c));
+    c->pitch.g = *pitch;
+    c->yaw.g   = *yaw;
+    VelocityInit(&c->pitch.est, vel_window);
+    VelocityInit(&c->yaw.est, vel_window);
+
+    c->inner.divider   = 1;
+    c->inner.budget_ns = inner_budget_ns;
+    c->outer.divider   = outer_divider ? outer_divider : 1;
+    c->outer.budget_ns = outer_budget_ns;
+}
+
+/*********************************************
+* @brief Advances the base tick. The outer loop is due on the first tick
+*        and then once every outer divider ticks.
+*
+* @param [inout] c controller
+*
+* @return 1: outer loop due on this tick; 0: inner loop only
+*********************************************/
+int CascadeTick(Cascade *c) {
+    return (c->tick++ % c->outer.divider) == 0;
+}
+
+/*********************************************
+* @brief Outer position loop, proportional with a velocity limit
+*
+* @param [inout] a      axis
+* @param [in]    pos    current position [rad]
+* @param [in]    dst    destination [rad]
+* @param [in]    vel_ff feedforward velocity, e.g. from a trajectory [rad/s]
+*
+* @return None.
+*********************************************/
+void CascadeOuterStep(CascadeAxis *a, double pos, double dst, double vel_ff) {
+    a->vel_ref = Clamp(vel_ff + a->g.kp_pos * (dst - pos), a->g.v_max);
+    a->vel_ff  = vel_ff;
+}
+
+/*********************************************
+* @brief Inner velocity loop, PI with conditional integration: the
+*        integrator is frozen while the output saturates in the same
+*        direction as the error.
+*
+* @param [inout] a   axis
+* @param [in]    pos current position [rad]
+* @param [in]    dt  time since the previous inner step [s]
+*
+* @return drive output in [-out_max, out_max]
+*********************************************/
+double CascadeInnerStep(CascadeAxis *a, double pos, double dt) {
+    return CascadeInnerStepVel(a, VelocityUpdate(&a->est, pos, dt), dt);
+}
+
+/*********************************************
+* @brief Inner velocity loop on a measured velocity, the estimator of the
+*        axis is bypassed
+*
+* @param [inout] a   axis
+* @param [in]    vel measured velocity [rad/s]
+* @param [in]    dt  time since the previous inner step [s]
+*
+* @return drive output in [-out_max, out_max]
+*********************************************/
+double CascadeInnerStepVel(CascadeAxis *a, double vel, double dt) {
+    double err = a->vel_ref - vel;
+
+    double integ = a->integ + a->g.ki_vel * err * dt;
+    double raw = a->g.kv_ff * a->vel_ff + a->g.kp_vel * err + integ;
+    double out = Clamp(raw, a->g.out_max);
+    if (raw == out || (raw > out) != (err > 0.0)) a->integ = Clamp(integ, a->g.out_max);
+
+    a->out = out;
+    return out;
+}
+
+/*********************************************
+* @brief Accounts one run of a rate group against its budget
+*
+* @param [inout] g  rate group
+* @param [in]    ns duration of the run
+*
+* @return 1: budget exceeded; 0: within budget
+*********************************************/
+int RateGroupRecord(RateGroup *g, int64_t ns) {
+    g->runs++;
+    if (ns > g->max_ns) g->max_ns = ns;
+    if (g->budget_ns > 0 && ns > g->budget_ns) {
+        g->overruns++;
+        return 1;
+    }
+    return 0;
+}
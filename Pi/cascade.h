@@ -0,0 +1,95 @@
+// Filename : cascade.h
+// Authors : Luis Moreno (s3608255), Luca Provenzano (s3487636)
+// Group : 43
+// License : N.A. or open source license like LGPL
+// Description : header file for the cascaded multi-rate controller (inner velocity, outer position loop)
+//==============================================================
+
+#ifndef CASCADE_H
+#define CASCADE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define VEL_WINDOW_MAX 128 // Longest velocity estimation window, in samples
+
+// Velocity from encoder positions, differenced over a sliding window of samples.
+// A longer window lowers the quantization noise (one count over the window)
+// at the cost of half a window of delay.
+typedef struct VelocityEstimator {
+    double pos[VEL_WINDOW_MAX];  // Ring of past positions [rad]
+    double t[VEL_WINDOW_MAX];    // Ring of their sample times [s]
+    unsigned window;            // Samples differenced (1 .. VEL_WINDOW_MAX - 1)
+    unsigned head, filled;
+    double time;                // Running sample time [s]
+    double vel;                 // Latest estimate [rad/s]
+} VelocityEstimator;
+
+// Gains of one axis.
+typedef struct CascadeGains {
+    double kp_pos;      // Outer loop: velocity reference per rad of error [1/s]
+    double v_max;       // Outer loop: velocity reference limit [rad/s]
+    double kp_vel;      // Inner loop: output per rad/s of error
+    double ki_vel;      // Inner loop: output per rad of integrated error
+    double kv_ff;       // Inner loop: output per rad/s of feedforward velocity
+    double out_max;     // Inner loop: output limit, as the 20-sim limiter (0.99)
+} CascadeGains;
+
+typedef struct CascadeAxis {
+    CascadeGains g;
+    VelocityEstimator est;
+    double vel_ref;     // Set by the outer loop
+    double vel_ff;      // Feedforward velocity of the last outer step [rad/s]
+    double integ;       // Inner loop integrator [output units]
+    double out;         // Latest inner loop output
+} CascadeAxis;
+
+// Execution statistics of one rate group against its budget.
+typedef struct RateGroup {
+    unsigned divider;   // Runs once every `divider` base ticks
+    int64_t budget_ns;  // Time allowed per run, 0: unlimited
+    uint64_t runs;
+    uint64_t overruns;  // Runs that exceeded the budget
+    int64_t max_ns;     // Longest run
+} RateGroup;
+
+typedef struct Cascade {
+    CascadeAxis pitch, yaw;
+    RateGroup inner, outer;
+    uint64_t tick;      // Base ticks elapsed
+} Cascade;
+
+// Default gains of the pitch and yaw axes.
+void CascadeDefaultGains(CascadeGains *pitch, CascadeGains *yaw);
+
+// Initializes the controller. The outer loop runs every outer_divider inner ticks.
+void CascadeInit(Cascade *c, const CascadeGains *pitch, const CascadeGains *yaw, unsigned vel_window,
+                 unsigned outer_divider, int64_t inner_budget_ns, int64_t outer_budget_ns);
+
+// Advances the base tick and tells whether the outer loop is due on it.
+int CascadeTick(Cascade *c);
+
+// Outer loop: velocity reference from the position error, plus a feedforward velocity.
+void CascadeOuterStep(CascadeAxis *a, double pos, double dst, double vel_ff);
+
+// Inner loop: updates the velocity estimate and returns the drive output in [-out_max, out_max].
+double CascadeInnerStep(CascadeAxis *a, double pos, double dt);
+
+// Inner loop on a velocity measured elsewhere (e.g. the FPGA estimates, command 0x25).
+double CascadeInnerStepVel(CascadeAxis *a, double vel, double dt);
+
+// Accounts one run of a rate group; returns 1 if it exceeded its budget.
+int RateGroupRecord(RateGroup *g, int64_t ns);
+
+// Velocity estimator on its own.
+void VelocityInit(VelocityEstimator *e, unsigned window);
+double VelocityUpdate(VelocityEstimator *e, double pos, double dt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,94 @@
+// Filename : clock_source.c
+// Authors : Luis Moreno (s3608255), Luca Provenzano (s3487636)
+// Group : 43
+// License : N.A. or open source license like LGPL
+// Description : Monotonic time source, either the real clock or a virtual clock for simulation
+//==============================================================
+#include "clock_source.h"
+#include <time.h>
+
+#define NS_PER_SEC 1000000000LL
+
+// Virtual clock state. Only meant for single-threaded simulation runs.
+static int g_virtual = 0;
+static int64_t g_virtual_ns = 0;
+static clock_hook_t g_hook = 0;
+
+/*********************************************
+* @brief Returns the current time
+*
+* @return time in ns
+*********************************************/
+int64_t ClockNowNs(void) {
+    if (g_virtual) return g_virtual_ns;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+/*********************************************
+* @brief Sleeps until an absolute time. With the virtual clock the time
+*        jumps to t_ns and the hook is called.
+*
+* @param [in] t_ns absolute wake-up time in ns
+*
+* @return None.
+*********************************************/
+void ClockSleepUntilNs(int64_t t_ns) {
+    if (g_virtual) {
+        if (t_ns > g_virtual_ns) g_virtual_ns = t_ns;
+        if (g_hook) g_hook(g_virtual_ns);
+        return;
+    }
+
+    struct timespec ts = {
+        .tv_sec  = (time_t)(t_ns / NS_PER_SEC),
+        .tv_nsec = (long)(t_ns % NS_PER_SEC),
+    };
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+/*********************************************
+* @brief Sleeps for a relative time
+*
+* @param [in] us time to sleep in microseconds
+*
+* @return None.
+*********************************************/
+void ClockSleepUs(unsigned us) {
+    ClockSleepUntilNs(ClockNowNs() + (int64_t)us * 1000);
+}
+
+/*********************************************
+* @brief Switches to the virtual clock
+*
+* @param [in] start_ns initial virtual time
+* @param [in] hook     function called on every advance, may be NULL
+*
+* @return None.
+*********************************************/
+void ClockUseVirtual(int64_t start_ns, clock_hook_t hook) {
+    g_virtual_ns = start_ns;
+    g_hook = hook;
+    g_virtual = 1;
+}
+
+/*********************************************
+* @brief Switches back to the real monotonic clock
+*
+* @return None.
+*********************************************/
+void ClockUseReal(void) {
+    g_virtual = 0;
+    g_hook = 0;
+}
+
+/*********************************************
+* @brief Tells whether the virtual clock is active
+*
+* @return 1: virtual clock; 0: real clock
+*********************************************/
+int ClockIsVirtual(void) {
+    return g_virtual;
+}
@@ -0,0 +1,42 @@
+// Filename : clock_source.h
+// Authors : Luis Moreno (s3608255), Luca Provenzano (s3487636)
+// Group : 43
+// License : N.A. or open source license like LGPL
+// Description : header file for the monotonic time source (real or virtual)
+//==============================================================
+
+#ifndef CLOCK_SOURCE_H
+#define CLOCK_SOURCE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+// Called every time the virtual clock moves forward.
+typedef void (*clock_hook_t)(int64_t now_ns);
+
+// Returns the current time in ns (CLOCK_MONOTONIC, or virtual time).
+int64_t ClockNowNs(void);
+
+// Sleeps until the absolute time t_ns.
+void ClockSleepUntilNs(int64_t t_ns);
+
+// Sleeps for a relative amount of microseconds.
+void ClockSleepUs(unsigned us);
+
+// Switches to a virtual clock starting at start_ns. Sleeping advances it instantly.
+void ClockUseVirtual(int64_t start_ns, clock_hook_t hook);
+
+// Switches back to the real monotonic clock.
+void ClockUseReal(void);
+
+// Returns 1 if the virtual clock is active.
+int ClockIsVirtual(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
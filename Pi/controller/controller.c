@@ -7,8 +7,14 @@
 #include "controller.h"
 
 #include "pan/pan_xxsubmod.h"
+#include "pan/pan_xxmodel.h"
 #include "tilt/tilt_xxsubmod.h"
+#include "tilt/tilt_xxmodel.h"
 #include <stdbool.h>
+#include <math.h>
+
+// Error beyond which the PID integrators hold, in rad
+#define INTEGRATOR_BAND_RAD 0.1
 
 // Global variables to hold the I/O for each controller
 static XXDouble pan_inputs[2];
@@ -40,6 +46,28 @@ void ControllerInitialize(void) {
     g_is_initialized = true;
 }
 
+/*********************************************
+* @brief Anti-windup of a 20-sim PID1. The new uI is dropped, keeping the
+*        previous one, while the output is beyond the SignalLimiter2 and uD
+*        drives it further out, or while the error is outside
+*        INTEGRATOR_BAND_RAD. Otherwise uI winds up over a long slew, and
+*        the axis stalls by friction short of or past the target until it
+*        unwinds (seconds with tauI 9 s).
+* 
+* @param [in]    s    model states (uD, error, uI previous)
+* @param [inout] R    new states (uD, error, uI)
+* @param [in]    raw  PID output before the limiter
+* @param [in]    min  limiter minimum
+* @param [in]    max  limiter maximum
+* 
+* @return None.
+*********************************************/
+static void HoldWoundIntegrator(const XXDouble *s, XXDouble *R, XXDouble raw, XXDouble min, XXDouble max) {
+    if ((raw > max && R[0] > 0.0) || (raw < min && R[0] < 0.0) || fabs(R[1]) > INTEGRATOR_BAND_RAD) {
+        R[2] = s[2];
+    }
+}
+
 /*********************************************
 * @brief Actuates a step in the PID controller, updating its input values
 * 
@@ -73,6 +101,7 @@ void ControllerStep(XXDouble tiltPos, XXDouble tiltDst,
     
     // Calculate one step
     PanCalculateSubmodel(pan_inputs, pan_outputs, g_pan_time);
+    HoldWoundIntegrator(pan_s, pan_R, pan_V[1], pan_P[5], pan_P[6]);
     
     // Tilt Controller
     // Update step size
@@ -87,6 +116,7 @@ void ControllerStep(XXDouble tiltPos, XXDouble tiltDst,
     
     // Calculate one step
     TiltCalculateSubmodel(tilt_inputs, tilt_outputs, g_tilt_time);
+    HoldWoundIntegrator(tilt_s, tilt_R, tilt_V[4], tilt_P[5], tilt_P[6]);
 }
 
 
@@ -0,0 +1,214 @@
+// Filename : flight_recorder.c
+// Authors : Luis Moreno (s3608255), Luca Provenzano (s3487636)
+// Group : 43
+// License : N.A. or open source license like LGPL
+// Description : Memory-mapped ring recorder of the control loop state, with triggered snapshots
+//==============================================================
+#include "flight_recorder.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Both structures are written to disk as-is, their layout must not change silently
+typedef char fr_record_size_check[(sizeof(FrRecord) == 64) ? 1 : -1];
+typedef char fr_header_size_check[(sizeof(FrHeader) == 64) ? 1 : -1];
+
+/*********************************************
+* @brief Returns a short name for a trigger reason
+*
+* @param [in] reason fr_trigger_t value
+*
+* @return constant string
+*********************************************/
+const char *FrTriggerName(uint32_t reason) {
+    switch (reason) {
+    case FrTriggerOverrun:    return "overrun";
+    case FrTriggerTargetLost: return "target_lost";
+    case FrTriggerSpiError:   return "spi_error";
+    case FrTriggerManual:     return "manual";
+    default:                  return "none";
+    }
+}
+
+/*********************************************
+* @brief Creates the ring file, sizes it and maps it in memory. The whole
+*        mapping is touched once so the control thread never page-faults.
+*
+* @param [out] fr           recorder
+* @param [in]  path         ring file path, snapshots are written next to it
+* @param [in]  capacity     number of records in the ring
+* @param [in]  post_records records written after a trigger before the snapshot
+*
+* @return 0: recorder ready; -1: error creating or mapping the file
+*********************************************/
+int FrOpen(FlightRecorder *fr, const char *path, uint32_t capacity, uint32_t post_records) {
+    memset(fr, 0, sizeof(*fr));
+    if (capacity == 0) capacity = FR_DEFAULT_CAPACITY;
+    if (post_records >= capacity) post_records = capacity / 2;
+
+    snprintf(fr->path, sizeof(fr->path), "%s", path);
+    fr->map_size = sizeof(FrHeader) + (uint64_t)capacity * sizeof(FrRecord);
+    fr->post_records = post_records;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("open(flight recorder)");
+        return -1;
+    }
+    if (ftruncate(fd, (off_t)fr->map_size) < 0) {
+        perror("ftruncate(flight recorder)");
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, fr->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd); // The mapping keeps the file referenced
+    if (map == MAP_FAILED) {
+        perror("mmap(flight recorder)");
+        return -1;
+    }
+
+    // Pre-fault all pages
+    memset(map, 0, fr->map_size);
+
+    fr->header = (FrHeader *)map;
+    fr->ring   = (FrRecord *)((uint8_t *)map + sizeof(FrHeader));
+    fr->header->magic       = FR_MAGIC;
+    fr->header->version     = FR_VERSION;
+    fr->header->record_size = sizeof(FrRecord);
+    fr->header->capacity    = capacity;
+    fr->running = 1;
+    return 0;
+}
+
+/*********************************************
+* @brief Appends one record to the ring. Only plain memory writes, safe
+*        to call from the control loop.
+*
+* @param [inout] fr  recorder
+* @param [in]    rec record to be stored, its seq field is overwritten
+*
+* @return None.
+*********************************************/
+void FrRecordCycle(FlightRecorder *fr, const FrRecord *rec) {
+    FrHeader *h = fr->header;
+    uint64_t index = h->head;
+    FrRecord *slot = &fr->ring[index % h->capacity];
+
+    *slot = *rec;
+    slot->seq = (uint32_t)index;
+
+    h->first = (index + 1 > h->capacity) ? index + 1 - h->capacity : 0;
+    // Publish the record after its contents
+    __atomic_store_n(&h->head, index + 1, __ATOMIC_RELEASE);
+}
+
+/*********************************************
+* @brief Requests a snapshot. Ignored if one is already pending or the
+*        per-run snapshot budget is used up.
+*
+* @param [inout] fr     recorder
+* @param [in]    reason trigger reason
+*
+* @return None.
+*********************************************/
+void FrTrigger(FlightRecorder *fr, fr_trigger_t reason) {
+    if (__atomic_load_n(&fr->pending_reason, __ATOMIC_ACQUIRE) != FrTriggerNone) return;
+    if (__atomic_load_n(&fr->snapshots, __ATOMIC_RELAXED) >= FR_MAX_SNAPSHOTS) return;
+
+    fr->pending_index = __atomic_load_n(&fr->header->head, __ATOMIC_RELAXED);
+    __atomic_store_n(&fr->pending_reason, (uint32_t)reason, __ATOMIC_RELEASE);
+}
+
+/*********************************************
+* @brief Writes the pending snapshot once enough records followed the
+*        trigger. The ring keeps being written during the copy, records
+*        overwritten meanwhile are excluded from the valid range.
+*
+* @param [inout] fr    recorder
+* @param [in]    force write the pending snapshot even if it is not due yet
+*
+* @return 1: snapshot written; 0: nothing to do; -1: error writing the file
+*********************************************/
+int FrService(FlightRecorder *fr, int force) {
+    uint32_t reason = __atomic_load_n(&fr->pending_reason, __ATOMIC_ACQUIRE);
+    if (reason == FrTriggerNone) return 0;
+
+    uint64_t head = __atomic_load_n(&fr->header->head, __ATOMIC_ACQUIRE);
+    if (!force && head < fr->pending_index + fr->post_records) return 0;
+
+    char snap_path[300];
+    snprintf(snap_path, sizeof(snap_path), "%s.%02u.%s", fr->path, fr->snapshots, FrTriggerName(reason));
+
+    uint32_t capacity = fr->header->capacity;
+    FrHeader snap_header = *fr->header;
+    snap_header.head           = head;
+    snap_header.trigger_reason = reason;
+    snap_header.trigger_index  = fr->pending_index;
+
+    int err = 0;
+    FILE *f = fopen(snap_path, "wb");
+    if (f == NULL) {
+        perror("fopen(flight recorder snapshot)");
+        err = -1;
+    } else {
+        fwrite(&snap_header, sizeof(snap_header), 1, f);
+        fwrite(fr->ring, sizeof(FrRecord), capacity, f);
+
+        // Records overwritten while copying are no longer valid
+        uint64_t head_after = __atomic_load_n(&fr->header->head, __ATOMIC_ACQUIRE);
+        snap_header.first = (head_after > capacity) ? head_after - capacity : 0;
+        if (snap_header.first > head) snap_header.first = head;
+        fseek(f, 0, SEEK_SET);
+        fwrite(&snap_header, sizeof(snap_header), 1, f);
+        fclose(f);
+        printf("Flight recorder: %s snapshot written to %s\n", FrTriggerName(reason), snap_path);
+    }
+
+    __atomic_store_n(&fr->snapshots, fr->snapshots + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&fr->pending_reason, (uint32_t)FrTriggerNone, __ATOMIC_RELEASE);
+    return err < 0 ? err : 1;
+}
+
+/*********************************************
+* @brief Serves snapshot triggers until FrStop is called, then flushes a
+*        pending snapshot even if its post-trigger window is incomplete
+*
+* @param [inout] fr recorder
+*
+* @return None.
+*********************************************/
+void FrServiceLoop(FlightRecorder *fr) {
+    while (__atomic_load_n(&fr->running, __ATOMIC_ACQUIRE)) {
+        FrService(fr, 0);
+        usleep(10000);
+    }
+    FrService(fr, 1);
+}
+
+/*********************************************
+* @brief Stops the service loop
+*
+* @param [inout] fr recorder
+*
+* @return None.
+*********************************************/
+void FrStop(FlightRecorder *fr) {
+    __atomic_store_n(&fr->running, 0, __ATOMIC_RELEASE);
+}
+
+/*********************************************
+* @brief Flushes and unmaps the ring file
+*
+* @param [inout] fr recorder
+*
+* @return None.
+*********************************************/
+void FrClose(FlightRecorder *fr) {
+    if (fr->header == NULL) return;
+    msync(fr->header, fr->map_size, MS_SYNC);
+    munmap(fr->header, fr->map_size);
+    fr->header = NULL;
+    fr->ring   = NULL;
+}
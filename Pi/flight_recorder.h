@@ -0,0 +1,108 @@
+// Filename : flight_recorder.h
+// Authors : Luis Moreno (s3608255), Luca Provenzano (s3487636)
+// Group : 43
+// License : N.A. or open source license like LGPL
+// Description : header file for the memory-mapped control loop flight recorder
+//==============================================================
+
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define FR_MAGIC            0x43455246u // "FREC"
+#define FR_VERSION          1
+#define FR_DEFAULT_CAPACITY 65536       // ~6.5 s at 10 kHz, 4 MB
+#define FR_DEFAULT_POST     2000        // Records kept after a trigger (0.2 s at 10 kHz)
+#define FR_MAX_SNAPSHOTS    16          // Snapshots written per run, at most
+
+// Per-record event flags.
+#define FR_FLAG_NEW_FRAME   0x01        // A new vision result was consumed
+#define FR_FLAG_TARGET      0x02        // A target was being tracked
+#define FR_FLAG_OVERRUN     0x04        // The previous cycle missed its deadline
+#define FR_FLAG_SPI_ERROR   0x08        // The position read failed
+#define FR_FLAG_SPI_HELD    0x10        // Checked read still corrupted after its retries, positions held
+
+// Reasons for taking a snapshot of the ring.
+typedef enum {
+    FrTriggerNone       = 0,
+    FrTriggerOverrun    = 1,
+    FrTriggerTargetLost = 2,
+    FrTriggerSpiError   = 3,
+    FrTriggerManual     = 4
+} fr_trigger_t;
+
+// One control cycle. Fixed 64 bytes, written as-is to the file.
+typedef struct FrRecord {
+    int64_t  t_ns;                      // CLOCK_MONOTONIC timestamp
+    uint32_t seq;                       // Low 32 bits of the record index
+    uint32_t flags;                     // FR_FLAG_*
+    int32_t  raw_pitch, raw_yaw;        // Raw encoder counts
+    float    pitch_rad, yaw_rad;        // Positions
+    float    pitch_dst_rad, yaw_dst_rad;// Destinations
+    float    dt;                        // Controller step in s
+    float    tilt_out, pan_out;         // Controller outputs
+    uint16_t tilt_duty, pan_duty;       // PWM duty sent to the FPGA
+    uint8_t  tilt_dir, pan_dir;         // PWM direction sent to the FPGA
+    uint8_t  reserved[6];
+} FrRecord;
+
+// File header, followed by capacity records. Record i lives at slot i % capacity.
+typedef struct FrHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t capacity;
+    uint32_t trigger_reason;            // fr_trigger_t of a snapshot, 0 for the live ring
+    uint64_t head;                      // Number of records written so far
+    uint64_t first;                     // Oldest valid record index
+    uint64_t trigger_index;             // Record index at the trigger
+    uint8_t  reserved[24];
+} FrHeader;
+
+typedef struct FlightRecorder {
+    FrHeader *header;                   // Start of the mapping
+    FrRecord *ring;                     // Records, right after the header
+    uint64_t  map_size;
+    char      path[256];
+
+    uint32_t  post_records;             // Records to wait after a trigger before the snapshot
+    uint32_t  snapshots;                // Snapshots written so far
+    uint32_t  pending_reason;           // Trigger waiting to be served (0: none)
+    uint64_t  pending_index;            // Record index at the pending trigger
+    int       running;                  // Service loop keeps running while set
+} FlightRecorder;
+
+// Creates the ring file and maps it in memory.
+int FrOpen(FlightRecorder *fr, const char *path, uint32_t capacity, uint32_t post_records);
+
+// Appends one record to the ring. No syscalls, control thread only.
+void FrRecordCycle(FlightRecorder *fr, const FrRecord *rec);
+
+// Requests a snapshot of the ring once post_records more records are written.
+void FrTrigger(FlightRecorder *fr, fr_trigger_t reason);
+
+// Writes the pending snapshot if it is due, or unconditionally if force is set.
+int FrService(FlightRecorder *fr, int force);
+
+// Serves triggers until FrStop is called. Meant to run in its own thread.
+void FrServiceLoop(FlightRecorder *fr);
+
+// Stops the service loop.
+void FrStop(FlightRecorder *fr);
+
+// Unmaps and closes the ring file.
+void FrClose(FlightRecorder *fr);
+
+// Returns a short name for a trigger reason.
+const char *FrTriggerName(uint32_t reason);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
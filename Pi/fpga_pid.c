@@ -0,0 +1,133 @@
+// Filename : fpga_pid.c
+// Authors : Luis Moreno (s3608255), Luca Provenzano (s3487636)
+// Group : 43
+// License : N.A. or open source license like LGPL
+// Description : FPGA position loop (PID.v), conversion of the 20-sim gains and bit-exact model of the block
+//==============================================================
+#include "fpga_pid.h"
+#include <math.h>
+#include <string.h>
+
+/*********************************************
+* @brief Saturates a value to the signed 32-bit range, as PID.v sat32
+*
+* @param [in] v value
+*
+* @return saturated value
+*********************************************/
+static int32_t Sat32(int64_t v) {
+    return v > INT32_MAX ? INT32_MAX : (v < INT32_MIN ? INT32_MIN : (int32_t)v);
+}
+
+/*********************************************
+* @brief Product shifted right, rounded towards minus infinity like the
+*        arithmetic shift of PID.v. Operands of PID.v never overflow it.
+*
+* @param [in] x     first factor
+* @param [in] y     second factor
+* @param [in] shift bits shifted out
+*
+* @return (x * y) >> shift
+*********************************************/
+static int64_t MulShr(int64_t x, int64_t y, unsigned shift) {
+    return (x * y) >> shift;
+}
+
+/*********************************************
+* @brief Fills in the parameters of the 20-sim pan and tilt models
+*        (controller/pan, controller/tilt)
+*
+* @param [out] pitch tilt model parameters
+* @param [out] yaw   pan model parameters
+*
+* @return None.
+*********************************************/
+void FpgaPidDefaultParams(PidParams *pitch, PidParams *yaw) {
+    *pitch = (PidParams){ .kp = 1.5, .tau_d = 0.05, .beta = 0.5,  .tau_i = 2.0, .out_max = 0.99 };
+    *yaw   = (PidParams){ .kp = 2.6, .tau_d = 0.05, .beta = 0.17, .tau_i = 9.0, .out_max = 0.99 };
+}
+
+/*********************************************
+* @brief Converts the 20-sim PID parameters to the PID.v coefficients at a
+*        fixed sample time. The error scale (rad per count) and the output
+*        scale (duty per unit) are folded into b and c.
+*
+* @param [out] g             coefficients
+* @param [in]  p             20-sim parameters
+* @param [in]  sample_s      sample time T [s]
+* @param [in]  rad_per_count encoder resolution [rad]
+* @param [in]  duty_per_unit duty cycle of an output of 1.0
+*
+* @return 0: No error; -1: a coefficient is out of range
+*********************************************/
+int FpgaPidGainsFrom(FpgaPidGains *g, const PidParams *p, double sample_s, double rad_per_count,
+                     double duty_per_unit) {
+    double factor = 1.0 / (sample_s + p->tau_d * p->beta);
+    double scale  = rad_per_count * duty_per_unit;
+    double a = p->tau_d * p->beta * factor;
+    double b = p->kp * p->tau_d * factor * scale;
+    double c = p->kp * sample_s * factor * scale;
+    double d = sample_s / p->tau_i;
+    double limit = floor(p->out_max * duty_per_unit);
+
+    const double coef_one = (double)(1 << FPGA_PID_COEF_FRAC);
+    const double coef_max = (double)INT32_MAX / coef_one;
+    if (fabs(a) >= coef_max || fabs(b) >= coef_max || fabs(c) >= coef_max) return -1;
+    if (d < 0.0 || d >= 1.0 || limit < 0.0 || limit > 4095.0) return -1;
+
+    g->a = (int32_t)lround(a * coef_one);
+    g->b = (int32_t)lround(b * coef_one);
+    g->c = (int32_t)lround(c * coef_one);
+    g->d = (uint32_t)llround(d * 4294967296.0);
+    g->limit = (uint16_t)limit;
+    return 0;
+}
+
+/*********************************************
+* @brief Loads the coefficients and clears the states. g may point to the
+*        coefficients already in pid.
+*
+* @param [out] pid model
+* @param [in]  g   coefficients
+*
+* @return None.
+*********************************************/
+void FpgaPidReset(FpgaPid *pid, const FpgaPidGains *g) {
+    FpgaPidGains gains = *g;
+    memset(pid, 0, sizeof(*pid));
+    pid->g = gains;
+}
+
+/*********************************************
+* @brief One update, in the order and with the roundings of PID.v
+*
+* @param [inout] pid      model
+* @param [in]    position encoder counts
+* @param [in]    setpoint encoder counts
+* @param [out]   dir      1: negative output
+*
+* @return duty cycle, up to the limit
+*********************************************/
+uint16_t FpgaPidStep(FpgaPid *pid, int32_t position, int32_t setpoint, uint8_t *dir) {
+    int64_t e = (int64_t)setpoint - position;
+    if (e > FPGA_PID_ERROR_MAX)  e = FPGA_PID_ERROR_MAX;
+    if (e < -FPGA_PID_ERROR_MAX) e = -FPGA_PID_ERROR_MAX;
+    int64_t de = e - pid->e_prev;
+
+    // The error products are Q24 counts, 8 bits above the state format
+    const unsigned err_shift = FPGA_PID_COEF_FRAC - FPGA_PID_STATE_FRAC;
+    int32_t ud = Sat32(MulShr(pid->g.a, pid->ud_prev, FPGA_PID_COEF_FRAC) + MulShr(pid->g.b, de, err_shift) +
+                       MulShr(pid->g.c, e, err_shift));
+    int32_t ui = Sat32((int64_t)pid->ui_prev + MulShr((int64_t)pid->g.d, ud, FPGA_PID_D_FRAC));
+    int64_t out = Sat32((int64_t)ui + ud);
+
+    int64_t lim = (int64_t)pid->g.limit << FPGA_PID_STATE_FRAC;
+    if (out > lim)  out = lim;
+    if (out < -lim) out = -lim;
+
+    pid->e_prev  = (int32_t)e;
+    pid->ud_prev = ud;
+    pid->ui_prev = ui;
+    *dir = out < 0;
+    return (uint16_t)((out < 0 ? -out : out) >> FPGA_PID_STATE_FRAC);
+}
@@ -0,0 +1,55 @@
+// Filename : fpga_pid.h
+// Authors : Luis Moreno (s3608255), Luca Provenzano (s3487636)
+// Group : 43
+// License : N.A. or open source license like LGPL
+// Description : header file for the FPGA position loop (PID.v): gain conversion and bit-exact model
+//==============================================================
+
+#ifndef FPGA_PID_H
+#define FPGA_PID_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "spi_comm.h"
+
+#define FPGA_PID_HZ         FPGA_PWM_HZ // Update rate: once per PWM period (TopEntity PWM_FREQ / PID_DIV)
+#define FPGA_PID_COEF_FRAC  24      // a, b, c: signed Q7.24
+#define FPGA_PID_D_FRAC     32      // d: unsigned Q0.32
+#define FPGA_PID_STATE_FRAC 16      // uD, uI and the output: Q15.16 duty cycle units
+#define FPGA_PID_ERROR_MAX  8388607 // Errors saturate at 24 bits [counts]
+
+// Parameters of the 20-sim PID1 and SignalLimiter2 blocks of one axis.
+typedef struct PidParams {
+    double kp, tau_d, beta, tau_i;
+    double out_max;     // Symmetric output limit
+} PidParams;
+
+// State of one PID.v instance.
+typedef struct FpgaPid {
+    FpgaPidGains g;
+    int32_t e_prev, ud_prev, ui_prev;
+} FpgaPid;
+
+// Parameters of the 20-sim models: tilt drives pitch, pan drives yaw.
+void FpgaPidDefaultParams(PidParams *pitch, PidParams *yaw);
+
+// Converts the 20-sim parameters to PID.v coefficients, with the position in
+// encoder counts and the output in duty cycle units.
+// Returns 0, or -1 if a coefficient does not fit its fixed-point format.
+int FpgaPidGainsFrom(FpgaPidGains *g, const PidParams *p, double sample_s, double rad_per_count,
+                     double duty_per_unit);
+
+// Clears the states, as PID.v does while disabled.
+void FpgaPidReset(FpgaPid *pid, const FpgaPidGains *g);
+
+// One update of PID.v: returns the duty cycle and sets dir (1: negative output).
+uint16_t FpgaPidStep(FpgaPid *pid, int32_t position, int32_t setpoint, uint8_t *dir);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -10,6 +10,8 @@
 #include <math.h>
 #include <unistd.h>
 
+#include "clock_source.h"
+
 #define DFOV_DEG    55 //Obtained from camera manufacturer website
 #define HFOV_DEG    48.808 //Calculated
 #define VFOV_DEG    28.634 //Calculated
@@ -17,12 +19,6 @@
 #define HFOV_RAD    HFOV_DEG * M_PI / 180.0f
 #define VFOV_RAD    VFOV_DEG * M_PI / 180.0f
 
-// Definitions for the global shared variables
-std::atomic<bool> g_run(true);
-TargetData g_target_data;
-std::mutex g_target_mutex;
-
-
 /*********************************************
 * @brief Vision thread loop function
 * 
@@ -38,6 +34,9 @@ void vision_thread_func(GstElement *sink) {
     while(g_run) {
         // Attempt to process a new frame. 
         if (ProcessOneFrame(sink, x_offset, y_offset, obj_size)){
+            // The first processed frame releases the startup
+            if (g_first_frame_ns.load(std::memory_order_relaxed) == 0) g_first_frame_ns = ClockNowNs();
+
             // Update the shared data.
             {
                 std::lock_guard<std::mutex> lock(g_target_mutex);
@@ -53,6 +52,22 @@ void vision_thread_func(GstElement *sink) {
     printf("Vision thread finished.\n");
 }
 
+/*********************************************
+* @brief Waits until the vision thread has processed its first frame
+* 
+* @param [in] timeout_ms maximum wait in ms
+* 
+* @return true: a frame was processed; false: timeout or shutdown requested
+*********************************************/
+bool WaitForFirstFrame(unsigned timeout_ms) {
+    int64_t deadline = ClockNowNs() + (int64_t)timeout_ms * 1000000;
+    while (g_run && g_first_frame_ns.load() == 0) {
+        if (ClockNowNs() >= deadline) return false;
+        ClockSleepUs(1000);
+    }
+    return g_first_frame_ns.load() != 0;
+}
+
 /*********************************************
 * @brief Gstreamer Pipeline initilizer
 * 
@@ -14,25 +14,8 @@
 
 // For threading
 #include <thread>
-#include <mutex>
-#include <atomic>
 
-#include "controller/common/xxtypes.h" // For XXDouble
-
-#define MIN_OBJ_SIZE    2000
-
-// Shared data structure between threads
-struct TargetData {
-    XXDouble x_offset_rad = 0.0;
-    XXDouble y_offset_rad = 0.0;
-    double obj_size = 0.0;
-    bool new_frame = false;
-};
-
-// Global variables for thread communication
-extern std::atomic<bool> g_run;
-extern TargetData g_target_data;
-extern std::mutex g_target_mutex;
+#include "target_data.hpp" // Shared data: g_run, g_target_data, g_target_mutex
 
 
 // Initializes the GStreamer pipeline.
@@ -44,6 +27,9 @@ void CleanupGstreamerPipeline(GstElement* pipeline);
 // The main loop for the vision thread.
 void vision_thread_func(GstElement *sink);
 
+// Waits until the vision thread has processed its first frame.
+bool WaitForFirstFrame(unsigned timeout_ms);
+
 // Internal processing functions
 bool ProcessOneFrame(GstElement* appsink, double& x_offset_rad, double& y_offset_rad, double& obj_size);
 void ComputeAngles(int x_actual, int y_actual, int width, int height, double& x_offset_rad, double& y_offset_rad);
@@ -0,0 +1,183 @@
+// Filename : loop_telemetry.cpp
+// Authors : Luis Moreno (s3608255), Luca Provenzano (s3487636)
+// Group : 43
+// License : N.A. or open source license like LGPL
+// Description : Per-phase timing histograms of the control loop and their publisher thread
+//==============================================================
+#include "loop_telemetry.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "target_data.hpp" // Shared data: g_run
+
+// Global telemetry shared by the control thread (writer) and the publisher (reader)
+LoopTelemetry g_loop_telemetry;
+
+static const char *kPhaseNames[PhaseCount] = {
+    "read", "step", "write", "cycle", "period", "late"
+};
+
+
+/*********************************************
+* @brief Clears all the histograms and counters
+*
+* @param [inout] t telemetry to be cleared
+*
+* @return None.
+*********************************************/
+void TelemetryReset(LoopTelemetry *t) {
+    for (int p = 0; p < PhaseCount; p++) {
+        PhaseHistogram &h = t->phase[p];
+        for (int b = 0; b < TELEMETRY_BUCKETS; b++) h.buckets[b].store(0, std::memory_order_relaxed);
+        h.count.store(0, std::memory_order_relaxed);
+        h.sum_ns.store(0, std::memory_order_relaxed);
+        h.min_ns.store(INT64_MAX, std::memory_order_relaxed);
+        h.max_ns.store(0, std::memory_order_relaxed);
+    }
+    t->overruns.store(0, std::memory_order_relaxed);
+}
+
+
+/*********************************************
+* @brief Adds one sample to a phase histogram. There is a single writer, so
+*        plain relaxed loads and stores are enough, except for min/max: the
+*        reader swaps them out at the end of each window, so a new extreme
+*        is only stored by a compare-exchange against what is there.
+*
+* @param [inout] t      telemetry
+* @param [in]    phase  phase the sample belongs to
+* @param [in]    ns     duration in ns
+*
+* @return None.
+*********************************************/
+void TelemetryRecord(LoopTelemetry *t, TelemetryPhase phase, int64_t ns) {
+    PhaseHistogram &h = t->phase[phase];
+
+    if (ns < 0) ns = 0;
+    int64_t b = ns / TELEMETRY_BUCKET_NS;
+    if (b >= TELEMETRY_BUCKETS) b = TELEMETRY_BUCKETS - 1;
+
+    h.buckets[b].store(h.buckets[b].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    h.sum_ns.store(h.sum_ns.load(std::memory_order_relaxed) + (uint64_t)ns, std::memory_order_relaxed);
+    // Usually one load each: the compare-exchange only runs on a new extreme
+    int64_t min_ns = h.min_ns.load(std::memory_order_relaxed);
+    while (ns < min_ns && !h.min_ns.compare_exchange_weak(min_ns, ns, std::memory_order_relaxed)) {}
+    int64_t max_ns = h.max_ns.load(std::memory_order_relaxed);
+    while (ns > max_ns && !h.max_ns.compare_exchange_weak(max_ns, ns, std::memory_order_relaxed)) {}
+    // Count last, so a reader never sees more samples than bucket entries
+    h.count.store(h.count.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+
+/*********************************************
+* @brief Returns the upper edge of the bucket holding the requested percentile
+*
+* @param [in] delta  bucket counts of the window
+* @param [in] total  number of samples in the window
+* @param [in] pct    percentile in [0, 1]
+*
+* @return percentile value in us
+*********************************************/
+static double Percentile(const uint32_t *delta, uint64_t total, double pct) {
+    uint64_t target = (uint64_t)(pct * (double)total);
+    if (target >= total) target = total - 1;
+    uint64_t acc = 0;
+    for (int b = 0; b < TELEMETRY_BUCKETS; b++) {
+        acc += delta[b];
+        if (acc > target) return (double)(b + 1) * TELEMETRY_BUCKET_NS / 1000.0;
+    }
+    return (double)TELEMETRY_BUCKETS * TELEMETRY_BUCKET_NS / 1000.0;
+}
+
+
+/*********************************************
+* @brief Computes the statistics of each phase since the previous call,
+*        by differencing the histograms against the window snapshot
+*
+* @param [inout] t         telemetry
+* @param [inout] w         reader-side snapshot of the previous window
+* @param [out]   summary   statistics of each phase
+* @param [out]   overruns  pacer overruns in the window
+*
+* @return None.
+*********************************************/
+void TelemetrySummarize(LoopTelemetry *t, TelemetryWindow *w, PhaseSummary summary[PhaseCount],
+                        uint64_t *overruns) {
+    static uint32_t delta[TELEMETRY_BUCKETS];
+
+    for (int p = 0; p < PhaseCount; p++) {
+        PhaseHistogram &h = t->phase[p];
+        PhaseSummary &s = summary[p];
+
+        uint64_t count = h.count.load(std::memory_order_acquire);
+        uint64_t sum   = h.sum_ns.load(std::memory_order_relaxed);
+        for (int b = 0; b < TELEMETRY_BUCKETS; b++) {
+            uint32_t now = h.buckets[b].load(std::memory_order_relaxed);
+            delta[b] = now - w->buckets[p][b];
+            w->buckets[p][b] = now;
+        }
+
+        s.count = count - w->count[p];
+        s.mean_us = s.count ? (double)(sum - w->sum_ns[p]) / (double)s.count / 1000.0 : 0.0;
+        w->count[p]  = count;
+        w->sum_ns[p] = sum;
+
+        // Min/max are per window: swapped for fresh ones, so the extremes of a
+        // sample recorded meanwhile land in this window or the next, never lost
+        int64_t min_ns = h.min_ns.exchange(INT64_MAX, std::memory_order_relaxed);
+        s.min_us = (min_ns == INT64_MAX) ? 0.0 : min_ns / 1000.0;
+        s.max_us = h.max_ns.exchange(0, std::memory_order_relaxed) / 1000.0;
+
+        if (s.count) {
+            s.p50_us  = Percentile(delta, s.count, 0.50);
+            s.p99_us  = Percentile(delta, s.count, 0.99);
+            s.p999_us = Percentile(delta, s.count, 0.999);
+        } else {
+            s.p50_us = s.p99_us = s.p999_us = 0.0;
+        }
+    }
+
+    uint64_t total_overruns = t->overruns.load(std::memory_order_relaxed);
+    *overruns = total_overruns - w->overruns;
+    w->overruns = total_overruns;
+}
+
+
+/*********************************************
+* @brief Telemetry thread loop function, prints the loop timing once per period
+*
+* @param [in] period_ms publishing period in ms
+*
+* @return None.
+*********************************************/
+void telemetry_thread_func(unsigned period_ms) {
+    printf("Telemetry thread started.\n");
+
+    static TelemetryWindow window;
+    PhaseSummary summary[PhaseCount];
+    uint64_t overruns;
+
+    memset(&window, 0, sizeof(window));
+    unsigned elapsed_ms = 0;
+
+    while (g_run) {
+        usleep(10000); // Sleep 10ms, to react quickly to g_run
+        elapsed_ms += 10;
+        if (elapsed_ms < period_ms) continue;
+        elapsed_ms = 0;
+
+        TelemetrySummarize(&g_loop_telemetry, &window, summary, &overruns);
+        if (summary[PhaseCycle].count == 0) continue;
+
+        printf("[telemetry] %llu cycles, %llu overruns\n",
+               (unsigned long long)summary[PhaseCycle].count, (unsigned long long)overruns);
+        for (int p = 0; p < PhaseCount; p++) {
+            const PhaseSummary &s = summary[p];
+            printf("  %-6s mean %7.2f  min %7.2f  p50 %5.0f  p99 %5.0f  p99.9 %5.0f  max %8.2f us\n",
+                   kPhaseNames[p], s.mean_us, s.min_us, s.p50_us, s.p99_us, s.p999_us, s.max_us);
+        }
+    }
+    printf("Telemetry thread finished.\n");
+}
@@ -0,0 +1,73 @@
+// Filename : loop_telemetry.hpp
+// Authors : Luis Moreno (s3608255), Luca Provenzano (s3487636)
+// Group : 43
+// License : N.A. or open source license like LGPL
+// Description : Header file for the control loop timing telemetry
+//==============================================================
+
+#ifndef LOOP_TELEMETRY_HPP
+#define LOOP_TELEMETRY_HPP
+
+#include <atomic>
+#include <cstdint>
+
+#define TELEMETRY_BUCKETS    1024   // 1 us wide buckets, the last one collects the rest
+#define TELEMETRY_BUCKET_NS  1000
+
+// Timed phases of a control cycle.
+enum TelemetryPhase {
+    PhaseRead = 0,  // ReadPositionCmd SPI read
+    PhaseStep,      // ControllerStep
+    PhaseWrite,     // SendAllPwmCmd SPI write
+    PhaseCycle,     // Whole loop body, from wake-up to the end of the write
+    PhasePeriod,    // Time between consecutive wake-ups
+    PhaseLateness,  // Wake-up lateness reported by the pacer
+    PhaseCount
+};
+
+// Fixed-bucket histogram of one phase. Written only by the control thread,
+// except min/max, which the reader swaps for fresh ones at each window.
+struct PhaseHistogram {
+    std::atomic<uint32_t> buckets[TELEMETRY_BUCKETS];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum_ns;
+    std::atomic<int64_t>  min_ns;
+    std::atomic<int64_t>  max_ns;
+};
+
+struct LoopTelemetry {
+    PhaseHistogram phase[PhaseCount];
+    std::atomic<uint64_t> overruns;     // Pacer overruns, mirrored by the control thread
+};
+
+// Reader-side state used to compute the statistics of one publishing window.
+struct TelemetryWindow {
+    uint32_t buckets[PhaseCount][TELEMETRY_BUCKETS];
+    uint64_t count[PhaseCount];
+    uint64_t sum_ns[PhaseCount];
+    uint64_t overruns;
+};
+
+// Statistics of one phase over one window, in microseconds.
+struct PhaseSummary {
+    uint64_t count;
+    double mean_us, min_us, max_us;
+    double p50_us, p99_us, p999_us;
+};
+
+extern LoopTelemetry g_loop_telemetry;
+
+// Clears all histograms and counters.
+void TelemetryReset(LoopTelemetry *t);
+
+// Adds one sample to a phase histogram. Control thread only, lock and allocation free.
+void TelemetryRecord(LoopTelemetry *t, TelemetryPhase phase, int64_t ns);
+
+// Computes the statistics accumulated since the previous call for the same window.
+void TelemetrySummarize(LoopTelemetry *t, TelemetryWindow *w, PhaseSummary summary[PhaseCount],
+                        uint64_t *overruns);
+
+// Background loop publishing the loop timing every period_ms.
+void telemetry_thread_func(unsigned period_ms);
+
+#endif
@@ -1,7 +1,9 @@
 // main.cpp
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <csignal>
 #include <thread>
 #include <pthread.h>
@@ -10,6 +12,35 @@
 #include "controller/controller.h"
 #include "img_proc.hpp"
 #include "motor_control.hpp"
+#include "loop_telemetry.hpp"
+#include "flight_recorder.h"
+#include "clock_source.h"
+
+#define FIRST_FRAME_TIMEOUT_MS 5000 // Camera bring-up time after which tracking starts anyway
+#define SPIN_US_MAX            1000000 // Longest --spin-us busy-wait window, one second
+#define TELEMETRY_MS_MAX       3600000 // Longest --telemetry-ms period, one hour
+#define RATE_HZ_MAX            100000  // Fastest --rate-hz control loop
+#define CASCADE_MAX            1000    // Most --cascade inner cycles per outer loop run
+#define SPI_HZ_MAX             30000000 // Fastest --spi-hz, the highest clock the FPGA slave is simulated at
+
+// Start and end of one startup phase, in ns.
+struct StartupPhase {
+    const char *name;
+    int64_t start_ns, end_ns;
+};
+
+// Setpoint profile limits used by --traj (v [rad/s], a [rad/s^2], j [rad/s^3])
+static const TrajLimits kDefaultTraj = { 2.5, 30.0, 1000.0 };
+
+// Optional flight recorder, enabled with --record=<file>
+static FlightRecorder recorder;
+static const char *record_path = NULL;
+
+// Optional persisted homing calibration, enabled with --calib=<file>
+static const char *calib_path = NULL;
+
+// Homing with the FPGA stall detection, enabled with --fast-homing
+static bool fast_homing = false;
 
 /*********************************************
 * @brief Signal handler to stop the threads gracefully
@@ -38,6 +69,132 @@ int error(const char *msg, const int e_code, int fd) {
     return e_code;
 }
 
+/*********************************************
+* @brief Parses the integer value of a --name=N flag and checks its range
+* 
+* @param [in]  arg    whole flag, e.g. "--rate-hz=2000"
+* @param [in]  prefix length of the flag name up to and including '='
+* @param [in]  min    smallest value accepted
+* @param [in]  max    largest value accepted
+* @param [out] value  parsed value
+* 
+* @return 0: value parsed; -1: not a number or out of range (reported)
+*********************************************/
+static int ParseRange(const char *arg, size_t prefix, long min, long max, long *value) {
+    char *end;
+    errno = 0;
+    *value = strtol(arg + prefix, &end, 10);
+    if (end == arg + prefix || *end != '\0' || errno == ERANGE || *value < min || *value > max) {
+        fprintf(stderr, "Malformed option: %s (%ld to %ld)\n", arg, min, max);
+        return -1;
+    }
+    return 0;
+}
+
+/*********************************************
+* @brief Parses the optional command line flags following the device path
+* 
+* @param [in]  argc  argument count
+* @param [in]  argv  argument vector
+* @param [out] opts  control thread options
+* @param [out] telemetry_ms telemetry publishing period, 0 to disable
+* 
+* @return 0: flags parsed; -1: unknown or malformed flag
+*********************************************/
+int ParseOptions(int argc, char *argv[], ControlOptions *opts, unsigned *telemetry_ms) {
+    for (int i = 2; i < argc; i++) {
+        const char *arg = argv[i];
+        long value;
+        if (strcmp(arg, "--overrun=skip") == 0) {
+            opts->overrun_policy = PacerSkip;
+        } else if (strcmp(arg, "--overrun=catchup") == 0) {
+            opts->overrun_policy = PacerCatchUp;
+        } else if (strcmp(arg, "--overrun=rephase") == 0) {
+            opts->overrun_policy = PacerRephase;
+        } else if (strncmp(arg, "--spin-us=", 10) == 0) {
+            if (ParseRange(arg, 10, 0, SPIN_US_MAX, &value) != 0) return -1;
+            opts->spin_ns = (int64_t)value * 1000;
+        } else if (strncmp(arg, "--record=", 9) == 0) {
+            record_path = arg + 9;
+        } else if (strncmp(arg, "--calib=", 8) == 0) {
+            calib_path = arg + 8;
+        } else if (strcmp(arg, "--fast-homing") == 0) {
+            fast_homing = true;
+        } else if (strncmp(arg, "--telemetry-ms=", 15) == 0) {
+            if (ParseRange(arg, 15, 0, TELEMETRY_MS_MAX, &value) != 0) return -1;
+            *telemetry_ms = (unsigned)value;
+        } else if (strncmp(arg, "--rate-hz=", 10) == 0) {
+            if (ParseRange(arg, 10, 1, RATE_HZ_MAX, &value) != 0) return -1;
+            opts->period_ns = 1000000000LL / value;
+        } else if (strncmp(arg, "--cascade=", 10) == 0) {
+            if (ParseRange(arg, 10, 0, CASCADE_MAX, &value) != 0) return -1;
+            opts->outer_divider = (unsigned)value;
+        } else if (strncmp(arg, "--vel-window=", 13) == 0) {
+            if (ParseRange(arg, 13, 1, VEL_WINDOW_MAX - 1, &value) != 0) return -1;
+            opts->vel_window = (unsigned)value;
+        } else if (strcmp(arg, "--exchange") == 0) {
+            opts->exchange = true;
+        } else if (strcmp(arg, "--spi-thread") == 0) {
+            opts->spi_thread = true;
+        } else if (strcmp(arg, "--spi-crc") == 0) {
+            SpiSetChecked(1);
+        } else if (strcmp(arg, "--hw-dt") == 0) {
+            opts->hw_dt = true;
+        } else if (strcmp(arg, "--fpga-vel") == 0) {
+            opts->fpga_vel = true;
+        } else if (strcmp(arg, "--fpga-pid") == 0) {
+            opts->fpga_pid = true;
+        } else if (strncmp(arg, "--spi-hz=", 9) == 0) {
+            if (ParseRange(arg, 9, 1, SPI_HZ_MAX, &value) != 0) return -1;
+            SpiSetSpeed((unsigned)value);
+        } else if (strcmp(arg, "--traj") == 0) {
+            opts->traj = kDefaultTraj;
+        } else if (strncmp(arg, "--traj=", 7) == 0) {
+            if (sscanf(arg + 7, "%lf,%lf,%lf", &opts->traj.v_max, &opts->traj.a_max, &opts->traj.j_max) != 3 ||
+                opts->traj.a_max <= 0.0 || opts->traj.j_max <= 0.0) {
+                fprintf(stderr, "Malformed option: %s\n", arg);
+                return -1;
+            }
+        } else if (strncmp(arg, "--budget-us=", 12) == 0) {
+            int inner_us = 0, outer_us = 0;
+            if (sscanf(arg + 12, "%d,%d", &inner_us, &outer_us) != 2) {
+                fprintf(stderr, "Malformed option: %s\n", arg);
+                return -1;
+            }
+            opts->inner_budget_ns = (int64_t)inner_us * 1000;
+            opts->outer_budget_ns = (int64_t)outer_us * 1000;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", arg);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*********************************************
+* @brief Prints the time taken by each startup phase and the overlap gained
+*        by running them concurrently
+* 
+* @param [in] t_start  program start time in ns
+* @param [in] phases   startup phases
+* @param [in] n        number of phases
+* 
+* @return None.
+*********************************************/
+void PrintStartup(int64_t t_start, const StartupPhase *phases, size_t n) {
+    int64_t serial_ns = 0, ready_ns = 0;
+    printf("Startup:\n");
+    for (size_t i = 0; i < n; i++) {
+        const StartupPhase &p = phases[i];
+        printf("  %-16s %8.1f ms  (from %7.1f to %7.1f ms)\n", p.name, (p.end_ns - p.start_ns) / 1e6,
+               (p.start_ns - t_start) / 1e6, (p.end_ns - t_start) / 1e6);
+        serial_ns += p.end_ns - p.start_ns;
+        if (p.end_ns > ready_ns) ready_ns = p.end_ns;
+    }
+    printf("  time to track    %8.1f ms  (%.1f ms if run one after the other)\n",
+           (ready_ns - t_start) / 1e6, serial_ns / 1e6);
+}
+
 /*********************************************
 * @brief Main function, starts up the threads and closes them at finish
 * 
@@ -47,39 +204,96 @@ int main(int argc, char *argv[]) {
     // Register signal handler for Ctrl+C
     signal(SIGINT, signal_handler);
 
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <source_file>\n", argv[0]);
+    ControlOptions opts;
+    unsigned telemetry_ms = 1000;
+    if (argc < 2 || ParseOptions(argc, argv, &opts, &telemetry_ms) != 0) {
+        fprintf(stderr, "Usage: %s <source_file> [--overrun=skip|catchup|rephase] [--spin-us=N] "
+                        "[--telemetry-ms=N] [--record=<file>] [--calib=<file>] [--fast-homing]\n"
+                        "          [--rate-hz=N] [--cascade=N] [--vel-window=N] [--budget-us=I,O] [--traj[=V,A,J]]\n"
+                        "          [--exchange] [--spi-thread] [--spi-crc] [--spi-hz=N] [--hw-dt] [--fpga-vel]\n"
+                        "          [--fpga-pid]\n", argv[0]);
         return 1;
     }
     
     GstElement *pipeline, *sink;
+    int64_t t_start = ClockNowNs();
 
     // 1) Open SPI
-    int fd = SpiOpen(SPI_CHANNEL, SPI_SPEED_HZ, SPI_MODE);
+    StartupPhase spi_phase = { "spi open", t_start, 0 };
+    int fd = SpiOpen(SPI_CHANNEL, SpiGetSpeed(), SPI_MODE);
     if (fd < 0) return 1;
+    spi_phase.end_ns = ClockNowNs();
 
-    // 2) Homing procedure
+    // 2) Homing procedure, in the background: it only needs the SPI
     int32_t pitch_offset, yaw_offset;
     uint32_t pitch_max_steps, yaw_max_steps;
-    HomeBothAxes(fd, &pitch_offset, &yaw_offset, &pitch_max_steps, &yaw_max_steps);
+    StartupPhase homing_phase = { "homing", ClockNowNs(), 0 };
+    std::thread homing_thr([&] {
+        if (calib_path != NULL) {
+            HomeWithCalibration(fd, calib_path, &pitch_offset, &yaw_offset, &pitch_max_steps, &yaw_max_steps,
+                                fast_homing);
+        } else {
+            HomeBothAxes(fd, &pitch_offset, &yaw_offset, &pitch_max_steps, &yaw_max_steps, fast_homing);
+        }
+        homing_phase.end_ns = ClockNowNs();
+    });
+
+    // 3) Meanwhile: controller, camera pipeline and vision thread
+    StartupPhase controller_phase = { "controller init", ClockNowNs(), 0 };
+    ControllerInitialize();
+    controller_phase.end_ns = ClockNowNs();
+
+    StartupPhase gst_phase = { "gstreamer init", ClockNowNs(), 0 };
+    if (InitGstreamerPipeline(argv[1], &pipeline, &sink) != 0) {
+        homing_thr.join();
+        SpiClose(fd);
+        return -1;
+    }
+    gst_phase.end_ns = ClockNowNs();
+
+    // The vision thread starts processing frames while homing goes on
+    std::thread vision_thr(vision_thread_func, sink);
+
+    StartupPhase frame_phase = { "first frame", gst_phase.end_ns, 0 };
+    if (!WaitForFirstFrame(FIRST_FRAME_TIMEOUT_MS) && g_run) {
+        fprintf(stderr, "Warning: no camera frame after %d ms, starting anyway.\n", FIRST_FRAME_TIMEOUT_MS);
+    }
+    frame_phase.end_ns = g_first_frame_ns ? g_first_frame_ns.load() : ClockNowNs();
+
+    // 4) Tracking starts once both homing and the first frame are ready
+    homing_thr.join();
 
     if (!g_run) { // Check if Ctrl+C was pressed during homing
         printf("Shutdown signal received during homing. Exiting.\n");
+        vision_thr.join();
         SpiClose(fd);
+        CleanupGstreamerPipeline(pipeline);
         return 0;
     }
 
-    // 3) Init Controller and GStreamer
-    ControllerInitialize();
-    if (InitGstreamerPipeline(argv[1], &pipeline, &sink) != 0) {
-        SpiClose(fd);
-        return -1;
-    }
+    const StartupPhase phases[] = { spi_phase, homing_phase, controller_phase, gst_phase, frame_phase };
+    PrintStartup(t_start, phases, sizeof(phases) / sizeof(phases[0]));
     
-    // 4) Start Threads
+    // Flight recorder ring, its snapshots are written by a helper thread
+    std::thread recorder_thr;
+    if (record_path != NULL) {
+        if (FrOpen(&recorder, record_path, FR_DEFAULT_CAPACITY, FR_DEFAULT_POST) == 0) {
+            opts.recorder = &recorder;
+            recorder_thr = std::thread(FrServiceLoop, &recorder);
+        } else {
+            fprintf(stderr, "Warning: flight recorder disabled.\n");
+        }
+    }
+
+    // Frames seen during homing were taken with the gimbal moving
+    {
+        std::lock_guard<std::mutex> lock(g_target_mutex);
+        g_target_data.new_frame = false;
+    }
+
+    // 5) Start the control thread
     printf("Starting threads...\n");
-    std::thread control_thr(control_thread_func, fd, pitch_offset, yaw_offset, pitch_max_steps, yaw_max_steps);
-    std::thread vision_thr(vision_thread_func, sink);
+    std::thread control_thr(control_thread_func, fd, pitch_offset, yaw_offset, pitch_max_steps, yaw_max_steps, opts);
 
     // Set CPU affinity for threads
     cpu_set_t cpuset_control;
@@ -101,12 +315,22 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "Warning: Error setting CPU affinity for Vision Thread: %d\n", rc_vision);
     }
 
-    // 5) Wait for threads to finish
+    // Telemetry publisher, runs on whatever core is free
+    std::thread telemetry_thr;
+    if (telemetry_ms > 0) telemetry_thr = std::thread(telemetry_thread_func, telemetry_ms);
+
+    // 6) Wait for threads to finish
     // The threads will run until g_run is set to false (by Ctrl+C)
     control_thr.join();
     vision_thr.join();
+    if (telemetry_thr.joinable()) telemetry_thr.join();
+    if (recorder_thr.joinable()) {
+        FrStop(&recorder);
+        recorder_thr.join();
+        FrClose(&recorder);
+    }
 
-    // 6) Stop & close
+    // 7) Stop & close
     printf("Stopping motors and closing SPI.\n");
     SendAllPwmCmd(fd, 0,0,0, 0,0,0);
     SpiClose(fd);
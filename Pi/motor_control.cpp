@@ -7,21 +7,205 @@
 #include "motor_control.hpp"
 
 #include <stdio.h>
-#include <unistd.h>
 #include <time.h>
 #include <math.h>
+#include <thread>
 
 #include "spi_comm.h"
+#include "fpga_pid.h"
+#include "pacer.h"
+#include "cascade.h"
+#include "trajectory.h"
+#include "clock_source.h"
+#include "calibration.h"
+#include "loop_telemetry.hpp"
+#include "spi_io.hpp"
 #include "controller/controller.h"
 #include "controller/steps2rads.h"
-#include "img_proc.hpp" // Shared data: g_run, g_target_data, g_target_mutex
+#include "target_data.hpp" // Shared data: g_run, g_target_data, g_target_mutex
 
 // Constants for control loop
 #define LOOP_HZ         10000 // 10kHz control loop
 #define PERIOD_NS       (1000000000L / LOOP_HZ)
+#define HW_DT_MAX_PERIODS 4 // Longest FPGA sample interval used as dt, in loop periods
 #define ENCODER_ERROR_TOLERANCE  2
 #define HOMING_STALL_THRESHOLD  50
+#define HOMING_POLL_US         10000
+#define CALIB_STALL_THRESHOLD  25    // Verification touch: 25 x 2 ms without movement
+#define CALIB_POLL_US          2000
+#define CALIB_TOLERANCE_STEPS  100   // Allowed distance between stored and found stop
+#define FAST_HOMING_POLL_US      1000
+#define FAST_HOMING_SPINUP_US    100000 // Idle flag trusted after this long even if the axis never moved
+#define FAST_HOMING_FALLBACK     100    // Polls without movement that make a stall if the flag never rises
+#define FAST_HOMING_BACKOFF      1000   // Counts backed off after the fast touch (~0.05 rad)
+#define FAST_HOMING_SLOW_ZONE    2000   // Counts before a known stop where the approach slows down
+#define FAST_HOMING_SLOW_DUTY    ((uint16_t)(0.06 * ((1 << 12) - 1)))
 #define MAX_SAFE_DUTY  ((uint16_t)(0.2 * ((1 << 12) - 1)))
+#define TRAJ_REPLAN_RAD  0.005 // Destination change that triggers a new setpoint profile
+#define SPI_IO_START_TIMEOUT_US 100000 // Wait for the first sample of the SPI thread
+
+
+/*********************************************
+* @brief Drives the selected axes into their end stops and waits until each
+*        one stalls, i.e. moves less than ENCODER_ERROR_TOLERANCE counts
+*        for stall_samples consecutive polls
+* 
+* @param [in]  spi_fd        SPI communication handle
+* @param [in]  active        axes to be driven, indexed pitch, yaw
+* @param [in]  dir           direction of each axis, 1 towards the lower stop
+* @param [out] stop_pos      counter value of each axis once stalled
+* @param [in]  duty          PWM duty used for the approach
+* @param [in]  poll_us       time between two polls
+* @param [in]  stall_samples polls without movement that make a stall
+* 
+* @return None.
+*********************************************/
+static void DriveToLimits(int spi_fd, const bool active[2], const uint8_t dir[2], int32_t stop_pos[2],
+                          uint16_t duty, unsigned poll_us, int stall_samples) {
+    int32_t current[2] = { 0, 0 };
+    if (ReadPositionCmd(spi_fd, UnitAll, &current[0], &current[1]) < 0) {
+        fprintf(stderr, "Homing: Failed initial read.\n");
+    }
+
+    int32_t last[2] = { current[0], current[1] };
+    int stall_counter[2] = { 0, 0 };
+    bool homed[2] = { !active[0], !active[1] };
+
+    // PWM write and position read of each poll go out in one message
+    SpiSession spi;
+    SpiSessionInit(&spi, spi_fd, SpiGetSpeed());
+    const spi_op_t poll_ops[2] = { SpiOpWriteAll, SpiOpReadAll };
+
+    while (!homed[0] || !homed[1]) {
+        // Enable only the motors that still need homing
+        SpiSessionSetPwm(&spi, homed[0] ? 0 : duty, !homed[0], dir[0],
+                               homed[1] ? 0 : duty, !homed[1], dir[1]);
+
+        // Read current position
+        if (SpiSessionRun(&spi, poll_ops, 2) < 0) {
+            fprintf(stderr, "Homing: Failed to read position, retrying...\n");
+            ClockSleepUs(poll_us);
+            continue;
+        }
+        SpiSessionPositions(&spi, SpiOpReadAll, &current[0], &current[1]);
+
+        // Detect the stall of each axis
+        for (int a = 0; a < 2; a++) {
+            if (homed[a]) continue;
+            stall_counter[a] = (abs(current[a] - last[a]) < ENCODER_ERROR_TOLERANCE)
+                ? stall_counter[a] + 1 : 0;
+            last[a] = current[a];
+
+            if (stall_counter[a] >= stall_samples) {
+                homed[a] = true;
+                stop_pos[a] = current[a];
+            }
+        }
+
+        ClockSleepUs(poll_us);
+    }
+    SendAllPwmCmd(spi_fd, 0, 0, 0, 0, 0, 0); // Stop motors
+}
+
+
+// Phases of one axis during fast homing
+enum FastPhase { FastApproach, FastBackOff, FastSlowApproach, FastDone };
+
+/*********************************************
+* @brief Fast homing towards the end stops, using the FPGA idle detection
+*        (command 0x23) polled every millisecond. Each axis approaches at
+*        MAX_SAFE_DUTY and slows down to FAST_HOMING_SLOW_DUTY near its
+*        stop: when the stop position is known, from FAST_HOMING_SLOW_ZONE
+*        counts before it; otherwise after a first fast touch, a short
+*        back-off and a second, slow touch that gives the stop position.
+* 
+* @param [in]  spi_fd   SPI communication handle
+* @param [in]  active   axes to be driven, indexed pitch, yaw
+* @param [in]  dir      direction of each axis, 1 towards the lower stop
+* @param [in]  expected expected stop position of each axis, NULL if unknown
+* @param [out] stop_pos counter value of each axis at the slow touch
+* 
+* @return None.
+*********************************************/
+static void FastDriveToLimits(int spi_fd, const bool active[2], const uint8_t dir[2],
+                              const int32_t *expected, int32_t stop_pos[2]) {
+    FastPhase phase[2] = { active[0] ? FastApproach : FastDone, active[1] ? FastApproach : FastDone };
+    int32_t current[2] = { 0, 0 }, last[2] = { 0, 0 }, touch[2] = { 0, 0 };
+    uint8_t motion[2] = { MOTION_IDLE, MOTION_IDLE };
+    bool moved[2] = { false, false };
+    int still[2] = { 0, 0 };
+    int64_t phase_start[2] = { ClockNowNs(), ClockNowNs() };
+
+    if (ReadMotionCmd(spi_fd, &last[0], &last[1], &motion[0], &motion[1]) < 0) {
+        fprintf(stderr, "Homing: Failed initial read.\n");
+    }
+
+    while (phase[0] != FastDone || phase[1] != FastDone) {
+        uint16_t duty[2];
+        uint8_t drive_dir[2];
+        for (int a = 0; a < 2; a++) {
+            bool back = phase[a] == FastBackOff;
+            duty[a]      = (phase[a] == FastApproach) ? MAX_SAFE_DUTY : FAST_HOMING_SLOW_DUTY;
+            drive_dir[a] = back ? !dir[a] : dir[a];
+        }
+        SendAllPwmCmd(spi_fd, phase[0] == FastDone ? 0 : duty[0], phase[0] != FastDone, drive_dir[0],
+                              phase[1] == FastDone ? 0 : duty[1], phase[1] != FastDone, drive_dir[1]);
+
+        ClockSleepUs(FAST_HOMING_POLL_US);
+        if (ReadMotionCmd(spi_fd, &current[0], &current[1], &motion[0], &motion[1]) < 0) {
+            fprintf(stderr, "Homing: Failed to read position, retrying...\n");
+            continue;
+        }
+
+        int64_t now = ClockNowNs();
+        for (int a = 0; a < 2; a++) {
+            if (phase[a] == FastDone) continue;
+
+            // The idle flag of an axis at rest is set from the start: it only
+            // means a stall once the axis moved the commanded way, or after the
+            // spin-up time for an axis that was already against its stop
+            uint8_t towards = drive_dir[a] ? MOTION_DOWN : MOTION_UP;
+            if (motion[a] == towards) moved[a] = true;
+            still[a] = (abs(current[a] - last[a]) < ENCODER_ERROR_TOLERANCE) ? still[a] + 1 : 0;
+            last[a] = current[a];
+            bool stalled = (motion[a] == MOTION_IDLE &&
+                            (moved[a] || now - phase_start[a] >= FAST_HOMING_SPINUP_US * 1000LL)) ||
+                           still[a] >= FAST_HOMING_FALLBACK;
+
+            FastPhase next = phase[a];
+            switch (phase[a]) {
+            case FastApproach:
+                if (expected != NULL && abs(expected[a] - current[a]) <= FAST_HOMING_SLOW_ZONE) {
+                    next = FastSlowApproach;
+                } else if (stalled) {
+                    // A known stop found before its slow zone is reported as is
+                    stop_pos[a] = current[a];
+                    touch[a] = current[a];
+                    next = (expected != NULL) ? FastDone : FastBackOff;
+                }
+                break;
+            case FastBackOff:
+                if (abs(current[a] - touch[a]) >= FAST_HOMING_BACKOFF || stalled) next = FastSlowApproach;
+                break;
+            case FastSlowApproach:
+                if (stalled) {
+                    stop_pos[a] = current[a];
+                    next = FastDone;
+                }
+                break;
+            case FastDone:
+                break;
+            }
+            if (next != phase[a]) {
+                phase[a] = next;
+                phase_start[a] = now;
+                moved[a] = false;
+                still[a] = 0;
+            }
+        }
+    }
+    SendAllPwmCmd(spi_fd, 0, 0, 0, 0, 0, 0); // Stop motors
+}
 
 
 /*********************************************
@@ -32,97 +216,151 @@
 * @param [inout]    yaw_offset_out Yaw offset from initial position
 * @param [out]      pitch_max_steps Pitch counted max steps
 * @param [out]      yaw_max_steps Yaw counted max steps
+* @param [in]       fast Use the FPGA stall detection (FastDriveToLimits)
 * 
 * @return None.
 *********************************************/
 void HomeBothAxes(int spi_fd, int32_t* pitch_offset_out, int32_t* yaw_offset_out,
-                                uint32_t* pitch_max_steps, uint32_t* yaw_max_steps) {
-    printf("Homing both axes simultaneously...\n");
+                                uint32_t* pitch_max_steps, uint32_t* yaw_max_steps, bool fast) {
+    printf("Homing both axes simultaneously%s...\n", fast ? " (fast)" : "");
 
     SendAllPwmCmd(spi_fd, 0, 0, 0, 0, 0, 0); // Stop motors before homing
     
     uint16_t homing_duty = (uint16_t)(0.15 * ((1 << 12) - 1));
-    
-    int32_t current_pitch = 0, current_yaw = 0;
-    if (ReadPositionCmd(spi_fd, UnitAll, &current_pitch, &current_yaw) < 0) {
-        fprintf(stderr, "Homing: Failed initial read.\n");
-    }
+    const bool both[2] = { true, true };
+    int32_t stop_pos[2] = { 0, 0 };
+
+    // First pass towards the lower stops sets the offsets
+    const uint8_t lower[2] = { 1, 1 };
+    if (fast) FastDriveToLimits(spi_fd, both, lower, NULL, stop_pos);
+    else DriveToLimits(spi_fd, both, lower, stop_pos, homing_duty, HOMING_POLL_US, HOMING_STALL_THRESHOLD);
+    *pitch_offset_out = stop_pos[0];
+    *yaw_offset_out   = stop_pos[1];
+
+    // Second pass towards the upper stops sets the max steps
+    const uint8_t upper[2] = { 0, 0 };
+    if (fast) FastDriveToLimits(spi_fd, both, upper, NULL, stop_pos);
+    else DriveToLimits(spi_fd, both, upper, stop_pos, homing_duty, HOMING_POLL_US, HOMING_STALL_THRESHOLD);
+    *pitch_max_steps = abs(stop_pos[0] - *pitch_offset_out);
+    *yaw_max_steps   = abs(stop_pos[1] - *yaw_offset_out);
 
-    int32_t last_pitch = current_pitch;
-    int32_t last_yaw = current_yaw;
-    
-    int pitch_stall_counter = 0;
-    int yaw_stall_counter = 0;
-    
-    bool pitch_homed = false;
-    bool yaw_homed = false;
-
-    // Two iterations, one for each limit
-    for (uint8_t i = 0; i < 2; i++) {
-        while (!pitch_homed || !yaw_homed) {
-            // Enable only the motors that still need homing
-            uint16_t pitch_drive_duty = pitch_homed ? 0 : homing_duty;
-            uint16_t yaw_drive_duty = yaw_homed ? 0 : homing_duty;
-
-            // First pass forward, second pass reverse
-            uint8_t dir = i == 0 ? 1 : 0;
-
-            SendAllPwmCmd(spi_fd, pitch_drive_duty, !pitch_homed, dir, 
-                                yaw_drive_duty, !yaw_homed, dir);
-
-            // Read current position
-            if (ReadPositionCmd(spi_fd, UnitAll, &current_pitch, &current_yaw) < 0) {
-                fprintf(stderr, "Homing: Failed to read position, retrying...\n");
-                usleep(10000);
-                continue;
-            }
+    printf("Homing complete for both axes.\n");
+}
 
-            // Detect pitch stall
-            if (!pitch_homed) {
-                pitch_stall_counter = (abs(current_pitch - last_pitch) < ENCODER_ERROR_TOLERANCE)
-                    ? pitch_stall_counter + 1 : 0;
-                last_pitch = current_pitch;
-
-                if (pitch_stall_counter >= HOMING_STALL_THRESHOLD) {
-                    pitch_homed = true;
-                    if (i == 0)
-                        // First pass sets the offset
-                        *pitch_offset_out = current_pitch;
-                    else
-                        // Second pass sets the max steps
-                        *pitch_max_steps = abs(current_pitch - *pitch_offset_out);
-                }
-            }
 
-            // Detect yaw stall
-            if (!yaw_homed) {
-                yaw_stall_counter = (abs(current_yaw - last_yaw) < ENCODER_ERROR_TOLERANCE)
-                    ? yaw_stall_counter + 1 : 0;
-                last_yaw = current_yaw;
-
-                if (yaw_stall_counter >= HOMING_STALL_THRESHOLD) {
-                    yaw_homed = true;
-                    if (i == 0)
-                        // First pass sets the offset
-                        *yaw_offset_out = current_yaw;
-                    else
-                        // Second pass sets the max steps
-                        *yaw_max_steps = abs(current_yaw - *yaw_offset_out);
-                }
-            }
+/*********************************************
+* @brief Checks a stored calibration by touching, on each axis, the end
+*        stop closest to the current position and comparing where it is
+*        found with where the calibration puts it. The axes are left at
+*        their upper stops, like after HomeBothAxes.
+* 
+* @param [in] spi_fd SPI communication handle
+* @param [in] c      calibration to be verified
+* @param [in] fast   Use the FPGA stall detection, slowing down near the stored stops
+* 
+* @return true: both axes agree with the calibration; false: full homing needed
+*********************************************/
+static bool VerifyCalibration(int spi_fd, const Calibration *c, bool fast) {
+    const int32_t offset[2]    = { c->pitch_offset, c->yaw_offset };
+    const uint32_t max_steps[2] = { c->pitch_max_steps, c->yaw_max_steps };
+
+    int32_t current[2];
+    if (ReadPositionCmd(spi_fd, UnitAll, &current[0], &current[1]) < 0) return false;
+
+    const bool both[2] = { true, true };
+    uint8_t dir[2];
+    int32_t expected[2];
+    for (int a = 0; a < 2; a++) {
+        if (max_steps[a] == 0) return false;
+
+        // The counter must lie between the stored stops, otherwise the FPGA was reset
+        int32_t abs_pos = current[a] - offset[a];
+        if (abs_pos < -CALIB_TOLERANCE_STEPS || abs_pos > (int32_t)max_steps[a] + CALIB_TOLERANCE_STEPS) {
+            printf("Calibration: axis %d out of the stored range (%d of %u).\n", a, abs_pos, max_steps[a]);
+            return false;
+        }
+        bool to_lower = abs_pos < (int32_t)(max_steps[a] / 2);
+        dir[a]      = to_lower ? 1 : 0;
+        expected[a] = to_lower ? offset[a] : offset[a] + (int32_t)max_steps[a];
+    }
 
-            usleep(10000);
+    int32_t stop_pos[2] = { 0, 0 };
+    uint16_t homing_duty = (uint16_t)(0.15 * ((1 << 12) - 1));
+    if (fast) FastDriveToLimits(spi_fd, both, dir, expected, stop_pos);
+    else DriveToLimits(spi_fd, both, dir, stop_pos, homing_duty, CALIB_POLL_US, CALIB_STALL_THRESHOLD);
+
+    for (int a = 0; a < 2; a++) {
+        if (abs(stop_pos[a] - expected[a]) > CALIB_TOLERANCE_STEPS) {
+            printf("Calibration: axis %d stop found at %d, expected %d.\n", a, stop_pos[a], expected[a]);
+            return false;
         }
+    }
 
-        // Prepare for next homing pass
-        pitch_homed = false;
-        yaw_homed = false;
-        pitch_stall_counter = 0;
-        yaw_stall_counter = 0;
+    // Full homing ends at the upper stops: the axes that touched a lower
+    // stop move there too, so tracking starts from the same pose either way
+    bool park[2];
+    for (int a = 0; a < 2; a++) {
+        park[a]     = dir[a] == 1;
+        dir[a]      = 0;
+        expected[a] = offset[a] + (int32_t)max_steps[a];
     }
+    if (!park[0] && !park[1]) return true;
+    if (fast) FastDriveToLimits(spi_fd, park, dir, expected, stop_pos);
+    else DriveToLimits(spi_fd, park, dir, stop_pos, homing_duty, CALIB_POLL_US, CALIB_STALL_THRESHOLD);
+
+    for (int a = 0; a < 2; a++) {
+        if (park[a] && abs(stop_pos[a] - expected[a]) > CALIB_TOLERANCE_STEPS) {
+            printf("Calibration: axis %d upper stop found at %d, expected %d.\n", a, stop_pos[a], expected[a]);
+            return false;
+        }
+    }
+    return true;
+}
 
-    printf("Homing complete for both axes.\n");
-    SendAllPwmCmd(spi_fd, 0, 0, 0, 0, 0, 0); // Stop motors
+
+/*********************************************
+* @brief Homing with a persisted calibration: the stored offsets and max
+*        steps are verified with a single-limit touch, and full homing only
+*        runs (and refreshes the file) when they cannot be trusted
+* 
+* @param [in]  spi_fd           SPI communication handle
+* @param [in]  calib_path       calibration file
+* @param [out] pitch_offset_out Pitch offset from initial position
+* @param [out] yaw_offset_out   Yaw offset from initial position
+* @param [out] pitch_max_steps  Pitch counted max steps
+* @param [out] yaw_max_steps    Yaw counted max steps
+* @param [in]  fast             Use the FPGA stall detection
+* 
+* @return true: stored calibration verified; false: full homing was run
+*********************************************/
+bool HomeWithCalibration(int spi_fd, const char *calib_path, int32_t* pitch_offset_out, int32_t* yaw_offset_out,
+                         uint32_t* pitch_max_steps, uint32_t* yaw_max_steps, bool fast) {
+    Calibration c;
+    int err = CalibLoad(calib_path, &c);
+    if (err == 0) {
+        printf("Verifying stored calibration %s...\n", calib_path);
+        if (VerifyCalibration(spi_fd, &c, fast)) {
+            *pitch_offset_out = c.pitch_offset;
+            *yaw_offset_out   = c.yaw_offset;
+            *pitch_max_steps  = c.pitch_max_steps;
+            *yaw_max_steps    = c.yaw_max_steps;
+            printf("Calibration verified, full homing skipped.\n");
+            return true;
+        }
+    } else if (err != CALIB_ERR_MISSING) {
+        printf("Calibration file %s is invalid (%d).\n", calib_path, err);
+    }
+
+    HomeBothAxes(spi_fd, pitch_offset_out, yaw_offset_out, pitch_max_steps, yaw_max_steps, fast);
+
+    c.pitch_offset    = *pitch_offset_out;
+    c.yaw_offset      = *yaw_offset_out;
+    c.pitch_max_steps = *pitch_max_steps;
+    c.yaw_max_steps   = *yaw_max_steps;
+    if (g_run && CalibSave(calib_path, &c) != 0) {
+        fprintf(stderr, "Warning: could not save the calibration to %s.\n", calib_path);
+    }
+    return false;
 }
 
 
@@ -134,11 +372,13 @@ void HomeBothAxes(int spi_fd, int32_t* pitch_offset_out, int32_t* yaw_offset_out
 * @param [in] yaw_offset Yaw offset from initial position in steps
 * @param [in] pitch_max_steps Pitch max steps in full range rotation
 * @param [in] yaw_max_steps Yaw max steps in full range rotation
+* @param [in] opts Runtime options (overrun policy, spin window, recorder, cascade)
 * 
 * @return None.
 *********************************************/
 void control_thread_func(int spi_fd, int32_t pitch_offset, int32_t yaw_offset, 
-                         uint32_t pitch_max_steps, uint32_t yaw_max_steps) {
+                         uint32_t pitch_max_steps, uint32_t yaw_max_steps,
+                         ControlOptions opts) {
     printf("Control thread started.\n");
 
     // Convert max steps to radians
@@ -147,7 +387,7 @@ void control_thread_func(int spi_fd, int32_t pitch_offset, int32_t yaw_offset,
 
     // Forward declaration of loop variables
     int32_t raw_p, raw_y, abs_p, abs_y; 
-    XXDouble pitch_curr_pos_rad, yaw_curr_pos_rad, pitch_dst_rad, yaw_dst_rad, pan_out, tilt_out;
+    XXDouble pitch_curr_pos_rad, yaw_curr_pos_rad, pitch_dst_rad, yaw_dst_rad, pan_out, tilt_out, dt;
     TargetData current_target;
     uint16_t pan_duty, tlt_duty;
     uint8_t pan_dir, tlt_dir;
@@ -156,15 +396,90 @@ void control_thread_func(int spi_fd, int32_t pitch_offset, int32_t yaw_offset,
     pitch_dst_rad = steps2rads((int32_t)pitch_max_steps/2, (int32_t)pitch_max_steps, PITCH_RANGE_RAD);
     yaw_dst_rad   = steps2rads((int32_t)yaw_max_steps/2, (int32_t)yaw_max_steps, YAW_RANGE_RAD);
 
-    // Initialize timing
-    struct timespec next_time;
-    clock_gettime(CLOCK_MONOTONIC, &next_time);
+    // Prebuilt SPI transfers, the loop only rewrites the PWM payload
+    SpiSession spi;
+    SpiSessionInit(&spi, spi_fd, SpiGetSpeed());
+    bool fpga_pid = opts.fpga_pid && !opts.spi_thread;
+    const spi_op_t read_op  = fpga_pid ? SpiOpPidExchange : opts.fpga_vel ? SpiOpVelocity :
+                              opts.exchange ? SpiOpExchange : SpiOpReadAll;
+    const spi_op_t write_op = SpiOpWriteAll;
 
-    struct timespec last_step, now;
-    clock_gettime(CLOCK_MONOTONIC, &last_step);
+    // Initialize timing
+    int64_t period_ns = opts.period_ns > 0 ? opts.period_ns : PERIOD_NS;
+
+    // Optional SPI thread at the loop rate, inheriting the scheduling of this thread
+    SpiIo io;
+    SpiSample sample;
+    SpiPwm pwm;
+    std::thread spi_thr;
+    if (opts.spi_thread) {
+        SpiIoInit(&io);
+        spi_thr = std::thread(spi_io_thread_func, &io, spi_fd, period_ns, opts.exchange);
+        if (!SpiIoWaitFirstSample(&io, SPI_IO_START_TIMEOUT_US)) {
+            fprintf(stderr, "Error: SPI thread did not start.\n");
+            g_run = false;
+        }
+    }
+    Pacer pacer;
+    PacerInit(&pacer, period_ns, opts.overrun_policy, opts.spin_ns);
+
+    // Cascaded controller: the outer loop (vision target, position) runs every
+    // outer_divider cycles, the inner velocity loop on every cycle
+    bool cascade_on = opts.outer_divider > 0 && !fpga_pid;
+    Cascade cascade;
+    CascadeGains pitch_gains, yaw_gains;
+    CascadeDefaultGains(&pitch_gains, &yaw_gains);
+    CascadeInit(&cascade, &pitch_gains, &yaw_gains, opts.vel_window, opts.outer_divider,
+                opts.inner_budget_ns > 0 ? opts.inner_budget_ns : period_ns / 2, opts.outer_budget_ns);
+
+    // Setpoint profiles, started from the measured position on the first cycle
+    bool traj_on = opts.traj.v_max > 0.0, traj_started = false;
+    Trajectory pitch_traj, yaw_traj;
+    XXDouble pitch_ref_rad, yaw_ref_rad, pitch_ff = 0.0, yaw_ff = 0.0;
+
+    // Phase timestamps for the telemetry, in ns
+    int64_t t_wake = PacerNow(), t_prev_wake = t_wake, t_read, t_step, t_write;
+    int64_t last_step = t_wake;
+    TelemetryReset(&g_loop_telemetry);
+
+    // Flight recorder state
+    FrRecord rec = {};
+    bool tracking = false;
+    bool have_positions = false;
+    unsigned held = 0, held_total = 0;
+
+    // FPGA sample times of the positions, for opts.hw_dt
+    uint32_t stamp = 0, last_stamp = 0;
+    bool stamped = false, have_stamp = false;
+    uint64_t hw_dt_cycles = 0;
+
+    // FPGA velocity estimates of the positions, for opts.fpga_vel
+    EncoderVelocity pitch_vel = { 0, 0 }, yaw_vel = { 0, 0 };
+    bool fpga_vel = opts.fpga_vel && cascade_on && !opts.spi_thread;
+    const double pitch_rad_per_count = steps2rads(1, (int32_t)pitch_max_steps, PITCH_RANGE_RAD);
+    const double yaw_rad_per_count   = steps2rads(1, (int32_t)yaw_max_steps, YAW_RANGE_RAD);
+    uint64_t last_overruns = 0;
+
+    // FPGA position loops, for opts.fpga_pid: the 20-sim gains at the FPGA
+    // update rate, with the same duty scale as the PWM written from here.
+    // They start with the first setpoints; the PWM write on exit stops them.
+    if (fpga_pid) {
+        PidParams pitch_pid, yaw_pid;
+        FpgaPidGains pitch_g, yaw_g;
+        FpgaPidDefaultParams(&pitch_pid, &yaw_pid);
+        if (FpgaPidGainsFrom(&pitch_g, &pitch_pid, 1.0 / FPGA_PID_HZ, pitch_rad_per_count, MAX_SAFE_DUTY) < 0 ||
+            FpgaPidGainsFrom(&yaw_g, &yaw_pid, 1.0 / FPGA_PID_HZ, yaw_rad_per_count, MAX_SAFE_DUTY) < 0 ||
+            SendPidGainsCmd(spi_fd, UnitPitch, &pitch_g) < 0 || SendPidGainsCmd(spi_fd, UnitYaw, &yaw_g) < 0) {
+            fprintf(stderr, "Error: Failed to load the FPGA position loop gains.\n");
+            g_run = false;
+        }
+    }
 
     while (g_run) {
-        {
+        // The target is only sampled by the outer loop
+        bool outer_due = cascade_on ? CascadeTick(&cascade) : true;
+        int64_t outer_ns = 0, outer_step_ns = 0, t_outer = PacerNow();
+        if (outer_due) {
             // Check for new target data
             std::lock_guard<std::mutex> lock(g_target_mutex);
             current_target = g_target_data;
@@ -172,14 +487,45 @@ void control_thread_func(int spi_fd, int32_t pitch_offset, int32_t yaw_offset,
                     // Reset the new frame flag
                     g_target_data.new_frame = false;
             }
+            outer_ns = PacerNow() - t_outer;
+        } else {
+            current_target.new_frame = false;
         }
 
-        // Read current position from encoders
-        if (ReadPositionCmd(spi_fd, UnitAll, &raw_p, &raw_y) < 0) {
+        // Read current position from encoders. In exchange mode the PWM of
+        // the previous cycle is written by the same transaction.
+        int64_t t_read_start = PacerNow();
+        int err = opts.spi_thread ? io.error.load(std::memory_order_acquire) : SpiSessionRun(&spi, &read_op, 1);
+        bool hold = err == SPI_ERR_CHECK && have_positions && ++held < SPI_HOLD_LIMIT;
+        if (err < 0 && !hold) {
             fprintf(stderr, "Error: Failed to read position in control thread.\n");
+            if (opts.recorder) {
+                rec.t_ns  = t_read_start;
+                rec.flags = FR_FLAG_SPI_ERROR;
+                FrRecordCycle(opts.recorder, &rec);
+                FrTrigger(opts.recorder, FrTriggerSpiError);
+            }
             g_run = false;
             continue;
         }
+        if (opts.spi_thread) {
+            // A sample already used has no new time
+            stamped = MailboxRead(&io.status, &sample) && sample.stamped;
+            stamp = sample.stamp;
+            raw_p = sample.pitch;
+            raw_y = sample.yaw;
+        } else if (hold) {
+            // Corrupted even after the retries: keep the previous positions
+            held_total++;
+            stamped = false;
+        } else {
+            SpiSessionPositions(&spi, read_op, &raw_p, &raw_y);
+            stamped = SpiSessionStamp(&spi, read_op, &stamp) == 0;
+            SpiSessionVelocity(&spi, read_op, &pitch_vel, &yaw_vel);
+            held = 0;
+        }
+        have_positions = true;
+        t_read = PacerNow();
 
         // Convert encoder readings to radians
         abs_p = raw_p - pitch_offset;
@@ -192,23 +538,82 @@ void control_thread_func(int spi_fd, int32_t pitch_offset, int32_t yaw_offset,
             if (current_target.obj_size <= MIN_OBJ_SIZE) {
                 pitch_dst_rad = pitch_curr_pos_rad;
                 yaw_dst_rad   = yaw_curr_pos_rad;
+                if (tracking && opts.recorder) FrTrigger(opts.recorder, FrTriggerTargetLost);
+                tracking = false;
             } else {
+                tracking = true;
                 // Add the offset to the current position and clamp to max range
                 yaw_dst_rad   = fmax(0.0, fmin(yaw_curr_pos_rad + current_target.x_offset_rad, yaw_max_rad));
                 pitch_dst_rad = fmax(0.0, fmin(pitch_curr_pos_rad + current_target.y_offset_rad, pitch_max_rad));
             }
         }
-        // dt calculation
-        clock_gettime(CLOCK_MONOTONIC, &now);
-        dt = (XXDouble)(now.tv_sec - last_step.tv_sec) + 
-             (XXDouble)(now.tv_nsec - last_step.tv_nsec) / 1000000000.0;
+        // dt calculation. With hw_dt, the interval between the FPGA samples
+        // of this cycle and the previous one, free of the scheduling jitter
+        // of this thread; anything above HW_DT_MAX_PERIODS is not trusted.
+        int64_t now = PacerNow();
+        dt = (XXDouble)(now - last_step) / 1000000000.0;
         last_step = now;
+        if (opts.hw_dt) {
+            XXDouble hw = have_stamp && stamped ? SpiStampSeconds(last_stamp, stamp) : 0.0;
+            if (hw > 0.0 && hw < HW_DT_MAX_PERIODS * period_ns / 1000000000.0) {
+                dt = hw;
+                hw_dt_cycles++;
+            }
+            have_stamp = stamped;
+            last_stamp = stamp;
+        }
 
-        ControllerStep(pitch_curr_pos_rad, pitch_dst_rad, yaw_curr_pos_rad, yaw_dst_rad, dt);
+        // Jerk-limited profile towards the destination, replanned when it moves
+        pitch_ref_rad = pitch_dst_rad;
+        yaw_ref_rad   = yaw_dst_rad;
+        if (traj_on) {
+            if (!traj_started) {
+                TrajInit(&pitch_traj, &opts.traj, pitch_curr_pos_rad);
+                TrajInit(&yaw_traj, &opts.traj, yaw_curr_pos_rad);
+                traj_started = true;
+            }
+            if (fabs(pitch_dst_rad - pitch_traj.goal) > TRAJ_REPLAN_RAD) TrajPlan(&pitch_traj, pitch_dst_rad);
+            if (fabs(yaw_dst_rad - yaw_traj.goal) > TRAJ_REPLAN_RAD)     TrajPlan(&yaw_traj, yaw_dst_rad);
+            TrajStep(&pitch_traj, dt);
+            TrajStep(&yaw_traj, dt);
+            pitch_ref_rad = pitch_traj.q;
+            yaw_ref_rad   = yaw_traj.q;
+            pitch_ff      = pitch_traj.v;
+            yaw_ff        = yaw_traj.v;
+        }
 
-        // Get controller outputs
-        pan_out  = getPanOut();
-        tilt_out = getTiltOut();
+        if (fpga_pid) {
+            // Setpoints in encoder counts, sent with the next read
+            SpiSessionSetSetpoints(&spi, (int32_t)lround(pitch_ref_rad / pitch_rad_per_count) + pitch_offset,
+                                   (int32_t)lround(yaw_ref_rad / yaw_rad_per_count) + yaw_offset,
+                                   PID_ENABLE_PITCH | PID_ENABLE_YAW);
+            tilt_out = 0.0;
+            pan_out  = 0.0;
+            t_step = PacerNow();
+        } else if (cascade_on) {
+            if (outer_due) {
+                t_outer = PacerNow();
+                CascadeOuterStep(&cascade.pitch, pitch_curr_pos_rad, pitch_ref_rad, pitch_ff);
+                CascadeOuterStep(&cascade.yaw, yaw_curr_pos_rad, yaw_ref_rad, yaw_ff);
+                outer_step_ns = PacerNow() - t_outer;
+                RateGroupRecord(&cascade.outer, outer_ns + outer_step_ns);
+            }
+            if (fpga_vel) {
+                tilt_out = CascadeInnerStepVel(&cascade.pitch, EncoderVelocityCps(&pitch_vel) * pitch_rad_per_count, dt);
+                pan_out  = CascadeInnerStepVel(&cascade.yaw, EncoderVelocityCps(&yaw_vel) * yaw_rad_per_count, dt);
+            } else {
+                tilt_out = CascadeInnerStep(&cascade.pitch, pitch_curr_pos_rad, dt);
+                pan_out  = CascadeInnerStep(&cascade.yaw, yaw_curr_pos_rad, dt);
+            }
+            t_step = PacerNow();
+        } else {
+            ControllerStep(pitch_curr_pos_rad, pitch_ref_rad, yaw_curr_pos_rad, yaw_ref_rad, dt);
+            t_step = PacerNow();
+
+            // Get controller outputs
+            pan_out  = getPanOut();
+            tilt_out = getTiltOut();
+        }
 
         // Convert to PWM signals
         pan_duty = (uint16_t)(fmin(fabs(pan_out), 1.0) * MAX_SAFE_DUTY);
@@ -216,18 +621,89 @@ void control_thread_func(int spi_fd, int32_t pitch_offset, int32_t yaw_offset,
         tlt_duty = (uint16_t)(fmin(fabs(tilt_out), 1.0) * MAX_SAFE_DUTY);
         tlt_dir  = (tilt_out >= 0.0) ? 0 : 1;
 
-        // Send PWM command
-        SendAllPwmCmd(spi_fd, tlt_duty, 1, tlt_dir, pan_duty, 1, pan_dir);
+        // Send PWM command, unless it goes out with the next read
+        if (opts.spi_thread) {
+            pwm = { tlt_duty, pan_duty, 1, tlt_dir, 1, pan_dir };
+            MailboxPublish(&io.command, pwm);
+        } else {
+            SpiSessionSetPwm(&spi, tlt_duty, 1, tlt_dir, pan_duty, 1, pan_dir);
+            if (read_op != SpiOpExchange && !fpga_pid) SpiSessionRun(&spi, &write_op, 1);
+        }
+        t_write = PacerNow();
+        if (cascade_on) RateGroupRecord(&cascade.inner, t_write - t_read_start - outer_step_ns);
+
+        // Publish the cycle timing
+        TelemetryRecord(&g_loop_telemetry, PhaseRead,   t_read - t_read_start);
+        TelemetryRecord(&g_loop_telemetry, PhaseStep,   t_step - now);
+        TelemetryRecord(&g_loop_telemetry, PhaseWrite,  t_write - t_step);
+        TelemetryRecord(&g_loop_telemetry, PhaseCycle,  t_write - t_wake);
+
+        // Record the cycle state
+        if (opts.recorder) {
+            rec.t_ns          = t_read_start;
+            rec.flags         = (current_target.new_frame ? FR_FLAG_NEW_FRAME : 0) |
+                                (tracking ? FR_FLAG_TARGET : 0) | (hold ? FR_FLAG_SPI_HELD : 0) |
+                                (pacer.overruns != last_overruns ? FR_FLAG_OVERRUN : 0);
+            rec.raw_pitch     = raw_p;
+            rec.raw_yaw       = raw_y;
+            rec.pitch_rad     = (float)pitch_curr_pos_rad;
+            rec.yaw_rad       = (float)yaw_curr_pos_rad;
+            rec.pitch_dst_rad = (float)pitch_dst_rad;
+            rec.yaw_dst_rad   = (float)yaw_dst_rad;
+            rec.dt            = (float)dt;
+            rec.tilt_out      = (float)tilt_out;
+            rec.pan_out       = (float)pan_out;
+            rec.tilt_duty     = tlt_duty;
+            rec.tilt_dir      = tlt_dir;
+            rec.pan_duty      = pan_duty;
+            rec.pan_dir       = pan_dir;
+            FrRecordCycle(opts.recorder, &rec);
+        }
+        last_overruns = pacer.overruns;
 
         // Wait until next cycle
-        next_time.tv_nsec += PERIOD_NS;
-        if (next_time.tv_nsec >= 1000000000L) {
-            next_time.tv_sec++;
-            next_time.tv_nsec -= 1000000000L;
-        }
-        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_time, NULL);
+        int64_t late = PacerWait(&pacer);
+        t_prev_wake = t_wake;
+        t_wake = PacerNow();
+        TelemetryRecord(&g_loop_telemetry, PhasePeriod,   t_wake - t_prev_wake);
+        TelemetryRecord(&g_loop_telemetry, PhaseLateness, late);
+        g_loop_telemetry.overruns.store(pacer.overruns, std::memory_order_relaxed);
+        if (opts.recorder && pacer.overruns != last_overruns) FrTrigger(opts.recorder, FrTriggerOverrun);
     }
 
-    printf("Control thread finished.\n");
+    printf("Control thread finished: %llu cycles, %llu overruns, %llu missed periods, max lateness %.1f us.\n",
+           (unsigned long long)pacer.cycles, (unsigned long long)pacer.overruns,
+           (unsigned long long)pacer.missed, pacer.max_late_ns / 1000.0);
+    if (opts.spi_thread) {
+        io.run = false;
+        spi_thr.join();
+        printf("  SPI thread: %llu cycles, %llu overruns, max transfer %.1f us\n",
+               (unsigned long long)io.cycles.load(), (unsigned long long)io.overruns.load(),
+               io.max_xfer_ns.load() / 1000.0);
+        held_total = (unsigned)io.held.load();
+    }
+    SpiLinkStats link;
+    SpiGetLinkStats(&link);
+    if (link.frames > 0) {
+        printf("  SPI link: %llu checked frames, %llu CRC errors, %llu nacks, %llu bad acks, %llu retries, "
+               "%llu failures (FPGA rejected %u), %u cycles held\n",
+               (unsigned long long)link.frames, (unsigned long long)link.crc_errors,
+               (unsigned long long)link.nacks, (unsigned long long)link.ack_errors,
+               (unsigned long long)link.retries, (unsigned long long)link.failures, link.fpga_errors, held_total);
+    }
+    if (opts.hw_dt) {
+        printf("  Hardware dt: %llu of %llu cycles\n", (unsigned long long)hw_dt_cycles,
+               (unsigned long long)pacer.cycles);
+    }
+    if (cascade_on) {
+        const RateGroup *groups[2] = { &cascade.inner, &cascade.outer };
+        const char *names[2] = { "inner", "outer" };
+        for (int i = 0; i < 2; i++) {
+            printf("  %s loop: every %u cycles, %llu runs, %llu over the %.1f us budget, max %.1f us\n",
+                   names[i], groups[i]->divider, (unsigned long long)groups[i]->runs,
+                   (unsigned long long)groups[i]->overruns, groups[i]->budget_ns / 1000.0,
+                   groups[i]->max_ns / 1000.0);
+        }
+    }
 }
 
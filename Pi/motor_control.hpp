@@ -10,14 +10,61 @@
 
 #include <cstdint>
 #include "controller/common/xxtypes.h" // For XXDouble
+#include "pacer.h"
+#include "flight_recorder.h"
+#include "cascade.h"
+#include "trajectory.h"
 
+// Runtime options of the control thread.
+struct ControlOptions {
+    pacer_policy_t overrun_policy = PacerSkip; // What to do after a missed deadline
+    int64_t spin_ns = 0;                       // Busy-wait window before each deadline
+    FlightRecorder *recorder = nullptr;        // Per-cycle state recorder, optional
+    int64_t period_ns = 0;                     // Loop period, 0: default 10 kHz
+
+    // Cascaded control, see cascade.h. With outer_divider 0 the 20-sim PIDs run every cycle.
+    unsigned outer_divider = 0;                // Loop cycles per outer position loop run
+    unsigned vel_window = 20;                  // Velocity estimation window in loop cycles
+    int64_t inner_budget_ns = 0;               // Time budget of the inner group, 0: half the period
+    int64_t outer_budget_ns = 20000;           // Time budget of the outer group
+
+    // Jerk-limited setpoint profile between vision updates, v_max 0: setpoint steps
+    TrajLimits traj = { 0.0, 0.0, 0.0 };
+
+    // One SPI transaction per cycle (command 0x40): the position read also carries
+    // the PWM computed in the previous cycle, instead of a separate write
+    bool exchange = false;
+
+    // SPI offloaded to its own thread (spi_io.hpp): the loop only exchanges
+    // the latest sample and PWM command through lock-free mailboxes
+    bool spi_thread = false;
+
+    // Controller dt from the FPGA timestamps of consecutive position reads
+    // (0x22) instead of the host clock; cycles without one fall back to the host clock
+    bool hw_dt = false;
+
+    // Inner loop velocity from the FPGA estimators (command 0x25) instead of
+    // differencing positions; cascade only, the read then carries no PWM or timestamp
+    bool fpga_vel = false;
+
+    // Position loops closed in the FPGA (PID.v, commands 0x50-0x52): the loop only
+    // sends the setpoints, read back with the positions; overrides the cascade
+    bool fpga_pid = false;
+};
 
 // Finds the physical limits of the gimbal axes and sets the zero offset.
+// With fast, the stalls are detected by the FPGA (command 0x23) within a few ms.
 void HomeBothAxes(int spi_fd, int32_t* pitch_offset_out, int32_t* yaw_offset_out,
-                  uint32_t* pitch_max_steps, uint32_t* yaw_max_steps);
+                  uint32_t* pitch_max_steps, uint32_t* yaw_max_steps, bool fast = false);
+
+// Uses the calibration stored in calib_path when a short end stop touch confirms it,
+// otherwise homes both axes and stores the result. Returns true if homing was skipped.
+bool HomeWithCalibration(int spi_fd, const char *calib_path, int32_t* pitch_offset_out, int32_t* yaw_offset_out,
+                         uint32_t* pitch_max_steps, uint32_t* yaw_max_steps, bool fast = false);
 
 // The main loop for the high-frequency motor control thread.
 void control_thread_func(int spi_fd, int32_t pitch_offset, int32_t yaw_offset, 
-                         uint32_t pitch_max_steps, uint32_t yaw_max_steps);
+                         uint32_t pitch_max_steps, uint32_t yaw_max_steps,
+                         ControlOptions opts);
 
 #endif
\ No newline at end of file
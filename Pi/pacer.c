@@ -0,0 +1,106 @@
+// Filename : pacer.c
+// Authors : Luis Moreno (s3608255), Luca Provenzano (s3487636)
+// Group : 43
+// License : N.A. or open source license like LGPL
+// Description : Periodic deadline pacer with overrun accounting for the control loop
+//==============================================================
+#include "pacer.h"
+#include "clock_source.h"
+
+/*********************************************
+* @brief Returns the current monotonic time
+*
+* @return CLOCK_MONOTONIC (or virtual) time in ns
+*********************************************/
+int64_t PacerNow(void) {
+    return ClockNowNs();
+}
+
+/*********************************************
+* @brief Initializes the pacer, the first deadline is one period from now
+*
+* @param [out] p         pacer to be initialized
+* @param [in]  period_ns nominal period in ns
+* @param [in]  policy    overrun policy
+* @param [in]  spin_ns   busy-wait window before each deadline, 0 to only sleep
+*
+* @return None.
+*********************************************/
+void PacerInit(Pacer *p, int64_t period_ns, pacer_policy_t policy, int64_t spin_ns) {
+    p->period_ns    = period_ns;
+    p->spin_ns      = (spin_ns > 0) ? spin_ns : 0;
+    p->policy       = policy;
+    p->cycles       = 0;
+    p->overruns     = 0;
+    p->missed       = 0;
+    p->last_late_ns = 0;
+    p->max_late_ns  = 0;
+    p->next_ns      = PacerNow() + period_ns;
+}
+
+/*********************************************
+* @brief Computes the next deadline, applying the overrun policy if the
+*        deadline has already passed
+*
+* @param [inout] p      pacer
+* @param [in]    now_ns current time in ns
+*
+* @return 0: deadline in the future; > 0: number of periods behind schedule
+*********************************************/
+int PacerAdvance(Pacer *p, int64_t now_ns) {
+    if (now_ns < p->next_ns) return 0;
+
+    // Overrun: the deadline passed while the loop body was still running
+    int64_t behind = (now_ns - p->next_ns) / p->period_ns + 1;
+    p->overruns++;
+
+    switch (p->policy) {
+    case PacerSkip:
+        // Jump to the last grid point before now, dropping the missed periods
+        p->next_ns += (behind - 1) * p->period_ns;
+        p->missed  += (uint64_t)(behind - 1);
+        break;
+    case PacerRephase:
+        // New schedule starts now
+        p->next_ns = now_ns;
+        break;
+    case PacerCatchUp:
+    default:
+        // Keep the deadline, the following cycles run back-to-back
+        break;
+    }
+    return (int)behind;
+}
+
+/*********************************************
+* @brief Waits until the next deadline and schedules the following one.
+*        Sleeps until spin_ns before the deadline and busy-waits the rest.
+*
+* @param [inout] p pacer
+*
+* @return lateness of the wake-up in ns
+*********************************************/
+int64_t PacerWait(Pacer *p) {
+    int64_t now = PacerNow();
+    int64_t deadline = p->next_ns;
+
+    if (PacerAdvance(p, now) == 0) {
+        // A virtual clock only moves when sleeping, never spin on it
+        int64_t spin_ns = ClockIsVirtual() ? 0 : p->spin_ns;
+        int64_t wake_ns = p->next_ns - spin_ns;
+        if (wake_ns > now) ClockSleepUntilNs(wake_ns);
+        // Spin for the last part to tighten the wake-up
+        do {
+            now = PacerNow();
+        } while (now < p->next_ns);
+    }
+
+    // Lateness is measured against the original deadline, whatever the policy
+    int64_t late = now - deadline;
+    p->last_late_ns = late;
+    if (late > p->max_late_ns) p->max_late_ns = late;
+    p->cycles++;
+
+    p->next_ns += p->period_ns;
+    return late;
+}
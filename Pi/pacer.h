@@ -0,0 +1,54 @@
+// Filename : pacer.h
+// Authors : Luis Moreno (s3608255), Luca Provenzano (s3487636)
+// Group : 43
+// License : N.A. or open source license like LGPL
+// Description : header file for the periodic deadline pacer of the control loop
+//==============================================================
+
+#ifndef PACER_H
+#define PACER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+// What to do with the periods that were missed after an overrun.
+typedef enum {
+    PacerSkip    = 0, // Drop the missed periods, keep the original phase
+    PacerCatchUp = 1, // Run the missed periods back-to-back
+    PacerRephase = 2  // Restart the schedule from the current time
+} pacer_policy_t;
+
+typedef struct Pacer {
+    int64_t period_ns;      // Nominal period
+    int64_t spin_ns;        // Busy-wait window before each deadline (0: sleep only)
+    pacer_policy_t policy;  // Overrun policy
+    int64_t next_ns;        // Absolute deadline of the next cycle (CLOCK_MONOTONIC)
+
+    // Statistics
+    uint64_t cycles;        // Number of completed waits
+    uint64_t overruns;      // Cycles whose deadline had already passed
+    uint64_t missed;        // Periods dropped by the skip policy
+    int64_t  last_late_ns;  // Lateness of the last wake-up
+    int64_t  max_late_ns;   // Worst lateness seen so far
+} Pacer;
+
+// Initializes the pacer with the first deadline one period from now.
+void PacerInit(Pacer *p, int64_t period_ns, pacer_policy_t policy, int64_t spin_ns);
+
+// Computes the next deadline from the current time, applying the overrun policy.
+int PacerAdvance(Pacer *p, int64_t now_ns);
+
+// Waits for the next deadline and returns the wake-up lateness in ns.
+int64_t PacerWait(Pacer *p);
+
+// Returns the current time in ns, from the active clock source.
+int64_t PacerNow(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,303 @@
+// Filename : sim_main.cpp
+// Authors : Luis Moreno (s3608255), Luca Provenzano (s3487636)
+// Group : 43
+// License : N.A. or open source license like LGPL
+// Description : Closed-loop simulation of homing and tracking against the simulated FPGA and plant
+//==============================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <thread>
+#include <mutex>
+
+#include "spi_comm.h"
+#include "clock_source.h"
+#include "controller/controller.h"
+#include "controller/pan/pan_xxmodel.h"
+#include "controller/tilt/tilt_xxmodel.h"
+#include "motor_control.hpp"
+#include "loop_telemetry.hpp"
+#include "target_data.hpp"
+#include "sim/spi_sim.h"
+
+#define SIM_FRAME_NS     (1000000000LL / 30)  // 30 fps camera
+#define SIM_SETTLE_RAD   0.05                  // Settling band around the target (~3 deg)
+#define SIM_MAX_STEPS    64
+
+// Target angles (from the lower end stops) visited by the step scenario
+static const double kYawTargets[]   = { 1.2, 2.0, 1.6, 0.6, 2.4, 1.571 };
+static const double kPitchTargets[] = { 0.5, 1.0, 0.8, 0.3, 1.2, 0.785 };
+#define SIM_NUM_TARGETS (sizeof(kYawTargets) / sizeof(kYawTargets[0]))
+
+struct SimScenario {
+    int64_t start_ns = 0;           // Tracking start, in clock time
+    int64_t end_ns = 0;             // Tracking end
+    int64_t step_ns = 0;            // Time each target is held
+    int64_t next_frame_ns = 0;
+    bool active = false;
+
+    // Metrics
+    int step = -1;                  // Index of the current target step
+    int64_t step_start_ns = 0;
+    int64_t settled_since_ns = -1;  // Start of the current in-band interval, -1 if outside
+    double settle_s[SIM_MAX_STEPS];
+    double overshoot[SIM_MAX_STEPS];  // Worst travel past the target of either axis [rad]
+    double final_err[SIM_MAX_STEPS];  // Larger error of the two axes at the end of the step [rad]
+    double yaw_sign = 0.0, pitch_sign = 0.0; // Direction of the current step
+    double sq_err = 0.0;
+    uint64_t samples = 0;
+};
+
+static SimScenario g_scn;
+
+/*********************************************
+* @brief Stores the settling time of the current step
+*
+* @return None.
+*********************************************/
+static void CloseStep(void) {
+    if (g_scn.step < 0 || g_scn.step >= SIM_MAX_STEPS) return;
+    g_scn.settle_s[g_scn.step] = (g_scn.settled_since_ns < 0) ? NAN :
+        (double)(g_scn.settled_since_ns - g_scn.step_start_ns) * 1e-9;
+}
+
+/*********************************************
+* @brief Virtual clock hook: publishes the camera frames, keeps the
+*        metrics and stops the run at the end of the scenario
+*
+* @param [in] now_ns current clock time
+*
+* @return None.
+*********************************************/
+static void SimHook(int64_t now_ns) {
+    if (!g_scn.active) return;
+    if (now_ns >= g_scn.end_ns) {
+        g_run = false;
+        return;
+    }
+
+    // Close the settling interval of the previous step
+    int step = (int)((now_ns - g_scn.start_ns) / g_scn.step_ns);
+    if (step != g_scn.step) {
+        CloseStep();
+        g_scn.step = step;
+        g_scn.step_start_ns = now_ns;
+        g_scn.settled_since_ns = -1;
+    }
+
+    SimPlant *plant = SimDevicePlant();
+    double yaw_target   = kYawTargets[step % SIM_NUM_TARGETS];
+    double pitch_target = kPitchTargets[step % SIM_NUM_TARGETS];
+    double yaw_err   = yaw_target - plant->yaw.theta;
+    double pitch_err = pitch_target - plant->pitch.theta;
+
+    if (now_ns == g_scn.step_start_ns && step < SIM_MAX_STEPS) {
+        g_scn.yaw_sign   = (yaw_err >= 0.0) ? 1.0 : -1.0;
+        g_scn.pitch_sign = (pitch_err >= 0.0) ? 1.0 : -1.0;
+        g_scn.overshoot[step] = 0.0;
+    }
+    if (step < SIM_MAX_STEPS) {
+        g_scn.overshoot[step] = fmax(g_scn.overshoot[step],
+                                     fmax(-g_scn.yaw_sign * yaw_err, -g_scn.pitch_sign * pitch_err));
+    }
+
+    if (step < SIM_MAX_STEPS) g_scn.final_err[step] = fmax(fabs(yaw_err), fabs(pitch_err));
+    g_scn.sq_err += yaw_err * yaw_err + pitch_err * pitch_err;
+    g_scn.samples++;
+    if (fabs(yaw_err) < SIM_SETTLE_RAD && fabs(pitch_err) < SIM_SETTLE_RAD) {
+        if (g_scn.settled_since_ns < 0) g_scn.settled_since_ns = now_ns;
+    } else {
+        g_scn.settled_since_ns = -1;
+    }
+
+    // The camera sees the target offset from the current pose, and strobes
+    // FRAME_SYNC at the exposure
+    if (now_ns >= g_scn.next_frame_ns) {
+        g_scn.next_frame_ns += SIM_FRAME_NS;
+        SimDeviceFrameSync();
+        std::lock_guard<std::mutex> lock(g_target_mutex);
+        g_target_data.x_offset_rad = yaw_err;
+        g_target_data.y_offset_rad = pitch_err;
+        g_target_data.obj_size = 5 * MIN_OBJ_SIZE;
+        g_target_data.new_frame = true;
+    }
+}
+
+/*********************************************
+* @brief Overrides a controller gain when the argument matches the flag
+*
+* @param [in]  arg   command line argument
+* @param [in]  flag  flag prefix, including '='
+* @param [out] param 20-sim parameter to be overridden
+*
+* @return true: argument consumed; false: flag does not match
+*********************************************/
+static bool GainOption(const char *arg, const char *flag, double *param) {
+    size_t n = strlen(flag);
+    if (strncmp(arg, flag, n) != 0) return false;
+    *param = atof(arg + n);
+    return true;
+}
+
+/*********************************************
+* @brief Simulation entry point: homing and step tracking on the simulated
+*        plant, on a virtual clock unless --realtime is given
+*
+* @return 0: run finished; 1: bad arguments
+*********************************************/
+int main(int argc, char *argv[]) {
+    ControlOptions opts;
+    double duration_s = 12.0, step_s = 2.0;
+    bool realtime = false, warm = false, fast_homing = false;
+    int64_t spi_latency_ns = 0;
+    double spi_ber = 0.0;
+    const char *calib_path = NULL;
+
+    // Controller gains are applied after ControllerInitialize
+    double pan_gain[3] = { NAN, NAN, NAN }, tilt_gain[3] = { NAN, NAN, NAN };
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strncmp(arg, "--duration=", 11) == 0)      duration_s = atof(arg + 11);
+        else if (strncmp(arg, "--step-s=", 9) == 0)    step_s = atof(arg + 9);
+        else if (strcmp(arg, "--realtime") == 0)       realtime = true;
+        else if (strcmp(arg, "--warm") == 0)           warm = true;
+        else if (strncmp(arg, "--calib=", 8) == 0)     calib_path = arg + 8;
+        else if (strcmp(arg, "--fast-homing") == 0)    fast_homing = true;
+        else if (strcmp(arg, "--overrun=skip") == 0)   opts.overrun_policy = PacerSkip;
+        else if (strcmp(arg, "--overrun=catchup") == 0) opts.overrun_policy = PacerCatchUp;
+        else if (strcmp(arg, "--overrun=rephase") == 0) opts.overrun_policy = PacerRephase;
+        else if (strncmp(arg, "--rate-hz=", 10) == 0 && atoi(arg + 10) > 0) opts.period_ns = 1000000000LL / atoi(arg + 10);
+        else if (strncmp(arg, "--cascade=", 10) == 0)  opts.outer_divider = (unsigned)atoi(arg + 10);
+        else if (strncmp(arg, "--vel-window=", 13) == 0) opts.vel_window = (unsigned)atoi(arg + 13);
+        else if (strcmp(arg, "--exchange") == 0)       opts.exchange = true;
+        else if (strcmp(arg, "--spi-thread") == 0)     opts.spi_thread = true;
+        else if (strncmp(arg, "--spi-latency-us=", 17) == 0) spi_latency_ns = (int64_t)(atof(arg + 17) * 1000.0);
+        else if (strcmp(arg, "--spi-crc") == 0)        SpiSetChecked(1);
+        else if (strcmp(arg, "--hw-dt") == 0)          opts.hw_dt = true;
+        else if (strcmp(arg, "--fpga-vel") == 0)       opts.fpga_vel = true;
+        else if (strcmp(arg, "--fpga-pid") == 0)       opts.fpga_pid = true;
+        else if (strncmp(arg, "--spi-hz=", 9) == 0 && atoi(arg + 9) > 0) SpiSetSpeed((unsigned)atoi(arg + 9));
+        else if (strncmp(arg, "--spi-ber=", 10) == 0)  spi_ber = atof(arg + 10);
+        else if (strcmp(arg, "--traj") == 0)           opts.traj = { 2.5, 30.0, 1000.0 };
+        else if (strncmp(arg, "--traj=", 7) == 0 &&
+                 sscanf(arg + 7, "%lf,%lf,%lf", &opts.traj.v_max, &opts.traj.a_max, &opts.traj.j_max) == 3) {
+        }
+        else if (GainOption(arg, "--pan-kp=", &pan_gain[0]) || GainOption(arg, "--pan-taud=", &pan_gain[1]) ||
+                 GainOption(arg, "--pan-taui=", &pan_gain[2]) || GainOption(arg, "--tilt-kp=", &tilt_gain[0]) ||
+                 GainOption(arg, "--tilt-taud=", &tilt_gain[1]) || GainOption(arg, "--tilt-taui=", &tilt_gain[2])) {
+        } else {
+            fprintf(stderr, "Usage: %s [--duration=S] [--step-s=S] [--realtime] [--overrun=skip|catchup|rephase]\n"
+                            "          [--calib=<file>] [--warm] [--fast-homing]\n"
+                            "          [--rate-hz=N] [--cascade=N] [--vel-window=N] [--traj[=V,A,J]] [--exchange]\n"
+                            "          [--spi-thread] [--spi-latency-us=N] [--spi-crc] [--spi-hz=N] [--spi-ber=P] [--hw-dt]\n"
+                            "          [--fpga-vel] [--fpga-pid]\n"
+                            "          [--pan-kp=K] [--pan-taud=T] [--pan-taui=T] [--tilt-kp=K] [--tilt-taud=T] [--tilt-taui=T]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    // The virtual clock is single-threaded, the SPI thread needs the real one
+    if (opts.spi_thread && !realtime) {
+        printf("--spi-thread runs on the real clock (--realtime).\n");
+        realtime = true;
+    }
+
+    // 1) Simulated device, axes start somewhere inside their range
+    if (!realtime) ClockUseVirtual(0, SimHook);
+    SimDeviceInit(0.6, 1.9);
+    if (warm) {
+        // Program restart with the FPGA still counting: the counter origin is
+        // kept, the axes are wherever the previous run left them
+        SimDevicePlant()->pitch.theta = 1.1;
+        SimDevicePlant()->yaw.theta   = 0.8;
+    }
+    SpiSetBackend(SimSpiBackend());
+    int fd = SpiOpen(SPI_CHANNEL, SpiGetSpeed(), SPI_MODE);
+
+    auto wall_start = std::chrono::steady_clock::now();
+
+    // 2) Homing
+    int64_t t0 = ClockNowNs();
+    int32_t pitch_offset = 0, yaw_offset = 0;
+    uint32_t pitch_max_steps = 0, yaw_max_steps = 0;
+    if (calib_path != NULL) {
+        HomeWithCalibration(fd, calib_path, &pitch_offset, &yaw_offset, &pitch_max_steps, &yaw_max_steps, fast_homing);
+    } else {
+        HomeBothAxes(fd, &pitch_offset, &yaw_offset, &pitch_max_steps, &yaw_max_steps, fast_homing);
+    }
+    double homing_s = (double)(ClockNowNs() - t0) * 1e-9;
+    printf("Homing: %.3f s, pitch %u steps, yaw %u steps\n", homing_s, pitch_max_steps, yaw_max_steps);
+
+    // 3) Controller, with the optional gain overrides (PID1\kp, tauD, tauI)
+    ControllerInitialize();
+    const int gain_index[3] = { 1, 2, 4 };
+    for (int i = 0; i < 3; i++) {
+        if (!isnan(pan_gain[i]))  pan_P[gain_index[i]]  = pan_gain[i];
+        if (!isnan(tilt_gain[i])) tilt_P[gain_index[i]] = tilt_gain[i];
+    }
+
+    // 4) Tracking scenario, bus cost (bytes at the SPI clock plus the call latency)
+    // and bit errors from here on
+    if (spi_latency_ns > 0) SimDeviceSetLatency(spi_latency_ns, 8000000000LL / SpiGetSpeed());
+    if (spi_ber > 0.0) SimDeviceSetBitErrors(spi_ber, 12345);
+    g_scn.start_ns = ClockNowNs();
+    g_scn.step_ns = (int64_t)(step_s * 1e9);
+    g_scn.end_ns = g_scn.start_ns + (int64_t)(duration_s * 1e9);
+    g_scn.next_frame_ns = g_scn.start_ns;
+    g_scn.active = true;
+
+    if (realtime) {
+        // Real clock: the scenario is driven from a helper thread
+        std::thread scenario_thr([] {
+            while (g_run) {
+                SimHook(ClockNowNs());
+                ClockSleepUs(1000);
+            }
+        });
+        control_thread_func(fd, pitch_offset, yaw_offset, pitch_max_steps, yaw_max_steps, opts);
+        scenario_thr.join();
+    } else {
+        control_thread_func(fd, pitch_offset, yaw_offset, pitch_max_steps, yaw_max_steps, opts);
+    }
+    g_scn.active = false;
+    CloseStep();
+
+    SendAllPwmCmd(fd, 0, 0, 0, 0, 0, 0);
+    SpiClose(fd);
+
+    // 5) Report
+    double sim_s = (double)(ClockNowNs() - t0) * 1e-9;
+    double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+    printf("Tracking: %.1f s, RMS error %.4f rad, %llu SPI transactions\n", duration_s,
+           sqrt(g_scn.sq_err / (double)(g_scn.samples ? g_scn.samples : 1)),
+           (unsigned long long)SimDeviceTransactions());
+    for (int i = 0; i <= g_scn.step && i < SIM_MAX_STEPS; i++) {
+        if (isnan(g_scn.settle_s[i])) printf("  step %d: not settled", i);
+        else                         printf("  step %d: settled in %.3f s", i, g_scn.settle_s[i]);
+        printf(", overshoot %.1f mrad, final error %.1f mrad\n", g_scn.overshoot[i] * 1000.0,
+               g_scn.final_err[i] * 1000.0);
+    }
+
+    // Loop timing over the whole run
+    static TelemetryWindow window;
+    PhaseSummary summary[PhaseCount];
+    uint64_t overruns;
+    TelemetrySummarize(&g_loop_telemetry, &window, summary, &overruns);
+    const TelemetryPhase shown[3] = { PhaseRead, PhaseWrite, PhaseCycle };
+    const char *names[3] = { "read", "write", "cycle" };
+    printf("Loop timing:");
+    for (int i = 0; i < 3; i++) {
+        printf(" %s %.1f/%.1f us", names[i], summary[shown[i]].mean_us, summary[shown[i]].p99_us);
+    }
+    printf(" (mean/p99), %llu overruns\n", (unsigned long long)overruns);
+
+    if (spi_ber > 0.0) printf("SPI bus: %llu bits flipped\n", (unsigned long long)SimDeviceFlippedBits());
+
+    printf("Simulated %.2f s in %.3f s wall time (%.0fx real time)\n", sim_s, wall_s, sim_s / wall_s);
+    return 0;
+}
@@ -0,0 +1,221 @@
+// Filename : sim_plant.c
+// Authors : Luis Moreno (s3608255), Luca Provenzano (s3487636)
+// Group : 43
+// License : N.A. or open source license like LGPL
+// Description : Simulated gimbal plant, DC motor with gear and quadrature encoder per axis
+//==============================================================
+#include "sim_plant.h"
+#include <math.h>
+#include <stdlib.h>
+
+/*********************************************
+* @brief Fills in plausible parameters for both axes. The gear and encoder
+*        give ~20k counts per output radian; the motors reach ~2 rad/s at
+*        the 20% duty limit of the control loop.
+*
+* @param [out] pitch pitch axis parameters
+* @param [out] yaw   yaw axis parameters
+*
+* @return None.
+*********************************************/
+void SimAxisDefaults(SimAxisParams *pitch, SimAxisParams *yaw) {
+    SimAxisParams base = {
+        .supply_v       = 12.0,
+        .resistance     = 2.5,
+        .k_motor        = 0.0134,
+        .gear_ratio     = 60.0,
+        .inertia        = 4.6e-3,
+        .viscous        = 1.0e-3,
+        .coulomb        = 0.02,
+        .range_rad      = M_PI,
+        .counts_per_rad = 2048.0 * 60.0 / (2.0 * M_PI),
+    };
+    *yaw = base;
+
+    // Pitch moves a lighter load over a quarter turn
+    *pitch = base;
+    pitch->inertia   = 3.0e-3;
+    pitch->range_rad = M_PI / 2.0;
+}
+
+/*********************************************
+* @brief Resets the plant with both axes at rest
+*
+* @param [out] plant        plant to be initialized
+* @param [in]  pitch        pitch parameters
+* @param [in]  yaw          yaw parameters
+* @param [in]  pitch_theta0 initial pitch angle from its lower end stop
+* @param [in]  yaw_theta0   initial yaw angle from its lower end stop
+* @param [in]  t_ns         initial time
+*
+* @return None.
+*********************************************/
+void SimPlantInit(SimPlant *plant, const SimAxisParams *pitch, const SimAxisParams *yaw,
+                  double pitch_theta0, double yaw_theta0, int64_t t_ns) {
+    SimAxis *axes[2] = { &plant->pitch, &plant->yaw };
+    const SimAxisParams *params[2] = { pitch, yaw };
+    double theta0[2] = { pitch_theta0, yaw_theta0 };
+
+    for (int i = 0; i < 2; i++) {
+        SimAxis *a = axes[i];
+        a->p      = *params[i];
+        a->theta  = fmin(fmax(theta0[i], 0.0), a->p.range_rad);
+        a->theta0 = a->theta;
+        a->omega  = 0.0;
+        a->enable = 0;
+        a->dir    = 0;
+        a->duty   = 0;
+        a->last_count   = 0;
+        a->last_edge_ns = t_ns;
+        a->motion       = 0;
+        a->edge_period_ns = 0;
+        a->window_end_ns  = t_ns + SIM_VEL_WINDOW_NS;
+        a->window_base    = 0;
+        a->window_count   = 0;
+    }
+    plant->t_ns = t_ns;
+}
+
+/*********************************************
+* @brief One integration step of an axis (semi-implicit Euler). The PWM is
+*        averaged over its period; disabled or 0% duty shorts the motor.
+*
+* @param [inout] a axis
+* @param [in]    h step in s
+*
+* @return None.
+*********************************************/
+static void AxisStep(SimAxis *a, double h) {
+    const SimAxisParams *p = &a->p;
+
+    // dir 0 drives towards increasing counts
+    double sign = a->dir ? -1.0 : 1.0;
+    double volts = a->enable ? sign * p->supply_v * (double)a->duty / 4095.0 : 0.0;
+
+    double omega_motor = a->omega * p->gear_ratio;
+    double current = (volts - p->k_motor * omega_motor) / p->resistance;
+    double drive = p->k_motor * current * p->gear_ratio - p->viscous * a->omega;
+
+    // Coulomb friction, sticking while it can hold the drive torque
+    double net;
+    if (a->omega == 0.0) {
+        if (fabs(drive) <= p->coulomb) return;
+        net = drive - copysign(p->coulomb, drive);
+    } else {
+        net = drive - copysign(p->coulomb, a->omega);
+    }
+
+    double omega_new = a->omega + h * net / p->inertia;
+    // Friction alone cannot reverse the motion, it stops at the zero crossing
+    if (a->omega != 0.0 && omega_new * a->omega < 0.0 && fabs(drive) <= p->coulomb) omega_new = 0.0;
+    a->omega = omega_new;
+    a->theta += h * a->omega;
+
+    // Hard end stops, fully inelastic
+    if (a->theta <= 0.0) {
+        a->theta = 0.0;
+        if (a->omega < 0.0) a->omega = 0.0;
+    } else if (a->theta >= p->range_rad) {
+        a->theta = p->range_rad;
+        if (a->omega > 0.0) a->omega = 0.0;
+    }
+}
+
+/*********************************************
+* @brief Records an encoder edge of an axis, if its counter changed, and
+*        closes its counting window when due. Several edges in one substep
+*        share its duration.
+*
+* @param [inout] a    axis
+* @param [in]    t_ns current time
+*
+* @return None.
+*********************************************/
+static void TrackEdges(SimAxis *a, int64_t t_ns) {
+    int32_t count = SimAxisCounts(a);
+    if (t_ns >= a->window_end_ns) {
+        a->window_count   = (int16_t)(count - a->window_base);
+        a->window_base    = count;
+        a->window_end_ns += SIM_VEL_WINDOW_NS;
+    }
+    if (count == a->last_count) return;
+
+    uint8_t motion = count > a->last_count ? 0x1 : 0x3;
+    int64_t period = (t_ns - a->last_edge_ns) / (count - a->last_count);
+    a->edge_period_ns = (motion == a->motion) ? period : 0;
+    a->motion       = motion;
+    a->last_count   = count;
+    a->last_edge_ns = t_ns;
+}
+
+/*********************************************
+* @brief Integrates the plant up to a given time with fixed substeps.
+*        The drive inputs are held constant over the interval.
+*
+* @param [inout] plant plant
+* @param [in]    t_ns  time to advance to, earlier times are ignored
+*
+* @return None.
+*********************************************/
+void SimPlantAdvance(SimPlant *plant, int64_t t_ns) {
+    while (plant->t_ns < t_ns) {
+        int64_t step_ns = t_ns - plant->t_ns;
+        if (step_ns > SIM_SUBSTEP_NS) step_ns = SIM_SUBSTEP_NS;
+        double h = (double)step_ns * 1e-9;
+        AxisStep(&plant->pitch, h);
+        AxisStep(&plant->yaw, h);
+        plant->t_ns += step_ns;
+        TrackEdges(&plant->pitch, plant->t_ns);
+        TrackEdges(&plant->yaw, plant->t_ns);
+    }
+}
+
+/*********************************************
+* @brief Returns the quadrature counter of an axis. The FPGA counter starts
+*        at 0 at power-up, wherever the axis happened to be.
+*
+* @param [in] axis axis
+*
+* @return encoder counts
+*********************************************/
+int32_t SimAxisCounts(const SimAxis *axis) {
+    return (int32_t)floor((axis->theta - axis->theta0) * axis->p.counts_per_rad);
+}
+
+/*********************************************
+* @brief Returns the movement code of an axis as QuadratureEncoder.v
+*        reports it
+*
+* @param [in] axis    axis
+* @param [in] t_ns    current time
+* @param [in] idle_ns time without edges after which the axis is idle
+*
+* @return 0x1: counting up; 0x3: counting down; 0: idle
+*********************************************/
+uint8_t SimAxisMotion(const SimAxis *axis, int64_t t_ns, int64_t idle_ns) {
+    return (t_ns - axis->last_edge_ns >= idle_ns) ? 0 : axis->motion;
+}
+
+/*********************************************
+* @brief Returns the velocity estimates of an axis as QuadratureEncoder.v
+*        reports them. Without a new edge the period grows with the time
+*        waited once that exceeds it, so a stopping axis slows down.
+*
+* @param [in]  axis      axis
+* @param [in]  t_ns      current time
+* @param [in]  idle_ns   time without edges after which the axis is idle
+* @param [out] period_ns signed time between edges, 0 when idle or just reversed
+* @param [out] window    edges counted in the last window
+*
+* @return None.
+*********************************************/
+void SimAxisVelocity(const SimAxis *axis, int64_t t_ns, int64_t idle_ns, int64_t *period_ns, int16_t *window) {
+    int64_t waited = t_ns - axis->last_edge_ns;
+    *period_ns = axis->edge_period_ns;
+    if (waited >= idle_ns) {
+        *period_ns = 0;
+    } else if (*period_ns != 0 && waited > llabs(*period_ns)) {
+        *period_ns = *period_ns > 0 ? waited : -waited;
+    }
+    *window = axis->window_count;
+}
@@ -0,0 +1,86 @@
+// Filename : sim_plant.h
+// Authors : Luis Moreno (s3608255), Luca Provenzano (s3487636)
+// Group : 43
+// License : N.A. or open source license like LGPL
+// Description : header file for the simulated gimbal plant (DC motor, gear, encoder, end stops)
+//==============================================================
+
+#ifndef SIM_PLANT_H
+#define SIM_PLANT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define SIM_SUBSTEP_NS 10000 // 10 us integration step
+#define SIM_VEL_WINDOW_NS 1000000 // Edge counting window, TopEntity VEL_WINDOW_US
+
+// Physical parameters of one axis, referred to the output shaft.
+typedef struct SimAxisParams {
+    double supply_v;        // H-bridge supply voltage
+    double resistance;      // Armature resistance [ohm]
+    double k_motor;         // Torque / back-EMF constant [Nm/A = Vs/rad]
+    double gear_ratio;      // Motor turns per output turn
+    double inertia;         // Total inertia at the output [kg m^2]
+    double viscous;         // Viscous friction at the output [Nm s/rad]
+    double coulomb;         // Coulomb friction at the output [Nm]
+    double range_rad;       // Travel between the two end stops
+    double counts_per_rad;  // Quadrature counts per output radian
+} SimAxisParams;
+
+typedef struct SimAxis {
+    SimAxisParams p;
+    double theta;           // Angle from the lower end stop [rad]
+    double omega;           // Angular velocity [rad/s]
+    double theta0;          // Angle at power-up, where the encoder counter is 0
+
+    // Motor driver inputs, as driven by the FPGA PWM block
+    uint8_t  enable, dir;
+    uint16_t duty;          // 12-bit duty cycle
+
+    // Encoder edge tracking, for the FPGA idle detection
+    int32_t last_count;     // Counter after the last edge
+    int64_t last_edge_ns;   // Time of the last edge
+    uint8_t motion;         // Direction of the last edge: 0x1 up, 0x3 down, 0 none yet
+
+    // Velocity estimates, as QuadratureEncoder.v period and window_count
+    int64_t edge_period_ns; // Signed time between the last two edges, 0 after a reversal
+    int64_t window_end_ns;  // End of the current counting window
+    int32_t window_base;    // Counter at the start of the current window
+    int16_t window_count;   // Edges counted in the last complete window
+} SimAxis;
+
+typedef struct SimPlant {
+    SimAxis pitch, yaw;
+    int64_t t_ns;           // Time the state corresponds to
+} SimPlant;
+
+// Default parameters of the pitch and yaw axes.
+void SimAxisDefaults(SimAxisParams *pitch, SimAxisParams *yaw);
+
+// Resets the plant at time t_ns with both axes at rest at the given angles.
+void SimPlantInit(SimPlant *plant, const SimAxisParams *pitch, const SimAxisParams *yaw,
+                  double pitch_theta0, double yaw_theta0, int64_t t_ns);
+
+// Integrates the plant up to t_ns.
+void SimPlantAdvance(SimPlant *plant, int64_t t_ns);
+
+// Returns the encoder counter of an axis, as the FPGA would report it.
+int32_t SimAxisCounts(const SimAxis *axis);
+
+// Returns the QuadratureEncoder DIR code of an axis at t_ns: the direction of
+// the last edge, or 0 (idle) once no edge was seen for idle_ns.
+uint8_t SimAxisMotion(const SimAxis *axis, int64_t t_ns, int64_t idle_ns);
+
+// Returns the QuadratureEncoder velocity estimates of an axis at t_ns: the
+// signed time between its last two edges, which grows while no edge comes and
+// is 0 once idle, and the edges counted in the last SIM_VEL_WINDOW_NS window.
+void SimAxisVelocity(const SimAxis *axis, int64_t t_ns, int64_t idle_ns, int64_t *period_ns, int16_t *window);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
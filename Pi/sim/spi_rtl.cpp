@@ -0,0 +1,384 @@
+// Filename : spi_rtl.cpp
+// Authors : Luis Moreno (s3608255), Luca Provenzano (s3487636)
+// Group : 43
+// License : N.A. or open source license like LGPL
+// Description : Simulated FPGA SPI device running the Verilator model of TopEntity.v, cycle by cycle,
+//               in place of spi_sim.c: same interface, the plant is driven by the RTL PWM pins and
+//               drives its encoder pins
+//==============================================================
+#include "spi_sim.h"
+#include <linux/spi/spidev.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "VTopEntity.h"
+#include "verilated.h"
+
+#include "clock_source.h"
+
+#define RTL_MAX_BYTES 4096 // spidev buffer size
+#define RTL_CLK_PS    (1000000000000LL / FPGA_CLK_HZ) // Period of the TopEntity clk
+#define RTL_SUBSTEP_CYCLES (SIM_SUBSTEP_NS * (FPGA_CLK_HZ / 1000000) / 1000) // clk cycles per plant step
+#define RTL_ENC_STEP_CYCLES 4 // clk cycles between two encoder edges of an axis, at least
+#define RTL_CS_SETUP_PS 100000 // CS falling to the first SPI clock edge
+#define RTL_CS_GAP_PS   1000000 // CS high after a transaction, before the next one (>= 3 clk cycles)
+#define RTL_FRAME_SYNC_CYCLES 16 // Length of the FRAME_SYNC pulse (>= 3 clk cycles)
+
+// Simulated spidev: a thread-safe transport that clocks every byte into the
+// model. The model runs on its own time base (ps), started at the clock time
+// of SimDeviceInit; each access first runs it up to ClockNowNs(), and a
+// transaction moves the virtual clock on by the time it took on the bus.
+static VerilatedContext *g_ctx = NULL;
+static VTopEntity *g_top = NULL;
+static int64_t g_origin_ns = 0;   // Clock time of model time 0
+static int64_t g_now_ps = 0;      // Model time
+static int64_t g_clk_next_ps = 0; // Next clk edge
+static uint64_t g_cycles = 0;     // clk rising edges since SimDeviceInit
+
+static SimPlant g_plant;
+static uint64_t g_transactions = 0;
+static int64_t g_call_ns = 0;
+static uint32_t g_ber_threshold = 0;
+static uint64_t g_flipped_bits = 0;
+static uint64_t g_rng = 1;
+
+// Coupling of the plant to the pins: PWM high cycles of the current plant
+// step and the counter the encoder pins of each axis show
+static unsigned g_pwm_high[2];
+static int32_t g_pin_count[2];
+static unsigned g_frame_sync_left; // clk cycles FRAME_SYNC stays high
+
+// Serializes the model between the SPI callers and the scenario (real clock runs)
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*********************************************
+* @brief Quadrature phase of a counter on the encoder pins, in the order
+*        QuadratureEncoder.v counts up: {A, B} = 00, 10, 11, 01
+*
+* @param [in] count encoder counter
+* @param [in] axis  pin of the axis
+* @param [inout] a  ENC_A pins
+* @param [inout] b  ENC_B pins
+*
+* @return None.
+*********************************************/
+static void SetEncoderPins(int32_t count, int axis, uint8_t *a, uint8_t *b) {
+    unsigned phase = (unsigned)count & 3u;
+    uint8_t bit = (uint8_t)(1u << axis);
+    *a = (phase == 1 || phase == 2) ? (uint8_t)(*a | bit) : (uint8_t)(*a & ~bit);
+    *b = (phase == 2 || phase == 3) ? (uint8_t)(*b | bit) : (uint8_t)(*b & ~bit);
+}
+
+/*********************************************
+* @brief Plant side of a clk rising edge: counts the PWM high cycles, moves
+*        the encoder pins one edge towards the plant counter, and at the end
+*        of each plant step drives the motors with the averaged PWM pins and
+*        integrates the plant over that step
+*
+* @return None.
+*********************************************/
+static void PlantCycle(void) {
+    SimAxis *axes[2] = { &g_plant.pitch, &g_plant.yaw };
+    for (int i = 0; i < 2; i++) {
+        if (g_top->PWM_VAL & (1u << i)) g_pwm_high[i]++;
+    }
+    if (g_frame_sync_left > 0 && --g_frame_sync_left == 0) g_top->FRAME_SYNC = 0;
+
+    if (g_cycles % RTL_ENC_STEP_CYCLES == 0) {
+        uint8_t a = g_top->ENC_A, b = g_top->ENC_B;
+        for (int i = 0; i < 2; i++) {
+            int32_t target = SimAxisCounts(axes[i]);
+            if (target == g_pin_count[i]) continue;
+            g_pin_count[i] += target > g_pin_count[i] ? 1 : -1;
+            SetEncoderPins(g_pin_count[i], i, &a, &b);
+        }
+        g_top->ENC_A = a;
+        g_top->ENC_B = b;
+    }
+
+    if (g_cycles % RTL_SUBSTEP_CYCLES == 0) {
+        for (int i = 0; i < 2; i++) {
+            // PWM.v: ina = direction, inb = ~direction, both low when disabled (brake)
+            bool ina = g_top->DIRA & (1u << i), inb = g_top->DIRB & (1u << i);
+            axes[i]->enable = ina || inb;
+            axes[i]->dir    = ina;
+            axes[i]->duty   = (uint16_t)((g_pwm_high[i] * 4095u + RTL_SUBSTEP_CYCLES / 2) / RTL_SUBSTEP_CYCLES);
+            g_pwm_high[i] = 0;
+        }
+        SimPlantAdvance(&g_plant, g_origin_ns + g_now_ps / 1000);
+    }
+}
+
+/*********************************************
+* @brief Runs the model up to a model time, clk edge by clk edge, with the
+*        SPI pins held
+*
+* @param [in] t_ps model time to run to
+*
+* @return None.
+*********************************************/
+static void RtlRunUntil(int64_t t_ps) {
+    while (g_clk_next_ps <= t_ps) {
+        g_now_ps = g_clk_next_ps;
+        g_ctx->time(g_now_ps);
+        g_top->clk = !g_top->clk;
+        g_top->eval();
+        if (g_top->clk) {
+            g_cycles++;
+            PlantCycle();
+        }
+        g_clk_next_ps += RTL_CLK_PS / 2;
+    }
+    if (t_ps > g_now_ps) g_now_ps = t_ps;
+}
+
+/*********************************************
+* @brief Runs the model up to the current clock time
+*
+* @return None.
+*********************************************/
+static void RtlCatchUp(void) {
+    RtlRunUntil((ClockNowNs() - g_origin_ns) * 1000);
+}
+
+/*********************************************
+* @brief Resets the model and the plant
+*
+* @param [in] pitch_theta0 initial pitch angle from its lower end stop
+* @param [in] yaw_theta0   initial yaw angle from its lower end stop
+*
+* @return None.
+*********************************************/
+void SimDeviceInit(double pitch_theta0, double yaw_theta0) {
+    delete g_top;
+    delete g_ctx;
+    g_ctx = new VerilatedContext;
+    g_top = new VTopEntity{ g_ctx };
+    g_top->clk = 0;
+    g_top->btn1 = 0;
+    g_top->SPI_CS = 1;
+    g_top->SPI_CLK = 0;
+    g_top->SPI_PICO = 0;
+    g_top->ENC_A = 0;
+    g_top->ENC_B = 0;
+    g_top->FRAME_SYNC = 0;
+    g_top->eval();
+
+    SimAxisParams pitch, yaw;
+    SimAxisDefaults(&pitch, &yaw);
+    g_origin_ns = ClockNowNs();
+    SimPlantInit(&g_plant, &pitch, &yaw, pitch_theta0, yaw_theta0, g_origin_ns);
+    g_now_ps = 0;
+    g_clk_next_ps = RTL_CLK_PS / 2;
+    g_cycles = 0;
+    memset(g_pwm_high, 0, sizeof(g_pwm_high));
+    memset(g_pin_count, 0, sizeof(g_pin_count));
+    g_frame_sync_left = 0;
+    g_transactions = 0;
+    g_call_ns = 0;
+    g_ber_threshold = 0;
+    g_flipped_bits = 0;
+}
+
+/*********************************************
+* @brief Returns the plant, with the model run up to the current time
+*
+* @return plant
+*********************************************/
+SimPlant *SimDevicePlant(void) {
+    pthread_mutex_lock(&g_lock);
+    RtlCatchUp();
+    pthread_mutex_unlock(&g_lock);
+    return &g_plant;
+}
+
+/*********************************************
+* @brief Camera frame strobe: pulses FRAME_SYNC, so FrameSync.v stores the
+*        positions a few clk cycles later
+*
+* @return None.
+*********************************************/
+void SimDeviceFrameSync(void) {
+    pthread_mutex_lock(&g_lock);
+    RtlCatchUp();
+    g_top->FRAME_SYNC = 1;
+    g_top->eval();
+    g_frame_sync_left = RTL_FRAME_SYNC_CYCLES;
+    pthread_mutex_unlock(&g_lock);
+}
+
+/*********************************************
+* @brief Sets the emulated cost of the SPI messages. The bytes already take
+*        their time at the SPI clock on the model bus, so only the fixed
+*        cost of each message is added.
+*
+* @param [in] call_ns fixed cost of each message (ioctl, driver, CS)
+* @param [in] byte_ns cost of each byte on the bus, unused
+*
+* @return None.
+*********************************************/
+void SimDeviceSetLatency(int64_t call_ns, int64_t byte_ns) {
+    (void)byte_ns;
+    g_call_ns = call_ns;
+}
+
+/*********************************************
+* @brief Sets the bit error rate of the SPI bus
+*
+* @param [in] ber  probability of each bit being flipped, 0 for a clean bus
+* @param [in] seed random seed
+*
+* @return None.
+*********************************************/
+void SimDeviceSetBitErrors(double ber, uint32_t seed) {
+    g_ber_threshold = ber <= 0.0 ? 0 : ber >= 1.0 ? UINT32_MAX : (uint32_t)(ber * 4294967296.0);
+    g_rng = seed != 0 ? seed : 1;
+    g_flipped_bits = 0;
+}
+
+/*********************************************
+* @brief Number of bits flipped on the bus
+*
+* @return flipped bit count
+*********************************************/
+uint64_t SimDeviceFlippedBits(void) {
+    return g_flipped_bits;
+}
+
+/*********************************************
+* @brief Number of transactions served
+*
+* @return transaction count
+*********************************************/
+uint64_t SimDeviceTransactions(void) {
+    return g_transactions;
+}
+
+/*********************************************
+* @brief Whether the next bit on the bus gets flipped
+*
+* @return true: flip it
+*********************************************/
+static bool RtlBitError(void) {
+    if (g_ber_threshold == 0) return false;
+    // xorshift64*, upper bits
+    g_rng ^= g_rng >> 12;
+    g_rng ^= g_rng << 25;
+    g_rng ^= g_rng >> 27;
+    if ((uint32_t)((g_rng * 0x2545F4914F6CDD1DULL) >> 32) >= g_ber_threshold) return false;
+    g_flipped_bits++;
+    return true;
+}
+
+/*********************************************
+* @brief Clocks one CS-delimited transaction through the model pins in SPI
+*        mode 0: PICO is set while SPI_CLK is low, POCI is sampled before
+*        the rising edge. CS then stays high for RTL_CS_GAP_PS, so that the
+*        frame is decoded before the next one.
+*
+* @param [in]  tx       bytes from the Pi
+* @param [out] rx       bytes to the Pi, NULL to drop them
+* @param [in]  len      transaction length
+* @param [in]  speed_hz SPI clock
+*
+* @return None.
+*********************************************/
+static void RtlTransaction(const uint8_t *tx, uint8_t *rx, unsigned len, unsigned speed_hz) {
+    int64_t half_ps = 500000000000LL / speed_hz;
+    int64_t t = g_now_ps;
+
+    g_top->SPI_CS = 0;
+    g_top->eval();
+    t += RTL_CS_SETUP_PS;
+    for (unsigned i = 0; i < len; i++) {
+        uint8_t in = 0;
+        for (int bit = 7; bit >= 0; bit--) {
+            bool pico = (tx[i] >> bit) & 1;
+            g_top->SPI_PICO = pico != RtlBitError();
+            g_top->eval();
+            RtlRunUntil(t += half_ps);
+            bool poci = g_top->SPI_POCI;
+            in = (uint8_t)((in << 1) | (poci != RtlBitError()));
+            g_top->SPI_CLK = 1;
+            g_top->eval();
+            RtlRunUntil(t += half_ps);
+            g_top->SPI_CLK = 0;
+            g_top->eval();
+        }
+        if (rx != NULL) rx[i] = in;
+    }
+    RtlRunUntil(t += half_ps);
+    g_top->SPI_CS = 1;
+    g_top->eval();
+    RtlRunUntil(t + RTL_CS_GAP_PS);
+    g_transactions++;
+}
+
+/*********************************************
+* @brief Simulated SpiOpen
+*
+* @return simulated SPI handle
+*********************************************/
+static int RtlOpen(unsigned spi_chan, unsigned spi_baud, unsigned spi_flags) {
+    (void)spi_chan; (void)spi_baud; (void)spi_flags;
+    return SIM_SPI_FD;
+}
+
+/*********************************************
+* @brief Simulated SpiClose
+*
+* @return 0
+*********************************************/
+static int RtlClose(int fd) {
+    (void)fd;
+    return 0;
+}
+
+/*********************************************
+* @brief Simulated SPI_IOC_MESSAGE: every transfer is its own transaction.
+*        On the virtual clock, the clock is moved on to the end of the
+*        message on the model bus.
+*
+* @param [in]    fd    SPI handle
+* @param [inout] xfers transfers
+* @param [in]    n     number of transfers
+*
+* @return total number of bytes transferred; -1: bad handle
+*********************************************/
+static int RtlMessage(int fd, struct spi_ioc_transfer *xfers, unsigned n) {
+    if (fd != SIM_SPI_FD) return -1;
+
+    int total = 0;
+    pthread_mutex_lock(&g_lock);
+    RtlCatchUp();
+    RtlRunUntil(g_now_ps + g_call_ns * 1000);
+    for (unsigned i = 0; i < n; i++) {
+        uint8_t tx[RTL_MAX_BYTES];
+        uint8_t *rx = (uint8_t *)(uintptr_t)xfers[i].rx_buf;
+        unsigned len = xfers[i].len < RTL_MAX_BYTES ? xfers[i].len : RTL_MAX_BYTES;
+        if (xfers[i].tx_buf != 0) {
+            memcpy(tx, (const uint8_t *)(uintptr_t)xfers[i].tx_buf, len);
+        } else {
+            memset(tx, 0, len);
+        }
+        RtlTransaction(tx, rx, len, xfers[i].speed_hz != 0 ? xfers[i].speed_hz : SpiGetSpeed());
+        total += (int)xfers[i].len;
+    }
+    int64_t end_ns = g_origin_ns + g_now_ps / 1000;
+    pthread_mutex_unlock(&g_lock);
+
+    if (ClockIsVirtual()) ClockSleepUntilNs(end_ns);
+    return total;
+}
+
+static const SpiBackend kRtlBackend = { RtlOpen, RtlClose, RtlMessage };
+
+/*********************************************
+* @brief Returns the transport to the model
+*
+* @return backend to be passed to SpiSetBackend
+*********************************************/
+const SpiBackend *SimSpiBackend(void) {
+    return &kRtlBackend;
+}
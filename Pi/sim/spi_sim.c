@@ -0,0 +1,1000 @@
+// Filename : spi_sim.c
+// Authors : Luis Moreno (s3608255), Luca Provenzano (s3487636)
+// Group : 43
+// License : N.A. or open source license like LGPL
+// Description : Simulated FPGA SPI device, implements the TopEntity command set on top of the plant
+//==============================================================
+#include "spi_sim.h"
+#include <linux/spi/spidev.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "clock_source.h"
+#include "fpga_pid.h"
+
+// Same command codes as TopEntity.v
+#define CMD_WRITE_PITCH_PWM 0x10
+#define CMD_WRITE_YAW_PWM   0x11
+#define CMD_WRITE_ALL_PWM   0x12
+#define CMD_WRITE_AXES_PWM  0x13
+#define CMD_READ_PITCH_POS  0x20
+#define CMD_READ_YAW_POS    0x21
+#define CMD_READ_ALL_POSITIONS 0x22
+#define CMD_READ_MOTION  0x23
+#define CMD_READ_AXES    0x24
+#define CMD_READ_VELOCITY 0x25
+#define CHECK_PWM_STATUS 0x30
+#define CMD_EXCHANGE     0x40
+#define CMD_WRITE_PITCH_GAINS 0x50
+#define CMD_WRITE_YAW_GAINS   0x51
+#define CMD_PID_EXCHANGE      0x52
+#define CMD_READ_SAMPLES      0x60
+#define CMD_SET_SAMPLER       0x61
+#define CMD_SET_PWM_QUEUE     0x62
+#define CMD_QUEUE_PWM         0x63
+#define CMD_READ_FRAMES       0x64
+#define CMD_READ_INTERVALS    0x65
+#define CMD_READ_REGS         0x70
+#define CMD_WRITE_REGS        0x71
+#define CMD_CHECKED      0x80
+
+#define SIM_IDLE_NS 2000000 // TopEntity IDLE_US
+#define SIM_TICK_NS (1000000000 / FPGA_CLK_HZ) // Period of the TopEntity timestamp
+#define SIM_PID_PERIOD_NS (1000000000 / FPGA_PID_HZ) // PID.v update period
+#define SIM_PWM_PERIOD_NS (1000000000 / FPGA_PWM_HZ) // PWM period, whose ends play the PWM queue
+
+#define SIM_AXES 2 // TopEntity NUM_AXES: pitch and yaw
+#define SIM_MAX_BYTES 4096 // spidev buffer size
+#define SIM_SHORT_BYTES 32 // Longest fixed command (0x25) with its check bytes, rounded up
+
+static SimPlant g_plant;
+static uint64_t g_transactions = 0;
+static int64_t g_call_ns = 0, g_byte_ns = 0;
+static uint8_t g_crc_errors = 0; // TopEntity crc_errors
+
+// FPGA position loops (PID.v), pitch and yaw
+typedef struct SimLoop {
+    FpgaPid pid;
+    int32_t setpoint;
+    bool on;
+    int64_t next_ns;    // End of the PWM period of the next update
+} SimLoop;
+static SimLoop g_loop[2];
+
+// FPGA sampler (SampleFifo.v)
+typedef struct SimSampler {
+    int64_t period_ns;  // 0: stopped
+    int64_t next_ns;    // Time of the next sample
+    uint16_t wr, rd;    // Sample indexes, as wr_index and rd_index
+    uint8_t overflows;
+    EncoderSample ring[SAMPLE_FIFO_DEPTH];
+} SimSampler;
+static SimSampler g_sampler;
+
+// FPGA PWM queue (PwmQueue.v)
+typedef struct SimQueueEntry {
+    uint32_t at;        // FPGA clock cycle
+    uint16_t pitch, yaw; // PWM words {hi, lo}
+} SimQueueEntry;
+typedef struct SimPwmQueue {
+    uint16_t wr, rd;    // Entry indexes, as wr_index and rd_index
+    uint8_t underruns;
+    bool brake;
+    uint32_t timeout;   // FPGA clock cycles, 0: no underrun detection
+    bool active;        // An entry was applied, no underrun since
+    int64_t last_ns;    // End of the PWM period that applied the last entry
+    int64_t tick_ns;    // Last PWM period end that was played
+    SimQueueEntry ring[PWM_QUEUE_DEPTH];
+} SimPwmQueue;
+static SimPwmQueue g_queue;
+
+// FPGA frame ring (FrameSync.v): index of the next frame, snapshots by index
+typedef struct SimFrames {
+    uint16_t index;
+    EncoderSample ring[FRAME_RING_DEPTH];
+} SimFrames;
+static SimFrames g_frames;
+
+// FPGA interval histogram (IntervalHistogram.v), set up by the writable
+// registers REG_HIST_SETUP/REG_HIST_BINS: start of the last frame timed
+typedef struct SimIntervals {
+    bool have_last;
+    uint32_t last_start;
+    IntervalHistogram hist;
+} SimIntervals;
+static SimIntervals g_intervals;
+
+// Writable registers 0x10-0x1F as last applied, whichever command wrote them
+// (SpiSlave outputs)
+static uint32_t g_wregs[16];
+#define WREG(addr) g_wregs[(addr) - REG_PWM_PITCH]
+
+// Bus bit errors: probability per bit, as a threshold on a 32-bit random number
+static uint32_t g_ber_threshold = 0;
+static uint64_t g_rng = 1;
+static uint64_t g_flipped_bits = 0;
+
+// Serializes the plant between the SPI callers and the scenario (real clock runs)
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*********************************************
+* @brief Resets the simulated device
+*
+* @param [in] pitch_theta0 initial pitch angle from its lower end stop
+* @param [in] yaw_theta0   initial yaw angle from its lower end stop
+*
+* @return None.
+*********************************************/
+void SimDeviceInit(double pitch_theta0, double yaw_theta0) {
+    SimAxisParams pitch, yaw;
+    SimAxisDefaults(&pitch, &yaw);
+    SimPlantInit(&g_plant, &pitch, &yaw, pitch_theta0, yaw_theta0, ClockNowNs());
+    g_transactions = 0;
+    g_call_ns = 0;
+    g_byte_ns = 0;
+    g_crc_errors = 0;
+    g_ber_threshold = 0;
+    g_flipped_bits = 0;
+    memset(g_loop, 0, sizeof(g_loop));
+    memset(&g_sampler, 0, sizeof(g_sampler));
+    memset(&g_queue, 0, sizeof(g_queue));
+    memset(&g_frames, 0, sizeof(g_frames));
+    memset(g_wregs, 0, sizeof(g_wregs));
+    memset(&g_intervals, 0, sizeof(g_intervals));
+    g_intervals.hist.min = UINT32_MAX;
+}
+
+/*********************************************
+* @brief Applies a packed PWM word (bytes lo, hi) to an axis
+*
+* @param [out] axis axis to be driven
+* @param [in]  lo   duty[7:0]
+* @param [in]  hi   {enable, dir, duty[11:8], 2'b00}
+*
+* @return None.
+*********************************************/
+static void ApplyPwm(SimAxis *axis, uint8_t lo, uint8_t hi) {
+    axis->enable = (hi >> 7) & 0x01;
+    axis->dir    = (hi >> 6) & 0x01;
+    axis->duty   = (uint16_t)((((hi >> 2) & 0x0F) << 8) | lo);
+}
+
+/*********************************************
+* @brief Time of the next event of the PWM queue after the plant time: the
+*        end of a PWM period while it holds entries, or its underrun
+*
+* @param [out] tick true: end of a PWM period; false: underrun
+*
+* @return event time, INT64_MAX for none
+*********************************************/
+static int64_t SimQueueNext(bool *tick) {
+    *tick = g_queue.wr != g_queue.rd;
+    if (*tick) {
+        // The PWM counters run from time 0, whether their axes are enabled or
+        // braked; one period end is played once
+        int64_t end = (g_plant.t_ns + SIM_PWM_PERIOD_NS - 1) / SIM_PWM_PERIOD_NS * SIM_PWM_PERIOD_NS;
+        return end > g_queue.tick_ns ? end : g_queue.tick_ns + SIM_PWM_PERIOD_NS;
+    }
+    if (g_queue.active && g_queue.timeout != 0) return g_queue.last_ns + (int64_t)g_queue.timeout * SIM_TICK_NS;
+    return INT64_MAX;
+}
+
+/*********************************************
+* @brief Plays the PWM queue at the plant time: applies its oldest entry at
+*        the end of a PWM period once its time has come, which takes both
+*        axes from their position loops, or counts an underrun and brakes
+*        both axes if set up so
+*
+* @param [in] tick true: end of a PWM period; false: underrun
+*
+* @return None.
+*********************************************/
+static void SimQueueEvent(bool tick) {
+    uint32_t stamp = (uint32_t)(g_plant.t_ns / SIM_TICK_NS);
+    if (!tick) {
+        g_queue.active = false;
+        g_queue.underruns++;
+        if (g_queue.brake) {
+            g_plant.pitch.enable = 0;
+            g_plant.yaw.enable   = 0;
+        }
+        return;
+    }
+    g_queue.tick_ns = g_plant.t_ns;
+    const SimQueueEntry *e = &g_queue.ring[g_queue.rd % PWM_QUEUE_DEPTH];
+    if ((int32_t)(stamp - e->at) < 0) return;
+    ApplyPwm(&g_plant.pitch, (uint8_t)e->pitch, (uint8_t)(e->pitch >> 8));
+    ApplyPwm(&g_plant.yaw, (uint8_t)e->yaw, (uint8_t)(e->yaw >> 8));
+    g_loop[0].on = false;
+    g_loop[1].on = false;
+    g_queue.rd++;
+    g_queue.active  = true;
+    g_queue.last_ns = g_plant.t_ns;
+}
+
+/*********************************************
+* @brief Integrates the plant up to t_ns, stopping at each update of the
+*        position loops that are on to apply their output, at each sample
+*        of the sampler and at each event of the PWM queue
+*
+* @param [in] t_ns time to advance to
+*
+* @return None.
+*********************************************/
+static void SimAdvance(int64_t t_ns) {
+    SimAxis *axes[2] = { &g_plant.pitch, &g_plant.yaw };
+    for (;;) {
+        int64_t next = t_ns;
+        for (int i = 0; i < 2; i++) {
+            if (g_loop[i].on && g_loop[i].next_ns < next) next = g_loop[i].next_ns;
+        }
+        if (g_sampler.period_ns > 0 && g_sampler.next_ns < next) next = g_sampler.next_ns;
+        bool queue_tick;
+        int64_t queue_ns = SimQueueNext(&queue_tick);
+        if (queue_ns < next) next = queue_ns;
+        SimPlantAdvance(&g_plant, next);
+        for (int i = 0; i < 2; i++) {
+            if (!g_loop[i].on || g_loop[i].next_ns > next) continue;
+            axes[i]->duty = FpgaPidStep(&g_loop[i].pid, SimAxisCounts(axes[i]), g_loop[i].setpoint, &axes[i]->dir);
+            g_loop[i].next_ns += SIM_PID_PERIOD_NS;
+        }
+        if (g_sampler.period_ns > 0 && g_sampler.next_ns <= next) {
+            if ((uint16_t)(g_sampler.wr - g_sampler.rd) == SAMPLE_FIFO_DEPTH) {
+                g_sampler.overflows++;
+            } else {
+                EncoderSample *smp = &g_sampler.ring[g_sampler.wr % SAMPLE_FIFO_DEPTH];
+                smp->pitch = SimAxisCounts(&g_plant.pitch);
+                smp->yaw   = SimAxisCounts(&g_plant.yaw);
+                smp->stamp = (uint32_t)(g_plant.t_ns / SIM_TICK_NS);
+                g_sampler.wr++;
+            }
+            g_sampler.next_ns += g_sampler.period_ns;
+        }
+        if (queue_ns <= next) SimQueueEvent(queue_tick);
+        if (next >= t_ns) return;
+    }
+}
+
+/*********************************************
+* @brief Returns the plant, integrated up to the current time
+*
+* @return plant
+*********************************************/
+SimPlant *SimDevicePlant(void) {
+    pthread_mutex_lock(&g_lock);
+    SimAdvance(ClockNowNs());
+    pthread_mutex_unlock(&g_lock);
+    return &g_plant;
+}
+
+/*********************************************
+* @brief Camera frame strobe: stores both positions and their timestamp
+*        in the frame ring, over the oldest frame
+*
+* @return None.
+*********************************************/
+void SimDeviceFrameSync(void) {
+    pthread_mutex_lock(&g_lock);
+    SimAdvance(ClockNowNs());
+    EncoderSample *frame = &g_frames.ring[g_frames.index % FRAME_RING_DEPTH];
+    frame->pitch = SimAxisCounts(&g_plant.pitch);
+    frame->yaw   = SimAxisCounts(&g_plant.yaw);
+    frame->stamp = (uint32_t)(g_plant.t_ns / SIM_TICK_NS);
+    g_frames.index++;
+    pthread_mutex_unlock(&g_lock);
+}
+
+/*********************************************
+* @brief Sets the emulated cost of the SPI messages, 0 for instant ones
+*
+* @param [in] call_ns fixed cost of each message (ioctl, driver, CS)
+* @param [in] byte_ns cost of each byte on the bus
+*
+* @return None.
+*********************************************/
+void SimDeviceSetLatency(int64_t call_ns, int64_t byte_ns) {
+    g_call_ns = call_ns;
+    g_byte_ns = byte_ns;
+}
+
+/*********************************************
+* @brief Sets the probability of each bit being flipped on the bus, in
+*        both directions
+*
+* @param [in] ber  bit error rate, 0 for a clean bus
+* @param [in] seed random seed, not 0
+*
+* @return None.
+*********************************************/
+void SimDeviceSetBitErrors(double ber, uint32_t seed) {
+    g_ber_threshold = ber <= 0.0 ? 0 : ber >= 1.0 ? UINT32_MAX : (uint32_t)(ber * 4294967296.0);
+    g_rng = seed != 0 ? seed : 1;
+    g_flipped_bits = 0;
+}
+
+/*********************************************
+* @brief Number of bits flipped since SimDeviceSetBitErrors
+*
+* @return flipped bits
+*********************************************/
+uint64_t SimDeviceFlippedBits(void) {
+    return g_flipped_bits;
+}
+
+/*********************************************
+* @brief Flips the bits of a buffer with the configured error rate
+*
+* @param [inout] buf bytes on the bus
+* @param [in]    len number of bytes
+*
+* @return None.
+*********************************************/
+static void SimCorrupt(uint8_t *buf, unsigned len) {
+    if (g_ber_threshold == 0) return;
+    for (unsigned i = 0; i < len * 8; i++) {
+        // xorshift64*, upper bits
+        g_rng ^= g_rng >> 12;
+        g_rng ^= g_rng << 25;
+        g_rng ^= g_rng >> 27;
+        if ((uint32_t)((g_rng * 0x2545F4914F6CDD1DULL) >> 32) < g_ber_threshold) {
+            buf[i / 8] ^= (uint8_t)(0x80 >> (i % 8));
+            g_flipped_bits++;
+        }
+    }
+}
+
+/*********************************************
+* @brief Lets the emulated message cost pass. A blocking ioctl keeps the
+*        calling thread busy, so the real clock is busy-waited.
+*
+* @param [in] ns time to be spent
+*
+* @return None.
+*********************************************/
+static void SimSpend(int64_t ns) {
+    if (ns <= 0) return;
+    int64_t until = ClockNowNs() + ns;
+    if (ClockIsVirtual()) {
+        ClockSleepUntilNs(until);
+        return;
+    }
+    while (ClockNowNs() < until) {
+    }
+}
+
+/*********************************************
+* @brief Number of transactions served
+*
+* @return transaction count
+*********************************************/
+uint64_t SimDeviceTransactions(void) {
+    return g_transactions;
+}
+
+/*********************************************
+* @brief Stores a big-endian 32-bit value, as the FPGA shifts it out
+*
+* @param [out] dst   destination bytes
+* @param [in]  value value to be stored
+*
+* @return None.
+*********************************************/
+static void PutBe32(uint8_t *dst, int32_t value) {
+    uint32_t v = (uint32_t)value;
+    dst[0] = (uint8_t)(v >> 24);
+    dst[1] = (uint8_t)(v >> 16);
+    dst[2] = (uint8_t)(v >> 8);
+    dst[3] = (uint8_t)v;
+}
+
+/*********************************************
+* @brief Loads a big-endian 32-bit value, as the FPGA shifts it in
+*
+* @param [in] src source bytes
+*
+* @return value
+*********************************************/
+static int32_t GetBe32(const uint8_t *src) {
+    return (int32_t)(((uint32_t)src[0] << 24) | ((uint32_t)src[1] << 16) | ((uint32_t)src[2] << 8) | src[3]);
+}
+
+/*********************************************
+* @brief Applies the setpoints and enable bits of command 0x52. A loop
+*        switched on starts from cleared states with its PWM running from
+*        0; one switched off brakes its axis.
+*
+* @param [in] pitch_setpoint pitch setpoint in counts
+* @param [in] yaw_setpoint   yaw setpoint in counts
+* @param [in] enable         bit 0: pitch loop on; bit 1: yaw loop on
+*
+* @return None.
+*********************************************/
+static void SetLoops(int32_t pitch_setpoint, int32_t yaw_setpoint, uint8_t enable) {
+    SimAxis *axes[2] = { &g_plant.pitch, &g_plant.yaw };
+    WREG(REG_SETPOINT_PITCH) = (uint32_t)pitch_setpoint;
+    WREG(REG_SETPOINT_YAW)   = (uint32_t)yaw_setpoint;
+    WREG(REG_PID_ENABLE)     = enable & 0x3u;
+    g_loop[0].setpoint = pitch_setpoint;
+    g_loop[1].setpoint = yaw_setpoint;
+    for (int i = 0; i < 2; i++) {
+        bool on = (enable >> i) & 0x1;
+        if (on == g_loop[i].on) continue;
+        FpgaPidGains gains = g_loop[i].pid.g;
+        g_loop[i].on = on;
+        FpgaPidReset(&g_loop[i].pid, &gains);
+        // PID.v counts the ends of the free-running PWM periods from here
+        g_loop[i].next_ns = (g_plant.t_ns / SIM_PWM_PERIOD_NS + 1) * SIM_PWM_PERIOD_NS + SIM_PID_PERIOD_NS -
+                            SIM_PWM_PERIOD_NS;
+        axes[i]->enable = on;
+        axes[i]->duty   = 0;
+    }
+}
+
+/*********************************************
+* @brief Packs the PWM status of an axis as command 0x30 reports it
+*
+* @param [in]  axis axis
+* @param [out] dst  two destination bytes
+*
+* @return None.
+*********************************************/
+static void PackPwm(const SimAxis *axis, uint8_t *dst) {
+    dst[0] = (uint8_t)((axis->enable << 7) | (axis->dir << 6) | (((axis->duty >> 8) & 0x0F) << 2));
+    dst[1] = (uint8_t)(axis->duty & 0xFF);
+}
+
+/*********************************************
+* @brief Writes the PWM word of an axis, which also switches its position
+*        loop off
+*
+* @param [in] i    0: pitch; 1: yaw
+* @param [in] word {hi, lo}
+*
+* @return None.
+*********************************************/
+static void WritePwm(int i, uint16_t word) {
+    WREG(REG_PWM_PITCH + i) = word;
+    ApplyPwm(i == 0 ? &g_plant.pitch : &g_plant.yaw, (uint8_t)word, (uint8_t)(word >> 8));
+    g_loop[i].on = false;
+}
+
+/*********************************************
+* @brief Loads the gain registers into the position loop of an axis, at
+*        once, also into a loop that is running
+*
+* @param [in] i 0: pitch; 1: yaw
+*
+* @return None.
+*********************************************/
+static void LoadGains(int i) {
+    FpgaPidGains *g = &g_loop[i].pid.g;
+    g->a     = (int32_t)WREG(REG_GAIN_A);
+    g->b     = (int32_t)WREG(REG_GAIN_A + 1);
+    g->c     = (int32_t)WREG(REG_GAIN_A + 2);
+    g->d     = WREG(REG_GAIN_A + 3);
+    g->limit = (uint16_t)WREG(REG_GAIN_LIMIT) & 0x0FFF;
+    WREG(REG_GAIN_LOAD) = (uint32_t)i;
+}
+
+/*********************************************
+* @brief Sets the sampler period and empties its ring
+*
+* @param [in] cycles FPGA clock cycles between samples, 0: stopped
+*
+* @return None.
+*********************************************/
+static void SetSampler(uint32_t cycles) {
+    WREG(REG_SAMPLE_PERIOD) = cycles & 0xFFFFFFu;
+    memset(&g_sampler, 0, sizeof(g_sampler));
+    g_sampler.period_ns = (int64_t)(cycles & 0xFFFFFFu) * SIM_TICK_NS;
+    g_sampler.next_ns   = g_plant.t_ns + g_sampler.period_ns;
+}
+
+/*********************************************
+* @brief Frees the samples before an index, if it is within the ring
+*
+* @param [in] first index of the first sample still wanted
+*
+* @return None.
+*********************************************/
+static void FreeSamples(uint16_t first) {
+    WREG(REG_SAMPLE_FREE) = first;
+    if ((uint16_t)(first - g_sampler.rd) <= (uint16_t)(g_sampler.wr - g_sampler.rd)) g_sampler.rd = first;
+}
+
+/*********************************************
+* @brief Sets up the PWM queue and empties it
+*
+* @param [in] brake   brake both axes on underrun, instead of holding them
+* @param [in] timeout FPGA clock cycles without entry before an underrun, 0: never
+*
+* @return None.
+*********************************************/
+static void SetQueue(bool brake, uint32_t timeout) {
+    memset(&g_queue, 0, sizeof(g_queue));
+    g_queue.brake   = brake;
+    g_queue.timeout = timeout & 0xFFFFFFu;
+}
+
+/*********************************************
+* @brief Queues the entries of a 0x63 frame that follow the write index,
+*        while there is room
+*
+* @param [in] tx frame from the Pi
+*
+* @return None.
+*********************************************/
+static void QueueEntries(const uint8_t *tx) {
+    uint16_t index = (uint16_t)((tx[1] << 8) | tx[2]);
+    for (unsigned k = 0; k < tx[3]; k++, index++) {
+        if (index != g_queue.wr || (uint16_t)(g_queue.wr - g_queue.rd) >= PWM_QUEUE_DEPTH) continue;
+        SimQueueEntry *e = &g_queue.ring[g_queue.wr % PWM_QUEUE_DEPTH];
+        e->at    = (uint32_t)GetBe32(&tx[6 + 8 * k]);
+        e->pitch = (uint16_t)((tx[10 + 8 * k] << 8) | tx[11 + 8 * k]);
+        e->yaw   = (uint16_t)((tx[12 + 8 * k] << 8) | tx[13 + 8 * k]);
+        g_queue.wr++;
+    }
+}
+
+/*********************************************
+* @brief Clears the interval histogram, as its setup does
+*
+* @return None.
+*********************************************/
+static void ClearIntervals(void) {
+    memset(&g_intervals, 0, sizeof(g_intervals));
+    g_intervals.hist.min = UINT32_MAX;
+}
+
+/*********************************************
+* @brief Times the start of a frame against the last one timed, if the
+*        histogram filter takes its command
+*
+* @param [in] cmd   command byte without the checked flag
+* @param [in] start FPGA clock cycle of the frame start
+*
+* @return None.
+*********************************************/
+static void TimeFrame(uint8_t cmd, uint32_t start) {
+    uint32_t setup = WREG(REG_HIST_SETUP), bins = WREG(REG_HIST_BINS);
+    if (((setup >> 24) & HIST_ONE_CMD) && cmd != ((setup >> 24) & 0x7F)) return;
+
+    SimIntervals *iv = &g_intervals;
+    uint32_t interval = start - iv->last_start;
+    bool timed = iv->have_last;
+    iv->have_last  = true;
+    iv->last_start = start;
+    if (!timed) return;
+
+    uint32_t origin = setup & 0xFFFFFFu, deadline = bins & 0xFFFFFFu;
+    uint32_t scaled = interval < origin ? 0 : (interval - origin) >> ((bins >> 24) & 0x1F);
+    unsigned bin = scaled >= INTERVAL_BINS - 1 ? INTERVAL_BINS - 1 : scaled;
+    if (iv->hist.bins[bin] < 0xFFFFFFu) iv->hist.bins[bin]++;
+    if (interval < iv->hist.min) iv->hist.min = interval;
+    if (interval > iv->hist.max) iv->hist.max = interval;
+    if (deadline != 0 && interval > deadline) iv->hist.missed++;
+    iv->hist.count++;
+}
+
+/*********************************************
+* @brief Value of a register of the 0x70/0x71 map, from the plant at the
+*        current time
+*
+* @param [in] addr register address
+*
+* @return value, 0 for an unmapped register
+*********************************************/
+static uint32_t SimReadReg(uint8_t addr) {
+    uint8_t pwm[4];
+    int64_t period;
+    int16_t pitch_window, yaw_window;
+    switch (addr) {
+    case REG_ID:
+        return REG_MAP_ID;
+    case REG_POS_PITCH:
+        return (uint32_t)SimAxisCounts(&g_plant.pitch);
+    case REG_POS_YAW:
+        return (uint32_t)SimAxisCounts(&g_plant.yaw);
+    case REG_TIMESTAMP:
+        return (uint32_t)(g_plant.t_ns / SIM_TICK_NS);
+    case REG_MOTION:
+        return (uint32_t)((SimAxisMotion(&g_plant.yaw, g_plant.t_ns, SIM_IDLE_NS) << 4) |
+                          SimAxisMotion(&g_plant.pitch, g_plant.t_ns, SIM_IDLE_NS));
+    case REG_PWM_STATUS:
+        PackPwm(&g_plant.pitch, &pwm[0]);
+        PackPwm(&g_plant.yaw, &pwm[2]);
+        return (uint32_t)GetBe32(pwm);
+    case REG_PERIOD_PITCH:
+        SimAxisVelocity(&g_plant.pitch, g_plant.t_ns, SIM_IDLE_NS, &period, &pitch_window);
+        return (uint32_t)(int32_t)(period / SIM_TICK_NS);
+    case REG_PERIOD_YAW:
+        SimAxisVelocity(&g_plant.yaw, g_plant.t_ns, SIM_IDLE_NS, &period, &yaw_window);
+        return (uint32_t)(int32_t)(period / SIM_TICK_NS);
+    case REG_WINDOWS:
+        SimAxisVelocity(&g_plant.pitch, g_plant.t_ns, SIM_IDLE_NS, &period, &pitch_window);
+        SimAxisVelocity(&g_plant.yaw, g_plant.t_ns, SIM_IDLE_NS, &period, &yaw_window);
+        return ((uint32_t)(uint16_t)pitch_window << 16) | (uint16_t)yaw_window;
+    case REG_SAMPLES:
+        return ((uint32_t)g_sampler.wr << 16) | ((uint32_t)g_sampler.overflows << 8);
+    case REG_LINK_ERRORS:
+        return g_crc_errors;
+    case REG_QUEUE:
+        return ((uint32_t)g_queue.wr << 16) | g_queue.rd;
+    case REG_QUEUE_UNDERRUNS:
+        return g_queue.underruns;
+    case REG_AXES:
+        return SIM_AXES;
+    case REG_FRAMES:
+        return (uint32_t)g_frames.index << 16;
+    case REG_QUEUE_SETUP:
+        return ((uint32_t)g_queue.brake << 24) | g_queue.timeout;
+    case REG_INTERVAL_MIN:
+        return g_intervals.hist.min;
+    case REG_INTERVAL_MAX:
+        return g_intervals.hist.max;
+    case REG_INTERVAL_MISSED:
+        return g_intervals.hist.missed;
+    case REG_INTERVAL_COUNT:
+        return g_intervals.hist.count;
+    default:
+        return (addr >= REG_PWM_PITCH && addr <= REG_HIST_BINS) ? WREG(addr) : 0;
+    }
+}
+
+/*********************************************
+* @brief Unchecked length of a command, as TopEntity cmd_len
+*
+* @param [in] cmd command byte without the checked flag
+*
+* @return length in bytes
+*********************************************/
+static unsigned SimCmdLen(uint8_t cmd) {
+    switch (cmd) {
+    case CMD_WRITE_PITCH_PWM:
+    case CMD_WRITE_YAW_PWM:
+        return 3;
+    case CMD_READ_PITCH_POS:
+    case CMD_READ_YAW_POS:
+    case CMD_EXCHANGE:
+        return 9;
+    case CMD_READ_MOTION:
+        return 10;
+    case CMD_READ_ALL_POSITIONS:
+        return 13;
+    case CMD_READ_VELOCITY:
+        return 21;
+    case CMD_WRITE_PITCH_GAINS:
+    case CMD_WRITE_YAW_GAINS:
+        return 19;
+    case CMD_PID_EXCHANGE:
+        return 10;
+    case CMD_WRITE_AXES_PWM:
+    case CMD_READ_AXES:
+    case CMD_READ_REGS:
+    case CMD_WRITE_REGS:
+        return 3;   // until their count byte
+    default: // 0x60/0x63 until their count byte
+        return 5;
+    }
+}
+
+/*********************************************
+* @brief Serves one CS-delimited transaction. Reads sample the plant when
+*        the command byte is decoded, and the position reads add the
+*        sample time as the TopEntity timestamp. Writes take effect at CS
+*        deassert.
+*        Checked frames get their check bytes, and their writes are only
+*        applied if the command CRC matched.
+*
+* @param [in]  tx  bytes from the Pi
+* @param [out] rx  bytes to the Pi
+* @param [in]  len transaction length
+*
+* @return None.
+*********************************************/
+static void SimTransaction(const uint8_t *tx, uint8_t *rx, unsigned len) {
+    // Cleared up to the longest fixed response with its check bytes, or the transfer
+    uint8_t resp[SIM_MAX_BYTES];
+    memset(resp, 0, len > SIM_SHORT_BYTES ? (len < SIM_MAX_BYTES ? len : SIM_MAX_BYTES) : SIM_SHORT_BYTES);
+    resp[0] = 0x01; // Dummy first byte
+
+    SimAdvance(ClockNowNs());
+    g_transactions++;
+
+    uint8_t cmd = len > 0 ? (uint8_t)(tx[0] & ~CMD_CHECKED) : 0x00;
+    bool checked = len > 0 && (tx[0] & CMD_CHECKED);
+    int32_t stamp = (int32_t)(uint32_t)(g_plant.t_ns / SIM_TICK_NS);
+    switch (cmd) {
+    case CMD_READ_PITCH_POS:
+        PutBe32(&resp[1], SimAxisCounts(&g_plant.pitch));
+        PutBe32(&resp[5], stamp);
+        break;
+    case CMD_READ_YAW_POS:
+        PutBe32(&resp[1], SimAxisCounts(&g_plant.yaw));
+        PutBe32(&resp[5], stamp);
+        break;
+    case CMD_READ_ALL_POSITIONS:
+        PutBe32(&resp[1], SimAxisCounts(&g_plant.pitch));
+        PutBe32(&resp[5], SimAxisCounts(&g_plant.yaw));
+        PutBe32(&resp[9], stamp);
+        break;
+    case CMD_EXCHANGE:
+    case CMD_PID_EXCHANGE:
+        PutBe32(&resp[1], SimAxisCounts(&g_plant.pitch));
+        PutBe32(&resp[5], SimAxisCounts(&g_plant.yaw));
+        break;
+    case CMD_READ_MOTION:
+        PutBe32(&resp[1], SimAxisCounts(&g_plant.pitch));
+        PutBe32(&resp[5], SimAxisCounts(&g_plant.yaw));
+        resp[9] = (uint8_t)((SimAxisMotion(&g_plant.yaw, g_plant.t_ns, SIM_IDLE_NS) << 4) |
+                            SimAxisMotion(&g_plant.pitch, g_plant.t_ns, SIM_IDLE_NS));
+        break;
+    case CMD_READ_AXES: {
+        // Axes past SIM_AXES read 0, the timestamp follows the positions
+        unsigned n = len >= 3 ? tx[2] : 0;
+        for (unsigned k = 0; k < n && AXES_POS_BYTES(k + 1) <= SIM_MAX_BYTES; k++) {
+            uint8_t axis = (uint8_t)(tx[1] + k);
+            int32_t pos = axis == 0 ? SimAxisCounts(&g_plant.pitch) : axis == 1 ? SimAxisCounts(&g_plant.yaw) : 0;
+            PutBe32(&resp[3 + 4 * k], pos);
+        }
+        if (AXES_POS_BYTES(n) <= SIM_MAX_BYTES) PutBe32(&resp[3 + 4 * n], stamp);
+        break;
+    }
+    case CMD_READ_VELOCITY: {
+        int64_t pitch_period, yaw_period;
+        int16_t pitch_window, yaw_window;
+        SimAxisVelocity(&g_plant.pitch, g_plant.t_ns, SIM_IDLE_NS, &pitch_period, &pitch_window);
+        SimAxisVelocity(&g_plant.yaw, g_plant.t_ns, SIM_IDLE_NS, &yaw_period, &yaw_window);
+        PutBe32(&resp[1], SimAxisCounts(&g_plant.pitch));
+        PutBe32(&resp[5], SimAxisCounts(&g_plant.yaw));
+        PutBe32(&resp[9], (int32_t)(pitch_period / SIM_TICK_NS));
+        PutBe32(&resp[13], (int32_t)(yaw_period / SIM_TICK_NS));
+        resp[17] = (uint8_t)((uint16_t)pitch_window >> 8);
+        resp[18] = (uint8_t)pitch_window;
+        resp[19] = (uint8_t)((uint16_t)yaw_window >> 8);
+        resp[20] = (uint8_t)yaw_window;
+        break;
+    }
+    case CHECK_PWM_STATUS:
+        PackPwm(&g_plant.pitch, &resp[1]);
+        PackPwm(&g_plant.yaw, &resp[3]);
+        break;
+    case CMD_READ_SAMPLES: {
+        // The ring is sent from the first index asked, valid or not
+        uint16_t first = len >= 3 ? (uint16_t)((tx[1] << 8) | tx[2]) : 0;
+        resp[1] = (uint8_t)(g_sampler.wr >> 8);
+        resp[2] = (uint8_t)g_sampler.wr;
+        resp[3] = g_sampler.overflows;
+        for (unsigned k = 0; len >= 4 && k < tx[3] && SAMPLE_BURST_BYTES(k + 1) <= SIM_MAX_BYTES; k++) {
+            const EncoderSample *smp = &g_sampler.ring[(uint16_t)(first + k) % SAMPLE_FIFO_DEPTH];
+            PutBe32(&resp[5 + 12 * k], smp->pitch);
+            PutBe32(&resp[9 + 12 * k], smp->yaw);
+            PutBe32(&resp[13 + 12 * k], (int32_t)smp->stamp);
+        }
+        break;
+    }
+    case CMD_READ_FRAMES: {
+        // As the sample bursts, from the slot of the first index asked
+        uint16_t first = len >= 3 ? (uint16_t)((tx[1] << 8) | tx[2]) : 0;
+        resp[1] = (uint8_t)(g_frames.index >> 8);
+        resp[2] = (uint8_t)g_frames.index;
+        for (unsigned k = 0; len >= 4 && k < tx[3] && FRAME_BURST_BYTES(k + 1) <= SIM_MAX_BYTES; k++) {
+            const EncoderSample *frame = &g_frames.ring[(uint16_t)(first + k) % FRAME_RING_DEPTH];
+            PutBe32(&resp[5 + 12 * k], frame->pitch);
+            PutBe32(&resp[9 + 12 * k], frame->yaw);
+            PutBe32(&resp[13 + 12 * k], (int32_t)frame->stamp);
+        }
+        break;
+    }
+    case CMD_READ_INTERVALS: {
+        // Four 24-bit bins per entry, from the first entry asked
+        uint16_t first = len >= 3 ? (uint16_t)((tx[1] << 8) | tx[2]) : 0;
+        for (unsigned k = 0; len >= 4 && k < tx[3] && SAMPLE_BURST_BYTES(k + 1) <= SIM_MAX_BYTES; k++) {
+            for (unsigned b = 0; b < 4; b++) {
+                uint32_t count = g_intervals.hist.bins[(4 * (first + k) + b) % INTERVAL_BINS];
+                resp[5 + 12 * k + 3 * b]     = (uint8_t)(count >> 16);
+                resp[5 + 12 * k + 3 * b + 1] = (uint8_t)(count >> 8);
+                resp[5 + 12 * k + 3 * b + 2] = (uint8_t)count;
+            }
+        }
+        break;
+    }
+    case CMD_QUEUE_PWM:
+        resp[1] = (uint8_t)(g_queue.wr >> 8);
+        resp[2] = (uint8_t)g_queue.wr;
+        resp[3] = (uint8_t)(g_queue.rd >> 8);
+        resp[4] = (uint8_t)g_queue.rd;
+        resp[5] = g_queue.underruns;
+        break;
+    case CMD_READ_REGS:
+    case CMD_WRITE_REGS:
+        // A write sends the values before it
+        for (unsigned k = 0; len >= 3 && k < tx[2] && REG_BURST_BYTES(k + 1) <= SIM_MAX_BYTES; k++) {
+            PutBe32(&resp[3 + 4 * k], (int32_t)SimReadReg((uint8_t)(tx[1] + k)));
+        }
+        break;
+    default:
+        break;
+    }
+
+    // Check bytes: count, response CRC, then the ack once the command CRC is in.
+    // Unchecked writes need the exact command length; a burst has its own.
+    unsigned cmd_len = (cmd == CMD_READ_SAMPLES && len >= 4)                          ? SAMPLE_BURST_BYTES(tx[3]) :
+                       (cmd == CMD_READ_FRAMES && len >= 4)                           ? FRAME_BURST_BYTES(tx[3]) :
+                       (cmd == CMD_READ_INTERVALS && len >= 4)                        ? SAMPLE_BURST_BYTES(tx[3]) :
+                       (cmd == CMD_QUEUE_PWM && len >= 4)                             ? PWM_QUEUE_BURST_BYTES(tx[3]) :
+                       (cmd == CMD_WRITE_AXES_PWM && len >= 3)                        ? AXES_PWM_BYTES(tx[2]) :
+                       (cmd == CMD_READ_AXES && len >= 3)                             ? AXES_POS_BYTES(tx[2]) :
+                       ((cmd == CMD_READ_REGS || cmd == CMD_WRITE_REGS) && len >= 3) ? REG_BURST_BYTES(tx[2])
+                                                                                     : SimCmdLen(cmd);
+    bool apply = len == cmd_len;
+    if (checked) {
+        resp[cmd_len]     = g_crc_errors;
+        resp[cmd_len + 1] = SpiCrc8(&resp[1], cmd_len);
+        apply = len >= cmd_len + 2 && SpiCrc8(tx, cmd_len + 1) == tx[cmd_len + 1];
+        if (len >= cmd_len + 2) {
+            resp[cmd_len + 2] = apply ? tx[cmd_len] : (uint8_t)~tx[cmd_len];
+            if (!apply) g_crc_errors++;
+        }
+    }
+    if (rx != NULL) memcpy(rx, resp, len < SIM_MAX_BYTES ? len : SIM_MAX_BYTES);
+    // Every frame is timed, applied or not, from its snapshot as CS fell
+    if (len > 0) TimeFrame(cmd, (uint32_t)stamp);
+    if (!apply) return;
+
+    // End of transaction: writes, as the FPGA only uses the bytes it received
+    switch (cmd) {
+    case CMD_WRITE_PITCH_PWM:
+        WritePwm(0, (uint16_t)((tx[2] << 8) | tx[1]));
+        break;
+    case CMD_WRITE_YAW_PWM:
+        WritePwm(1, (uint16_t)((tx[2] << 8) | tx[1]));
+        break;
+    case CMD_WRITE_ALL_PWM:
+    case CMD_EXCHANGE:
+        WritePwm(0, (uint16_t)((tx[2] << 8) | tx[1]));
+        WritePwm(1, (uint16_t)((tx[4] << 8) | tx[3]));
+        break;
+    case CMD_WRITE_AXES_PWM:
+        // Only the axes the device has
+        for (unsigned k = 0; k < tx[2]; k++) {
+            uint8_t axis = (uint8_t)(tx[1] + k);
+            if (axis < SIM_AXES) WritePwm(axis, (uint16_t)((tx[4 + 2 * k] << 8) | tx[3 + 2 * k]));
+        }
+        break;
+    case CMD_WRITE_PITCH_GAINS:
+    case CMD_WRITE_YAW_GAINS:
+        for (int k = 0; k < 4; k++) WREG(REG_GAIN_A + k) = (uint32_t)GetBe32(&tx[1 + 4 * k]);
+        WREG(REG_GAIN_LIMIT) = (uint32_t)((tx[17] << 8) | tx[18]);
+        LoadGains(cmd & 0x1);
+        break;
+    case CMD_PID_EXCHANGE:
+        SetLoops(GetBe32(&tx[1]), GetBe32(&tx[5]), tx[9]);
+        break;
+    case CMD_READ_SAMPLES:
+        // Samples before the first one asked are freed
+        FreeSamples((uint16_t)((tx[1] << 8) | tx[2]));
+        break;
+    case CMD_SET_SAMPLER:
+        SetSampler(((uint32_t)tx[1] << 16) | ((uint32_t)tx[2] << 8) | tx[3]);
+        break;
+    case CMD_SET_PWM_QUEUE:
+        SetQueue(tx[1] & 0x1, ((uint32_t)tx[2] << 16) | ((uint32_t)tx[3] << 8) | tx[4]);
+        break;
+    case CMD_QUEUE_PWM:
+        QueueEntries(tx);
+        break;
+    case CMD_WRITE_REGS: {
+        // Every register received, applied in the order of TopEntity: gains,
+        // then setpoints, with the PWM words taking their axis back last
+        uint32_t stage[16];
+        uint16_t dirty = 0;
+        for (unsigned k = 0; k < tx[2]; k++) {
+            uint8_t addr = (uint8_t)(tx[1] + k);
+            if ((addr & 0xF0) != REG_PWM_PITCH) continue;
+            stage[addr & 0x0F] = (uint32_t)GetBe32(&tx[3 + 4 * k]);
+            dirty |= (uint16_t)(1u << (addr & 0x0F));
+        }
+        for (uint8_t addr = REG_GAIN_A; addr <= REG_GAIN_LIMIT; addr++) {
+            if (dirty & (1u << (addr & 0x0F))) WREG(addr) = stage[addr & 0x0F];
+        }
+        if (dirty & (1u << (REG_GAIN_LOAD & 0x0F))) LoadGains(stage[REG_GAIN_LOAD & 0x0F] & 0x1);
+        if (dirty & (0x7u << (REG_SETPOINT_PITCH & 0x0F))) {
+            for (uint8_t addr = REG_SETPOINT_PITCH; addr <= REG_PID_ENABLE; addr++) {
+                if (dirty & (1u << (addr & 0x0F))) WREG(addr) = stage[addr & 0x0F];
+            }
+            SetLoops((int32_t)WREG(REG_SETPOINT_PITCH), (int32_t)WREG(REG_SETPOINT_YAW), (uint8_t)WREG(REG_PID_ENABLE));
+        }
+        if (dirty & (1u << (REG_SAMPLE_PERIOD & 0x0F))) SetSampler(stage[REG_SAMPLE_PERIOD & 0x0F]);
+        if (dirty & (1u << (REG_SAMPLE_FREE & 0x0F))) FreeSamples((uint16_t)stage[REG_SAMPLE_FREE & 0x0F]);
+        if (dirty & (1u << (REG_QUEUE_SETUP & 0x0F))) {
+            uint32_t setup = stage[REG_QUEUE_SETUP & 0x0F];
+            SetQueue((setup >> 24) & 0x1, setup);
+        }
+        if (dirty & (0x3u << (REG_HIST_SETUP & 0x0F))) {
+            for (uint8_t addr = REG_HIST_SETUP; addr <= REG_HIST_BINS; addr++) {
+                if (dirty & (1u << (addr & 0x0F))) WREG(addr) = stage[addr & 0x0F];
+            }
+            ClearIntervals();
+        }
+        for (int i = 0; i < 2; i++) {
+            if (dirty & (1u << ((REG_PWM_PITCH + i) & 0x0F))) WritePwm(i, (uint16_t)stage[(REG_PWM_PITCH + i) & 0x0F]);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+/*********************************************
+* @brief Simulated SpiOpen
+*
+* @return simulated SPI handle
+*********************************************/
+static int SimOpen(unsigned spi_chan, unsigned spi_baud, unsigned spi_flags) {
+    (void)spi_chan; (void)spi_baud; (void)spi_flags;
+    return SIM_SPI_FD;
+}
+
+/*********************************************
+* @brief Simulated SpiClose
+*
+* @return 0
+*********************************************/
+static int SimClose(int fd) {
+    (void)fd;
+    return 0;
+}
+
+/*********************************************
+* @brief Simulated SPI_IOC_MESSAGE: every transfer is its own transaction
+*
+* @param [in]    fd    SPI handle
+* @param [inout] xfers transfers
+* @param [in]    n     number of transfers
+*
+* @return total number of bytes transferred; -1: bad handle
+*********************************************/
+static int SimMessage(int fd, struct spi_ioc_transfer *xfers, unsigned n) {
+    if (fd != SIM_SPI_FD) return -1;
+
+    // Driver overhead first, then the bytes of each transfer
+    SimSpend(g_call_ns);
+    int total = 0;
+    for (unsigned i = 0; i < n; i++) {
+        uint8_t tx[SIM_MAX_BYTES];
+        uint8_t *rx = (uint8_t *)(uintptr_t)xfers[i].rx_buf;
+        unsigned len = xfers[i].len < SIM_MAX_BYTES ? xfers[i].len : SIM_MAX_BYTES;
+        if (xfers[i].tx_buf != 0) {
+            memcpy(tx, (const uint8_t *)(uintptr_t)xfers[i].tx_buf, len);
+        } else {
+            memset(tx, 0, len);
+        }
+
+        pthread_mutex_lock(&g_lock);
+        SimCorrupt(tx, len);
+        SimTransaction(tx, rx, len);
+        if (rx != NULL) SimCorrupt(rx, len);
+        pthread_mutex_unlock(&g_lock);
+        total += (int)xfers[i].len;
+    }
+    SimSpend(g_byte_ns * total);
+    return total;
+}
+
+static const SpiBackend kSimBackend = {
+    .open    = SimOpen,
+    .close   = SimClose,
+    .message = SimMessage,
+};
+
+/*********************************************
+* @brief Returns the simulated transport
+*
+* @return backend to be passed to SpiSetBackend
+*********************************************/
+const SpiBackend *SimSpiBackend(void) {
+    return &kSimBackend;
+}
@@ -0,0 +1,50 @@
+// Filename : spi_sim.h
+// Authors : Luis Moreno (s3608255), Luca Provenzano (s3487636)
+// Group : 43
+// License : N.A. or open source license like LGPL
+// Description : header file for the simulated FPGA SPI device
+//==============================================================
+
+#ifndef SPI_SIM_H
+#define SPI_SIM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "spi_comm.h"
+#include "sim_plant.h"
+
+#define SIM_SPI_FD 100 // Handle returned by the simulated SpiOpen
+
+// Resets the simulated device and its plant, axes start at the given angles.
+void SimDeviceInit(double pitch_theta0, double yaw_theta0);
+
+// Returns the SPI transport talking to the simulated device.
+const SpiBackend *SimSpiBackend(void);
+
+// Returns the plant, brought up to date with the current clock.
+SimPlant *SimDevicePlant(void);
+
+// Camera frame strobe (FRAME_SYNC pin): the positions and their timestamp go
+// into the frame ring read by ReadFramesCmd.
+void SimDeviceFrameSync(void);
+
+// Emulated cost of an SPI message: call_ns per ioctl plus byte_ns per byte.
+// The virtual clock is advanced by it, the real clock is busy-waited.
+void SimDeviceSetLatency(int64_t call_ns, int64_t byte_ns);
+
+// Flips each bit on the bus, both directions, with probability ber (0: clean bus).
+void SimDeviceSetBitErrors(double ber, uint32_t seed);
+
+// Number of bits flipped since SimDeviceSetBitErrors.
+uint64_t SimDeviceFlippedBits(void);
+
+// Number of SPI transactions served since SimDeviceInit.
+uint64_t SimDeviceTransactions(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
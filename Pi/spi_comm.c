@@ -17,10 +17,206 @@
 #define CMD_WRITE_PITCH_PWM 0x10
 #define CMD_WRITE_YAW_PWM   0x11
 #define CMD_WRITE_ALL_PWM   0x12
+#define CMD_WRITE_AXES_PWM  0x13
 #define CMD_READ_PITCH_POS  0x20
 #define CMD_READ_YAW_POS    0x21
 #define CMD_READ_ALL_POSITIONS 0x22
+#define CMD_READ_MOTION  0x23
+#define CMD_READ_AXES    0x24
+#define CMD_READ_VELOCITY 0x25
 #define CHECK_PWM_STATUS 0x30
+#define CMD_EXCHANGE     0x40
+#define CMD_WRITE_PITCH_GAINS 0x50
+#define CMD_WRITE_YAW_GAINS   0x51
+#define CMD_PID_EXCHANGE      0x52
+#define CMD_READ_SAMPLES      0x60
+#define CMD_SET_SAMPLER       0x61
+#define CMD_SET_PWM_QUEUE     0x62
+#define CMD_QUEUE_PWM         0x63
+#define CMD_READ_FRAMES       0x64
+#define CMD_READ_INTERVALS    0x65
+#define CMD_READ_REGS         0x70
+#define CMD_WRITE_REGS        0x71
+#define CMD_CHECKED      0x80 // Flag of the checked frames
+
+#define SPI_CRC_INIT 0xFF
+#define SPI_CRC_POLY 0x07
+
+// Alternative transport (e.g. the simulated device), NULL for spidev
+static const SpiBackend *g_backend = NULL;
+
+// Link settings and checked frame state
+static unsigned g_speed_hz = SPI_SPEED_HZ;
+static int g_checked = 0;
+static uint8_t g_seq = 0;
+static SpiLinkStats g_link;
+
+/*********************************************
+* @brief Selects the transport used by all the SPI functions
+* 
+* @param [in] backend transport to be used, NULL for spidev
+* 
+* @return None.
+*********************************************/
+void SpiSetBackend(const SpiBackend *backend) {
+    g_backend = backend;
+}
+
+/*********************************************
+* @brief Sets the clock of the command functions
+* 
+* @param [in] speed_hz SPI communication frequency
+* 
+* @return None.
+*********************************************/
+void SpiSetSpeed(unsigned speed_hz) {
+    g_speed_hz = speed_hz;
+}
+
+/*********************************************
+* @brief Returns the clock of the command functions
+* 
+* @return SPI communication frequency
+*********************************************/
+unsigned SpiGetSpeed(void) {
+    return g_speed_hz;
+}
+
+/*********************************************
+* @brief Enables or disables the checked frames
+* 
+* @param [in] enable 1: commands carry a sequence byte and CRCs
+* 
+* @return None.
+*********************************************/
+void SpiSetChecked(int enable) {
+    g_checked = enable != 0;
+}
+
+/*********************************************
+* @brief Copies the checked frame counters
+* 
+* @param [out] stats counters
+* 
+* @return None.
+*********************************************/
+void SpiGetLinkStats(SpiLinkStats *stats) {
+    *stats = g_link;
+}
+
+/*********************************************
+* @brief Clears the checked frame counters
+* 
+* @return None.
+*********************************************/
+void SpiResetLinkStats(void) {
+    memset(&g_link, 0, sizeof(g_link));
+}
+
+/*********************************************
+* @brief CRC-8 of a byte string, as computed by TopEntity.v
+* 
+* @param [in] data bytes
+* @param [in] n    number of bytes
+* 
+* @return CRC
+*********************************************/
+uint8_t SpiCrc8(const uint8_t *data, unsigned n) {
+    uint8_t crc = SPI_CRC_INIT;
+    for (unsigned i = 0; i < n; i++) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; b++) {
+            crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ SPI_CRC_POLY) : (uint8_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+/*********************************************
+* @brief Runs n transfers as one message, through the selected backend
+* 
+* @param [in]    fd    SPI communication handle
+* @param [inout] xfers transfers
+* @param [in]    n     number of transfers
+* 
+* @return error code, err >= 0: no error
+*********************************************/
+static int SpiMessage(int fd, struct spi_ioc_transfer *xfers, unsigned n) {
+    if (g_backend != NULL) return g_backend->message(fd, xfers, n);
+
+    int err = ioctl(fd, SPI_IOC_MESSAGE(n), xfers);
+    if (err < 0) perror("SPI_IOC_MESSAGE");
+    return err;
+}
+
+/*********************************************
+* @brief Checks the response of a checked frame and updates the counters
+* 
+* @param [in] tx  command bytes, with the check bytes
+* @param [in] rx  response bytes
+* @param [in] len unchecked command length L
+* 
+* @return 0: response valid and command accepted; -1: frame to be sent again
+*********************************************/
+static int SpiCheckFrame(const uint8_t *tx, const uint8_t *rx, unsigned len) {
+    g_link.frames++;
+    if (SpiCrc8(&rx[1], len) != rx[len + 1]) {
+        g_link.crc_errors++;
+        return -1;
+    }
+    g_link.fpga_errors = rx[len];
+
+    uint8_t seq = tx[len], nack = (uint8_t)~seq, ack = rx[len + 2];
+    if (ack == seq) return 0;
+    if (ack == nack) {
+        g_link.nacks++;
+    } else {
+        g_link.ack_errors++;
+    }
+    return -1;
+}
+
+/*********************************************
+* @brief Runs checked transfers as one message. Each one gets a new sequence
+*        byte and its CRC; the ones failing their checks are sent again,
+*        in a new message, up to SPI_CHECK_RETRIES times.
+* 
+* @param [in]    fd    SPI communication handle
+* @param [inout] xfers checked transfers, reordered by the retries
+* @param [in]    n     number of transfers
+* 
+* @return bytes transferred by the last message; < 0: error code; SPI_ERR_CHECK
+*********************************************/
+static int SpiCheckedMessage(int fd, struct spi_ioc_transfer *xfers, unsigned n) {
+    int err = -1;
+    for (int attempt = 0; attempt <= SPI_CHECK_RETRIES; attempt++) {
+        if (attempt > 0) g_link.retries += n;
+        for (unsigned i = 0; i < n; i++) {
+            uint8_t *tx = (uint8_t *)(uintptr_t)xfers[i].tx_buf;
+            unsigned len = xfers[i].len - SPI_CHECK_BYTES;
+            tx[len]     = g_seq++;
+            tx[len + 1] = SpiCrc8(tx, len + 1);
+            tx[len + 2] = 0x00;
+            xfers[i].cs_change = (i + 1 < n);
+        }
+
+        err = SpiMessage(fd, xfers, n);
+        if (err < 0) return err;
+
+        // Keep the failed transfers, in order
+        unsigned failed = 0;
+        for (unsigned i = 0; i < n; i++) {
+            if (SpiCheckFrame((const uint8_t *)(uintptr_t)xfers[i].tx_buf, (const uint8_t *)(uintptr_t)xfers[i].rx_buf,
+                              xfers[i].len - SPI_CHECK_BYTES) != 0) {
+                xfers[failed++] = xfers[i];
+            }
+        }
+        if (failed == 0) return err;
+        n = failed;
+    }
+    g_link.failures += n;
+    return SPI_ERR_CHECK;
+}
 
 /*********************************************
 * @brief Low-level helper to perform a generic SPI transaction using ioctl.
@@ -43,11 +239,51 @@ static int SpiXfer(int fd, unsigned speed, uint8_t *tx_buf, uint8_t *rx_buf, uns
         .bits_per_word = SPI_BITS_PER_WORD,
         .cs_change     = 0,
     };
-    int err = ioctl(fd, SPI_IOC_MESSAGE(1), &tr);
-    if (err < 0) perror("SPI_IOC_MESSAGE");
+    if (!g_checked) return SpiMessage(fd, &tr, 1);
+
+    // Checked frame: same payload, flagged command and the check bytes appended
+    uint8_t ctx[SPI_FRAME_BYTES], crx[SPI_FRAME_BYTES];
+    if (count + SPI_CHECK_BYTES > SPI_FRAME_BYTES) return -1;
+    memcpy(ctx, tx_buf, count);
+    memset(crx, 0, sizeof(crx));
+    ctx[0] |= CMD_CHECKED;
+    tr.tx_buf = (unsigned long)ctx;
+    tr.rx_buf = (unsigned long)crx;
+    tr.len    = count + SPI_CHECK_BYTES;
+
+    int err = SpiCheckedMessage(fd, &tr, 1);
+    if (err >= 0) memcpy(rx_buf, crx, count);
     return err;
 }
 
+/*********************************************
+* @brief Runs a burst command, longer than the frames SpiXfer handles,
+*        checked the same way when the checked frames are enabled
+* 
+* @param [in]    fd  SPI communication handle
+* @param [inout] tx  command, with room for the check bytes
+* @param [out]   rx  response, with room for the check bytes
+* @param [in]    len unchecked command length
+* 
+* @return bytes transferred; < 0: error code
+*********************************************/
+static int SpiBurstXfer(int fd, uint8_t *tx, uint8_t *rx, unsigned len) {
+    struct spi_ioc_transfer tr = {
+        .tx_buf        = (unsigned long)tx,
+        .rx_buf        = (unsigned long)rx,
+        .len           = len,
+        .speed_hz      = g_speed_hz,
+        .delay_usecs   = 0,
+        .bits_per_word = SPI_BITS_PER_WORD,
+        .cs_change     = 0,
+    };
+    if (!g_checked) return SpiMessage(fd, &tr, 1);
+
+    tx[0] |= CMD_CHECKED;
+    tr.len = len + SPI_CHECK_BYTES;
+    return SpiCheckedMessage(fd, &tr, 1);
+}
+
 /*********************************************
 * @brief Opens SPI communication
 * 
@@ -63,6 +299,8 @@ int SpiOpen(unsigned spi_chan, unsigned spi_baud, unsigned spi_flags) {
     char mode = spi_flags & 0x03;
     char bits = SPI_BITS_PER_WORD;
 
+    if (g_backend != NULL) return g_backend->open(spi_chan, spi_baud, spi_flags);
+
     // Construct the device path (e.g., /dev/spidev0.1) and open it.
     snprintf(dev, sizeof(dev), "/dev/spidev0.%u", spi_chan);
     fd = open(dev, O_RDWR);
@@ -90,6 +328,7 @@ int SpiOpen(unsigned spi_chan, unsigned spi_baud, unsigned spi_flags) {
 * @return None.
 *********************************************/
 int SpiClose(int fd) {
+    if (g_backend != NULL) return g_backend->close(fd);
     return close(fd);
 }
 
@@ -110,7 +349,7 @@ int SendPwmCmd(int fd, encoder_t unit, uint16_t duty, uint8_t enable, uint8_t di
     tx[1] = (uint8_t)(duty & 0xFF);
     tx[2] = (uint8_t)(((enable & 0x1) << 7) | ((dir & 0x1) << 6) | (((duty >> 8) & 0x0F) << 2));
     memset(rx, 0, sizeof(rx));
-    return SpiXfer(fd, SPI_SPEED_HZ, tx, rx, 3);
+    return SpiXfer(fd, g_speed_hz, tx, rx, 3);
 }
 
 
@@ -141,7 +380,7 @@ int SendAllPwmCmd(int fd, uint16_t pitch_duty, uint8_t pitch_enable, uint8_t pit
     tx[4] = (uint8_t)(((yaw_enable & 0x1) << 7) | ((yaw_dir & 0x1) << 6) | (((yaw_duty >> 8) & 0x0F) << 2));
 
     memset(rx, 0, sizeof(rx));
-    return SpiXfer(fd, SPI_SPEED_HZ, tx, rx, 5);
+    return SpiXfer(fd, g_speed_hz, tx, rx, 5);
 }
 
 
@@ -156,9 +395,26 @@ int SendAllPwmCmd(int fd, uint16_t pitch_duty, uint8_t pitch_enable, uint8_t pit
 * @return 0: Position read succesfully; < 0: returns code error
 *********************************************/
 int ReadPositionCmd(int fd, encoder_t unit, int32_t *pitch_pos, int32_t *yaw_pos) {
+    uint32_t stamp;
+    return ReadPositionStampedCmd(fd, unit, pitch_pos, yaw_pos, &stamp);
+}
+
+/*********************************************
+* @brief Reads from SPI the device position in steps, with the FPGA clock
+*        cycle in which it was sampled. The timestamp follows the positions.
+* 
+* @param [in] fd SPI communication channel
+* @param [in] unit determines the unit read (Yaw, Pitch, both)
+* @param [out] pitch_pos pitch steps position
+* @param [out] yaw_pos yaw steps position
+* @param [out] stamp FPGA clock cycle of the sample
+* 
+* @return 0: Position read succesfully; < 0: returns code error
+*********************************************/
+int ReadPositionStampedCmd(int fd, encoder_t unit, int32_t *pitch_pos, int32_t *yaw_pos, uint32_t *stamp) {
     // Ternary operator to set up single-axis or dual-axis read.
     int32_t *out_pos = (unit == UnitPitch) ? pitch_pos : (unit == UnitYaw) ? yaw_pos : NULL;
-    uint8_t byte_size = (unit == UnitAll) ? 9 : 5;
+    uint8_t byte_size = (unit == UnitAll) ? 13 : 9;
     uint8_t tx[byte_size], rx[byte_size];
 
     // The first byte sent is the command code. The rest are dummy bytes (0x00).
@@ -166,22 +422,398 @@ int ReadPositionCmd(int fd, encoder_t unit, int32_t *pitch_pos, int32_t *yaw_pos
     memset(rx, 0, sizeof(rx));
     tx[0] = (unit == UnitPitch) ? CMD_READ_PITCH_POS : (unit == UnitYaw) ? CMD_READ_YAW_POS : CMD_READ_ALL_POSITIONS;
 
-    int err = SpiXfer(fd, SPI_SPEED_HZ, tx, rx, byte_size);
+    int err = SpiXfer(fd, g_speed_hz, tx, rx, byte_size);
     if (err < 0) return err;
 
     // Reconstruct the 32-bit integer position values from the received bytes.
     if (unit == UnitAll) {
         *pitch_pos = ((int32_t)rx[1] << 24) | ((int32_t)rx[2] << 16) | ((int32_t)rx[3] << 8) | (int32_t)rx[4];
         *yaw_pos   = ((int32_t)rx[5] << 24) | ((int32_t)rx[6] << 16) | ((int32_t)rx[7] << 8) | (int32_t)rx[8];
+        *stamp     = ((uint32_t)rx[9] << 24) | ((uint32_t)rx[10] << 16) | ((uint32_t)rx[11] << 8) | (uint32_t)rx[12];
         return 0;
     }
 
     if (out_pos != NULL) {
         *out_pos = ((int32_t)rx[1] << 24) | ((int32_t)rx[2] << 16) | ((int32_t)rx[3] << 8) | (int32_t)rx[4];
     }
+    *stamp = ((uint32_t)rx[5] << 24) | ((uint32_t)rx[6] << 16) | ((uint32_t)rx[7] << 8) | (uint32_t)rx[8];
+    return 0;
+}
+
+/*********************************************
+* @brief Time between two FPGA timestamps. The unsigned difference stays
+*        right across one wrap of the counter.
+* 
+* @param [in] from earlier timestamp
+* @param [in] to   later timestamp
+* 
+* @return seconds
+*********************************************/
+double SpiStampSeconds(uint32_t from, uint32_t to) {
+    return (double)(uint32_t)(to - from) / (double)FPGA_CLK_HZ;
+}
+
+/*********************************************
+* @brief Reads both positions and writes both PWM words in a single CS
+*        assertion. The PWM words travel in the bytes the FPGA receives
+*        while it sends the positions, and are applied at CS deassert.
+* 
+* @param [in]  fd            SPI communication handle
+* @param [in]  pitch_duty    pitch duty cicle
+* @param [in]  pitch_enable  pitch pwm enable bit
+* @param [in]  pitch_dir     pitch pwm direction bit
+* @param [in]  yaw_duty      yaw duty cicle
+* @param [in]  yaw_enable    yaw pwm enable bit
+* @param [in]  yaw_dir       yaw pwm direction bit
+* @param [out] pitch_pos     pitch steps position, sampled before the PWM update
+* @param [out] yaw_pos       yaw steps position, sampled before the PWM update
+* 
+* @return 0: No error; < 0: error code
+*********************************************/
+int ExchangeCmd(int fd, uint16_t pitch_duty, uint8_t pitch_enable, uint8_t pitch_dir,
+                uint16_t yaw_duty, uint8_t yaw_enable, uint8_t yaw_dir, int32_t *pitch_pos, int32_t *yaw_pos) {
+    uint8_t tx[9] = { CMD_EXCHANGE }, rx[9] = {0};
+
+    // Byte 1-4: PWM data, packed as for CMD_WRITE_ALL_PWM. Bytes 5-8 are dummies.
+    tx[1] = (uint8_t)(pitch_duty & 0xFF);
+    tx[2] = (uint8_t)(((pitch_enable & 0x1) << 7) | ((pitch_dir & 0x1) << 6) | (((pitch_duty >> 8) & 0x0F) << 2));
+    tx[3] = (uint8_t)(yaw_duty & 0xFF);
+    tx[4] = (uint8_t)(((yaw_enable & 0x1) << 7) | ((yaw_dir & 0x1) << 6) | (((yaw_duty >> 8) & 0x0F) << 2));
+
+    int err = SpiXfer(fd, g_speed_hz, tx, rx, 9);
+    if (err < 0) return err;
+
+    *pitch_pos = ((int32_t)rx[1] << 24) | ((int32_t)rx[2] << 16) | ((int32_t)rx[3] << 8) | (int32_t)rx[4];
+    *yaw_pos   = ((int32_t)rx[5] << 24) | ((int32_t)rx[6] << 16) | ((int32_t)rx[7] << 8) | (int32_t)rx[8];
+    return 0;
+}
+
+/*********************************************
+* @brief Reads both positions together with the movement code of each
+*        encoder, which the FPGA sets to MOTION_IDLE when no edge was seen
+*        for its idle time
+* 
+* @param [in]  fd           SPI communication handle
+* @param [out] pitch_pos    pitch steps position
+* @param [out] yaw_pos      yaw steps position
+* @param [out] pitch_motion pitch movement code (MOTION_*)
+* @param [out] yaw_motion   yaw movement code (MOTION_*)
+* 
+* @return 0: No error; < 0: error code
+*********************************************/
+int ReadMotionCmd(int fd, int32_t *pitch_pos, int32_t *yaw_pos, uint8_t *pitch_motion, uint8_t *yaw_motion) {
+    uint8_t tx[10] = { CMD_READ_MOTION }, rx[10] = {0};
+    int err = SpiXfer(fd, g_speed_hz, tx, rx, 10);
+    if (err < 0) return err;
+
+    *pitch_pos    = ((int32_t)rx[1] << 24) | ((int32_t)rx[2] << 16) | ((int32_t)rx[3] << 8) | (int32_t)rx[4];
+    *yaw_pos      = ((int32_t)rx[5] << 24) | ((int32_t)rx[6] << 16) | ((int32_t)rx[7] << 8) | (int32_t)rx[8];
+    *pitch_motion = rx[9] & 0x03;
+    *yaw_motion   = (rx[9] >> 4) & 0x03;
+    return 0;
+}
+
+/*********************************************
+* @brief Reads both positions together with the velocity estimates of each
+*        encoder: edge period (bytes 9-12 pitch, 13-16 yaw) and edges per
+*        window (bytes 17-18 pitch, 19-20 yaw)
+* 
+* @param [in]  fd        SPI communication handle
+* @param [out] pitch_pos pitch steps position
+* @param [out] yaw_pos   yaw steps position
+* @param [out] pitch_vel pitch velocity estimates
+* @param [out] yaw_vel   yaw velocity estimates
+* 
+* @return 0: No error; < 0: error code
+*********************************************/
+int ReadVelocityCmd(int fd, int32_t *pitch_pos, int32_t *yaw_pos, EncoderVelocity *pitch_vel, EncoderVelocity *yaw_vel) {
+    uint8_t tx[21] = { CMD_READ_VELOCITY }, rx[21] = {0};
+    int err = SpiXfer(fd, g_speed_hz, tx, rx, 21);
+    if (err < 0) return err;
+
+    *pitch_pos        = ((int32_t)rx[1] << 24) | ((int32_t)rx[2] << 16) | ((int32_t)rx[3] << 8) | (int32_t)rx[4];
+    *yaw_pos          = ((int32_t)rx[5] << 24) | ((int32_t)rx[6] << 16) | ((int32_t)rx[7] << 8) | (int32_t)rx[8];
+    pitch_vel->period = ((int32_t)rx[9] << 24) | ((int32_t)rx[10] << 16) | ((int32_t)rx[11] << 8) | (int32_t)rx[12];
+    yaw_vel->period   = ((int32_t)rx[13] << 24) | ((int32_t)rx[14] << 16) | ((int32_t)rx[15] << 8) | (int32_t)rx[16];
+    pitch_vel->window = (int16_t)(((uint16_t)rx[17] << 8) | rx[18]);
+    yaw_vel->window   = (int16_t)(((uint16_t)rx[19] << 8) | rx[20]);
     return 0;
 }
 
+/*********************************************
+* @brief Speed of an encoder from its FPGA estimates. Fast, the window
+*        count is used, it averages the edge spacing errors of the encoder.
+*        Slow, a window holds few edges and the period between them is
+*        used instead.
+* 
+* @param [in] vel velocity estimates
+* 
+* @return counts per second, signed
+*********************************************/
+double EncoderVelocityCps(const EncoderVelocity *vel) {
+    int edges = vel->window < 0 ? -vel->window : vel->window;
+    if (edges >= VEL_WINDOW_MIN_EDGES || vel->period == 0) {
+        return (double)vel->window * 1e6 / (double)FPGA_VEL_WINDOW_US;
+    }
+    return (double)FPGA_CLK_HZ / (double)vel->period;
+}
+
+/*********************************************
+* @brief Stores a big-endian 32-bit value, in the order the FPGA shifts it in
+* 
+* @param [out] p     first byte
+* @param [in]  value value
+* 
+* @return None.
+*********************************************/
+static inline void PutBe32(uint8_t *p, uint32_t value) {
+    p[0] = (uint8_t)(value >> 24);
+    p[1] = (uint8_t)(value >> 16);
+    p[2] = (uint8_t)(value >> 8);
+    p[3] = (uint8_t)value;
+}
+
+/*********************************************
+* @brief Big-endian 32-bit value from the received bytes
+* 
+* @param [in] p first byte
+* 
+* @return value
+*********************************************/
+static inline int32_t Be32(const uint8_t *p) {
+    return (int32_t)(((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3]);
+}
+
+/*********************************************
+* @brief Loads the coefficients of the FPGA position loop of one axis:
+*        a, b, c, d (bytes 1-16) and the limit (bytes 17-18), big-endian
+* 
+* @param [in] fd    SPI communication handle
+* @param [in] unit  axis (pitch or yaw)
+* @param [in] gains coefficients, see fpga_pid.h
+* 
+* @return Return value of SpiXfer function
+*********************************************/
+int SendPidGainsCmd(int fd, encoder_t unit, const FpgaPidGains *gains) {
+    uint8_t tx[19], rx[19];
+    tx[0] = (unit == UnitPitch) ? CMD_WRITE_PITCH_GAINS : CMD_WRITE_YAW_GAINS;
+    PutBe32(&tx[1], (uint32_t)gains->a);
+    PutBe32(&tx[5], (uint32_t)gains->b);
+    PutBe32(&tx[9], (uint32_t)gains->c);
+    PutBe32(&tx[13], gains->d);
+    tx[17] = (uint8_t)(gains->limit >> 8);
+    tx[18] = (uint8_t)gains->limit;
+    memset(rx, 0, sizeof(rx));
+    return SpiXfer(fd, g_speed_hz, tx, rx, 19);
+}
+
+/*********************************************
+* @brief Reads both positions and writes the setpoints of the FPGA
+*        position loops in a single CS assertion, as ExchangeCmd does with
+*        the PWM words. The setpoints are applied at CS deassert.
+* 
+* @param [in]  fd             SPI communication handle
+* @param [in]  pitch_setpoint pitch setpoint in encoder counts
+* @param [in]  yaw_setpoint   yaw setpoint in encoder counts
+* @param [in]  enable         PID_ENABLE_* bits of the loops to be run
+* @param [out] pitch_pos      pitch steps position, sampled before the update
+* @param [out] yaw_pos        yaw steps position, sampled before the update
+* 
+* @return 0: No error; < 0: error code
+*********************************************/
+int PidExchangeCmd(int fd, int32_t pitch_setpoint, int32_t yaw_setpoint, uint8_t enable,
+                   int32_t *pitch_pos, int32_t *yaw_pos) {
+    uint8_t tx[10] = { CMD_PID_EXCHANGE }, rx[10] = {0};
+    PutBe32(&tx[1], (uint32_t)pitch_setpoint);
+    PutBe32(&tx[5], (uint32_t)yaw_setpoint);
+    tx[9] = enable & (PID_ENABLE_PITCH | PID_ENABLE_YAW);
+
+    int err = SpiXfer(fd, g_speed_hz, tx, rx, 10);
+    if (err < 0) return err;
+
+    *pitch_pos = ((int32_t)rx[1] << 24) | ((int32_t)rx[2] << 16) | ((int32_t)rx[3] << 8) | (int32_t)rx[4];
+    *yaw_pos   = ((int32_t)rx[5] << 24) | ((int32_t)rx[6] << 16) | ((int32_t)rx[7] << 8) | (int32_t)rx[8];
+    return 0;
+}
+
+/*********************************************
+* @brief Sets the period of the FPGA sampler, which also empties its buffer
+* 
+* @param [in] fd            SPI communication handle
+* @param [in] period_cycles FPGA clock cycles between samples, up to 2^24-1; 0: stopped
+* 
+* @return bytes transferred; < 0: error code
+*********************************************/
+int SetSamplerCmd(int fd, uint32_t period_cycles) {
+    if (period_cycles > 0xFFFFFF) return -1;
+    uint8_t tx[5] = { CMD_SET_SAMPLER, (uint8_t)(period_cycles >> 16), (uint8_t)(period_cycles >> 8),
+                      (uint8_t)period_cycles, 0x00 };
+    uint8_t rx[5] = {0};
+    return SpiXfer(fd, g_speed_hz, tx, rx, 5);
+}
+
+/*********************************************
+* @brief Reads a burst of samples from the FPGA sampler. The burst is
+*        addressed by sample index, so one sent again (checked frames)
+*        returns the same samples; the samples before first are freed.
+* 
+* @param [in]  fd         SPI communication handle
+* @param [in]  first      index of the first sample wanted
+* @param [in]  max        samples to read, 1..SAMPLE_BURST_MAX
+* @param [out] samples    max samples, the valid ones first
+* @param [out] next_index index of the next sample the FPGA takes
+* @param [out] overflows  samples dropped by the FPGA, wraps at 256
+* 
+* @return number of valid samples; < 0: error code
+*********************************************/
+int ReadSamplesCmd(int fd, uint16_t first, unsigned max, EncoderSample *samples, uint16_t *next_index,
+                   uint8_t *overflows) {
+    if (max == 0 || max > SAMPLE_BURST_MAX) return -1;
+
+    uint8_t tx[SAMPLE_BURST_BYTES(SAMPLE_BURST_MAX) + SPI_CHECK_BYTES];
+    uint8_t rx[SAMPLE_BURST_BYTES(SAMPLE_BURST_MAX) + SPI_CHECK_BYTES];
+    unsigned len = SAMPLE_BURST_BYTES(max);
+    memset(tx, 0, len + SPI_CHECK_BYTES);
+    memset(rx, 0, len + SPI_CHECK_BYTES);
+    tx[0] = CMD_READ_SAMPLES;
+    tx[1] = (uint8_t)(first >> 8);
+    tx[2] = (uint8_t)first;
+    tx[3] = (uint8_t)max;
+
+    int err = SpiBurstXfer(fd, tx, rx, len);
+    if (err < 0) return err;
+
+    *next_index = (uint16_t)((rx[1] << 8) | rx[2]);
+    *overflows  = rx[3];
+    unsigned n = (uint16_t)(*next_index - first);
+    if (n > SAMPLE_FIFO_DEPTH) n = 0;   // first is ahead of the FPGA, e.g. after a restart
+    if (n > max) n = max;
+    for (unsigned k = 0; k < n; k++) {
+        const uint8_t *p = &rx[5 + 12 * k];
+        samples[k].pitch = Be32(&p[0]);
+        samples[k].yaw   = Be32(&p[4]);
+        samples[k].stamp = (uint32_t)Be32(&p[8]);
+    }
+    return (int)n;
+}
+
+/*********************************************
+* @brief Reads a burst of frame-sync snapshots. The ring slots are
+*        addressed by frame index; the oldest frame the ring holds can be
+*        overwritten by a strobe during the burst, so it is not taken.
+* 
+* @param [in]    fd         SPI communication handle
+* @param [inout] first      index of the first frame wanted; of frames[0] on return
+* @param [in]    max        frames to read, 1..FRAME_RING_DEPTH
+* @param [out]   frames     max frames, the valid ones first
+* @param [out]   next_index index of the next frame the FPGA takes
+* 
+* @return number of valid frames; < 0: error code
+*********************************************/
+int ReadFramesCmd(int fd, uint16_t *first, unsigned max, EncoderSample *frames, uint16_t *next_index) {
+    if (max == 0 || max > FRAME_RING_DEPTH) return -1;
+
+    uint8_t tx[FRAME_BURST_BYTES(FRAME_RING_DEPTH) + SPI_CHECK_BYTES];
+    uint8_t rx[FRAME_BURST_BYTES(FRAME_RING_DEPTH) + SPI_CHECK_BYTES];
+    unsigned len = FRAME_BURST_BYTES(max);
+    memset(tx, 0, len + SPI_CHECK_BYTES);
+    memset(rx, 0, len + SPI_CHECK_BYTES);
+    tx[0] = CMD_READ_FRAMES;
+    tx[1] = (uint8_t)(*first >> 8);
+    tx[2] = (uint8_t)*first;
+    tx[3] = (uint8_t)max;
+
+    int err = SpiBurstXfer(fd, tx, rx, len);
+    if (err < 0) return err;
+
+    *next_index = (uint16_t)((rx[1] << 8) | rx[2]);
+    uint16_t oldest = (uint16_t)(*next_index - (FRAME_RING_DEPTH - 1));
+    unsigned skip = 0;
+    if ((uint16_t)(*next_index - *first) > FRAME_RING_DEPTH - 1) {
+        // Overwritten, or ahead of the FPGA (e.g. after a restart): from the oldest held on
+        skip = (uint16_t)(oldest - *first);
+        if (skip >= max) {
+            *first = oldest;
+            return 0;
+        }
+    }
+    unsigned n = (uint16_t)(*next_index - *first) - skip;
+    if (n > max - skip) n = max - skip;
+    for (unsigned k = 0; k < n; k++) {
+        const uint8_t *p = &rx[5 + 12 * (skip + k)];
+        frames[k].pitch = Be32(&p[0]);
+        frames[k].yaw   = Be32(&p[4]);
+        frames[k].stamp = (uint32_t)Be32(&p[8]);
+    }
+    *first = (uint16_t)(*first + skip);
+    return (int)n;
+}
+
+/*********************************************
+* @brief Starts the FPGA sampler and resets the reader state
+* 
+* @param [out] st      stream
+* @param [in]  fd      SPI communication handle
+* @param [in]  rate_hz samples per second, FPGA_CLK_HZ / 2^24 .. FPGA_CLK_HZ
+* 
+* @return 0: No error; < 0: error code
+*********************************************/
+int SampleStreamStart(SampleStream *st, int fd, unsigned rate_hz) {
+    memset(st, 0, sizeof(*st));
+    if (rate_hz == 0 || rate_hz > FPGA_CLK_HZ) return -1;
+    int err = SetSamplerCmd(fd, (FPGA_CLK_HZ + rate_hz / 2) / rate_hz);
+    return err < 0 ? err : 0;
+}
+
+/*********************************************
+* @brief Reads the samples taken since the previous call in one burst and
+*        counts the ones the FPGA dropped in the meantime
+* 
+* @param [inout] st      stream
+* @param [in]    fd      SPI communication handle
+* @param [out]   samples buffer of max samples
+* @param [in]    max     buffer size; at most SAMPLE_BURST_MAX are read
+* 
+* @return number of samples read; < 0: error code
+*********************************************/
+int SampleStreamDrain(SampleStream *st, int fd, EncoderSample *samples, unsigned max) {
+    uint16_t next_index;
+    uint8_t overflows;
+    int n = ReadSamplesCmd(fd, st->next, max < SAMPLE_BURST_MAX ? max : SAMPLE_BURST_MAX, samples, &next_index,
+                           &overflows);
+    if (n < 0) return n;
+    st->dropped  += (uint8_t)(overflows - st->overflows);
+    st->overflows = overflows;
+    st->next     += (uint16_t)n;
+    return n;
+}
+
+/*********************************************
+* @brief Unpacks the PWM status of one axis, as command 0x30 packs it
+* 
+* @param [in]  p      {en, dir, duty[11:8], 2'b00}, duty[7:0]
+* @param [out] status status struct
+* 
+* @return None.
+*********************************************/
+static void UnpackPwm(const uint8_t *p, PwmStatus *status) {
+    status->enable = (p[0] >> 7) & 0x01;
+    status->dir    = (p[0] >> 6) & 0x01;
+    status->duty   = (uint16_t)(((p[0] >> 2) & 0x0F) << 8 | p[1]);
+}
+
+/*********************************************
+* @brief Packs the PWM word of one axis, as command 0x30 reports it
+* 
+* @param [in] status enable, direction and duty cycle
+* 
+* @return {en, dir, duty[11:8], 2'b00, duty[7:0]}
+*********************************************/
+static uint16_t PackPwm(const PwmStatus *status) {
+    return (uint16_t)((((status->enable & 0x1) << 7) | ((status->dir & 0x1) << 6) | (((status->duty >> 8) & 0x0F) << 2))
+                      << 8 | (status->duty & 0xFF));
+}
+
 /*********************************************
 * @brief Checks the PWM status
 * 
@@ -193,16 +825,492 @@ int ReadPositionCmd(int fd, encoder_t unit, int32_t *pitch_pos, int32_t *yaw_pos
 *********************************************/
 int CheckPwmStatus(int fd, PwmStatus *pitch_status, PwmStatus *yaw_status) {
     uint8_t tx[5] = { CHECK_PWM_STATUS }, rx[5] = {0};
-    int err = SpiXfer(fd, SPI_SPEED_HZ, tx, rx, 5);
+    int err = SpiXfer(fd, g_speed_hz, tx, rx, 5);
     if (err < 0) return err;
     
     // Unpack the received bytes into the status structs.
-    pitch_status->enable = (rx[1] >> 7) & 0x01;
-    pitch_status->dir    = (rx[1] >> 6) & 0x01;
-    pitch_status->duty   = ((rx[1] >> 2) & 0x0F) << 8 | rx[2];
+    UnpackPwm(&rx[1], pitch_status);
+    UnpackPwm(&rx[3], yaw_status);
+    return 0;
+}
+
+/*********************************************
+* @brief Sets up the FPGA PWM queue, which also empties it
+* 
+* @param [in] fd             SPI communication handle
+* @param [in] flags          PWM_QUEUE_BRAKE: brake on underrun; 0: hold the last words
+* @param [in] timeout_cycles FPGA clock cycles without entry before an underrun, up to 2^24-1; 0: never
+* 
+* @return bytes transferred; < 0: error code
+*********************************************/
+int SetPwmQueueCmd(int fd, uint8_t flags, uint32_t timeout_cycles) {
+    if (timeout_cycles > 0xFFFFFF) return -1;
+    uint8_t tx[5] = { CMD_SET_PWM_QUEUE, (uint8_t)(flags & PWM_QUEUE_BRAKE), (uint8_t)(timeout_cycles >> 16),
+                      (uint8_t)(timeout_cycles >> 8), (uint8_t)timeout_cycles };
+    uint8_t rx[5] = {0};
+    return SpiXfer(fd, g_speed_hz, tx, rx, 5);
+}
+
+/*********************************************
+* @brief Sends entries to the FPGA PWM queue in one transaction. They are
+*        addressed by entry index, so a frame sent again (checked frames)
+*        does not queue anything twice.
+* 
+* @param [in]  fd        SPI communication handle
+* @param [in]  first     index of the first entry
+* @param [in]  entries   n entries
+* @param [in]  n         number of entries, 1..PWM_QUEUE_BURST_MAX
+* @param [out] wr_index  index the FPGA expects next, before the transaction
+* @param [out] rd_index  index of the next entry to be applied, before the transaction
+* @param [out] underruns underrun count, wraps at 256
+* 
+* @return entries now queued, from the first one; < 0: error code
+*********************************************/
+int QueuePwmCmd(int fd, uint16_t first, const PwmQueueEntry *entries, unsigned n, uint16_t *wr_index,
+                uint16_t *rd_index, uint8_t *underruns) {
+    if (n == 0 || n > PWM_QUEUE_BURST_MAX) return -1;
+
+    uint8_t tx[PWM_QUEUE_BURST_BYTES(PWM_QUEUE_BURST_MAX) + SPI_CHECK_BYTES];
+    uint8_t rx[PWM_QUEUE_BURST_BYTES(PWM_QUEUE_BURST_MAX) + SPI_CHECK_BYTES];
+    unsigned len = PWM_QUEUE_BURST_BYTES(n);
+    memset(tx, 0, len + SPI_CHECK_BYTES);
+    memset(rx, 0, len + SPI_CHECK_BYTES);
+    tx[0] = CMD_QUEUE_PWM;
+    tx[1] = (uint8_t)(first >> 8);
+    tx[2] = (uint8_t)first;
+    tx[3] = (uint8_t)n;
+    for (unsigned k = 0; k < n; k++) {
+        uint8_t *p = &tx[6 + 8 * k];
+        PutBe32(p, entries[k].at);
+        PutBe32(&p[4], ((uint32_t)PackPwm(&entries[k].pitch) << 16) | PackPwm(&entries[k].yaw));
+    }
+
+    int err = SpiBurstXfer(fd, tx, rx, len);
+    if (err < 0) return err;
+
+    *wr_index  = (uint16_t)((rx[1] << 8) | rx[2]);
+    *rd_index  = (uint16_t)((rx[3] << 8) | rx[4]);
+    *underruns = rx[5];
+
+    // As the FPGA: entries before its write index were queued already, the
+    // ones from it on are taken while there is room
+    unsigned queued = (uint16_t)(*wr_index - first);
+    if (queued > PWM_QUEUE_DEPTH) return 0;  // first is ahead of the FPGA, e.g. after a restart
+    if (queued >= n) return (int)n;
+    unsigned room = PWM_QUEUE_DEPTH - (uint16_t)(*wr_index - *rd_index);
+    return (int)(queued + (n - queued < room ? n - queued : room));
+}
+
+/*********************************************
+* @brief Sets up the FPGA PWM queue and resets the writer state
+* 
+* @param [out] q              queue
+* @param [in]  fd             SPI communication handle
+* @param [in]  flags          as SetPwmQueueCmd
+* @param [in]  timeout_cycles as SetPwmQueueCmd
+* 
+* @return 0: No error; < 0: error code
+*********************************************/
+int PwmQueueStart(PwmQueue *q, int fd, uint8_t flags, uint32_t timeout_cycles) {
+    memset(q, 0, sizeof(*q));
+    int err = SetPwmQueueCmd(fd, flags, timeout_cycles);
+    return err < 0 ? err : 0;
+}
+
+/*********************************************
+* @brief Sends the next entries to the FPGA PWM queue and counts the
+*        underruns reported since the previous call
+* 
+* @param [inout] q       queue
+* @param [in]    fd      SPI communication handle
+* @param [in]    entries n entries, following the ones already taken
+* @param [in]    n       number of entries; at most PWM_QUEUE_BURST_MAX are sent
+* 
+* @return entries taken; < 0: error code
+*********************************************/
+int PwmQueuePush(PwmQueue *q, int fd, const PwmQueueEntry *entries, unsigned n) {
+    uint16_t wr_index, rd_index;
+    uint8_t underruns;
+    int taken = QueuePwmCmd(fd, q->next, entries, n < PWM_QUEUE_BURST_MAX ? n : PWM_QUEUE_BURST_MAX, &wr_index,
+                            &rd_index, &underruns);
+    if (taken < 0) return taken;
+    q->underrun_total += (uint8_t)(underruns - q->underruns);
+    q->underruns = underruns;
+    q->next     += (uint16_t)taken;
+    q->level     = (uint16_t)(q->next - rd_index);
+    return taken;
+}
+
+/*********************************************
+* @brief Reads a burst of registers (command 0x70). The address moves on
+*        after each register, so any contiguous block of the map comes
+*        from one snapshot.
+* 
+* @param [in]  fd     SPI communication handle
+* @param [in]  addr   first register (REG_*)
+* @param [in]  count  number of registers, 1..REG_BURST_MAX
+* @param [out] values count register values
+* 
+* @return 0: No error; < 0: error code
+*********************************************/
+int ReadRegsCmd(int fd, uint8_t addr, unsigned count, uint32_t *values) {
+    if (count == 0 || count > REG_BURST_MAX) return -1;
+
+    uint8_t tx[REG_BURST_BYTES(REG_BURST_MAX) + SPI_CHECK_BYTES];
+    uint8_t rx[REG_BURST_BYTES(REG_BURST_MAX) + SPI_CHECK_BYTES];
+    unsigned len = REG_BURST_BYTES(count);
+    memset(tx, 0, len + SPI_CHECK_BYTES);
+    memset(rx, 0, len + SPI_CHECK_BYTES);
+    tx[0] = CMD_READ_REGS;
+    tx[1] = addr;
+    tx[2] = (uint8_t)count;
+
+    int err = SpiBurstXfer(fd, tx, rx, len);
+    if (err < 0) return err;
+
+    for (unsigned k = 0; k < count; k++) values[k] = (uint32_t)Be32(&rx[3 + 4 * k]);
+    return 0;
+}
+
+/*********************************************
+* @brief Writes a burst of registers (command 0x71). The FPGA applies all
+*        of them at CS deassert, as the command carrying each one would.
+* 
+* @param [in] fd     SPI communication handle
+* @param [in] addr   first register (REG_*)
+* @param [in] count  number of registers, 1..REG_BURST_MAX
+* @param [in] values count register values
+* 
+* @return bytes transferred; < 0: error code
+*********************************************/
+int WriteRegsCmd(int fd, uint8_t addr, unsigned count, const uint32_t *values) {
+    if (count == 0 || count > REG_BURST_MAX) return -1;
+
+    uint8_t tx[REG_BURST_BYTES(REG_BURST_MAX) + SPI_CHECK_BYTES];
+    uint8_t rx[REG_BURST_BYTES(REG_BURST_MAX) + SPI_CHECK_BYTES];
+    unsigned len = REG_BURST_BYTES(count);
+    memset(tx, 0, len + SPI_CHECK_BYTES);
+    memset(rx, 0, len + SPI_CHECK_BYTES);
+    tx[0] = CMD_WRITE_REGS;
+    tx[1] = addr;
+    tx[2] = (uint8_t)count;
+    for (unsigned k = 0; k < count; k++) PutBe32(&tx[3 + 4 * k], values[k]);
+
+    return SpiBurstXfer(fd, tx, rx, len);
+}
+
+/*********************************************
+* @brief Reads the map ID and the readable registers (positions to link
+*        errors) in one burst and decodes them
+* 
+* @param [in]  fd   SPI communication handle
+* @param [out] snap state of the FPGA when CS fell
+* 
+* @return 0: No error; -1: no register map (e.g. older FPGA image); < 0: error code
+*********************************************/
+int ReadSnapshotCmd(int fd, FpgaSnapshot *snap) {
+    uint32_t reg[REG_LINK_ERRORS + 1];  // Indexed by register address
+    int err = ReadRegsCmd(fd, REG_ID, REG_LINK_ERRORS + 1, reg);
+    if (err < 0) return err;
+    if (reg[REG_ID] != REG_MAP_ID) return -1;
+
+    uint8_t pwm[4];
+    PutBe32(pwm, reg[REG_PWM_STATUS]);
+    snap->pitch            = (int32_t)reg[REG_POS_PITCH];
+    snap->yaw              = (int32_t)reg[REG_POS_YAW];
+    snap->stamp            = reg[REG_TIMESTAMP];
+    snap->pitch_motion     = (uint8_t)(reg[REG_MOTION] & 0x03);
+    snap->yaw_motion       = (uint8_t)((reg[REG_MOTION] >> 4) & 0x03);
+    UnpackPwm(&pwm[0], &snap->pitch_pwm);
+    UnpackPwm(&pwm[2], &snap->yaw_pwm);
+    snap->pitch_vel.period = (int32_t)reg[REG_PERIOD_PITCH];
+    snap->yaw_vel.period   = (int32_t)reg[REG_PERIOD_YAW];
+    snap->pitch_vel.window = (int16_t)(reg[REG_WINDOWS] >> 16);
+    snap->yaw_vel.window   = (int16_t)reg[REG_WINDOWS];
+    snap->sample_index     = (uint16_t)(reg[REG_SAMPLES] >> 16);
+    snap->sample_overflows = (uint8_t)(reg[REG_SAMPLES] >> 8);
+    snap->link_errors      = (uint8_t)reg[REG_LINK_ERRORS];
+    return 0;
+}
+
+/*********************************************
+* @brief Reads the number of encoder/PWM channels of the FPGA
+* 
+* @param [in] fd SPI communication handle
+* 
+* @return channels, 0 for an FPGA image without axis commands; < 0: error code
+*********************************************/
+int ReadAxisCountCmd(int fd) {
+    uint32_t axes;
+    int err = ReadRegsCmd(fd, REG_AXES, 1, &axes);
+    if (err < 0) return err;
+    return axes <= AXES_MAX ? (int)axes : 0;
+}
+
+/*********************************************
+* @brief Sets up the FPGA interval histogram (registers 0x1E/0x1F, written
+*        together), which clears it
+* 
+* @param [in] fd         SPI communication handle
+* @param [in] cmd        command timed (0x00-0x7F), or INTERVAL_ALL_CMDS
+* @param [in] origin     lower end of the first bin, FPGA clock cycles
+* @param [in] width_log2 bin width, 2^width_log2 FPGA clock cycles, 0..31
+* @param [in] deadline   longest interval not missed, FPGA clock cycles; 0: none
+* 
+* @return bytes transferred; < 0: error code
+*********************************************/
+int SetIntervalHistogramCmd(int fd, int cmd, uint32_t origin, unsigned width_log2, uint32_t deadline) {
+    if (cmd < INTERVAL_ALL_CMDS || cmd > 0x7F || origin > 0xFFFFFFu || width_log2 > 31 || deadline > 0xFFFFFFu) {
+        return -1;
+    }
+
+    uint32_t regs[2];
+    regs[0] = (cmd == INTERVAL_ALL_CMDS ? 0u : (HIST_ONE_CMD | (uint32_t)cmd) << 24) | origin;
+    regs[1] = ((uint32_t)width_log2 << 24) | deadline;
+    return WriteRegsCmd(fd, REG_HIST_SETUP, 2, regs);
+}
+
+/*********************************************
+* @brief Reads the interval statistics (registers 0x20-0x23), then all the
+*        bins of the interval histogram in one burst (command 0x65)
+* 
+* @param [in]  fd   SPI communication handle
+* @param [out] hist statistics and bins
+* 
+* @return 0: No error; < 0: error code
+*********************************************/
+int ReadIntervalHistogramCmd(int fd, IntervalHistogram *hist) {
+    uint32_t stats[4];
+    int err = ReadRegsCmd(fd, REG_INTERVAL_MIN, 4, stats);
+    if (err < 0) return err;
+
+    uint8_t tx[INTERVAL_BURST_BYTES + SPI_CHECK_BYTES];
+    uint8_t rx[INTERVAL_BURST_BYTES + SPI_CHECK_BYTES];
+    memset(tx, 0, sizeof(tx));
+    memset(rx, 0, sizeof(rx));
+    tx[0] = CMD_READ_INTERVALS;
+    tx[3] = INTERVAL_BINS / 4;  // Entries, from entry 0
+
+    err = SpiBurstXfer(fd, tx, rx, INTERVAL_BURST_BYTES);
+    if (err < 0) return err;
+
+    hist->min    = stats[0];
+    hist->max    = stats[1];
+    hist->missed = stats[2];
+    hist->count  = stats[3];
+    for (unsigned b = 0; b < INTERVAL_BINS; b++) {
+        const uint8_t *p = &rx[5 + 3 * b];  // 24-bit bins, 4 per 12-byte entry
+        hist->bins[b] = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+    }
+    return 0;
+}
+
+/*********************************************
+* @brief Writes the PWM words of a range of axes (command 0x13)
+* 
+* @param [in] fd    SPI communication handle
+* @param [in] first first axis, 0: pitch, 1: yaw
+* @param [in] n     number of axes, 1..AXES_MAX - first
+* @param [in] pwm   n PWM words
+* 
+* @return bytes transferred; < 0: error code
+*********************************************/
+int SendAxesPwmCmd(int fd, unsigned first, unsigned n, const PwmStatus *pwm) {
+    if (n == 0 || first + n > AXES_MAX) return -1;
+
+    uint8_t tx[AXES_PWM_BYTES(AXES_MAX) + SPI_CHECK_BYTES];
+    uint8_t rx[AXES_PWM_BYTES(AXES_MAX) + SPI_CHECK_BYTES];
+    unsigned len = AXES_PWM_BYTES(n);
+    memset(tx, 0, len + SPI_CHECK_BYTES);
+    memset(rx, 0, len + SPI_CHECK_BYTES);
+    tx[0] = CMD_WRITE_AXES_PWM;
+    tx[1] = (uint8_t)first;
+    tx[2] = (uint8_t)n;
+    for (unsigned k = 0; k < n; k++) {
+        uint16_t word = PackPwm(&pwm[k]);
+        tx[3 + 2 * k] = (uint8_t)word;          // lo, hi as command 0x12
+        tx[4 + 2 * k] = (uint8_t)(word >> 8);
+    }
+    return SpiBurstXfer(fd, tx, rx, len);
+}
+
+/*********************************************
+* @brief Reads the positions of a range of axes and their timestamp
+*        (command 0x24), all from one snapshot
+* 
+* @param [in]  fd        SPI communication handle
+* @param [in]  first     first axis, 0: pitch, 1: yaw
+* @param [in]  n         number of axes, 1..AXES_MAX - first
+* @param [out] positions n positions
+* @param [out] stamp     FPGA clock cycle of the positions
+* 
+* @return 0: No error; < 0: error code
+*********************************************/
+int ReadAxesCmd(int fd, unsigned first, unsigned n, int32_t *positions, uint32_t *stamp) {
+    if (n == 0 || first + n > AXES_MAX) return -1;
+
+    uint8_t tx[AXES_POS_BYTES(AXES_MAX) + SPI_CHECK_BYTES];
+    uint8_t rx[AXES_POS_BYTES(AXES_MAX) + SPI_CHECK_BYTES];
+    unsigned len = AXES_POS_BYTES(n);
+    memset(tx, 0, len + SPI_CHECK_BYTES);
+    memset(rx, 0, len + SPI_CHECK_BYTES);
+    tx[0] = CMD_READ_AXES;
+    tx[1] = (uint8_t)first;
+    tx[2] = (uint8_t)n;
+
+    int err = SpiBurstXfer(fd, tx, rx, len);
+    if (err < 0) return err;
+
+    for (unsigned k = 0; k < n; k++) positions[k] = Be32(&rx[3 + 4 * k]);
+    *stamp = (uint32_t)Be32(&rx[3 + 4 * n]);
+    return 0;
+}
+
+
+// Command byte and length of each session command
+static const uint8_t kSessionCmd[SpiOpCount] = { CMD_READ_ALL_POSITIONS, CMD_WRITE_ALL_PWM, CMD_EXCHANGE, CMD_READ_MOTION,
+                                                 CMD_READ_VELOCITY, CMD_PID_EXCHANGE };
+static const uint8_t kSessionLen[SpiOpCount] = { 13, 5, 9, 10, 21, 10 };
 
-    yaw_status->enable   = (rx[3] >> 7) & 0x01;
-    yaw_status->dir      = (rx[3] >> 6) & 0x01;
-    yaw_status->duty     = ((rx[3] >> 2) & 0x0F) << 8 | rx[4];
+/*********************************************
+* @brief Builds the tx buffers and transfer descriptors of every command
+* 
+* @param [out] s        session
+* @param [in]  fd       SPI communication handle
+* @param [in]  speed_hz SPI communication frequency
+* 
+* @return None.
+*********************************************/
+void SpiSessionInit(SpiSession *s, int fd, unsigned speed_hz) {
+    memset(s, 0, sizeof(*s));
+    s->fd = fd;
+    s->checked = g_checked;
+    for (int op = 0; op < SpiOpCount; op++) {
+        s->frame[op].tx[0] = kSessionCmd[op] | (s->checked ? CMD_CHECKED : 0);
+        s->xfer[op].tx_buf        = (unsigned long)s->frame[op].tx;
+        s->xfer[op].rx_buf        = (unsigned long)s->frame[op].rx;
+        s->xfer[op].len           = kSessionLen[op] + (s->checked ? SPI_CHECK_BYTES : 0);
+        s->xfer[op].speed_hz      = speed_hz;
+        s->xfer[op].bits_per_word = SPI_BITS_PER_WORD;
+    }
+}
+
+/*********************************************
+* @brief Packs the PWM words into the write and exchange commands, which
+*        share the payload layout (bytes 1-4)
+* 
+* @param [inout] s             session
+* @param [in]    pitch_duty    pitch duty cicle
+* @param [in]    pitch_enable  pitch pwm enable bit
+* @param [in]    pitch_dir     pitch pwm direction bit
+* @param [in]    yaw_duty      yaw duty cicle
+* @param [in]    yaw_enable    yaw pwm enable bit
+* @param [in]    yaw_dir       yaw pwm direction bit
+* 
+* @return None.
+*********************************************/
+void SpiSessionSetPwm(SpiSession *s, uint16_t pitch_duty, uint8_t pitch_enable, uint8_t pitch_dir,
+                      uint16_t yaw_duty, uint8_t yaw_enable, uint8_t yaw_dir) {
+    uint8_t payload[4] = {
+        (uint8_t)(pitch_duty & 0xFF),
+        (uint8_t)(((pitch_enable & 0x1) << 7) | ((pitch_dir & 0x1) << 6) | (((pitch_duty >> 8) & 0x0F) << 2)),
+        (uint8_t)(yaw_duty & 0xFF),
+        (uint8_t)(((yaw_enable & 0x1) << 7) | ((yaw_dir & 0x1) << 6) | (((yaw_duty >> 8) & 0x0F) << 2)),
+    };
+    memcpy(&s->frame[SpiOpWriteAll].tx[1], payload, sizeof(payload));
+    memcpy(&s->frame[SpiOpExchange].tx[1], payload, sizeof(payload));
+}
+
+/*********************************************
+* @brief Packs the setpoints and enable bits into the position loop
+*        exchange command
+* 
+* @param [inout] s              session
+* @param [in]    pitch_setpoint pitch setpoint in encoder counts
+* @param [in]    yaw_setpoint   yaw setpoint in encoder counts
+* @param [in]    enable         PID_ENABLE_* bits
+* 
+* @return None.
+*********************************************/
+void SpiSessionSetSetpoints(SpiSession *s, int32_t pitch_setpoint, int32_t yaw_setpoint, uint8_t enable) {
+    uint8_t *tx = s->frame[SpiOpPidExchange].tx;
+    PutBe32(&tx[1], (uint32_t)pitch_setpoint);
+    PutBe32(&tx[5], (uint32_t)yaw_setpoint);
+    tx[9] = enable & (PID_ENABLE_PITCH | PID_ENABLE_YAW);
+}
+
+/*********************************************
+* @brief Runs prebuilt commands. A single command uses its own descriptor;
+*        several are copied into one message with cs_change set between
+*        them, so the FPGA still sees one CS assertion per command. Checked
+*        commands go through the batch, which the retries reorder.
+* 
+* @param [inout] s   session
+* @param [in]    ops commands, in order
+* @param [in]    n   number of commands, up to SPI_SESSION_BATCH
+* 
+* @return bytes transferred; < 0: error code
+*********************************************/
+int SpiSessionRun(SpiSession *s, const spi_op_t *ops, unsigned n) {
+    if (n == 1 && !s->checked) return SpiMessage(s->fd, &s->xfer[ops[0]], 1);
+    if (n == 0 || n > SPI_SESSION_BATCH) return -1;
+
+    for (unsigned i = 0; i < n; i++) {
+        s->batch[i] = s->xfer[ops[i]];
+        s->batch[i].cs_change = (i + 1 < n);
+    }
+    return s->checked ? SpiCheckedMessage(s->fd, s->batch, n) : SpiMessage(s->fd, s->batch, n);
+}
+
+/*********************************************
+* @brief Decodes both positions of any command but the PWM write. All
+*        of them return them in bytes 1-8.
+* 
+* @param [in]  s         session
+* @param [in]  op        command that was run
+* @param [out] pitch_pos pitch steps position
+* @param [out] yaw_pos   yaw steps position
+* 
+* @return None.
+*********************************************/
+void SpiSessionPositions(const SpiSession *s, spi_op_t op, int32_t *pitch_pos, int32_t *yaw_pos) {
+    *pitch_pos = Be32(&s->frame[op].rx[1]);
+    *yaw_pos   = Be32(&s->frame[op].rx[5]);
+}
+
+/*********************************************
+* @brief Decodes the FPGA timestamp of a read command, sent after the
+*        positions (bytes 9-12)
+* 
+* @param [in]  s     session
+* @param [in]  op    command that was run
+* @param [out] stamp FPGA clock cycle of the positions
+* 
+* @return 0: No error; -1: the command has no timestamp
+*********************************************/
+int SpiSessionStamp(const SpiSession *s, spi_op_t op, uint32_t *stamp) {
+    if (op != SpiOpReadAll) return -1;
+    *stamp = (uint32_t)Be32(&s->frame[op].rx[9]);
+    return 0;
+}
+
+/*********************************************
+* @brief Decodes the velocity estimates of a velocity command, sent after
+*        the positions (bytes 9-20)
+* 
+* @param [in]  s         session
+* @param [in]  op        command that was run
+* @param [out] pitch_vel pitch velocity estimates
+* @param [out] yaw_vel   yaw velocity estimates
+* 
+* @return 0: No error; -1: the command has no velocities
+*********************************************/
+int SpiSessionVelocity(const SpiSession *s, spi_op_t op, EncoderVelocity *pitch_vel, EncoderVelocity *yaw_vel) {
+    if (op != SpiOpVelocity) return -1;
+    const uint8_t *rx = s->frame[op].rx;
+    pitch_vel->period = Be32(&rx[9]);
+    yaw_vel->period   = Be32(&rx[13]);
+    pitch_vel->window = (int16_t)(((uint16_t)rx[17] << 8) | rx[18]);
+    yaw_vel->window   = (int16_t)(((uint16_t)rx[19] << 8) | rx[20]);
     return 0;
 }
@@ -13,11 +13,21 @@ extern "C" {
 #endif
 
 #include <stdint.h>
+#include <linux/spi/spidev.h>
 
 #define SPI_CHANNEL       1
 #define SPI_SPEED_HZ      10000000 // 10 MHz
 #define SPI_MODE          0
 #define SPI_BITS_PER_WORD 8
+// Build with -DFPGA_CLK_HZ=... -DFPGA_PWM_HZ=... for a bitstream with other
+// TopEntity.v SYS_FREQ (USE_PLL) or PWM_FREQ settings
+#ifndef FPGA_CLK_HZ
+#define FPGA_CLK_HZ       25000000 // Clock counted by the FPGA timestamps (TopEntity.v SYS_FREQ)
+#endif
+#define FPGA_VEL_WINDOW_US 1000    // Edge counting window of the FPGA velocity (TopEntity.v VEL_WINDOW_US)
+#ifndef FPGA_PWM_HZ
+#define FPGA_PWM_HZ       20000    // PWM period, on whose ends the queued PWM words are applied (TopEntity.v PWM_FREQ)
+#endif
 
 typedef enum {
     UnitPitch = 0,
@@ -25,11 +35,201 @@ typedef enum {
     UnitAll   = 2
 } encoder_t;
 
+// Encoder movement codes reported by command 0x23 (QuadratureEncoder.v DIR).
+#define MOTION_IDLE 0x0 // No encoder edge within the FPGA idle time
+#define MOTION_UP   0x1 // Counting up, as driven with dir 0
+#define MOTION_DOWN 0x3 // Counting down, as driven with dir 1
+
+// Velocity estimates of one encoder, reported by command 0x25. Both are
+// signed, negative when counting down.
+typedef struct EncoderVelocity {
+    int32_t period; // FPGA clock cycles between the last two edges, 0 when idle or just reversed
+    int16_t window; // Edges counted in the last FPGA_VEL_WINDOW_US window
+} EncoderVelocity;
+
+// Below this many edges per window the period gives the finer estimate.
+#define VEL_WINDOW_MIN_EDGES 8
+
+// Coefficients of the FPGA position loop of one axis (PID.v, see fpga_pid.h).
+typedef struct FpgaPidGains {
+    int32_t a, b, c;    // Signed Q7.24
+    uint32_t d;         // Unsigned Q0.32
+    uint16_t limit;     // Output limit, duty cycle units
+} FpgaPidGains;
+
+// Enable bits of command 0x52: the axis is driven by its FPGA position loop.
+#define PID_ENABLE_PITCH 0x1
+#define PID_ENABLE_YAW   0x2
+
+// Sample of both positions taken by the FPGA sampler (SampleFifo.v) on its own
+// clock, read back in bursts (command 0x60).
+typedef struct EncoderSample {
+    int32_t pitch, yaw;
+    uint32_t stamp;     // FPGA clock cycle of the sample, as ReadPositionStampedCmd
+} EncoderSample;
+
+#define SAMPLE_FIFO_DEPTH 256  // Samples held by the FPGA before new ones are dropped
+#define SAMPLE_BURST_MAX  255  // Samples per burst
+#define SAMPLE_BURST_BYTES(n) (5u + 12u * (n)) // Unchecked length of a burst of n samples
+
+// Snapshots taken on the camera frame strobe (FrameSync.v), read back in bursts
+// (command 0x64) as EncoderSample: the pose at the exposure of each frame.
+#define FRAME_RING_DEPTH  16   // Frames held by the FPGA, a new one overwrites the oldest
+#define FRAME_BURST_BYTES(n) SAMPLE_BURST_BYTES(n) // Unchecked length of a burst of n frames
+
+// Intervals between the starts of consecutive SPI frames, as the FPGA clocks
+// them (IntervalHistogram.v): the real cadence of the Pi loop, measured
+// without disturbing it. Read back with registers 0x20-0x23 and in one burst
+// (command 0x65).
+#define INTERVAL_BINS     64   // Bins of 2^width_log2 FPGA clock cycles from the origin
+#define INTERVAL_ALL_CMDS (-1) // SetIntervalHistogramCmd: every frame timed, whatever its command
+#define INTERVAL_BURST_BYTES SAMPLE_BURST_BYTES(INTERVAL_BINS / 4) // 4 bins per burst entry
+
+typedef struct IntervalHistogram {
+    uint32_t min, max;      // FPGA clock cycles; min > max before the first interval
+    uint32_t missed;        // Intervals over the deadline
+    uint32_t count;         // Intervals timed
+    uint32_t bins[INTERVAL_BINS]; // First and last also hold those below/above, saturate at 2^24 - 1
+} IntervalHistogram;
+
+// Reader state of the sample stream: index of the next sample wanted and
+// the samples the FPGA dropped because the Pi fell behind.
+typedef struct SampleStream {
+    uint16_t next;
+    uint8_t  overflows;     // Dropped-sample count last reported, wraps at 256
+    uint64_t dropped;
+} SampleStream;
+
 typedef struct PwmStatus {
     uint8_t enable, dir;
     uint16_t duty;
 } PwmStatus;
 
+// Entry of the FPGA PWM queue (PwmQueue.v): both PWM words, applied at the end
+// of the first PWM period at or after FPGA clock cycle at, as SendAllPwmCmd.
+typedef struct PwmQueueEntry {
+    uint32_t at;            // FPGA clock cycle (FPGA_CLK_HZ), as the position stamps
+    PwmStatus pitch, yaw;
+} PwmQueueEntry;
+
+#define PWM_QUEUE_DEPTH 256  // Entries held by the FPGA
+#define PWM_QUEUE_BURST_MAX 255 // Entries per frame
+#define PWM_QUEUE_BURST_BYTES(n) (6u + 8u * (n)) // Unchecked length of a frame of n entries
+#define PWM_QUEUE_BRAKE 0x1  // On underrun brake both axes, instead of holding the last words
+
+// Writer state of the PWM queue: index of the next entry to be sent, the
+// entries queued and the underruns reported.
+typedef struct PwmQueue {
+    uint16_t next;
+    uint16_t level;         // Entries waiting in the FPGA after the last push
+    uint8_t  underruns;     // Underrun count last reported, wraps at 256
+    uint64_t underrun_total;
+} PwmQueue;
+
+// Encoder/PWM channels of the FPGA (TopEntity.v NUM_AXES), addressed by axis
+// index by commands 0x13/0x24: axis 0 is pitch, 1 yaw, then the further axes.
+#define AXES_MAX 8
+#define AXES_PWM_BYTES(n) (3u + 2u * (n)) // Unchecked length of 0x13 for n axes
+#define AXES_POS_BYTES(n) (7u + 4u * (n)) // Unchecked length of 0x24 for n axes
+
+// Register map read and written in bursts by commands 0x70/0x71 (SpiSlave.v).
+// Registers are 32 bits; the writable ones (0x10-0x1F) read back the values
+// last applied.
+#define REG_ID           0x00 // REG_MAP_ID
+#define REG_POS_PITCH    0x01
+#define REG_POS_YAW      0x02
+#define REG_TIMESTAMP    0x03 // Of the positions, as ReadPositionStampedCmd
+#define REG_MOTION       0x04 // As command 0x23 byte 9
+#define REG_PWM_STATUS   0x05 // As command 0x30
+#define REG_PERIOD_PITCH 0x06
+#define REG_PERIOD_YAW   0x07
+#define REG_WINDOWS      0x08 // {pitch, yaw} edges per window
+#define REG_SAMPLES      0x09 // {next sample index, dropped samples, 0}
+#define REG_LINK_ERRORS  0x0A // Rejected checked frames, wraps at 256
+#define REG_QUEUE        0x0B // PWM queue {write index, read index}
+#define REG_QUEUE_UNDERRUNS 0x0C
+#define REG_AXES         0x0D // Encoder/PWM channels (TopEntity.v NUM_AXES), 0 for an image without them
+#define REG_FRAMES       0x0E // {next frame index, 0}
+#define REG_PWM_PITCH    0x10 // PWM word {hi, lo}, as command 0x10
+#define REG_PWM_YAW      0x11
+#define REG_SETPOINT_PITCH 0x12 // Encoder counts
+#define REG_SETPOINT_YAW 0x13
+#define REG_PID_ENABLE   0x14 // PID_ENABLE_* bits
+#define REG_SAMPLE_PERIOD 0x15 // FPGA clock cycles, as SetSamplerCmd
+#define REG_SAMPLE_FREE  0x16 // Frees the samples before this index
+#define REG_QUEUE_SETUP  0x17 // {PWM_QUEUE_BRAKE << 24, timeout}, as SetPwmQueueCmd
+#define REG_GAIN_A       0x18 // Gains a, b, c, d, limit of FpgaPidGains
+#define REG_GAIN_LIMIT   0x1C
+#define REG_GAIN_LOAD    0x1D // Written: loads the gains into the loop of this axis (encoder_t)
+#define REG_HIST_SETUP   0x1E // Interval histogram {HIST_ONE_CMD | command, origin}; written: clears it
+#define REG_HIST_BINS    0x1F // {width_log2, deadline}; written: clears it, as SetIntervalHistogramCmd
+#define REG_INTERVAL_MIN 0x20 // FPGA clock cycles
+#define REG_INTERVAL_MAX 0x21
+#define REG_INTERVAL_MISSED 0x22 // Intervals over the deadline
+#define REG_INTERVAL_COUNT  0x23
+
+#define REG_MAP_ID       0x474D0001u // "GM", register map version 1
+#define HIST_ONE_CMD     0x80u // REG_HIST_SETUP top byte: only the frames of its command are timed
+#define REG_BURST_MAX    255   // Registers per burst
+#define REG_BURST_BYTES(n) (3u + 4u * (n)) // Unchecked length of a burst of n registers
+
+// Readable state of the FPGA taken in one snapshot (registers 0x01-0x0A).
+typedef struct FpgaSnapshot {
+    int32_t pitch, yaw;
+    uint32_t stamp;                 // FPGA clock cycle of the positions
+    uint8_t pitch_motion, yaw_motion; // MOTION_* codes
+    PwmStatus pitch_pwm, yaw_pwm;
+    EncoderVelocity pitch_vel, yaw_vel;
+    uint16_t sample_index;          // Index of the next sample
+    uint8_t sample_overflows;       // Dropped samples, wraps at 256
+    uint8_t link_errors;            // Rejected checked frames, wraps at 256
+} FpgaSnapshot;
+
+// Transport used by the SPI commands. Without one, spidev is used directly.
+typedef struct SpiBackend {
+    int (*open)(unsigned spi_chan, unsigned spi_baud, unsigned spi_flags);
+    int (*close)(int fd);
+    // Runs n transfers as one message, like ioctl(SPI_IOC_MESSAGE(n)).
+    int (*message)(int fd, struct spi_ioc_transfer *xfers, unsigned n);
+} SpiBackend;
+
+// Selects the SPI transport, NULL restores spidev.
+void SpiSetBackend(const SpiBackend *backend);
+
+// Clock of the command functions and of the sessions built with SpiGetSpeed().
+void SpiSetSpeed(unsigned speed_hz);
+unsigned SpiGetSpeed(void);
+
+// Checked frames: the command byte has bit 7 set, and a command of L bytes is
+// followed by a sequence byte and a CRC-8 of bytes 0..L. The FPGA answers with
+// its count of rejected frames, the CRC-8 of response bytes 1..L and an ack
+// (the sequence byte, or its complement if the command CRC did not match).
+// A frame failing any check is sent again, up to SPI_CHECK_RETRIES times.
+#define SPI_CHECK_BYTES   3 // Bytes added to a checked frame
+#define SPI_CHECK_RETRIES 2 // Extra attempts within the same call
+#define SPI_ERR_CHECK    -3 // Frame still failing its checks after the retries
+
+typedef struct SpiLinkStats {
+    uint64_t frames;      // Checked frames sent, retries included
+    uint64_t crc_errors;  // Response CRC mismatch
+    uint64_t nacks;       // Command rejected by the FPGA (command CRC mismatch)
+    uint64_t ack_errors;  // Ack neither the sequence byte nor its complement
+    uint64_t retries;     // Frames sent again
+    uint64_t failures;    // Frames given up, reported as SPI_ERR_CHECK
+    uint8_t  fpga_errors; // Rejected-frame count last reported by the FPGA, wraps at 256
+} SpiLinkStats;
+
+// Enables checked frames for the command functions and the sessions initialized afterwards.
+// Like the backend selection, it is meant to be set before the threads start.
+void SpiSetChecked(int enable);
+
+// Copies / clears the checked frame counters.
+void SpiGetLinkStats(SpiLinkStats *stats);
+void SpiResetLinkStats(void);
+
+// CRC-8 (polynomial 0x07, initial value 0xFF, MSB first) used by checked frames.
+uint8_t SpiCrc8(const uint8_t *data, unsigned n);
+
 // Initializes the SPI interface.
 int SpiOpen(unsigned spi_chan, unsigned spi_baud, unsigned spi_flags);
 
@@ -46,9 +246,179 @@ int SendAllPwmCmd(int fd, uint16_t pitch_duty, uint8_t pitch_enable, uint8_t pit
 // Reads the current position of the specified encoder/s (pitch, yaw or both).
 int ReadPositionCmd(int fd, encoder_t unit, int32_t *pitch_pos, int32_t *yaw_pos);
 
+// As ReadPositionCmd, also returning the FPGA clock cycle (FPGA_CLK_HZ) in which
+// the positions were sampled. The counter wraps, only differences are meaningful.
+int ReadPositionStampedCmd(int fd, encoder_t unit, int32_t *pitch_pos, int32_t *yaw_pos, uint32_t *stamp);
+
+// Seconds from FPGA timestamp from to timestamp to, across the counter wrap.
+double SpiStampSeconds(uint32_t from, uint32_t to);
+
+// Reads both positions and sends new PWM values for both axes in one transaction.
+// The PWM is applied when the transaction ends, after the positions were sampled.
+int ExchangeCmd(int fd, uint16_t pitch_duty, uint8_t pitch_enable, uint8_t pitch_dir,
+                uint16_t yaw_duty, uint8_t yaw_enable, uint8_t yaw_dir, int32_t *pitch_pos, int32_t *yaw_pos);
+
+// Reads both positions and the movement code of each axis in one transaction.
+int ReadMotionCmd(int fd, int32_t *pitch_pos, int32_t *yaw_pos, uint8_t *pitch_motion, uint8_t *yaw_motion);
+
+// Reads both positions and the velocity estimates of both encoders in one transaction.
+int ReadVelocityCmd(int fd, int32_t *pitch_pos, int32_t *yaw_pos, EncoderVelocity *pitch_vel, EncoderVelocity *yaw_vel);
+
+// Encoder speed in counts per second from its FPGA estimates.
+double EncoderVelocityCps(const EncoderVelocity *vel);
+
+// Loads the coefficients of the FPGA position loop of one axis (pitch or yaw).
+int SendPidGainsCmd(int fd, encoder_t unit, const FpgaPidGains *gains);
+
+// Reads both positions and sends the setpoints (encoder counts) and enable bits
+// (PID_ENABLE_*) of the FPGA position loops in one transaction. A loop switched
+// on starts from cleared states; one switched off brakes its axis. Any PWM write
+// also switches the loop of its axis off.
+int PidExchangeCmd(int fd, int32_t pitch_setpoint, int32_t yaw_setpoint, uint8_t enable,
+                   int32_t *pitch_pos, int32_t *yaw_pos);
+
+// Starts the FPGA sampler with a period of period_cycles FPGA clock cycles (0 stops
+// it) and empties its buffer; the next sample gets index 0.
+int SetSamplerCmd(int fd, uint32_t period_cycles);
+
+// Reads up to max samples (SAMPLE_BURST_MAX) from index first in one transaction,
+// and frees the ones before first. Returns the number of valid samples, or < 0 on
+// error; next_index is the index the FPGA gives its next sample.
+int ReadSamplesCmd(int fd, uint16_t first, unsigned max, EncoderSample *samples, uint16_t *next_index,
+                   uint8_t *overflows);
+
+// Reads up to max frame-sync snapshots (FRAME_RING_DEPTH) from frame *first on, in
+// one transaction; frames[k] is frame *first + k. Frames the ring no longer holds
+// are left out, *first is moved to the oldest one returned. Returns the number of
+// frames read, or < 0 on error; next_index is the index the FPGA gives its next frame.
+int ReadFramesCmd(int fd, uint16_t *first, unsigned max, EncoderSample *frames, uint16_t *next_index);
+
+// Starts the sampler at rate_hz and resets the stream.
+int SampleStreamStart(SampleStream *st, int fd, unsigned rate_hz);
+
+// Reads the samples taken since the previous call, up to max. Returns their
+// number, or < 0 on error; a failed burst is read again by the next call.
+// The FPGA holds the samples of a burst until the next one, so calls should
+// come well within SAMPLE_FIFO_DEPTH / 2 sample periods; later, samples are
+// dropped and counted in st->dropped.
+int SampleStreamDrain(SampleStream *st, int fd, EncoderSample *samples, unsigned max);
+
+// Sets up the FPGA PWM queue and empties it; the next entry gets index 0. An
+// underrun is an empty queue timeout_cycles FPGA clock cycles (up to 2^24-1, 0:
+// never) after the last entry was applied; flags PWM_QUEUE_BRAKE brakes then.
+int SetPwmQueueCmd(int fd, uint8_t flags, uint32_t timeout_cycles);
+
+// Sends n entries (up to PWM_QUEUE_BURST_MAX) numbered from index first in one
+// transaction. Entries already queued are skipped, so sending again is safe; the
+// FPGA takes the ones following on from its queue that fit. Returns how many of
+// the n entries are now queued, or < 0 on error. wr_index, rd_index and underruns
+// are the queue state before the transaction.
+int QueuePwmCmd(int fd, uint16_t first, const PwmQueueEntry *entries, unsigned n, uint16_t *wr_index,
+                uint16_t *rd_index, uint8_t *underruns);
+
+// Sets up the queue as SetPwmQueueCmd and resets the writer state.
+int PwmQueueStart(PwmQueue *q, int fd, uint8_t flags, uint32_t timeout_cycles);
+
+// Sends the next entries. Returns how many were taken, from the first one, or < 0
+// on error; the others have to be sent again once the queue has room.
+int PwmQueuePush(PwmQueue *q, int fd, const PwmQueueEntry *entries, unsigned n);
+
 // Reads the current status of the PWM for both encoders (pitch and yaw).
 int CheckPwmStatus(int fd, PwmStatus *pitch_status, PwmStatus *yaw_status);
 
+// Reads count registers (up to REG_BURST_MAX) from addr on, in one transaction.
+int ReadRegsCmd(int fd, uint8_t addr, unsigned count, uint32_t *values);
+
+// Writes count registers (up to REG_BURST_MAX) from addr on, in one transaction.
+// They are applied together at CS deassert.
+int WriteRegsCmd(int fd, uint8_t addr, unsigned count, const uint32_t *values);
+
+// Reads the whole readable state of the FPGA in one transaction. Returns -1 if
+// the FPGA has no register map (REG_ID is not REG_MAP_ID).
+int ReadSnapshotCmd(int fd, FpgaSnapshot *snap);
+
+// Number of encoder/PWM channels of the FPGA (REG_AXES), or < 0 on error.
+int ReadAxisCountCmd(int fd);
+
+// Sets up and clears the FPGA interval histogram: the frames of command cmd
+// (checked or not), or all of them with INTERVAL_ALL_CMDS, are timed from CS
+// falling to the next one, in INTERVAL_BINS bins of 2^width_log2 FPGA clock
+// cycles from origin; intervals over deadline (0: none) count as missed.
+// origin and deadline are below 2^24 cycles.
+int SetIntervalHistogramCmd(int fd, int cmd, uint32_t origin, unsigned width_log2, uint32_t deadline);
+
+// Reads the statistics (one transaction) and the bins (a second one) of the
+// interval histogram; intervals timed in between may be in the bins only.
+int ReadIntervalHistogramCmd(int fd, IntervalHistogram *hist);
+
+// Sends the PWM words of axes first to first+n-1 (up to AXES_MAX) in one
+// transaction; they are applied together at CS deassert. Axes 0 and 1 are
+// written as by SendAllPwmCmd, which also switches their position loops off.
+int SendAxesPwmCmd(int fd, unsigned first, unsigned n, const PwmStatus *pwm);
+
+// Reads the positions of axes first to first+n-1 (up to AXES_MAX) and the FPGA
+// clock cycle in which they were all sampled, in one transaction. Axes the
+// FPGA does not have read 0.
+int ReadAxesCmd(int fd, unsigned first, unsigned n, int32_t *positions, uint32_t *stamp);
+
+// Commands with a prebuilt transfer in an SpiSession.
+typedef enum {
+    SpiOpReadAll  = 0, // 0x22, both positions and their timestamp
+    SpiOpWriteAll = 1, // 0x12, both PWM words
+    SpiOpExchange = 2, // 0x40, both positions and both PWM words
+    SpiOpMotion   = 3, // 0x23, both positions and movement codes
+    SpiOpVelocity = 4, // 0x25, both positions and velocity estimates
+    SpiOpPidExchange = 5, // 0x52, both positions and both position loop setpoints
+    SpiOpCount
+} spi_op_t;
+
+#define SPI_FRAME_BYTES     32 // Longest checked command (24 bytes), tx + rx fill a cache line
+#define SPI_CACHE_LINE      64
+#define SPI_SESSION_BATCH   4  // Transfers per SpiSessionRun call
+
+// tx/rx buffers of one command, on their own cache line.
+typedef struct SpiFrame {
+    uint8_t tx[SPI_FRAME_BYTES];
+    uint8_t rx[SPI_FRAME_BYTES];
+} __attribute__((aligned(SPI_CACHE_LINE))) SpiFrame;
+
+// SPI handle with the buffers and transfer descriptors of every command built
+// once, so that a control cycle only rewrites the PWM payload.
+typedef struct SpiSession {
+    SpiFrame frame[SpiOpCount];
+    struct spi_ioc_transfer xfer[SpiOpCount];
+    struct spi_ioc_transfer batch[SPI_SESSION_BATCH]; // Multi-transfer message
+    int fd;
+    int checked; // Frames carry the sequence byte and CRCs
+} SpiSession;
+
+// Builds the buffers and transfers of all the commands for the SPI handle fd,
+// checked if SpiSetChecked was enabled.
+void SpiSessionInit(SpiSession *s, int fd, unsigned speed_hz);
+
+// Sets the PWM payload of the write and exchange commands.
+void SpiSessionSetPwm(SpiSession *s, uint16_t pitch_duty, uint8_t pitch_enable, uint8_t pitch_dir,
+                      uint16_t yaw_duty, uint8_t yaw_enable, uint8_t yaw_dir);
+
+// Sets the setpoints and enable bits of the position loop exchange command.
+void SpiSessionSetSetpoints(SpiSession *s, int32_t pitch_setpoint, int32_t yaw_setpoint, uint8_t enable);
+
+// Runs n commands as one SPI_IOC_MESSAGE(n), each in its own CS assertion.
+// Checked commands failing their checks are run again in a new message.
+// Returns bytes transferred by the last message, < 0 on error or SPI_ERR_CHECK.
+int SpiSessionRun(SpiSession *s, const spi_op_t *ops, unsigned n);
+
+// Decodes the positions received by the last run of any command but the PWM write.
+void SpiSessionPositions(const SpiSession *s, spi_op_t op, int32_t *pitch_pos, int32_t *yaw_pos);
+
+// Decodes the FPGA timestamp of the positions of the last run of op.
+// Returns 0, or -1 if op does not carry one (only SpiOpReadAll does).
+int SpiSessionStamp(const SpiSession *s, spi_op_t op, uint32_t *stamp);
+
+// Decodes the velocity estimates of the last run of op.
+// Returns 0, or -1 if op does not carry them (only SpiOpVelocity does).
+int SpiSessionVelocity(const SpiSession *s, spi_op_t op, EncoderVelocity *pitch_vel, EncoderVelocity *yaw_vel);
+
 #ifdef __cplusplus
 }
 #endif
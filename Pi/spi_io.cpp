@@ -0,0 +1,119 @@
+// Filename : spi_io.cpp
+// Authors : Luis Moreno (s3608255), Luca Provenzano (s3487636)
+// Group : 43
+// License : N.A. or open source license like LGPL
+// Description : SPI I/O thread, runs the bus at a fixed cadence on behalf of the control thread
+//==============================================================
+#include "spi_io.hpp"
+
+#include <stdio.h>
+
+#include "spi_comm.h"
+#include "pacer.h"
+#include "clock_source.h"
+#include "target_data.hpp" // Shared data: g_run
+
+
+/*********************************************
+* @brief Prepares the mailboxes and clears the statistics
+*
+* @param [out] io SPI I/O state
+*
+* @return None.
+*********************************************/
+void SpiIoInit(SpiIo *io) {
+    const SpiSample no_sample = { 0, 0, 0, 0, 0, false };
+    const SpiPwm stopped = { 0, 0, 0, 0, 0, 0 };
+    MailboxInit(&io->status, no_sample);
+    MailboxInit(&io->command, stopped);
+    io->run.store(true, std::memory_order_relaxed);
+    io->error.store(0, std::memory_order_relaxed);
+    io->cycles.store(0, std::memory_order_relaxed);
+    io->overruns.store(0, std::memory_order_relaxed);
+    io->held.store(0, std::memory_order_relaxed);
+    io->max_xfer_ns.store(0, std::memory_order_relaxed);
+}
+
+
+/*********************************************
+* @brief Waits for the first sample of the SPI thread. The sample is left
+*        unread in the mailbox.
+*
+* @param [inout] io         SPI I/O state
+* @param [in]    timeout_us maximum wait
+*
+* @return true: a sample is available; false: timeout or SPI error
+*********************************************/
+bool SpiIoWaitFirstSample(SpiIo *io, unsigned timeout_us) {
+    int64_t deadline = ClockNowNs() + (int64_t)timeout_us * 1000;
+    while (io->cycles.load(std::memory_order_acquire) == 0) {
+        if (io->error.load(std::memory_order_relaxed) != 0 || ClockNowNs() >= deadline) return false;
+        ClockSleepUs(10);
+    }
+    return io->error.load(std::memory_order_relaxed) == 0;
+}
+
+
+/*********************************************
+* @brief SPI thread loop. Each cycle sends the latest PWM command and
+*        publishes the positions, so the control thread never waits on
+*        the bus. A checked read still corrupted after its retries is not
+*        published; it stops on any other SPI error, or after
+*        SPI_HOLD_LIMIT such cycles in a row, reported through io->error.
+*
+* @param [inout] io        SPI I/O state
+* @param [in]    spi_fd    SPI communication handle
+* @param [in]    period_ns bus cycle period
+* @param [in]    exchange  use the combined 0x40 transaction
+*
+* @return None.
+*********************************************/
+void spi_io_thread_func(SpiIo *io, int spi_fd, int64_t period_ns, bool exchange) {
+    SpiSession spi;
+    SpiSessionInit(&spi, spi_fd, SpiGetSpeed());
+    const spi_op_t exchange_op = SpiOpExchange;
+    const spi_op_t write_read[2] = { SpiOpWriteAll, SpiOpReadAll };
+    const spi_op_t read_op = exchange ? SpiOpExchange : SpiOpReadAll;
+
+    Pacer pacer;
+    PacerInit(&pacer, period_ns, PacerSkip, 0);
+
+    SpiPwm cmd;
+    SpiSample sample = { 0, 0, 0, 0, 0, false };
+    unsigned held = 0;
+    while (io->run.load(std::memory_order_relaxed) && g_run) {
+        MailboxRead(&io->command, &cmd);
+        SpiSessionSetPwm(&spi, cmd.pitch_duty, cmd.pitch_enable, cmd.pitch_dir,
+                         cmd.yaw_duty, cmd.yaw_enable, cmd.yaw_dir);
+
+        // One syscall either way: exchange, or write and read in one message
+        int64_t t_start = PacerNow();
+        int err = exchange ? SpiSessionRun(&spi, &exchange_op, 1) : SpiSessionRun(&spi, write_read, 2);
+        int64_t xfer_ns = PacerNow() - t_start;
+        if (err == SPI_ERR_CHECK && ++held < SPI_HOLD_LIMIT) {
+            io->held.fetch_add(1, std::memory_order_relaxed);
+            PacerWait(&pacer);
+            continue;
+        }
+        if (err < 0) {
+            fprintf(stderr, "Error: SPI thread transfer failed (%d).\n", err);
+            io->error.store(err, std::memory_order_release);
+            break;
+        }
+
+        held = 0;
+        SpiSessionPositions(&spi, read_op, &sample.pitch, &sample.yaw);
+        sample.stamped = SpiSessionStamp(&spi, read_op, &sample.stamp) == 0;
+        sample.t_ns = t_start;
+        sample.seq++;
+        MailboxPublish(&io->status, sample);
+
+        if (xfer_ns > io->max_xfer_ns.load(std::memory_order_relaxed)) {
+            io->max_xfer_ns.store(xfer_ns, std::memory_order_relaxed);
+        }
+        io->cycles.store(sample.seq, std::memory_order_release);
+
+        PacerWait(&pacer);
+        io->overruns.store(pacer.overruns, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,93 @@
+// Filename : spi_io.hpp
+// Authors : Luis Moreno (s3608255), Luca Provenzano (s3487636)
+// Group : 43
+// License : N.A. or open source license like LGPL
+// Description : Header file for the SPI I/O thread and its lock-free mailboxes
+//==============================================================
+
+#ifndef SPI_IO_HPP
+#define SPI_IO_HPP
+
+#include <atomic>
+#include <cstdint>
+
+#define MAILBOX_FRESH 0x4 // Set in Mailbox::middle when it holds an unread value
+
+// Consecutive cycles whose checked read failed (SPI_ERR_CHECK), with the previous
+// positions kept, before it is treated as a link failure
+#define SPI_HOLD_LIMIT 10
+
+// Latest-value mailbox between one writer and one reader (triple buffer).
+// Both sides only swap a slot index, neither ever waits for the other.
+template <typename T>
+struct Mailbox {
+    T slot[3];
+    std::atomic<uint8_t> middle; // Shared slot index, plus MAILBOX_FRESH
+    uint8_t back;                // Slot being written, writer only
+    uint8_t front;               // Slot being read, reader only
+};
+
+// Empties the mailbox, the reader sees value until the first publish.
+template <typename T>
+inline void MailboxInit(Mailbox<T> *m, const T &value) {
+    for (int i = 0; i < 3; i++) m->slot[i] = value;
+    m->back  = 0;
+    m->middle.store(1, std::memory_order_relaxed);
+    m->front = 2;
+}
+
+// Writer side: stores a new value, replacing any unread one.
+template <typename T>
+inline void MailboxPublish(Mailbox<T> *m, const T &value) {
+    m->slot[m->back] = value;
+    m->back = m->middle.exchange(m->back | MAILBOX_FRESH, std::memory_order_acq_rel) & 0x3;
+}
+
+// Reader side: copies the latest value. Returns true if it was not read before.
+template <typename T>
+inline bool MailboxRead(Mailbox<T> *m, T *out) {
+    bool fresh = m->middle.load(std::memory_order_relaxed) & MAILBOX_FRESH;
+    if (fresh) m->front = m->middle.exchange(m->front, std::memory_order_acq_rel) & 0x3;
+    *out = m->slot[m->front];
+    return fresh;
+}
+
+// Encoder sample published by the SPI thread.
+struct SpiSample {
+    int32_t pitch, yaw;     // Raw encoder counts
+    int64_t t_ns;           // Time the transfer started
+    uint64_t seq;           // Transfer number, from 1
+    uint32_t stamp;         // FPGA sample time of the positions (FPGA_CLK_HZ cycles)
+    bool stamped;           // stamp is valid: 0x22 read, not the exchange
+};
+
+// PWM command picked up by the SPI thread.
+struct SpiPwm {
+    uint16_t pitch_duty, yaw_duty;
+    uint8_t pitch_enable, pitch_dir, yaw_enable, yaw_dir;
+};
+
+struct SpiIo {
+    Mailbox<SpiSample> status;      // SPI thread -> control thread
+    Mailbox<SpiPwm>    command;     // Control thread -> SPI thread
+    std::atomic<bool>  run;         // Cleared to stop the SPI thread
+    std::atomic<int>   error;       // First SPI error, 0 if none
+
+    // Statistics, written by the SPI thread
+    std::atomic<uint64_t> cycles;
+    std::atomic<uint64_t> overruns;
+    std::atomic<uint64_t> held;     // Cycles without a sample, checked read failed
+    std::atomic<int64_t>  max_xfer_ns;
+};
+
+// Prepares the mailboxes (motors disabled, no sample) and clears the statistics.
+void SpiIoInit(SpiIo *io);
+
+// Waits up to timeout_us for the first sample. Returns false on timeout or SPI error.
+bool SpiIoWaitFirstSample(SpiIo *io, unsigned timeout_us);
+
+// SPI thread: every period_ns writes the latest command and publishes a new sample,
+// with the 0x40 exchange or a 0x12 + 0x22 message, until io->run or g_run is cleared.
+void spi_io_thread_func(SpiIo *io, int spi_fd, int64_t period_ns, bool exchange);
+
+#endif
@@ -0,0 +1,14 @@
+// Filename : target_data.cpp
+// Authors : Luis Moreno (s3608255), Luca Provenzano (s3487636)
+// Group : 43
+// License : N.A. or open source license like LGPL
+// Description : Data shared between the vision and control threads
+//==============================================================
+
+#include "target_data.hpp"
+
+// Definitions for the global shared variables
+std::atomic<bool> g_run(true);
+TargetData g_target_data;
+std::mutex g_target_mutex;
+std::atomic<int64_t> g_first_frame_ns(0);
@@ -0,0 +1,33 @@
+// Filename : target_data.hpp
+// Authors : Luis Moreno (s3608255), Luca Provenzano (s3487636)
+// Group : 43
+// License : N.A. or open source license like LGPL
+// Description : Header file for the data shared between the vision and control threads
+//==============================================================
+
+#ifndef TARGET_DATA_HPP
+#define TARGET_DATA_HPP
+
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+#include "controller/common/xxtypes.h" // For XXDouble
+
+#define MIN_OBJ_SIZE    2000
+
+// Shared data structure between threads
+struct TargetData {
+    XXDouble x_offset_rad = 0.0;
+    XXDouble y_offset_rad = 0.0;
+    double obj_size = 0.0;
+    bool new_frame = false;
+};
+
+// Global variables for thread communication
+extern std::atomic<bool> g_run;
+extern TargetData g_target_data;
+extern std::mutex g_target_mutex;
+extern std::atomic<int64_t> g_first_frame_ns; // Time the first frame was processed, 0: not yet
+
+#endif
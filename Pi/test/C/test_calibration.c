@@ -0,0 +1,68 @@
+#include "unity.h"
+#include "calibration.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#define CALIB_TEST_PATH "test_calibration.bin"
+
+static const Calibration stored = { -1234, 567, 30720, 61440 };
+
+void setUp(void) {
+    remove(CALIB_TEST_PATH);
+}
+
+void tearDown(void) {
+    remove(CALIB_TEST_PATH);
+}
+
+// Flips one byte of the file
+static void Corrupt(long offset) {
+    FILE *fp = fopen(CALIB_TEST_PATH, "r+b");
+    TEST_ASSERT_NOT_NULL(fp);
+    fseek(fp, offset, SEEK_SET);
+    int byte = fgetc(fp);
+    fseek(fp, offset, SEEK_SET);
+    fputc(byte ^ 0xFF, fp);
+    fclose(fp);
+}
+
+void test_CalibCrc32_check_value(void) {
+    TEST_ASSERT_EQUAL_HEX32(0xCBF43926, CalibCrc32("123456789", 9));
+}
+
+void test_CalibSave_then_load_round_trip(void) {
+    Calibration c;
+
+    TEST_ASSERT_EQUAL(0, CalibSave(CALIB_TEST_PATH, &stored));
+    TEST_ASSERT_EQUAL(0, CalibLoad(CALIB_TEST_PATH, &c));
+
+    TEST_ASSERT_EQUAL(stored.pitch_offset, c.pitch_offset);
+    TEST_ASSERT_EQUAL(stored.yaw_offset, c.yaw_offset);
+    TEST_ASSERT_EQUAL(stored.pitch_max_steps, c.pitch_max_steps);
+    TEST_ASSERT_EQUAL(stored.yaw_max_steps, c.yaw_max_steps);
+}
+
+void test_CalibLoad_missing_file(void) {
+    Calibration c;
+
+    TEST_ASSERT_EQUAL(CALIB_ERR_MISSING, CalibLoad(CALIB_TEST_PATH, &c));
+}
+
+void test_CalibLoad_rejects_other_version(void) {
+    Calibration c;
+    CalibSave(CALIB_TEST_PATH, &stored);
+    Corrupt(offsetof(CalibFile, version));
+
+    TEST_ASSERT_EQUAL(CALIB_ERR_FORMAT, CalibLoad(CALIB_TEST_PATH, &c));
+}
+
+void test_CalibLoad_rejects_corrupted_data(void) {
+    Calibration c = { 0, 0, 0, 0 };
+    CalibSave(CALIB_TEST_PATH, &stored);
+    Corrupt(offsetof(CalibFile, calib) + 2);
+
+    TEST_ASSERT_EQUAL(CALIB_ERR_CRC, CalibLoad(CALIB_TEST_PATH, &c));
+    TEST_ASSERT_EQUAL(0, c.pitch_max_steps); // Untouched on error
+}
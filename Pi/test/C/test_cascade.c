@@ -0,0 +1,122 @@
+#include "unity.h"
+#include "cascade.h"
+
+#define DT 0.0001 // 10 kHz
+
+static Cascade cascade;
+static CascadeGains pitch_gains, yaw_gains;
+
+void setUp(void) {
+    CascadeDefaultGains(&pitch_gains, &yaw_gains);
+    CascadeInit(&cascade, &pitch_gains, &yaw_gains, 10, 4, 50000, 20000);
+}
+
+void tearDown(void) {}
+
+void test_CascadeTick_runs_outer_every_divider(void) {
+    int due[9];
+    for (int i = 0; i < 9; i++) due[i] = CascadeTick(&cascade);
+
+    int expected[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+    TEST_ASSERT_EQUAL_INT_ARRAY(expected, due, 9);
+}
+
+void test_CascadeInit_zero_divider_runs_outer_every_tick(void) {
+    CascadeInit(&cascade, &pitch_gains, &yaw_gains, 10, 0, 0, 0);
+
+    TEST_ASSERT_EQUAL(1, CascadeTick(&cascade));
+    TEST_ASSERT_EQUAL(1, CascadeTick(&cascade));
+}
+
+void test_VelocityUpdate_constant_speed(void) {
+    VelocityEstimator e;
+    VelocityInit(&e, 10);
+
+    double vel = 0.0;
+    for (int i = 0; i < 50; i++) vel = VelocityUpdate(&e, 0.5 * i * DT, DT);
+
+    TEST_ASSERT_TRUE(vel > 0.4999 && vel < 0.5001);
+}
+
+void test_VelocityUpdate_window_averages_quantization(void) {
+    VelocityEstimator e;
+    VelocityInit(&e, 10);
+
+    // One count of 0.001 rad every 10 samples: 1 rad/s
+    double vel = 0.0;
+    for (int i = 0; i < 100; i++) vel = VelocityUpdate(&e, 0.001 * (i / 10), DT);
+
+    TEST_ASSERT_TRUE(vel > 0.999 && vel < 1.001);
+}
+
+void test_VelocityInit_clamps_window(void) {
+    VelocityEstimator e;
+
+    VelocityInit(&e, 0);
+    TEST_ASSERT_EQUAL(1, e.window);
+    VelocityInit(&e, 1000);
+    TEST_ASSERT_EQUAL(VEL_WINDOW_MAX - 1, e.window);
+}
+
+void test_CascadeOuterStep_limits_velocity(void) {
+    CascadeOuterStep(&cascade.yaw, 0.0, 0.1, 0.0);
+    TEST_ASSERT_TRUE(cascade.yaw.vel_ref > 0.0 && cascade.yaw.vel_ref < yaw_gains.v_max);
+
+    CascadeOuterStep(&cascade.yaw, 0.0, -100.0, 0.0);
+    TEST_ASSERT_TRUE(cascade.yaw.vel_ref == -yaw_gains.v_max);
+}
+
+void test_CascadeInnerStep_output_follows_error_sign(void) {
+    CascadeOuterStep(&cascade.pitch, 0.0, 1.0, 0.0);
+    double out = CascadeInnerStep(&cascade.pitch, 0.0, DT);
+    TEST_ASSERT_TRUE(out > 0.0);
+
+    CascadeInit(&cascade, &pitch_gains, &yaw_gains, 10, 4, 0, 0);
+    CascadeOuterStep(&cascade.pitch, 1.0, 0.0, 0.0);
+    out = CascadeInnerStep(&cascade.pitch, 1.0, DT);
+    TEST_ASSERT_TRUE(out < 0.0);
+}
+
+void test_CascadeInnerStep_integrator_does_not_wind_up(void) {
+    // Stalled axis with a large velocity demand: output saturates
+    CascadeOuterStep(&cascade.pitch, 0.0, 10.0, 0.0);
+    for (int i = 0; i < 100000; i++) CascadeInnerStep(&cascade.pitch, 0.0, DT);
+    TEST_ASSERT_TRUE(cascade.pitch.out == pitch_gains.out_max);
+    TEST_ASSERT_TRUE(cascade.pitch.integ <= pitch_gains.out_max);
+
+    // Demand reversed: the output leaves saturation right away
+    CascadeOuterStep(&cascade.pitch, 0.0, -10.0, 0.0);
+    double out = CascadeInnerStep(&cascade.pitch, 0.0, DT);
+    TEST_ASSERT_TRUE(out < pitch_gains.out_max);
+}
+
+void test_CascadeInnerStepVel_bypasses_the_estimator(void) {
+    cascade.pitch.vel_ref = 1.0;
+
+    // Measured at the reference: no output, and the estimator is left alone
+    TEST_ASSERT_TRUE(CascadeInnerStepVel(&cascade.pitch, 1.0, DT) == 0.0);
+    TEST_ASSERT_EQUAL(0, cascade.pitch.est.filled);
+    TEST_ASSERT_TRUE(CascadeInnerStepVel(&cascade.pitch, 0.0, DT) > 0.0);
+}
+
+void test_CascadeInnerStepVel_feeds_the_trajectory_velocity_forward(void) {
+    // Tracking the feedforward velocity exactly: the output holds the speed
+    // without waiting for the integrator
+    CascadeOuterStep(&cascade.pitch, 0.0, 0.0, 2.0);
+    double out = CascadeInnerStepVel(&cascade.pitch, 2.0, DT);
+    TEST_ASSERT_TRUE(out == pitch_gains.kv_ff * 2.0);
+    TEST_ASSERT_TRUE(cascade.pitch.integ == 0.0);
+
+    // Without a feedforward velocity the output is unchanged
+    CascadeOuterStep(&cascade.pitch, 0.0, 0.0, 0.0);
+    TEST_ASSERT_TRUE(CascadeInnerStepVel(&cascade.pitch, 0.0, DT) == 0.0);
+}
+
+void test_RateGroupRecord_counts_budget_overruns(void) {
+    TEST_ASSERT_EQUAL(0, RateGroupRecord(&cascade.inner, 40000));
+    TEST_ASSERT_EQUAL(1, RateGroupRecord(&cascade.inner, 60000));
+
+    TEST_ASSERT_EQUAL(2, cascade.inner.runs);
+    TEST_ASSERT_EQUAL(1, cascade.inner.overruns);
+    TEST_ASSERT_EQUAL(60000, cascade.inner.max_ns);
+}
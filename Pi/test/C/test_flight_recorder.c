@@ -0,0 +1,92 @@
+#include "unity.h"
+#include "flight_recorder.h"
+#include <stdio.h>
+
+#define RING_PATH "test_flight_recorder.bin"
+#define CAPACITY  16
+#define POST      4
+
+static FlightRecorder fr;
+
+static void WriteRecords(int n) {
+    FrRecord rec = {0};
+    for (int i = 0; i < n; i++) {
+        rec.t_ns = 1000 * (int64_t)fr.header->head;
+        rec.raw_pitch = (int32_t)fr.header->head;
+        FrRecordCycle(&fr, &rec);
+    }
+}
+
+void setUp(void) {
+    TEST_ASSERT_EQUAL(0, FrOpen(&fr, RING_PATH, CAPACITY, POST));
+}
+
+void tearDown(void) {
+    FrClose(&fr);
+    remove(RING_PATH);
+}
+
+void test_FrOpen_writes_header(void) {
+    TEST_ASSERT_EQUAL_HEX32(FR_MAGIC, fr.header->magic);
+    TEST_ASSERT_EQUAL(FR_VERSION, fr.header->version);
+    TEST_ASSERT_EQUAL(64, fr.header->record_size);
+    TEST_ASSERT_EQUAL(CAPACITY, fr.header->capacity);
+    TEST_ASSERT_EQUAL(0, fr.header->head);
+}
+
+void test_FrRecordCycle_wraps_around(void) {
+    WriteRecords(CAPACITY + 5);
+
+    TEST_ASSERT_EQUAL(CAPACITY + 5, fr.header->head);
+    TEST_ASSERT_EQUAL(5, fr.header->first);
+    // Slot 0 now holds record 16
+    TEST_ASSERT_EQUAL(CAPACITY, fr.ring[0].seq);
+    TEST_ASSERT_EQUAL(CAPACITY, fr.ring[0].raw_pitch);
+}
+
+void test_FrService_waits_for_post_trigger_records(void) {
+    WriteRecords(3);
+    FrTrigger(&fr, FrTriggerOverrun);
+
+    WriteRecords(POST - 1);
+    TEST_ASSERT_EQUAL(0, FrService(&fr, 0));
+
+    WriteRecords(1);
+    TEST_ASSERT_EQUAL(1, FrService(&fr, 0));
+    TEST_ASSERT_EQUAL(1, fr.snapshots);
+
+    // Snapshot holds the header with the trigger and the ring
+    char snap_path[300];
+    snprintf(snap_path, sizeof(snap_path), "%s.00.overrun", RING_PATH);
+    FILE *f = fopen(snap_path, "rb");
+    TEST_ASSERT_NOT_NULL(f);
+    FrHeader h;
+    TEST_ASSERT_EQUAL(1, fread(&h, sizeof(h), 1, f));
+    fclose(f);
+    remove(snap_path);
+
+    TEST_ASSERT_EQUAL(FrTriggerOverrun, h.trigger_reason);
+    TEST_ASSERT_EQUAL(3, h.trigger_index);
+    TEST_ASSERT_EQUAL(3 + POST, h.head);
+    TEST_ASSERT_EQUAL(0, h.first);
+}
+
+void test_FrTrigger_ignored_while_pending(void) {
+    FrTrigger(&fr, FrTriggerSpiError);
+    FrTrigger(&fr, FrTriggerTargetLost);
+
+    TEST_ASSERT_EQUAL(FrTriggerSpiError, fr.pending_reason);
+
+    // Forced flush, as done on shutdown
+    TEST_ASSERT_EQUAL(1, FrService(&fr, 1));
+    TEST_ASSERT_EQUAL(FrTriggerNone, fr.pending_reason);
+
+    char snap_path[300];
+    snprintf(snap_path, sizeof(snap_path), "%s.00.spi_error", RING_PATH);
+    TEST_ASSERT_EQUAL(0, remove(snap_path));
+}
+
+void test_FrService_nothing_pending(void) {
+    WriteRecords(10);
+    TEST_ASSERT_EQUAL(0, FrService(&fr, 1));
+}
@@ -0,0 +1,128 @@
+#include "unity.h"
+#include "fpga_pid.h"
+#include <math.h>
+
+#define T            (1.0 / FPGA_PID_HZ)
+#define RAD_PER_CNT  0.001
+#define DUTY_PER_OUT 819.0
+
+static PidParams pitch, yaw;
+static FpgaPidGains g;
+static FpgaPid pid;
+
+// Floating-point form of the same difference equations, without limit
+typedef struct {
+    double a, b, c, d;
+    double e_prev, ud, ui;
+} RefPid;
+
+static void RefInit(RefPid *r, const PidParams *p) {
+    double factor = 1.0 / (T + p->tau_d * p->beta);
+    r->a = p->tau_d * p->beta * factor;
+    r->b = p->kp * p->tau_d * factor;
+    r->c = p->kp * T * factor;
+    r->d = T / p->tau_i;
+    r->e_prev = r->ud = r->ui = 0.0;
+}
+
+static double RefStep(RefPid *r, double e) {
+    r->ud = r->a * r->ud + r->b * (e - r->e_prev) + r->c * e;
+    r->ui = r->ui + r->d * r->ud;
+    r->e_prev = e;
+    return r->ui + r->ud;
+}
+
+void setUp(void) {
+    FpgaPidDefaultParams(&pitch, &yaw);
+    TEST_ASSERT_EQUAL(0, FpgaPidGainsFrom(&g, &pitch, T, RAD_PER_CNT, DUTY_PER_OUT));
+    FpgaPidReset(&pid, &g);
+}
+
+void tearDown(void) {}
+
+void test_FpgaPidGainsFrom_fixed_point_formats(void) {
+    double factor = 1.0 / (T + 0.05 * 0.5);
+
+    TEST_ASSERT_INT32_WITHIN(1, (int32_t)lround(0.025 * factor * (1 << 24)), g.a);
+    TEST_ASSERT_INT32_WITHIN(1, (int32_t)lround(1.5 * 0.05 * factor * RAD_PER_CNT * DUTY_PER_OUT * (1 << 24)), g.b);
+    TEST_ASSERT_INT32_WITHIN(1, (int32_t)lround(1.5 * T * factor * RAD_PER_CNT * DUTY_PER_OUT * (1 << 24)), g.c);
+    TEST_ASSERT_EQUAL_UINT32((uint32_t)llround(T / 2.0 * 4294967296.0), g.d);
+    TEST_ASSERT_EQUAL_UINT16(810, g.limit);     // floor(0.99 * 819)
+}
+
+void test_FpgaPidGainsFrom_rejects_out_of_range(void) {
+    PidParams p = pitch;
+    p.kp = 1e6;
+    TEST_ASSERT_EQUAL(-1, FpgaPidGainsFrom(&g, &p, T, RAD_PER_CNT, DUTY_PER_OUT));
+
+    p = pitch;
+    p.tau_i = T / 2.0;      // d >= 1
+    TEST_ASSERT_EQUAL(-1, FpgaPidGainsFrom(&g, &p, T, RAD_PER_CNT, DUTY_PER_OUT));
+
+    TEST_ASSERT_EQUAL(-1, FpgaPidGainsFrom(&g, &pitch, T, RAD_PER_CNT, 5000.0));
+}
+
+void test_FpgaPidStep_zero_error_gives_zero(void) {
+    uint8_t dir = 1;
+
+    TEST_ASSERT_EQUAL_UINT16(0, FpgaPidStep(&pid, 1234, 1234, &dir));
+    TEST_ASSERT_EQUAL_UINT8(0, dir);
+}
+
+void test_FpgaPidStep_follows_floating_point_model(void) {
+    RefPid ref;
+    RefInit(&ref, &pitch);
+
+    // Small steps and reversals, with the position moving towards the setpoint
+    int32_t position = 0;
+    for (int i = 0; i < 4000; i++) {
+        int32_t setpoint = (i < 2000) ? 40 : -25;
+        if (i % 50 == 0) position += (setpoint > position) ? 1 : -1;
+
+        uint8_t dir;
+        uint16_t duty = FpgaPidStep(&pid, position, setpoint, &dir);
+        double out = RefStep(&ref, (setpoint - position) * RAD_PER_CNT) * DUTY_PER_OUT;
+
+        TEST_ASSERT_TRUE(fabs(out) < g.limit);
+        TEST_ASSERT_INT_WITHIN(1, (int)fabs(out), duty);
+        if (duty > 0) TEST_ASSERT_EQUAL_UINT8(out < 0.0, dir);
+    }
+}
+
+void test_FpgaPidStep_limits_output(void) {
+    uint8_t dir;
+    uint16_t duty = 0;
+
+    for (int i = 0; i < 100; i++) duty = FpgaPidStep(&pid, 0, 100000, &dir);
+    TEST_ASSERT_EQUAL_UINT16(g.limit, duty);
+    TEST_ASSERT_EQUAL_UINT8(0, dir);
+
+    FpgaPidReset(&pid, &g);
+    for (int i = 0; i < 100; i++) duty = FpgaPidStep(&pid, 100000, 0, &dir);
+    TEST_ASSERT_EQUAL_UINT16(g.limit, duty);
+    TEST_ASSERT_EQUAL_UINT8(1, dir);
+}
+
+void test_FpgaPidStep_saturates_error(void) {
+    FpgaPid far;
+    uint8_t dir_a, dir_b;
+    FpgaPidReset(&far, &g);
+
+    FpgaPidStep(&pid, 0, FPGA_PID_ERROR_MAX, &dir_a);
+    FpgaPidStep(&far, INT32_MIN, INT32_MAX, &dir_b);
+
+    TEST_ASSERT_EQUAL_INT32(pid.ud_prev, far.ud_prev);
+    TEST_ASSERT_EQUAL_INT32(FPGA_PID_ERROR_MAX, far.e_prev);
+}
+
+void test_FpgaPidReset_clears_states_keeps_gains(void) {
+    uint8_t dir;
+    for (int i = 0; i < 10; i++) FpgaPidStep(&pid, 0, 50, &dir);
+
+    FpgaPidReset(&pid, &pid.g);
+    TEST_ASSERT_EQUAL_INT32(g.a, pid.g.a);
+    TEST_ASSERT_EQUAL_UINT16(g.limit, pid.g.limit);
+    TEST_ASSERT_EQUAL_INT32(0, pid.ud_prev);
+    TEST_ASSERT_EQUAL_INT32(0, pid.ui_prev);
+    TEST_ASSERT_EQUAL_INT32(0, pid.e_prev);
+}
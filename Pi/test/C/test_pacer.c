@@ -0,0 +1,90 @@
+#include "unity.h"
+#include "pacer.h"
+
+#define PERIOD 100000 // 100 us
+
+static Pacer pacer;
+
+static void InitAt(pacer_policy_t policy, int64_t next_ns) {
+    PacerInit(&pacer, PERIOD, policy, 0);
+    pacer.next_ns = next_ns;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_PacerInit_sets_defaults(void) {
+    PacerInit(&pacer, PERIOD, PacerSkip, -5);
+
+    TEST_ASSERT_EQUAL(PERIOD, pacer.period_ns);
+    TEST_ASSERT_EQUAL(0, pacer.spin_ns); // negative spin is clamped
+    TEST_ASSERT_EQUAL(0, pacer.overruns);
+    TEST_ASSERT_TRUE(pacer.next_ns > 0);
+}
+
+void test_PacerAdvance_on_time(void) {
+    InitAt(PacerSkip, 1000000);
+
+    int behind = PacerAdvance(&pacer, 950000);
+
+    TEST_ASSERT_EQUAL(0, behind);
+    TEST_ASSERT_EQUAL(1000000, pacer.next_ns);
+    TEST_ASSERT_EQUAL(0, pacer.overruns);
+}
+
+void test_PacerAdvance_skip_keeps_phase(void) {
+    InitAt(PacerSkip, 1000000);
+
+    // 3.5 periods late
+    int behind = PacerAdvance(&pacer, 1350000);
+
+    TEST_ASSERT_EQUAL(4, behind);
+    TEST_ASSERT_EQUAL(1300000, pacer.next_ns);
+    TEST_ASSERT_EQUAL(1, pacer.overruns);
+    TEST_ASSERT_EQUAL(3, pacer.missed);
+}
+
+void test_PacerAdvance_catchup_keeps_deadline(void) {
+    InitAt(PacerCatchUp, 1000000);
+
+    int behind = PacerAdvance(&pacer, 1350000);
+
+    TEST_ASSERT_EQUAL(4, behind);
+    TEST_ASSERT_EQUAL(1000000, pacer.next_ns);
+    TEST_ASSERT_EQUAL(1, pacer.overruns);
+    TEST_ASSERT_EQUAL(0, pacer.missed);
+}
+
+void test_PacerAdvance_rephase_restarts_now(void) {
+    InitAt(PacerRephase, 1000000);
+
+    int behind = PacerAdvance(&pacer, 1350000);
+
+    TEST_ASSERT_EQUAL(4, behind);
+    TEST_ASSERT_EQUAL(1350000, pacer.next_ns);
+    TEST_ASSERT_EQUAL(1, pacer.overruns);
+}
+
+void test_PacerWait_counts_overrun_and_lateness(void) {
+    PacerInit(&pacer, PERIOD, PacerSkip, 0);
+    pacer.next_ns = PacerNow() - 250000; // 2.5 periods late
+
+    int64_t late = PacerWait(&pacer);
+
+    TEST_ASSERT_TRUE(late >= 250000);
+    TEST_ASSERT_EQUAL(1, pacer.overruns);
+    TEST_ASSERT_EQUAL(2, pacer.missed);
+    TEST_ASSERT_EQUAL(1, pacer.cycles);
+    TEST_ASSERT_TRUE(pacer.max_late_ns >= 250000);
+}
+
+void test_PacerWait_sleeps_until_deadline(void) {
+    PacerInit(&pacer, PERIOD, PacerSkip, 20000);
+    int64_t deadline = pacer.next_ns;
+
+    PacerWait(&pacer);
+
+    TEST_ASSERT_TRUE(PacerNow() >= deadline);
+    TEST_ASSERT_EQUAL(0, pacer.overruns);
+    TEST_ASSERT_EQUAL(deadline + PERIOD, pacer.next_ns);
+}
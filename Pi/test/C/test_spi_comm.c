@@ -1,5 +1,6 @@
 #include "unity.h"
 #include "spi_comm.h"
+#include <string.h>
 
 // Override system headers
 #include "mock_fake_fcntl.h"
@@ -190,4 +191,284 @@ void test_ReadPositionCmd_reads_all_position_success(void) {
     int result = ReadPositionCmd(fd, UnitAll, &pitch, &yaw);
 
     TEST_ASSERT_EQUAL(0, result);
-}
\ No newline at end of file
+}
+void test_ReadMotionCmd_success(void) {
+    int fd = 3;
+    int32_t pitch = -1, yaw = -1;
+    uint8_t pitch_motion = 0xFF, yaw_motion = 0xFF;
+
+    ioctl_ExpectAnyArgsAndReturn(10); // 10 bytes transferred
+
+    int result = ReadMotionCmd(fd, &pitch, &yaw, &pitch_motion, &yaw_motion);
+
+    TEST_ASSERT_EQUAL(0, result);
+    TEST_ASSERT_EQUAL(MOTION_IDLE, pitch_motion);
+    TEST_ASSERT_EQUAL(MOTION_IDLE, yaw_motion);
+}
+
+void test_ReadMotionCmd_fail(void) {
+    int fd = 3;
+    int32_t pitch, yaw;
+    uint8_t pitch_motion, yaw_motion;
+
+    ioctl_ExpectAnyArgsAndReturn(-1);
+
+    int result = ReadMotionCmd(fd, &pitch, &yaw, &pitch_motion, &yaw_motion);
+    TEST_ASSERT_EQUAL(-1, result);
+}
+
+void test_ExchangeCmd_success(void) {
+    int fd = 3;
+    int32_t pitch = -1, yaw = -1;
+
+    ioctl_ExpectAnyArgsAndReturn(9); // 9 bytes transferred
+
+    int result = ExchangeCmd(fd, 0x234, 1, 1, 0x3FF, 1, 0, &pitch, &yaw);
+
+    TEST_ASSERT_EQUAL(0, result);
+    TEST_ASSERT_EQUAL(0, pitch);
+    TEST_ASSERT_EQUAL(0, yaw);
+}
+
+void test_ExchangeCmd_fail(void) {
+    int fd = 3;
+    int32_t pitch, yaw;
+
+    ioctl_ExpectAnyArgsAndReturn(-1);
+
+    int result = ExchangeCmd(fd, 0, 0, 0, 0, 0, 0, &pitch, &yaw);
+    TEST_ASSERT_EQUAL(-1, result);
+}
+
+void test_SendPidGainsCmd_success(void) {
+    int fd = 3;
+    FpgaPidGains gains = { 0x00123456, -2, 3, 0x80000000u, 810 };
+
+    ioctl_ExpectAnyArgsAndReturn(19); // 19 bytes transferred
+
+    TEST_ASSERT_EQUAL(19, SendPidGainsCmd(fd, UnitYaw, &gains));
+}
+
+void test_PidExchangeCmd_fail(void) {
+    int fd = 3;
+    int32_t pitch, yaw;
+
+    ioctl_ExpectAnyArgsAndReturn(-1);
+
+    TEST_ASSERT_EQUAL(-1, PidExchangeCmd(fd, 100, -100, PID_ENABLE_PITCH, &pitch, &yaw));
+}
+
+void test_SpiSessionSetSetpoints_packs_setpoints(void) {
+    SpiSession s;
+
+    SpiSessionInit(&s, 3, SPI_SPEED_HZ);
+    SpiSessionSetSetpoints(&s, 0x01020304, -2, 0xFF);
+
+    TEST_ASSERT_EQUAL(10, s.xfer[SpiOpPidExchange].len);
+    TEST_ASSERT_EQUAL_HEX8(0x52, s.frame[SpiOpPidExchange].tx[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x01, s.frame[SpiOpPidExchange].tx[1]);
+    TEST_ASSERT_EQUAL_HEX8(0x04, s.frame[SpiOpPidExchange].tx[4]);
+    TEST_ASSERT_EQUAL_HEX8(0xFF, s.frame[SpiOpPidExchange].tx[5]);
+    TEST_ASSERT_EQUAL_HEX8(0xFE, s.frame[SpiOpPidExchange].tx[8]);
+    TEST_ASSERT_EQUAL_HEX8(PID_ENABLE_PITCH | PID_ENABLE_YAW, s.frame[SpiOpPidExchange].tx[9]);
+}
+
+void test_SetSamplerCmd_rejects_long_period(void) {
+    TEST_ASSERT_EQUAL(-1, SetSamplerCmd(3, 0x1000000));
+}
+
+void test_ReadSamplesCmd_rejects_bad_count(void) {
+    EncoderSample samples[1];
+    uint16_t next;
+    uint8_t overflows;
+
+    TEST_ASSERT_EQUAL(-1, ReadSamplesCmd(3, 0, 0, samples, &next, &overflows));
+    TEST_ASSERT_EQUAL(-1, ReadSamplesCmd(3, 0, SAMPLE_BURST_MAX + 1, samples, &next, &overflows));
+}
+
+void test_ReadSamplesCmd_no_sample_taken(void) {
+    EncoderSample samples[4];
+    uint16_t next = 1;
+    uint8_t overflows = 1;
+
+    ioctl_ExpectAnyArgsAndReturn(SAMPLE_BURST_BYTES(4)); // One transfer, whatever its length
+
+    TEST_ASSERT_EQUAL(0, ReadSamplesCmd(3, 0, 4, samples, &next, &overflows));
+    TEST_ASSERT_EQUAL(0, next);
+    TEST_ASSERT_EQUAL(0, overflows);
+}
+
+void test_ReadFramesCmd_rejects_bad_count(void) {
+    EncoderSample frames[1];
+    uint16_t first = 0, next;
+
+    TEST_ASSERT_EQUAL(-1, ReadFramesCmd(3, &first, 0, frames, &next));
+    TEST_ASSERT_EQUAL(-1, ReadFramesCmd(3, &first, FRAME_RING_DEPTH + 1, frames, &next));
+}
+
+void test_SetIntervalHistogramCmd_rejects_bad_setup(void) {
+    TEST_ASSERT_EQUAL(-1, SetIntervalHistogramCmd(3, 0x80, 0, 4, 0));
+    TEST_ASSERT_EQUAL(-1, SetIntervalHistogramCmd(3, -2, 0, 4, 0));
+    TEST_ASSERT_EQUAL(-1, SetIntervalHistogramCmd(3, 0x22, 0x1000000, 4, 0));
+    TEST_ASSERT_EQUAL(-1, SetIntervalHistogramCmd(3, 0x22, 0, 32, 0));
+    TEST_ASSERT_EQUAL(-1, SetIntervalHistogramCmd(3, 0x22, 0, 4, 0x1000000));
+}
+
+void test_SpiSessionRun_batch_is_one_ioctl(void) {
+    SpiSession s;
+    const spi_op_t ops[2] = { SpiOpWriteAll, SpiOpReadAll };
+
+    SpiSessionInit(&s, 3, SPI_SPEED_HZ);
+    SpiSessionSetPwm(&s, 0x234, 1, 1, 0x3FF, 1, 0);
+    ioctl_ExpectAnyArgsAndReturn(14); // Both transfers in a single call
+
+    TEST_ASSERT_EQUAL(14, SpiSessionRun(&s, ops, 2));
+
+    // Prebuilt frames: command byte and PWM payload, CS released between the commands
+    TEST_ASSERT_EQUAL_HEX8(0x12, s.frame[SpiOpWriteAll].tx[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x34, s.frame[SpiOpWriteAll].tx[1]);
+    TEST_ASSERT_EQUAL_HEX8(0xC8, s.frame[SpiOpWriteAll].tx[2]);
+    TEST_ASSERT_EQUAL_HEX8(0xFF, s.frame[SpiOpExchange].tx[3]);
+    TEST_ASSERT_EQUAL_HEX8(0x8C, s.frame[SpiOpExchange].tx[4]);
+    TEST_ASSERT_EQUAL(1, s.batch[0].cs_change);
+    TEST_ASSERT_EQUAL(0, s.batch[1].cs_change);
+}
+
+void test_SpiSessionRun_fail(void) {
+    SpiSession s;
+    const spi_op_t op = SpiOpReadAll;
+
+    SpiSessionInit(&s, 3, SPI_SPEED_HZ);
+    ioctl_ExpectAnyArgsAndReturn(-1);
+
+    TEST_ASSERT_EQUAL(-1, SpiSessionRun(&s, &op, 1));
+}
+
+void test_SpiSessionStamp_decodes_read_timestamp(void) {
+    SpiSession s;
+    uint32_t stamp = 0;
+
+    SpiSessionInit(&s, 3, SPI_SPEED_HZ);
+    s.frame[SpiOpReadAll].rx[9]  = 0x12;
+    s.frame[SpiOpReadAll].rx[10] = 0x34;
+    s.frame[SpiOpReadAll].rx[11] = 0x56;
+    s.frame[SpiOpReadAll].rx[12] = 0x78;
+
+    TEST_ASSERT_EQUAL(13, s.xfer[SpiOpReadAll].len);
+    TEST_ASSERT_EQUAL(0, SpiSessionStamp(&s, SpiOpReadAll, &stamp));
+    TEST_ASSERT_EQUAL_HEX32(0x12345678, stamp);
+    TEST_ASSERT_EQUAL(-1, SpiSessionStamp(&s, SpiOpExchange, &stamp));
+}
+
+void test_SpiStampSeconds_across_counter_wrap(void) {
+    // 250 cycles before the wrap to 250 after: 500 cycles of 40 ns
+    TEST_ASSERT_FLOAT_WITHIN(1e-9, 20e-6, (float)SpiStampSeconds(0xFFFFFF06u, 0x000000FAu));
+    TEST_ASSERT_FLOAT_WITHIN(1e-9, 0.0, (float)SpiStampSeconds(1234u, 1234u));
+}
+
+void test_SpiSessionVelocity_decodes_signed_estimates(void) {
+    SpiSession s;
+    EncoderVelocity pitch, yaw;
+    const uint8_t rx[12] = { 0xFF, 0xFF, 0xFE, 0x0C, 0x00, 0x00, 0x13, 0x88, 0xFF, 0xF6, 0x00, 0x02 };
+
+    SpiSessionInit(&s, 3, SPI_SPEED_HZ);
+    memcpy(&s.frame[SpiOpVelocity].rx[9], rx, sizeof(rx));
+
+    TEST_ASSERT_EQUAL(21, s.xfer[SpiOpVelocity].len);
+    TEST_ASSERT_EQUAL(0, SpiSessionVelocity(&s, SpiOpVelocity, &pitch, &yaw));
+    TEST_ASSERT_EQUAL(-500, pitch.period);
+    TEST_ASSERT_EQUAL(5000, yaw.period);
+    TEST_ASSERT_EQUAL(-10, pitch.window);
+    TEST_ASSERT_EQUAL(2, yaw.window);
+    TEST_ASSERT_EQUAL(-1, SpiSessionVelocity(&s, SpiOpReadAll, &pitch, &yaw));
+}
+
+void test_EncoderVelocityCps_uses_period_when_slow(void) {
+    // 10 edges per 1 ms window: 10000 counts/s from the window
+    EncoderVelocity fast = { -2500, -10 };
+    // 2 edges per window: 5000 cycles of 40 ns between edges, 5000 counts/s
+    EncoderVelocity slow = { 5000, 2 };
+    EncoderVelocity idle = { 0, 0 };
+
+    TEST_ASSERT_FLOAT_WITHIN(1e-3, -10000.0, (float)EncoderVelocityCps(&fast));
+    TEST_ASSERT_FLOAT_WITHIN(1e-3, 5000.0, (float)EncoderVelocityCps(&slow));
+    TEST_ASSERT_FLOAT_WITHIN(1e-3, 0.0, (float)EncoderVelocityCps(&idle));
+}
+
+void test_SpiCrc8_check_value(void) {
+    const uint8_t data[9] = { '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+
+    TEST_ASSERT_EQUAL_HEX8(0xFB, SpiCrc8(data, 9));
+}
+
+void test_checked_frame_failing_its_checks_is_retried(void) {
+    int32_t pitch, yaw;
+    SpiLinkStats link;
+
+    SpiSetChecked(1);
+    SpiResetLinkStats();
+    // No response from the FPGA: every attempt fails its CRC
+    for (int i = 0; i <= SPI_CHECK_RETRIES; i++) ioctl_ExpectAnyArgsAndReturn(9 + SPI_CHECK_BYTES);
+
+    int result = ReadPositionCmd(3, UnitAll, &pitch, &yaw);
+    SpiGetLinkStats(&link);
+    SpiSetChecked(0);
+
+    TEST_ASSERT_EQUAL(SPI_ERR_CHECK, result);
+    TEST_ASSERT_EQUAL(SPI_CHECK_RETRIES + 1, link.frames);
+    TEST_ASSERT_EQUAL(SPI_CHECK_RETRIES + 1, link.crc_errors);
+    TEST_ASSERT_EQUAL(SPI_CHECK_RETRIES, link.retries);
+    TEST_ASSERT_EQUAL(1, link.failures);
+}
+
+void test_checked_session_frames_carry_the_check_bytes(void) {
+    SpiSession s;
+    const spi_op_t op = SpiOpWriteAll;
+
+    SpiSetChecked(1);
+    SpiSessionInit(&s, 3, SPI_SPEED_HZ);
+    SpiSetChecked(0);
+    SpiSessionSetPwm(&s, 0x234, 1, 1, 0x3FF, 1, 0);
+    ioctl_ExpectAnyArgsAndReturn(-1);
+
+    TEST_ASSERT_EQUAL(-1, SpiSessionRun(&s, &op, 1));
+    TEST_ASSERT_EQUAL(5 + SPI_CHECK_BYTES, s.batch[0].len);
+    TEST_ASSERT_EQUAL_HEX8(0x92, s.frame[SpiOpWriteAll].tx[0]);
+    TEST_ASSERT_EQUAL_HEX8(SpiCrc8(s.frame[SpiOpWriteAll].tx, 6), s.frame[SpiOpWriteAll].tx[6]);
+}
+
+void test_ReadRegsCmd_rejects_bad_count(void) {
+    uint32_t values[1] = {0};
+
+    TEST_ASSERT_EQUAL(-1, ReadRegsCmd(3, REG_ID, 0, values));
+    TEST_ASSERT_EQUAL(-1, ReadRegsCmd(3, REG_ID, REG_BURST_MAX + 1, values));
+    TEST_ASSERT_EQUAL(-1, WriteRegsCmd(3, REG_PWM_PITCH, 0, values));
+}
+
+void test_ReadSnapshotCmd_fails_without_register_map(void) {
+    FpgaSnapshot snap;
+
+    ioctl_ExpectAnyArgsAndReturn(REG_BURST_BYTES(REG_LINK_ERRORS + 1)); // All zeros, as an older FPGA image
+
+    TEST_ASSERT_EQUAL(-1, ReadSnapshotCmd(3, &snap));
+}
+
+void test_PwmQueue_commands_reject_bad_arguments(void) {
+    PwmQueueEntry entry = {0};
+    uint16_t wr_index, rd_index;
+    uint8_t underruns;
+
+    TEST_ASSERT_EQUAL(-1, SetPwmQueueCmd(3, PWM_QUEUE_BRAKE, 0x1000000));
+    TEST_ASSERT_EQUAL(-1, QueuePwmCmd(3, 0, &entry, 0, &wr_index, &rd_index, &underruns));
+    TEST_ASSERT_EQUAL(-1, QueuePwmCmd(3, 0, &entry, PWM_QUEUE_BURST_MAX + 1, &wr_index, &rd_index, &underruns));
+}
+
+void test_Axis_commands_reject_bad_ranges(void) {
+    PwmStatus pwm[AXES_MAX + 1] = {{0}};
+    int32_t positions[AXES_MAX + 1];
+    uint32_t stamp;
+
+    TEST_ASSERT_EQUAL(-1, SendAxesPwmCmd(3, 0, 0, pwm));
+    TEST_ASSERT_EQUAL(-1, SendAxesPwmCmd(3, 0, AXES_MAX + 1, pwm));
+    TEST_ASSERT_EQUAL(-1, ReadAxesCmd(3, 6, 3, positions, &stamp));
+}
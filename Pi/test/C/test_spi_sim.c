@@ -0,0 +1,844 @@
+#include "unity.h"
+#include "spi_comm.h"
+#include "clock_source.h"
+#include "sim_plant.h"
+#include "spi_sim.h"
+#include "fpga_pid.h"
+
+#include <math.h>
+
+static int fd;
+
+void setUp(void) {
+    ClockUseVirtual(0, NULL);
+    SimDeviceInit(0.5, 1.0);
+    SpiSetBackend(SimSpiBackend());
+    fd = SpiOpen(SPI_CHANNEL, SPI_SPEED_HZ, SPI_MODE);
+}
+
+void tearDown(void) {
+    SpiSetChecked(0);
+    SpiClose(fd);
+    SpiSetBackend(NULL);
+    ClockUseReal();
+}
+
+void test_SimSpi_positions_start_at_zero(void) {
+    int32_t pitch = -1, yaw = -1;
+
+    TEST_ASSERT_EQUAL(0, ReadPositionCmd(fd, UnitAll, &pitch, &yaw));
+    TEST_ASSERT_EQUAL(0, pitch);
+    TEST_ASSERT_EQUAL(0, yaw);
+}
+
+void test_SimSpi_pwm_status_reads_back(void) {
+    PwmStatus pitch, yaw;
+
+    TEST_ASSERT_EQUAL(5, SendAllPwmCmd(fd, 0x123, 1, 1, 0xABC, 1, 0)); // Bytes transferred
+    TEST_ASSERT_EQUAL(0, CheckPwmStatus(fd, &pitch, &yaw));
+
+    TEST_ASSERT_EQUAL(1, pitch.enable);
+    TEST_ASSERT_EQUAL(1, pitch.dir);
+    TEST_ASSERT_EQUAL_HEX16(0x123, pitch.duty);
+    TEST_ASSERT_EQUAL(1, yaw.enable);
+    TEST_ASSERT_EQUAL(0, yaw.dir);
+    TEST_ASSERT_EQUAL_HEX16(0xABC, yaw.duty);
+}
+
+void test_SimSpi_drive_moves_counts_by_direction(void) {
+    int32_t pitch, yaw;
+
+    // Pitch towards decreasing counts, yaw towards increasing counts
+    SendAllPwmCmd(fd, 800, 1, 1, 800, 1, 0);
+    ClockSleepUs(100000);
+    ReadPositionCmd(fd, UnitAll, &pitch, &yaw);
+
+    TEST_ASSERT_TRUE(pitch < 0);
+    TEST_ASSERT_TRUE(yaw > 0);
+}
+
+void test_SimSpi_end_stop_holds_axis(void) {
+    int32_t pitch, yaw;
+
+    SendPwmCmd(fd, UnitPitch, 4095, 1, 1);
+    ClockSleepUs(3000000);
+    ReadPositionCmd(fd, UnitPitch, &pitch, &yaw);
+    int32_t first = pitch;
+    ClockSleepUs(500000);
+    ReadPositionCmd(fd, UnitPitch, &pitch, &yaw);
+
+    TEST_ASSERT_EQUAL(first, pitch);
+    TEST_ASSERT_TRUE(SimDevicePlant()->pitch.theta == 0.0);
+}
+
+void test_SimSpi_disabled_axis_stays_put(void) {
+    int32_t pitch, yaw;
+
+    SendAllPwmCmd(fd, 4095, 0, 0, 4095, 0, 0);
+    ClockSleepUs(200000);
+    ReadPositionCmd(fd, UnitAll, &pitch, &yaw);
+
+    TEST_ASSERT_EQUAL(0, pitch);
+    TEST_ASSERT_EQUAL(0, yaw);
+}
+
+void test_SimSpi_motion_reports_direction_then_idle(void) {
+    int32_t pitch, yaw;
+    uint8_t pitch_motion, yaw_motion;
+
+    TEST_ASSERT_EQUAL(0, ReadMotionCmd(fd, &pitch, &yaw, &pitch_motion, &yaw_motion));
+    TEST_ASSERT_EQUAL(MOTION_IDLE, pitch_motion);
+    TEST_ASSERT_EQUAL(MOTION_IDLE, yaw_motion);
+
+    // Pitch towards decreasing counts, yaw towards increasing counts
+    SendAllPwmCmd(fd, 800, 1, 1, 800, 1, 0);
+    ClockSleepUs(100000);
+    ReadMotionCmd(fd, &pitch, &yaw, &pitch_motion, &yaw_motion);
+    TEST_ASSERT_EQUAL(MOTION_DOWN, pitch_motion);
+    TEST_ASSERT_EQUAL(MOTION_UP, yaw_motion);
+    TEST_ASSERT_TRUE(pitch < 0 && yaw > 0);
+
+    // Stopped: idle once no edge was seen for the FPGA idle time
+    SendAllPwmCmd(fd, 0, 0, 0, 0, 0, 0);
+    ClockSleepUs(200000);
+    ReadMotionCmd(fd, &pitch, &yaw, &pitch_motion, &yaw_motion);
+    TEST_ASSERT_EQUAL(MOTION_IDLE, pitch_motion);
+    TEST_ASSERT_EQUAL(MOTION_IDLE, yaw_motion);
+}
+
+void test_SimSpi_velocity_follows_the_axes_then_idles(void) {
+    int32_t pitch, yaw;
+    EncoderVelocity pitch_vel, yaw_vel;
+
+    TEST_ASSERT_EQUAL(0, ReadVelocityCmd(fd, &pitch, &yaw, &pitch_vel, &yaw_vel));
+    TEST_ASSERT_EQUAL(0, pitch_vel.period);
+    TEST_ASSERT_EQUAL(0, yaw_vel.window);
+
+    // Pitch towards decreasing counts, yaw towards increasing counts
+    SendAllPwmCmd(fd, 800, 1, 1, 800, 1, 0);
+    ClockSleepUs(100000);
+    ReadVelocityCmd(fd, &pitch, &yaw, &pitch_vel, &yaw_vel);
+    const SimPlant *plant = SimDevicePlant();
+    double pitch_cps = plant->pitch.omega * plant->pitch.p.counts_per_rad;
+    double yaw_cps   = plant->yaw.omega * plant->yaw.p.counts_per_rad;
+
+    TEST_ASSERT_TRUE(pitch_vel.period < 0 && pitch_vel.window < 0);
+    TEST_ASSERT_TRUE(yaw_vel.period > 0 && yaw_vel.window > 0);
+    TEST_ASSERT_DOUBLE_WITHIN(0.1 * fabs(pitch_cps), pitch_cps, EncoderVelocityCps(&pitch_vel));
+    TEST_ASSERT_DOUBLE_WITHIN(0.1 * fabs(yaw_cps), yaw_cps, EncoderVelocityCps(&yaw_vel));
+
+    // Checked frame of the longest command, through a session
+    SpiSession s;
+    EncoderVelocity session_pitch, session_yaw;
+    const spi_op_t velocity = SpiOpVelocity;
+    SpiSetChecked(1);
+    SpiSessionInit(&s, fd, SPI_SPEED_HZ);
+    TEST_ASSERT_EQUAL(24, SpiSessionRun(&s, &velocity, 1));
+    TEST_ASSERT_EQUAL(0, SpiSessionVelocity(&s, SpiOpVelocity, &session_pitch, &session_yaw));
+    TEST_ASSERT_EQUAL(yaw_vel.window, session_yaw.window);
+
+    // Stopped: both estimates drop to 0 once idle
+    SendAllPwmCmd(fd, 0, 0, 0, 0, 0, 0);
+    ClockSleepUs(200000);
+    ReadVelocityCmd(fd, &pitch, &yaw, &pitch_vel, &yaw_vel);
+    TEST_ASSERT_EQUAL(0, pitch_vel.period);
+    TEST_ASSERT_EQUAL(0, pitch_vel.window);
+    TEST_ASSERT_TRUE(EncoderVelocityCps(&yaw_vel) == 0.0);
+}
+
+void test_SimSpi_motion_idle_at_end_stop_while_driven(void) {
+    int32_t pitch, yaw;
+    uint8_t pitch_motion, yaw_motion;
+
+    // Still driven into the stop: the stall shows up as idle
+    SendPwmCmd(fd, UnitPitch, 4095, 1, 1);
+    ClockSleepUs(3000000);
+    ReadMotionCmd(fd, &pitch, &yaw, &pitch_motion, &yaw_motion);
+
+    TEST_ASSERT_TRUE(SimDevicePlant()->pitch.theta == 0.0);
+    TEST_ASSERT_EQUAL(MOTION_IDLE, pitch_motion);
+}
+
+void test_SimSpi_exchange_reads_positions_then_applies_pwm(void) {
+    int32_t pitch = -1, yaw = -1;
+    PwmStatus pitch_status, yaw_status;
+
+    TEST_ASSERT_EQUAL(0, ExchangeCmd(fd, 0x234, 1, 1, 0x3FF, 1, 0, &pitch, &yaw));
+
+    // Positions sampled before the PWM took effect
+    TEST_ASSERT_EQUAL(0, pitch);
+    TEST_ASSERT_EQUAL(0, yaw);
+
+    CheckPwmStatus(fd, &pitch_status, &yaw_status);
+    TEST_ASSERT_EQUAL(1, pitch_status.enable);
+    TEST_ASSERT_EQUAL(1, pitch_status.dir);
+    TEST_ASSERT_EQUAL_HEX16(0x234, pitch_status.duty);
+    TEST_ASSERT_EQUAL(1, yaw_status.enable);
+    TEST_ASSERT_EQUAL(0, yaw_status.dir);
+    TEST_ASSERT_EQUAL_HEX16(0x3FF, yaw_status.duty);
+
+    // Next exchange stops the axes and sees the movement
+    ClockSleepUs(100000);
+    ExchangeCmd(fd, 0, 0, 0, 0, 0, 0, &pitch, &yaw);
+    TEST_ASSERT_TRUE(pitch < 0 && yaw > 0);
+    TEST_ASSERT_EQUAL(0, SimDevicePlant()->pitch.enable);
+}
+
+void test_SimSpi_session_write_then_read_in_one_message(void) {
+    SpiSession s;
+    int32_t pitch, yaw;
+    const spi_op_t ops[2] = { SpiOpWriteAll, SpiOpReadAll };
+
+    SpiSessionInit(&s, fd, SPI_SPEED_HZ);
+    SpiSessionSetPwm(&s, 800, 1, 1, 800, 1, 0);
+    uint64_t before = SimDeviceTransactions();
+
+    TEST_ASSERT_EQUAL(5 + 13, SpiSessionRun(&s, ops, 2));
+    TEST_ASSERT_EQUAL(before + 2, SimDeviceTransactions()); // One CS assertion per command
+    TEST_ASSERT_EQUAL(1, SimDevicePlant()->pitch.enable);
+
+    ClockSleepUs(100000);
+    SpiSessionRun(&s, &ops[1], 1);
+    SpiSessionPositions(&s, SpiOpReadAll, &pitch, &yaw);
+    TEST_ASSERT_TRUE(pitch < 0 && yaw > 0);
+}
+
+void test_SimSpi_session_matches_single_commands(void) {
+    SpiSession s;
+    int32_t pitch, yaw, exp_pitch, exp_yaw;
+    const spi_op_t exchange = SpiOpExchange;
+
+    SendAllPwmCmd(fd, 800, 1, 0, 800, 1, 1);
+    ClockSleepUs(100000);
+    SpiSessionInit(&s, fd, SPI_SPEED_HZ);
+    SpiSessionSetPwm(&s, 0, 0, 0, 0, 0, 0);
+    SpiSessionRun(&s, &exchange, 1);
+    SpiSessionPositions(&s, SpiOpExchange, &pitch, &yaw);
+    ReadPositionCmd(fd, UnitAll, &exp_pitch, &exp_yaw);
+
+    TEST_ASSERT_EQUAL(exp_pitch, pitch); // Axes stopped by the exchange
+    TEST_ASSERT_EQUAL(exp_yaw, yaw);
+    TEST_ASSERT_TRUE(pitch > 0 && yaw < 0);
+}
+
+void test_SimSpi_position_stamps_follow_the_clock(void) {
+    SpiSession s;
+    int32_t pitch, yaw;
+    uint32_t first, second, session_stamp;
+    const spi_op_t read = SpiOpReadAll, exchange = SpiOpExchange;
+
+    TEST_ASSERT_EQUAL(0, ReadPositionStampedCmd(fd, UnitAll, &pitch, &yaw, &first));
+    ClockSleepUs(10000);
+    TEST_ASSERT_EQUAL(0, ReadPositionStampedCmd(fd, UnitPitch, &pitch, &yaw, &second));
+    TEST_ASSERT_EQUAL_UINT32(10000 * (FPGA_CLK_HZ / 1000000), second - first);
+
+    SpiSessionInit(&s, fd, SPI_SPEED_HZ);
+    ClockSleepUs(100);
+    SpiSessionRun(&s, &read, 1);
+    TEST_ASSERT_EQUAL(0, SpiSessionStamp(&s, SpiOpReadAll, &session_stamp));
+    TEST_ASSERT_EQUAL_UINT32(100 * (FPGA_CLK_HZ / 1000000), session_stamp - second);
+
+    // The exchange has no timestamp
+    SpiSessionRun(&s, &exchange, 1);
+    TEST_ASSERT_EQUAL(-1, SpiSessionStamp(&s, SpiOpExchange, &session_stamp));
+}
+
+void test_SimSpi_session_rejects_oversized_batch(void) {
+    SpiSession s;
+    const spi_op_t ops[SPI_SESSION_BATCH + 1] = { SpiOpReadAll };
+
+    SpiSessionInit(&s, fd, SPI_SPEED_HZ);
+    TEST_ASSERT_EQUAL(-1, SpiSessionRun(&s, ops, SPI_SESSION_BATCH + 1));
+}
+
+void test_SimSpi_checked_frames_match_unchecked(void) {
+    SpiSession s;
+    SpiLinkStats link;
+    int32_t pitch, yaw, exp_pitch, exp_yaw;
+    const spi_op_t ops[2] = { SpiOpWriteAll, SpiOpReadAll };
+
+    SendAllPwmCmd(fd, 800, 1, 0, 800, 1, 1);
+    ClockSleepUs(100000);
+    SendAllPwmCmd(fd, 0, 0, 0, 0, 0, 0);
+    ReadPositionCmd(fd, UnitAll, &exp_pitch, &exp_yaw);
+
+    SpiSetChecked(1);
+    SpiResetLinkStats();
+    SpiSessionInit(&s, fd, SPI_SPEED_HZ);
+    SpiSessionSetPwm(&s, 0x123, 0, 1, 0x456, 0, 0);
+
+    TEST_ASSERT_EQUAL(2 * SPI_CHECK_BYTES + 5 + 13, SpiSessionRun(&s, ops, 2));
+    SpiSessionPositions(&s, SpiOpReadAll, &pitch, &yaw);
+    TEST_ASSERT_EQUAL(exp_pitch, pitch);
+    TEST_ASSERT_EQUAL(exp_yaw, yaw);
+    TEST_ASSERT_EQUAL_HEX16(0x123, SimDevicePlant()->pitch.duty);
+    TEST_ASSERT_EQUAL_HEX16(0x456, SimDevicePlant()->yaw.duty);
+
+    SpiGetLinkStats(&link);
+    TEST_ASSERT_EQUAL(2, link.frames);
+    TEST_ASSERT_EQUAL(0, link.retries);
+}
+
+void test_SimSpi_checked_reads_survive_bit_errors(void) {
+    SpiLinkStats link;
+    int32_t pitch, yaw, exp_pitch, exp_yaw;
+    int wrong = 0, failed = 0;
+
+    SendAllPwmCmd(fd, 800, 1, 0, 800, 1, 1);
+    ClockSleepUs(100000);
+    SendAllPwmCmd(fd, 0, 0, 0, 0, 0, 0);
+    ReadPositionCmd(fd, UnitAll, &exp_pitch, &exp_yaw);
+
+    SpiSetChecked(1);
+    SpiResetLinkStats();
+    SimDeviceSetBitErrors(5e-4, 7);
+    for (int i = 0; i < 2000; i++) {
+        int err = ReadPositionCmd(fd, UnitAll, &pitch, &yaw);
+        if (err == SPI_ERR_CHECK) failed++;
+        else if (pitch != exp_pitch || yaw != exp_yaw) wrong++;
+    }
+
+    SpiGetLinkStats(&link);
+    TEST_ASSERT_EQUAL(0, wrong); // No corrupted position gets through
+    TEST_ASSERT_TRUE(link.retries > 50);
+    TEST_ASSERT_EQUAL(link.failures, (uint64_t)failed);
+    TEST_ASSERT_TRUE(failed < 20);
+}
+
+void test_SimSpi_corrupted_writes_are_not_applied(void) {
+    PwmStatus pitch, yaw;
+    int wrong = 0;
+
+    SendAllPwmCmd(fd, 0x123, 0, 1, 0x456, 0, 0);
+    SpiSetChecked(1);
+    for (int i = 0; i < 500; i++) {
+        SimDeviceSetBitErrors(5e-3, (uint32_t)i + 1);
+        SendAllPwmCmd(fd, 0xABC, 0, 0, 0x789, 0, 1);
+        SimDeviceSetBitErrors(0.0, 1);
+
+        // Either the old or the new words, never a mix or a corrupted one
+        CheckPwmStatus(fd, &pitch, &yaw);
+        int old_words = pitch.duty == 0x123 && pitch.dir == 1 && yaw.duty == 0x456 && yaw.dir == 0;
+        int new_words = pitch.duty == 0xABC && pitch.dir == 0 && yaw.duty == 0x789 && yaw.dir == 1;
+        if (!old_words && !new_words) wrong++;
+        SendAllPwmCmd(fd, 0x123, 0, 1, 0x456, 0, 0);
+    }
+    TEST_ASSERT_EQUAL(0, wrong);
+}
+
+void test_SimSpi_position_loops_reach_setpoints(void) {
+    PidParams pitch_p, yaw_p;
+    FpgaPidGains pitch_g, yaw_g;
+    int32_t pitch = -1, yaw = -1;
+
+    FpgaPidDefaultParams(&pitch_p, &yaw_p);
+    TEST_ASSERT_EQUAL(0, FpgaPidGainsFrom(&pitch_g, &pitch_p, 1.0 / FPGA_PID_HZ, 0.001, 819.0));
+    TEST_ASSERT_EQUAL(0, FpgaPidGainsFrom(&yaw_g, &yaw_p, 1.0 / FPGA_PID_HZ, 0.001, 819.0));
+    TEST_ASSERT_EQUAL(19, SendPidGainsCmd(fd, UnitPitch, &pitch_g));
+    TEST_ASSERT_EQUAL(19, SendPidGainsCmd(fd, UnitYaw, &yaw_g));
+
+    // Positions sampled before the loops start
+    TEST_ASSERT_EQUAL(0, PidExchangeCmd(fd, 300, -200, PID_ENABLE_PITCH | PID_ENABLE_YAW, &pitch, &yaw));
+    TEST_ASSERT_EQUAL(0, pitch);
+    TEST_ASSERT_EQUAL(0, yaw);
+    TEST_ASSERT_EQUAL(1, SimDevicePlant()->pitch.enable);
+
+    // Close after 1 s, the integrators (tauI 2 and 9 s) remove the rest slowly
+    ClockSleepUs(1000000);
+    PidExchangeCmd(fd, 300, -200, PID_ENABLE_PITCH | PID_ENABLE_YAW, &pitch, &yaw);
+    TEST_ASSERT_INT_WITHIN(15, 300, pitch);
+    TEST_ASSERT_INT_WITHIN(15, -200, yaw);
+}
+
+void test_SimSpi_pwm_write_stops_position_loop(void) {
+    PidParams pitch_p, yaw_p;
+    FpgaPidGains pitch_g;
+    int32_t pitch, yaw, pitch_stopped;
+
+    FpgaPidDefaultParams(&pitch_p, &yaw_p);
+    FpgaPidGainsFrom(&pitch_g, &pitch_p, 1.0 / FPGA_PID_HZ, 0.001, 819.0);
+    SendPidGainsCmd(fd, UnitPitch, &pitch_g);
+    PidExchangeCmd(fd, 5000, 0, PID_ENABLE_PITCH, &pitch, &yaw);
+    ClockSleepUs(50000);
+
+    // The write takes the axis back, the loop no longer drives it
+    SendPwmCmd(fd, UnitPitch, 0, 1, 0);
+    ReadPositionCmd(fd, UnitAll, &pitch_stopped, &yaw);
+    TEST_ASSERT_TRUE(pitch_stopped > 0);
+    ClockSleepUs(500000);
+    ReadPositionCmd(fd, UnitAll, &pitch, &yaw);
+    TEST_ASSERT_EQUAL(0, SimDevicePlant()->pitch.duty);
+    TEST_ASSERT_TRUE(pitch < 5000);
+}
+
+void test_SimSpi_sampler_keeps_its_own_rate(void) {
+    SampleStream st;
+    EncoderSample samples[SAMPLE_BURST_MAX];
+
+    TEST_ASSERT_EQUAL(0, SampleStreamStart(&st, fd, 10000));
+    SendAllPwmCmd(fd, 800, 1, 0, 0, 0, 0);
+
+    // Drained at irregular intervals, sampled every 100 us regardless
+    int total = 0;
+    uint32_t last_stamp = 0;
+    int32_t last_pitch = 0;
+    const int64_t waits_us[4] = { 3000, 7300, 1100, 8600 };
+    for (int i = 0; i < 4; i++) {
+        ClockSleepUs(waits_us[i]);
+        int n = SampleStreamDrain(&st, fd, samples, SAMPLE_BURST_MAX);
+        TEST_ASSERT_TRUE(n >= 0);
+        for (int k = 0; k < n; k++) {
+            if (total + k > 0) TEST_ASSERT_EQUAL_UINT32(FPGA_CLK_HZ / 10000, samples[k].stamp - last_stamp);
+            TEST_ASSERT_TRUE(samples[k].pitch >= last_pitch);
+            last_stamp = samples[k].stamp;
+            last_pitch = samples[k].pitch;
+        }
+        total += n;
+    }
+    TEST_ASSERT_INT_WITHIN(1, 200, total);
+    TEST_ASSERT_TRUE(last_pitch > 0);
+    TEST_ASSERT_EQUAL_UINT64(0, st.dropped);
+}
+
+void test_SimSpi_sample_burst_read_again_returns_same_samples(void) {
+    EncoderSample first[10], again[10];
+    uint16_t next;
+    uint8_t overflows;
+
+    SetSamplerCmd(fd, FPGA_CLK_HZ / 1000);
+    SendAllPwmCmd(fd, 800, 1, 0, 800, 1, 1);
+    ClockSleepUs(20000);
+
+    TEST_ASSERT_EQUAL(10, ReadSamplesCmd(fd, 5, 10, first, &next, &overflows));
+    TEST_ASSERT_EQUAL(10, ReadSamplesCmd(fd, 5, 10, again, &next, &overflows));
+    TEST_ASSERT_EQUAL_MEMORY(first, again, sizeof(first));
+    TEST_ASSERT_EQUAL(20, next);
+
+    // Samples before index 5 are gone
+    TEST_ASSERT_EQUAL(0, ReadSamplesCmd(fd, 30, 10, first, &next, &overflows));
+}
+
+void test_SimSpi_sampler_counts_dropped_samples(void) {
+    SampleStream st;
+    EncoderSample samples[SAMPLE_BURST_MAX];
+
+    SampleStreamStart(&st, fd, 10000);
+    ClockSleepUs(50000);    // 500 samples into a ring of 256
+
+    TEST_ASSERT_EQUAL(SAMPLE_BURST_MAX, SampleStreamDrain(&st, fd, samples, SAMPLE_BURST_MAX));
+    TEST_ASSERT_EQUAL(1, SampleStreamDrain(&st, fd, samples, SAMPLE_BURST_MAX));
+    TEST_ASSERT_INT_WITHIN(1, 500 - SAMPLE_FIFO_DEPTH, (int)st.dropped);
+}
+
+void test_SimSpi_checked_sample_bursts_survive_bit_errors(void) {
+    SampleStream st;
+    EncoderSample samples[SAMPLE_BURST_MAX];
+
+    SpiSetChecked(1);
+    SampleStreamStart(&st, fd, 10000);
+    SimDeviceSetBitErrors(1e-5, 7);
+
+    int total = 0;
+    for (int i = 0; i < 100; i++) {
+        ClockSleepUs(5000);
+        int n = SampleStreamDrain(&st, fd, samples, SAMPLE_BURST_MAX);
+        if (n > 0) total += n;  // A failed burst is read again by the next call
+    }
+    TEST_ASSERT_TRUE(SimDeviceFlippedBits() > 0);
+    SimDeviceSetBitErrors(0.0, 1);
+    total += SampleStreamDrain(&st, fd, samples, SAMPLE_BURST_MAX);
+
+    TEST_ASSERT_INT_WITHIN(1, 5000, total);
+    TEST_ASSERT_EQUAL(total, st.next);
+    TEST_ASSERT_EQUAL_UINT64(0, st.dropped);
+}
+
+void test_SimSpi_snapshot_matches_fixed_commands(void) {
+    FpgaSnapshot snap;
+    EncoderVelocity pitch_vel, yaw_vel;
+    PwmStatus pitch_pwm, yaw_pwm;
+    int32_t pitch, yaw;
+    uint8_t pitch_motion, yaw_motion;
+
+    SendAllPwmCmd(fd, 800, 1, 1, 600, 1, 0);
+    ClockSleepUs(50000);
+
+    // The virtual clock stands still between the commands
+    TEST_ASSERT_EQUAL(0, ReadSnapshotCmd(fd, &snap));
+    TEST_ASSERT_EQUAL(0, ReadVelocityCmd(fd, &pitch, &yaw, &pitch_vel, &yaw_vel));
+    ReadMotionCmd(fd, &pitch, &yaw, &pitch_motion, &yaw_motion);
+    CheckPwmStatus(fd, &pitch_pwm, &yaw_pwm);
+
+    TEST_ASSERT_EQUAL(pitch, snap.pitch);
+    TEST_ASSERT_EQUAL(yaw, snap.yaw);
+    TEST_ASSERT_EQUAL((uint32_t)(ClockNowNs() / (1000000000 / FPGA_CLK_HZ)), snap.stamp);
+    TEST_ASSERT_EQUAL(MOTION_DOWN, snap.pitch_motion);
+    TEST_ASSERT_EQUAL(yaw_motion, snap.yaw_motion);
+    TEST_ASSERT_EQUAL(pitch_vel.period, snap.pitch_vel.period);
+    TEST_ASSERT_EQUAL(yaw_vel.window, snap.yaw_vel.window);
+    TEST_ASSERT_EQUAL(pitch_pwm.duty, snap.pitch_pwm.duty);
+    TEST_ASSERT_EQUAL(yaw_pwm.dir, snap.yaw_pwm.dir);
+    TEST_ASSERT_EQUAL(0, snap.link_errors);
+}
+
+void test_SimSpi_register_writes_run_position_loops(void) {
+    PidParams pitch_p, yaw_p;
+    FpgaPidGains g;
+    int32_t pitch, yaw;
+
+    FpgaPidDefaultParams(&pitch_p, &yaw_p);
+    FpgaPidGainsFrom(&g, &pitch_p, 1.0 / FPGA_PID_HZ, 0.001, 819.0);
+
+    // Gains and their load, then setpoints and enables, one frame each
+    const uint32_t gains[6] = { (uint32_t)g.a, (uint32_t)g.b, (uint32_t)g.c, g.d, g.limit, UnitPitch };
+    const uint32_t loop[3] = { 300, 0, PID_ENABLE_PITCH };
+    TEST_ASSERT_EQUAL(REG_BURST_BYTES(6), WriteRegsCmd(fd, REG_GAIN_A, 6, gains));
+    TEST_ASSERT_EQUAL(REG_BURST_BYTES(3), WriteRegsCmd(fd, REG_SETPOINT_PITCH, 3, loop));
+    ClockSleepUs(1000000);
+
+    ReadPositionCmd(fd, UnitAll, &pitch, &yaw);
+    TEST_ASSERT_INT_WITHIN(15, 300, pitch);
+    TEST_ASSERT_EQUAL(0, yaw);
+}
+
+void test_SimSpi_registers_read_back_every_write(void) {
+    uint32_t regs[REG_GAIN_LOAD - REG_PWM_PITCH + 1];
+    const uint32_t pwm[2] = { 0xC834, 0x8CFF };
+    FpgaPidGains g = { 1, -2, 3, 4, 500 };
+
+    // Fixed commands and register writes change the same registers
+    SendPidGainsCmd(fd, UnitYaw, &g);
+    SetSamplerCmd(fd, 2500);
+    WriteRegsCmd(fd, REG_PWM_PITCH, 2, pwm);
+    TEST_ASSERT_EQUAL(0, ReadRegsCmd(fd, REG_PWM_PITCH, REG_GAIN_LOAD - REG_PWM_PITCH + 1, regs));
+
+    TEST_ASSERT_EQUAL_HEX32(0xC834, regs[REG_PWM_PITCH - REG_PWM_PITCH]);
+    TEST_ASSERT_EQUAL_HEX32(0x8CFF, regs[REG_PWM_YAW - REG_PWM_PITCH]);
+    TEST_ASSERT_EQUAL(2500, regs[REG_SAMPLE_PERIOD - REG_PWM_PITCH]);
+    TEST_ASSERT_EQUAL_HEX32(0xFFFFFFFE, regs[REG_GAIN_A + 1 - REG_PWM_PITCH]);
+    TEST_ASSERT_EQUAL(500, regs[REG_GAIN_LIMIT - REG_PWM_PITCH]);
+    TEST_ASSERT_EQUAL(UnitYaw, regs[REG_GAIN_LOAD - REG_PWM_PITCH]);
+    TEST_ASSERT_EQUAL(0x234, SimDevicePlant()->pitch.duty);
+    TEST_ASSERT_EQUAL(1, SimDevicePlant()->pitch.dir);
+    TEST_ASSERT_EQUAL(0x3FF, SimDevicePlant()->yaw.duty);
+}
+
+void test_SimSpi_checked_register_bursts_match_unchecked(void) {
+    uint32_t unchecked[REG_LINK_ERRORS + 1], checked[REG_LINK_ERRORS + 1];
+
+    SendAllPwmCmd(fd, 800, 1, 0, 800, 1, 1);
+    ClockSleepUs(20000);
+    ReadRegsCmd(fd, REG_ID, REG_LINK_ERRORS + 1, unchecked);
+    SpiSetChecked(1);
+    TEST_ASSERT_EQUAL(0, ReadRegsCmd(fd, REG_ID, REG_LINK_ERRORS + 1, checked));
+
+    TEST_ASSERT_EQUAL_HEX32(REG_MAP_ID, checked[REG_ID]);
+    TEST_ASSERT_EQUAL_HEX32_ARRAY(unchecked, checked, REG_LINK_ERRORS + 1);
+}
+
+void test_SimSpi_pwm_queue_applies_entries_at_period_ends(void) {
+    PwmQueue q;
+    PwmStatus pitch, yaw;
+    uint32_t regs[2];
+    const uint32_t period = FPGA_CLK_HZ / FPGA_PWM_HZ;
+    const PwmQueueEntry entries[3] = {
+        { 1000,          { 1, 0, 0x100 }, { 1, 1, 0x200 } }, // Within the first period
+        { 2 * period,    { 1, 1, 0x300 }, { 0, 0, 0x000 } }, // On the end of the second one
+        { FPGA_CLK_HZ / 250, { 0, 0, 0x000 }, { 1, 0, 0xFFF } },
+    };
+
+    TEST_ASSERT_EQUAL(0, PwmQueueStart(&q, fd, 0, 0));
+    TEST_ASSERT_EQUAL(3, PwmQueuePush(&q, fd, entries, 3));
+    TEST_ASSERT_EQUAL(3, q.level);
+
+    ClockSleepUs(49);
+    CheckPwmStatus(fd, &pitch, &yaw);
+    TEST_ASSERT_EQUAL(0, pitch.enable);
+    ClockSleepUs(1);
+    CheckPwmStatus(fd, &pitch, &yaw);
+    TEST_ASSERT_EQUAL_HEX16(0x100, pitch.duty);
+    TEST_ASSERT_EQUAL(1, yaw.dir);
+    ClockSleepUs(50);
+    CheckPwmStatus(fd, &pitch, &yaw);
+    TEST_ASSERT_EQUAL_HEX16(0x300, pitch.duty);
+    TEST_ASSERT_EQUAL(0, yaw.enable);
+
+    ClockSleepUs(3899);  // The last entry waits for its time, 4 ms
+    TEST_ASSERT_EQUAL(0, ReadRegsCmd(fd, REG_QUEUE, 2, regs));
+    TEST_ASSERT_EQUAL_HEX32(0x00030002, regs[0]);
+    ClockSleepUs(1);
+    CheckPwmStatus(fd, &pitch, &yaw);
+    TEST_ASSERT_EQUAL(0, pitch.enable);
+    TEST_ASSERT_EQUAL_HEX16(0xFFF, yaw.duty);
+    TEST_ASSERT_EQUAL(0, ReadRegsCmd(fd, REG_QUEUE, 2, regs));
+    TEST_ASSERT_EQUAL_HEX32(0x00030003, regs[0]);
+    TEST_ASSERT_EQUAL(0, regs[1]); // No underrun without timeout
+}
+
+void test_SimSpi_pwm_queue_underrun_brakes_or_holds(void) {
+    PwmQueue q;
+    PwmStatus pitch, yaw;
+    uint32_t setup;
+    const PwmQueueEntry entry = { 0, { 1, 0, 0x400 }, { 1, 1, 0x400 } };
+
+    // Brake 100 us after the entry applied at 50 us
+    PwmQueueStart(&q, fd, PWM_QUEUE_BRAKE, FPGA_CLK_HZ / 10000);
+    PwmQueuePush(&q, fd, &entry, 1);
+    ClockSleepUs(149);
+    CheckPwmStatus(fd, &pitch, &yaw);
+    TEST_ASSERT_EQUAL(1, pitch.enable);
+    ClockSleepUs(1);
+    CheckPwmStatus(fd, &pitch, &yaw);
+    TEST_ASSERT_EQUAL(0, pitch.enable);
+    TEST_ASSERT_EQUAL(0, yaw.enable);
+    TEST_ASSERT_EQUAL(0, ReadRegsCmd(fd, REG_QUEUE_SETUP, 1, &setup));
+    TEST_ASSERT_EQUAL_HEX32(0x01000000 | FPGA_CLK_HZ / 10000, setup);
+
+    // Hold: the underrun is only counted
+    PwmQueueStart(&q, fd, 0, FPGA_CLK_HZ / 10000);
+    PwmQueuePush(&q, fd, &entry, 1);
+    ClockSleepUs(1000);
+    CheckPwmStatus(fd, &pitch, &yaw);
+    TEST_ASSERT_EQUAL(1, pitch.enable);
+    TEST_ASSERT_EQUAL_HEX16(0x400, yaw.duty);
+    TEST_ASSERT_EQUAL(1, PwmQueuePush(&q, fd, &entry, 1));
+    TEST_ASSERT_EQUAL_UINT64(1, q.underrun_total);
+}
+
+void test_SimSpi_pwm_queue_plays_from_braked_axes(void) {
+    PwmQueue q;
+    PwmStatus pitch, yaw;
+    uint32_t regs;
+    // From the axes braked at power-up; the second entry brakes them again
+    const PwmQueueEntry entries[3] = {
+        { 0, { 1, 0, 0x100 }, { 0, 0, 0x000 } },
+        { 0, { 0, 0, 0x000 }, { 0, 0, 0x000 } },
+        { 0, { 1, 1, 0x300 }, { 0, 0, 0x000 } },
+    };
+
+    PwmQueueStart(&q, fd, PWM_QUEUE_BRAKE, FPGA_CLK_HZ / 10000);
+    TEST_ASSERT_EQUAL(3, PwmQueuePush(&q, fd, entries, 3));
+    ClockSleepUs(100);
+    CheckPwmStatus(fd, &pitch, &yaw);
+    TEST_ASSERT_EQUAL(0, pitch.enable);
+    ClockSleepUs(50);
+    CheckPwmStatus(fd, &pitch, &yaw);
+    TEST_ASSERT_EQUAL(1, pitch.dir);
+    TEST_ASSERT_EQUAL_HEX16(0x300, pitch.duty);
+
+    // Braked by the underrun 100 us later, the queue still plays
+    ClockSleepUs(100);
+    CheckPwmStatus(fd, &pitch, &yaw);
+    TEST_ASSERT_EQUAL(0, pitch.enable);
+    TEST_ASSERT_EQUAL(1, PwmQueuePush(&q, fd, entries, 1));
+    ClockSleepUs(50);
+    CheckPwmStatus(fd, &pitch, &yaw);
+    TEST_ASSERT_EQUAL(1, pitch.enable);
+    TEST_ASSERT_EQUAL_HEX16(0x100, pitch.duty);
+    TEST_ASSERT_EQUAL(0, ReadRegsCmd(fd, REG_QUEUE, 1, &regs));
+    TEST_ASSERT_EQUAL_HEX32(0x00040004, regs);
+}
+
+void test_SimSpi_pwm_queue_takes_entries_once(void) {
+    static PwmQueueEntry entries[PWM_QUEUE_DEPTH + 10];
+    PwmQueue q;
+    uint16_t wr_index, rd_index;
+    uint8_t underruns;
+
+    for (int k = 0; k < PWM_QUEUE_DEPTH + 10; k++) entries[k] = (PwmQueueEntry){ 0xFFFFFF, { 1, 0, 1 }, { 1, 0, 2 } };
+    PwmQueueStart(&q, fd, 0, 0);
+    TEST_ASSERT_EQUAL(PWM_QUEUE_BURST_MAX, PwmQueuePush(&q, fd, entries, PWM_QUEUE_DEPTH + 10));
+    TEST_ASSERT_EQUAL(1, PwmQueuePush(&q, fd, &entries[PWM_QUEUE_BURST_MAX], 10)); // Full
+    TEST_ASSERT_EQUAL(0, PwmQueuePush(&q, fd, &entries[PWM_QUEUE_DEPTH], 10));
+
+    // A frame sent again adds nothing
+    TEST_ASSERT_EQUAL(10, QueuePwmCmd(fd, 0, entries, 10, &wr_index, &rd_index, &underruns));
+    TEST_ASSERT_EQUAL(PWM_QUEUE_DEPTH, wr_index);
+    TEST_ASSERT_EQUAL(0, rd_index);
+    TEST_ASSERT_EQUAL(PWM_QUEUE_DEPTH, q.level);
+}
+
+void test_SimSpi_checked_pwm_queue_survives_bit_errors(void) {
+    static PwmQueueEntry entries[600];
+    PwmQueue q;
+    PwmStatus pitch, yaw;
+    uint32_t regs;
+    const uint32_t period = FPGA_CLK_HZ / FPGA_PWM_HZ;
+
+    // One entry per PWM period from 1 ms on, the duty counting them
+    for (int k = 0; k < 600; k++) {
+        entries[k] = (PwmQueueEntry){ (uint32_t)(25000 + k * period), { 1, 0, (uint16_t)k }, { 1, 1, (uint16_t)k } };
+    }
+    SpiSetChecked(1);
+    PwmQueueStart(&q, fd, PWM_QUEUE_BRAKE, 2 * period);
+    SimDeviceSetBitErrors(1e-5, 3);
+
+    int sent = 0;
+    for (int i = 0; i < 100 && sent < 600; i++) {
+        int n = PwmQueuePush(&q, fd, &entries[sent], (unsigned)(600 - sent));
+        if (n > 0) sent += n;   // A failed frame is sent again by the next call
+        ClockSleepUs(2000);
+    }
+    TEST_ASSERT_TRUE(SimDeviceFlippedBits() > 0);
+    SimDeviceSetBitErrors(0.0, 1);
+    ClockSleepUs(10000);
+
+    TEST_ASSERT_EQUAL(600, sent);
+    TEST_ASSERT_EQUAL(0, ReadRegsCmd(fd, REG_QUEUE, 1, &regs));
+    TEST_ASSERT_EQUAL_HEX32((600u << 16) | 600u, regs);
+    TEST_ASSERT_EQUAL(0, CheckPwmStatus(fd, &pitch, &yaw));
+    TEST_ASSERT_EQUAL(599, pitch.duty);
+    TEST_ASSERT_EQUAL(0, ReadRegsCmd(fd, REG_QUEUE_UNDERRUNS, 1, &regs));
+    TEST_ASSERT_EQUAL(1, regs);  // Only once the profile ended
+}
+
+void test_SimSpi_axis_reads_match_position_reads(void) {
+    int32_t positions[4] = { -1, -1, -1, -1 };
+    int32_t pitch, yaw;
+    uint32_t stamp, axes_stamp;
+
+    TEST_ASSERT_EQUAL(2, ReadAxisCountCmd(fd));
+    SendAllPwmCmd(fd, 800, 1, 1, 800, 1, 0);
+    ClockSleepUs(50000);
+
+    ReadPositionStampedCmd(fd, UnitAll, &pitch, &yaw, &stamp);
+    TEST_ASSERT_EQUAL(0, ReadAxesCmd(fd, 0, 4, positions, &axes_stamp));
+    TEST_ASSERT_EQUAL(pitch, positions[0]);
+    TEST_ASSERT_EQUAL(yaw, positions[1]);
+    TEST_ASSERT_EQUAL(0, positions[2]);  // Axes the device does not have
+    TEST_ASSERT_EQUAL(0, positions[3]);
+    TEST_ASSERT_EQUAL(stamp, axes_stamp);
+
+    SpiSetChecked(1);
+    TEST_ASSERT_EQUAL(0, ReadAxesCmd(fd, 1, 1, positions, &axes_stamp));
+    TEST_ASSERT_EQUAL(yaw, positions[0]);
+}
+
+void test_SimSpi_axis_pwm_writes_apply_together(void) {
+    const PwmStatus pwm[3] = { { 1, 1, 0x234 }, { 1, 0, 0x3FF }, { 1, 0, 0x100 } };
+    uint32_t regs[2];
+
+    TEST_ASSERT_EQUAL(AXES_PWM_BYTES(3), SendAxesPwmCmd(fd, 0, 3, pwm));
+    TEST_ASSERT_EQUAL(0, ReadRegsCmd(fd, REG_PWM_PITCH, 2, regs));
+    TEST_ASSERT_EQUAL_HEX32(0xC834, regs[0]);
+    TEST_ASSERT_EQUAL_HEX32(0x8CFF, regs[1]);
+
+    SpiSetChecked(1);
+    SendAxesPwmCmd(fd, 1, 1, &pwm[2]);
+    TEST_ASSERT_EQUAL(0x234, SimDevicePlant()->pitch.duty);
+    TEST_ASSERT_EQUAL(0x100, SimDevicePlant()->yaw.duty);
+}
+
+void test_SimSpi_frame_sync_snapshots_pose_at_strobe(void) {
+    EncoderSample frames[FRAME_RING_DEPTH];
+    int32_t pitch[2], yaw[2];
+    uint32_t stamp[2], regs;
+    uint16_t first = 0, next;
+
+    SendAllPwmCmd(fd, 800, 1, 1, 800, 1, 0);
+    for (int i = 0; i < 2; i++) {
+        ClockSleepUs(20000);
+        SimDeviceFrameSync();
+        ReadPositionStampedCmd(fd, UnitAll, &pitch[i], &yaw[i], &stamp[i]);
+    }
+    ClockSleepUs(20000);    // The axes keep moving after the frames
+
+    TEST_ASSERT_EQUAL(2, ReadFramesCmd(fd, &first, FRAME_RING_DEPTH, frames, &next));
+    TEST_ASSERT_EQUAL(0, first);
+    TEST_ASSERT_EQUAL(2, next);
+    for (int i = 0; i < 2; i++) {
+        TEST_ASSERT_EQUAL(pitch[i], frames[i].pitch);
+        TEST_ASSERT_EQUAL(yaw[i], frames[i].yaw);
+        TEST_ASSERT_EQUAL_UINT32(stamp[i], frames[i].stamp);
+    }
+    TEST_ASSERT_TRUE(frames[1].pitch != frames[0].pitch);
+    TEST_ASSERT_EQUAL(0, ReadRegsCmd(fd, REG_FRAMES, 1, &regs));
+    TEST_ASSERT_EQUAL_HEX32(0x20000, regs);
+
+    // Nothing new until the next strobe
+    first = next;
+    TEST_ASSERT_EQUAL(0, ReadFramesCmd(fd, &first, FRAME_RING_DEPTH, frames, &next));
+
+    SpiSetChecked(1);
+    SimDeviceFrameSync();
+    TEST_ASSERT_EQUAL(1, ReadFramesCmd(fd, &first, 4, frames, &next));
+    TEST_ASSERT_EQUAL(2, first);
+}
+
+void test_SimSpi_overwritten_frames_are_skipped(void) {
+    EncoderSample frames[FRAME_RING_DEPTH];
+    uint16_t first = 0, next;
+
+    for (int i = 0; i < 20; i++) {
+        ClockSleepUs(1000);
+        SimDeviceFrameSync();
+    }
+
+    // The oldest slot may be overwritten while read, so 15 are kept. The
+    // skipped slots were part of the burst.
+    TEST_ASSERT_EQUAL(11, ReadFramesCmd(fd, &first, FRAME_RING_DEPTH, frames, &next));
+    TEST_ASSERT_EQUAL(5, first);
+    TEST_ASSERT_EQUAL(20, next);
+    TEST_ASSERT_EQUAL_UINT32(6000 * (FPGA_CLK_HZ / 1000000), frames[0].stamp);
+    first += 11;
+    TEST_ASSERT_EQUAL(4, ReadFramesCmd(fd, &first, FRAME_RING_DEPTH, frames, &next));
+    TEST_ASSERT_EQUAL_UINT32(17000 * (FPGA_CLK_HZ / 1000000), frames[0].stamp);
+
+    // Fewer asked than skipped: only the index moves on
+    first = 0;
+    TEST_ASSERT_EQUAL(0, ReadFramesCmd(fd, &first, 4, frames, &next));
+    TEST_ASSERT_EQUAL(5, first);
+}
+
+void test_SimSpi_interval_histogram_times_one_command(void) {
+    IntervalHistogram hist;
+    PwmStatus pitch_pwm, yaw_pwm;
+    int32_t pitch, yaw;
+    uint32_t stamp, regs[2];
+    const uint32_t period = 100 * (FPGA_CLK_HZ / 1000000), origin = period - 32 * 16;
+
+    TEST_ASSERT_TRUE(SetIntervalHistogramCmd(fd, 0x22, origin, 4, period + 100) > 0);
+    TEST_ASSERT_EQUAL(0, ReadRegsCmd(fd, REG_HIST_SETUP, 2, regs));
+    TEST_ASSERT_EQUAL_HEX32(((HIST_ONE_CMD | 0x22) << 24) | origin, regs[0]);
+    TEST_ASSERT_EQUAL_HEX32((4u << 24) | (period + 100), regs[1]);
+
+    // Five loop periods, the last one late, with other frames in between
+    for (int i = 0; i < 6; i++) {
+        ClockSleepUs(i < 5 ? 100 : 120);
+        ReadPositionStampedCmd(fd, UnitAll, &pitch, &yaw, &stamp);
+        CheckPwmStatus(fd, &pitch_pwm, &yaw_pwm);
+    }
+
+    TEST_ASSERT_EQUAL(0, ReadIntervalHistogramCmd(fd, &hist));
+    TEST_ASSERT_EQUAL_UINT32(5, hist.count);
+    TEST_ASSERT_EQUAL_UINT32(period, hist.min);
+    TEST_ASSERT_EQUAL_UINT32(120 * (FPGA_CLK_HZ / 1000000), hist.max);
+    TEST_ASSERT_EQUAL_UINT32(1, hist.missed);
+    TEST_ASSERT_EQUAL_UINT32(4, hist.bins[32]);
+    TEST_ASSERT_EQUAL_UINT32(1, hist.bins[INTERVAL_BINS - 1]);  // Above the last bin
+
+    // Setting it up again clears it
+    SetIntervalHistogramCmd(fd, 0x22, origin, 4, 0);
+    TEST_ASSERT_EQUAL(0, ReadIntervalHistogramCmd(fd, &hist));
+    TEST_ASSERT_EQUAL_UINT32(0, hist.count);
+    TEST_ASSERT_EQUAL_UINT32(0, hist.bins[32]);
+    TEST_ASSERT_TRUE(hist.min > hist.max);
+}
+
+void test_SimSpi_interval_histogram_times_every_checked_frame(void) {
+    IntervalHistogram hist;
+    int32_t pitch, yaw;
+
+    SpiSetChecked(1);
+    SetIntervalHistogramCmd(fd, INTERVAL_ALL_CMDS, 0, 10, 0);
+    ReadPositionCmd(fd, UnitAll, &pitch, &yaw);
+    ClockSleepUs(50);
+    SendAllPwmCmd(fd, 100, 1, 0, 100, 1, 0);
+
+    // The statistics are read before their own frame is timed
+    TEST_ASSERT_EQUAL(0, ReadIntervalHistogramCmd(fd, &hist));
+    TEST_ASSERT_EQUAL_UINT32(1, hist.count);
+    TEST_ASSERT_EQUAL_UINT32(50 * (FPGA_CLK_HZ / 1000000), hist.min);
+    TEST_ASSERT_EQUAL_UINT32(1, hist.bins[1]);
+    TEST_ASSERT_EQUAL_UINT32(0, hist.missed);
+}
@@ -0,0 +1,144 @@
+#include "unity.h"
+#include "trajectory.h"
+
+#include <math.h>
+
+#define DT 0.0001 // 10 kHz
+
+static const TrajLimits limits = { 2.0, 20.0, 400.0 };
+static Trajectory tr;
+
+// Worst velocity, acceleration and position step seen while running
+static double max_v, max_a, max_dq;
+
+static void Run(int ticks) {
+    double prev_q = tr.q;
+    for (int i = 0; i < ticks; i++) {
+        TrajStep(&tr, DT);
+        if (fabs(tr.v) > max_v) max_v = fabs(tr.v);
+        if (fabs(tr.a) > max_a) max_a = fabs(tr.a);
+        if (fabs(tr.q - prev_q) > max_dq) max_dq = fabs(tr.q - prev_q);
+        prev_q = tr.q;
+    }
+}
+
+void setUp(void) {
+    TrajInit(&tr, &limits, 0.0);
+    max_v = max_a = max_dq = 0.0;
+}
+
+void tearDown(void) {}
+
+void test_TrajPlan_rest_to_rest_reaches_goal_within_limits(void) {
+    TEST_ASSERT_EQUAL(0, TrajPlan(&tr, 1.0));
+    Run(10000);
+
+    TEST_ASSERT_TRUE(fabs(tr.q - 1.0) < 1e-9);
+    TEST_ASSERT_TRUE(tr.v == 0.0);
+    TEST_ASSERT_TRUE(max_v <= limits.v_max + 1e-9);
+    TEST_ASSERT_TRUE(max_a <= limits.a_max + 1e-9);
+}
+
+void test_TrajPlan_long_move_is_time_optimal(void) {
+    // 1 rad: 0.1 s jerk + accel phases each way and cruise at v_max
+    TrajPlan(&tr, 1.0);
+
+    TEST_ASSERT_TRUE(fabs(TrajRemaining(&tr) - 0.65) < 1e-9);
+}
+
+void test_TrajPlan_short_move_does_not_reach_limits(void) {
+    TrajPlan(&tr, 0.01);
+    Run(10000);
+
+    TEST_ASSERT_TRUE(fabs(tr.q - 0.01) < 1e-9);
+    TEST_ASSERT_TRUE(max_v < limits.v_max);
+    TEST_ASSERT_TRUE(max_a < limits.a_max);
+}
+
+void test_TrajPlan_negative_move(void) {
+    TrajPlan(&tr, -1.5);
+    Run(2000);
+    TEST_ASSERT_TRUE(tr.v < 0.0);
+
+    Run(10000);
+    TEST_ASSERT_TRUE(fabs(tr.q + 1.5) < 1e-9);
+}
+
+void test_TrajPlan_replan_keeps_position_and_velocity(void) {
+    TrajPlan(&tr, 2.0);
+    Run(3000);
+    double q = tr.q, v = tr.v;
+
+    TrajPlan(&tr, 3.0);
+    TEST_ASSERT_TRUE(tr.q == q && tr.v == v);
+
+    Run(1);
+    TEST_ASSERT_TRUE(fabs(tr.q - q) <= limits.v_max * DT + 1e-9);
+}
+
+void test_TrajPlan_brakes_when_goal_is_too_close(void) {
+    TrajPlan(&tr, 2.0);
+    Run(3000); // Cruising at 2 rad/s
+    double q = tr.q;
+
+    // Goal just ahead: cannot stop on it, brake and come back
+    TEST_ASSERT_EQUAL(1, TrajPlan(&tr, q + 0.01));
+    Run(20000);
+
+    TEST_ASSERT_TRUE(fabs(tr.q - (q + 0.01)) < 1e-9);
+    TEST_ASSERT_TRUE(max_dq <= limits.v_max * DT + 1e-9);
+    TEST_ASSERT_TRUE(max_a <= limits.a_max + 1e-9);
+}
+
+void test_TrajPlan_reverse_while_moving(void) {
+    TrajPlan(&tr, 2.0);
+    Run(3000);
+
+    TrajPlan(&tr, 0.0);
+    Run(20000);
+
+    TEST_ASSERT_TRUE(fabs(tr.q) < 1e-9);
+    TEST_ASSERT_TRUE(max_dq <= limits.v_max * DT + 1e-9);
+}
+
+void test_TrajStep_without_plan_holds_position(void) {
+    Run(100);
+
+    TEST_ASSERT_TRUE(tr.q == 0.0 && tr.v == 0.0);
+    TEST_ASSERT_TRUE(TrajRemaining(&tr) == 0.0);
+}
+
+void test_TrajPlan_replan_while_accelerating_keeps_acceleration(void) {
+    TrajPlan(&tr, 2.0);
+    Run(300); // Halfway through the first jerk phase
+    double a = tr.a;
+
+    // Goal further ahead: the acceleration goes on rising
+    TEST_ASSERT_EQUAL(0, TrajPlan(&tr, 3.0));
+    Run(1);
+    TEST_ASSERT_TRUE(fabs(tr.a - (a + limits.j_max * DT)) < 1e-6);
+
+    Run(20000);
+    TEST_ASSERT_TRUE(fabs(tr.q - 3.0) < 1e-9);
+    TEST_ASSERT_TRUE(max_a <= limits.a_max + 1e-9);
+    TEST_ASSERT_TRUE(max_v <= limits.v_max + 1e-9);
+}
+
+void test_TrajPlan_replan_never_steps_the_acceleration(void) {
+    const double goals[] = { 0.1, 2.0, 1.9, -0.5, 0.3, 0.31, 1.0 };
+    double prev_a = tr.a;
+    for (unsigned g = 0; g < sizeof(goals) / sizeof(goals[0]); g++) {
+        TrajPlan(&tr, goals[g]);
+        // Replanned every 33 ms, like the camera frames
+        for (int i = 0; i < 330; i++) {
+            TrajStep(&tr, DT);
+            TEST_ASSERT_TRUE(fabs(tr.a - prev_a) <= limits.j_max * DT + 1e-6);
+            prev_a = tr.a;
+            if (fabs(tr.a) > max_a) max_a = fabs(tr.a);
+        }
+    }
+    Run(30000);
+
+    TEST_ASSERT_TRUE(fabs(tr.q - 1.0) < 1e-9);
+    TEST_ASSERT_TRUE(max_a <= limits.a_max + 1e-9);
+}
@@ -0,0 +1,81 @@
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include "../../motor_control.hpp"
+#include "../../spi_comm.h"
+#include "../../clock_source.h"
+#include "../../sim/spi_sim.h"
+
+#define CALIB_TEST_PATH "test_homing_sim.bin"
+
+// Pose and result of one homing run on the simulated device
+struct HomingRun {
+    bool verified;
+    double pitch, yaw;      // Axis angles from the lower stops when homing returned [rad]
+    double seconds;         // Homing time on the virtual clock
+    int32_t pitch_offset, yaw_offset;
+    uint32_t pitch_max_steps, yaw_max_steps;
+};
+
+// Restarts the program with the simulated device still counting from the
+// same origin; warm puts the axes where a previous run left them
+static HomingRun Home(bool warm, bool fast) {
+    HomingRun r;
+    ClockUseVirtual(0, NULL);
+    SimDeviceInit(0.6, 1.9);
+    if (warm) {
+        SimDevicePlant()->pitch.theta = 1.1;
+        SimDevicePlant()->yaw.theta   = 0.8;
+    }
+    SpiSetBackend(SimSpiBackend());
+    int fd = SpiOpen(SPI_CHANNEL, SPI_SPEED_HZ, SPI_MODE);
+
+    int64_t t0 = ClockNowNs();
+    r.verified = HomeWithCalibration(fd, CALIB_TEST_PATH, &r.pitch_offset, &r.yaw_offset,
+                                     &r.pitch_max_steps, &r.yaw_max_steps, fast);
+    r.seconds = (ClockNowNs() - t0) * 1e-9;
+    r.pitch = SimDevicePlant()->pitch.theta;
+    r.yaw   = SimDevicePlant()->yaw.theta;
+
+    SpiClose(fd);
+    SpiSetBackend(NULL);
+    ClockUseReal();
+    return r;
+}
+
+class HomingSimTest : public ::testing::TestWithParam<bool> {
+protected:
+    void SetUp() override { remove(CALIB_TEST_PATH); }
+    void TearDown() override { remove(CALIB_TEST_PATH); }
+};
+
+// A verified calibration must hand over the same calibration and the same
+// pose as full homing, so tracking starts from the same place either way
+TEST_P(HomingSimTest, WarmStartEndsAtFullHomingPose) {
+    bool fast = GetParam();
+    HomingRun full = Home(false, fast);
+    HomingRun warm = Home(true, fast);
+
+    EXPECT_FALSE(full.verified);
+    EXPECT_TRUE(warm.verified);
+    EXPECT_EQ(full.pitch_offset, warm.pitch_offset);
+    EXPECT_EQ(full.yaw_offset, warm.yaw_offset);
+    EXPECT_EQ(full.pitch_max_steps, warm.pitch_max_steps);
+    EXPECT_EQ(full.yaw_max_steps, warm.yaw_max_steps);
+    EXPECT_NEAR(full.pitch, warm.pitch, 0.005);
+    EXPECT_NEAR(full.yaw, warm.yaw, 0.005);
+    EXPECT_LT(warm.seconds, full.seconds);
+}
+
+// Restart from the power-on pose: pitch nearer its lower stop, yaw nearer
+// its upper one, so only pitch moves on after the touch
+TEST_P(HomingSimTest, WarmStartFromEitherSideEndsAtFullHomingPose) {
+    bool fast = GetParam();
+    HomingRun full = Home(false, fast);
+    HomingRun again = Home(false, fast);
+
+    EXPECT_TRUE(again.verified);
+    EXPECT_NEAR(full.pitch, again.pitch, 0.005);
+    EXPECT_NEAR(full.yaw, again.yaw, 0.005);
+}
+
+INSTANTIATE_TEST_SUITE_P(SlowAndFast, HomingSimTest, ::testing::Bool());
@@ -38,3 +38,19 @@ TEST(ComputeAnglesTest, ComputesCorrectOffsets) {
     EXPECT_NEAR(y_offset_rad, ((280 - 240) * (28.634 * M_PI / 180.0f)) / 480, 1e-6);
 }
 
+
+// ---------------------------------------------------------------------
+
+TEST(WaitForFirstFrameTest, ReturnsOnceAFrameWasProcessed) {
+    g_first_frame_ns = 12345;
+
+    EXPECT_TRUE(WaitForFirstFrame(10));
+
+    g_first_frame_ns = 0;
+}
+
+TEST(WaitForFirstFrameTest, TimesOutWithoutFrames) {
+    g_first_frame_ns = 0;
+
+    EXPECT_FALSE(WaitForFirstFrame(5));
+}
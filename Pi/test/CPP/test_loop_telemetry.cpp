@@ -0,0 +1,100 @@
+#include <gtest/gtest.h>
+#include <string.h>
+#include <thread>
+#include "../../loop_telemetry.hpp"
+
+// Normally defined by target_data.cpp
+std::atomic<bool> g_run(true);
+
+class LoopTelemetryTest : public ::testing::Test {
+protected:
+    LoopTelemetry tel;
+    TelemetryWindow window;
+    PhaseSummary summary[PhaseCount];
+    uint64_t overruns = 0;
+
+    void SetUp() override {
+        TelemetryReset(&tel);
+        memset(&window, 0, sizeof(window));
+    }
+};
+
+TEST_F(LoopTelemetryTest, EmptyWindow) {
+    TelemetrySummarize(&tel, &window, summary, &overruns);
+
+    EXPECT_EQ(summary[PhaseRead].count, 0u);
+    EXPECT_EQ(summary[PhaseRead].p99_us, 0.0);
+    EXPECT_EQ(overruns, 0u);
+}
+
+TEST_F(LoopTelemetryTest, MeanMinMaxAndPercentiles) {
+    // 99 samples at 10.5 us and one outlier at 80.2 us
+    for (int i = 0; i < 99; i++) TelemetryRecord(&tel, PhaseRead, 10500);
+    TelemetryRecord(&tel, PhaseRead, 80200);
+
+    TelemetrySummarize(&tel, &window, summary, &overruns);
+
+    EXPECT_EQ(summary[PhaseRead].count, 100u);
+    EXPECT_NEAR(summary[PhaseRead].mean_us, (99 * 10.5 + 80.2) / 100.0, 1e-6);
+    EXPECT_NEAR(summary[PhaseRead].min_us, 10.5, 1e-6);
+    EXPECT_NEAR(summary[PhaseRead].max_us, 80.2, 1e-6);
+    EXPECT_EQ(summary[PhaseRead].p50_us, 11.0);   // Upper edge of the 10-11 us bucket
+    EXPECT_EQ(summary[PhaseRead].p999_us, 81.0);
+    EXPECT_EQ(summary[PhaseStep].count, 0u);
+}
+
+TEST_F(LoopTelemetryTest, WindowsAreIndependent) {
+    TelemetryRecord(&tel, PhaseCycle, 50000);
+    tel.overruns.store(3);
+    TelemetrySummarize(&tel, &window, summary, &overruns);
+    EXPECT_EQ(overruns, 3u);
+
+    TelemetryRecord(&tel, PhaseCycle, 20000);
+    tel.overruns.store(4);
+    TelemetrySummarize(&tel, &window, summary, &overruns);
+
+    // Only the second sample belongs to the second window
+    EXPECT_EQ(summary[PhaseCycle].count, 1u);
+    EXPECT_NEAR(summary[PhaseCycle].mean_us, 20.0, 1e-6);
+    EXPECT_NEAR(summary[PhaseCycle].max_us, 20.0, 1e-6);
+    EXPECT_EQ(overruns, 1u);
+}
+
+TEST_F(LoopTelemetryTest, OverflowBucket) {
+    TelemetryRecord(&tel, PhasePeriod, 5000000); // 5 ms, beyond the last bucket
+    TelemetrySummarize(&tel, &window, summary, &overruns);
+
+    EXPECT_EQ(summary[PhasePeriod].p50_us, (double)TELEMETRY_BUCKETS);
+    EXPECT_NEAR(summary[PhasePeriod].max_us, 5000.0, 1e-6);
+}
+
+TEST_F(LoopTelemetryTest, MinMaxWindowsLoseNoSample) {
+    // Rising samples of 1, 2, ... N us while the reader closes windows: each
+    // window's min follows the previous window's max, so no sample is lost
+    // between them. The one sample being recorded while min and max are
+    // swapped can have its min in one window and its max in the next.
+    const int64_t n = 200000;
+    std::atomic<bool> done(false);
+    std::thread writer([&] {
+        for (int64_t k = 1; k <= n; k++) TelemetryRecord(&tel, PhaseCycle, k * 1000);
+        done.store(true);
+    });
+
+    double last_max = 0.0;
+    int windows = 0;
+    bool finished = false;
+    while (!finished) {
+        finished = done.load();
+        TelemetrySummarize(&tel, &window, summary, &overruns);
+        if (summary[PhaseCycle].max_us == 0.0) continue;
+        EXPECT_GT(summary[PhaseCycle].min_us, 0.0);
+        EXPECT_LE(summary[PhaseCycle].min_us, last_max + 2.0);
+        EXPECT_GT(summary[PhaseCycle].max_us, last_max);
+        last_max = summary[PhaseCycle].max_us;
+        windows++;
+    }
+    writer.join();
+
+    EXPECT_EQ(last_max, (double)n);
+    EXPECT_GT(windows, 0);
+}
@@ -0,0 +1,146 @@
+#include <gtest/gtest.h>
+#include <linux/spi/spidev.h>
+#include <thread>
+#include "../../spi_io.hpp"
+#include "../../spi_comm.h"
+#include "../../clock_source.h"
+
+// Normally defined by target_data.cpp
+std::atomic<bool> g_run(true);
+
+// Fake FPGA: positions count the transfers, PWM writes are kept
+static std::atomic<int> fake_result(0);
+static std::atomic<uint32_t> fake_transfers(0);
+static std::atomic<uint8_t> fake_pwm_lo(0);
+
+static int FakeOpen(unsigned, unsigned, unsigned) { return 7; }
+static int FakeClose(int) { return 0; }
+static int FakeMessage(int, struct spi_ioc_transfer *xfers, unsigned n) {
+    if (fake_result.load() < 0) return fake_result.load();
+    int total = 0;
+    for (unsigned i = 0; i < n; i++) {
+        const uint8_t *tx = (const uint8_t *)(uintptr_t)xfers[i].tx_buf;
+        uint8_t *rx = (uint8_t *)(uintptr_t)xfers[i].rx_buf;
+        uint32_t count = ++fake_transfers;
+        if (tx[0] == 0x12 || tx[0] == 0x40) fake_pwm_lo = tx[1];
+        rx[1] = rx[5] = 0;
+        rx[2] = rx[6] = 0;
+        rx[3] = rx[7] = (uint8_t)(count >> 8);
+        rx[4] = rx[8] = (uint8_t)count;
+        total += (int)xfers[i].len;
+    }
+    return total;
+}
+static const SpiBackend kFakeBackend = { FakeOpen, FakeClose, FakeMessage };
+
+struct Pair {
+    uint64_t seq;
+    uint64_t triple;
+};
+
+TEST(MailboxTest, ReadBeforePublishReturnsInitialValue) {
+    Mailbox<Pair> m;
+    Pair out;
+    MailboxInit(&m, Pair{ 0, 0 });
+
+    EXPECT_FALSE(MailboxRead(&m, &out));
+    EXPECT_EQ(out.seq, 0u);
+}
+
+TEST(MailboxTest, LatestValueWinsAndIsReadOnce) {
+    Mailbox<Pair> m;
+    Pair out;
+    MailboxInit(&m, Pair{ 0, 0 });
+
+    MailboxPublish(&m, Pair{ 1, 3 });
+    MailboxPublish(&m, Pair{ 2, 6 });
+    EXPECT_TRUE(MailboxRead(&m, &out));
+    EXPECT_EQ(out.seq, 2u);
+
+    // Nothing new: same value, not fresh
+    EXPECT_FALSE(MailboxRead(&m, &out));
+    EXPECT_EQ(out.seq, 2u);
+}
+
+TEST(MailboxTest, ConcurrentReaderNeverSeesTornValues) {
+    Mailbox<Pair> m;
+    MailboxInit(&m, Pair{ 0, 0 });
+    const uint64_t kCount = 1000000;
+
+    std::thread writer([&m, kCount] {
+        for (uint64_t i = 1; i <= kCount; i++) MailboxPublish(&m, Pair{ i, 3 * i });
+    });
+
+    Pair out;
+    uint64_t last = 0, torn = 0, backwards = 0;
+    while (last < kCount) {
+        MailboxRead(&m, &out);
+        if (out.triple != 3 * out.seq) torn++;
+        if (out.seq < last) backwards++;
+        last = out.seq;
+    }
+    writer.join();
+
+    EXPECT_EQ(torn, 0u);
+    EXPECT_EQ(backwards, 0u);
+}
+
+class SpiIoTest : public ::testing::Test {
+protected:
+    SpiIo io;
+    int fd;
+
+    void SetUp() override {
+        fake_result = 0;
+        fake_transfers = 0;
+        fake_pwm_lo = 0;
+        SpiSetBackend(&kFakeBackend);
+        fd = SpiOpen(0, 0, 0);
+        SpiIoInit(&io);
+    }
+
+    void TearDown() override {
+        SpiSetBackend(NULL);
+    }
+};
+
+TEST_F(SpiIoTest, PublishesSamplesAndAppliesCommands) {
+    std::thread spi_thr(spi_io_thread_func, &io, fd, 100000, true);
+    ASSERT_TRUE(SpiIoWaitFirstSample(&io, 1000000));
+
+    MailboxPublish(&io.command, SpiPwm{ 0x55, 0, 1, 0, 0, 0 });
+    while (fake_pwm_lo.load() != 0x55 && io.cycles.load() < 1000) ClockSleepUs(100);
+
+    SpiSample sample;
+    EXPECT_TRUE(MailboxRead(&io.status, &sample));
+    io.run = false;
+    spi_thr.join();
+
+    EXPECT_EQ(fake_pwm_lo.load(), 0x55);
+    EXPECT_GE(sample.seq, 1u);
+    EXPECT_EQ(sample.pitch, sample.yaw);
+    EXPECT_EQ(io.error.load(), 0);
+}
+
+TEST_F(SpiIoTest, WriteAndReadShareOneMessage) {
+    std::thread spi_thr(spi_io_thread_func, &io, fd, 100000, false);
+    ASSERT_TRUE(SpiIoWaitFirstSample(&io, 1000000));
+    io.run = false;
+    spi_thr.join();
+
+    // Two transfers per cycle, the read comes second
+    SpiSample sample;
+    MailboxRead(&io.status, &sample);
+    EXPECT_EQ(fake_transfers.load(), 2 * io.cycles.load());
+    EXPECT_EQ(sample.pitch, (int32_t)(2 * sample.seq));
+}
+
+TEST_F(SpiIoTest, TransferErrorIsReported) {
+    fake_result = -5;
+    std::thread spi_thr(spi_io_thread_func, &io, fd, 100000, true);
+
+    EXPECT_FALSE(SpiIoWaitFirstSample(&io, 1000000));
+    spi_thr.join();
+    EXPECT_EQ(io.error.load(), -5);
+    EXPECT_EQ(io.cycles.load(), 0u);
+}
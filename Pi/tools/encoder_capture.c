@@ -0,0 +1,88 @@
+// Filename : encoder_capture.c
+// Authors : Luis Moreno (s3608255), Luca Provenzano (s3487636)
+// Group : 43
+// License : N.A. or open source license like LGPL
+// Description : Records both encoders at a fixed rate with the FPGA sampler, drained in SPI bursts
+//==============================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../spi_comm.h"
+
+#define CAPTURE_DEFAULT_RATE_HZ  10000
+#define CAPTURE_DEFAULT_DRAIN_MS 5
+
+/*********************************************
+* @brief Starts the FPGA sampler, drains it every few ms and writes the
+*        samples as CSV (time from the first sample, both positions). The
+*        sample times come from the FPGA, so the record is uniformly
+*        sampled whatever the scheduling of this process.
+*
+* @param [in] argc argument count
+* @param [in] argv [--rate-hz=N] [--drain-ms=N] [--spi-crc] <seconds> [output.csv]
+*
+* @return 0: recorded without loss; 1: usage or SPI error; 2: samples dropped
+*********************************************/
+int main(int argc, char *argv[]) {
+    unsigned rate_hz = CAPTURE_DEFAULT_RATE_HZ, drain_ms = CAPTURE_DEFAULT_DRAIN_MS;
+    int arg = 1;
+    for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++) {
+        if (strncmp(argv[arg], "--rate-hz=", 10) == 0)       rate_hz = (unsigned)atoi(argv[arg] + 10);
+        else if (strncmp(argv[arg], "--drain-ms=", 11) == 0) drain_ms = (unsigned)atoi(argv[arg] + 11);
+        else if (strcmp(argv[arg], "--spi-crc") == 0)        SpiSetChecked(1);
+        else rate_hz = 0; // Forces the usage message
+    }
+    if (arg >= argc || argc - arg > 2 || atof(argv[arg]) <= 0.0 || rate_hz == 0 || drain_ms == 0) {
+        fprintf(stderr, "Usage: %s [--rate-hz=N] [--drain-ms=N] [--spi-crc] <seconds> [output.csv]\n", argv[0]);
+        return 1;
+    }
+    double seconds = atof(argv[arg]);
+    FILE *out = (argc - arg == 2) ? fopen(argv[arg + 1], "w") : stdout;
+    if (out == NULL) {
+        perror("fopen(output)");
+        return 1;
+    }
+
+    int fd = SpiOpen(SPI_CHANNEL, SPI_SPEED_HZ, SPI_MODE);
+    if (fd < 0) return 1;
+
+    SampleStream st;
+    if (SampleStreamStart(&st, fd, rate_hz) < 0) {
+        fprintf(stderr, "Error: Failed to start the FPGA sampler.\n");
+        SpiClose(fd);
+        return 1;
+    }
+
+    static EncoderSample samples[SAMPLE_BURST_MAX];
+    uint64_t wanted = (uint64_t)(seconds * rate_hz), total = 0, bursts = 0, failed = 0;
+    uint32_t last_stamp = 0;
+    double t_s = 0.0;   // Summed per sample, so the 32-bit stamps may wrap
+    const struct timespec drain = { (time_t)(drain_ms / 1000), (long)(drain_ms % 1000) * 1000000L };
+    fprintf(out, "t_s,pitch,yaw\n");
+    while (total < wanted) {
+        nanosleep(&drain, NULL);
+        int n;
+        do {
+            n = SampleStreamDrain(&st, fd, samples, SAMPLE_BURST_MAX);
+            bursts++;
+            if (n < 0) {
+                failed++;   // Read again on the next drain
+                break;
+            }
+            for (int k = 0; k < n && total < wanted; k++, total++) {
+                if (total > 0) t_s += SpiStampSeconds(last_stamp, samples[k].stamp);
+                last_stamp = samples[k].stamp;
+                fprintf(out, "%.7f,%d,%d\n", t_s, samples[k].pitch, samples[k].yaw);
+            }
+        } while (n == SAMPLE_BURST_MAX && total < wanted);
+    }
+    SetSamplerCmd(fd, 0);
+    SpiClose(fd);
+    if (out != stdout) fclose(out);
+
+    fprintf(stderr, "%llu samples at %u Hz in %llu bursts (%llu failed), %llu dropped\n", (unsigned long long)total,
+            rate_hz, (unsigned long long)bursts, (unsigned long long)failed, (unsigned long long)st.dropped);
+    return st.dropped > 0 ? 2 : 0;
+}
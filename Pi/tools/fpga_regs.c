@@ -0,0 +1,60 @@
+// Filename : fpga_regs.c
+// Authors : Luis Moreno (s3608255), Luca Provenzano (s3487636)
+// Group : 43
+// License : N.A. or open source license like LGPL
+// Description : Reads or writes a block of the FPGA register map (commands 0x70/0x71) in one SPI burst
+//==============================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../spi_comm.h"
+
+/*********************************************
+* @brief Prints count registers from addr on, read in one burst, or writes
+*        the values given from addr on in one burst
+*
+* @param [in] argc argument count
+* @param [in] argv [--spi-crc] <addr> [count] | [--spi-crc] --write <addr> <value>...
+*
+* @return 0: done; 1: usage or SPI error
+*********************************************/
+int main(int argc, char *argv[]) {
+    int arg = 1, write = 0;
+    for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++) {
+        if (strcmp(argv[arg], "--spi-crc") == 0)    SpiSetChecked(1);
+        else if (strcmp(argv[arg], "--write") == 0) write = 1;
+        else arg = argc; // Forces the usage message
+    }
+    int n_args = argc - arg;
+    if (n_args < 1 || (write ? n_args < 2 || n_args - 1 > REG_BURST_MAX : n_args > 2)) {
+        fprintf(stderr, "Usage: %s [--spi-crc] <addr> [count]\n"
+                        "       %s [--spi-crc] --write <addr> <value>...\n", argv[0], argv[0]);
+        return 1;
+    }
+    unsigned addr = (unsigned)strtoul(argv[arg], NULL, 0);
+    unsigned count = write ? (unsigned)(n_args - 1) : (n_args == 2 ? (unsigned)strtoul(argv[arg + 1], NULL, 0) : 1);
+    if (addr > 0xFF || count == 0 || count > REG_BURST_MAX) {
+        fprintf(stderr, "Error: Address 0x00-0xFF, 1 to %d registers.\n", REG_BURST_MAX);
+        return 1;
+    }
+
+    int fd = SpiOpen(SPI_CHANNEL, SPI_SPEED_HZ, SPI_MODE);
+    if (fd < 0) return 1;
+
+    uint32_t values[REG_BURST_MAX];
+    int err;
+    if (write) {
+        for (unsigned k = 0; k < count; k++) values[k] = (uint32_t)strtoul(argv[arg + 1 + k], NULL, 0);
+        err = WriteRegsCmd(fd, (uint8_t)addr, count, values);
+    } else {
+        err = ReadRegsCmd(fd, (uint8_t)addr, count, values);
+        for (unsigned k = 0; err >= 0 && k < count; k++) printf("0x%02X 0x%08X\n", (addr + k) & 0xFF, values[k]);
+    }
+    SpiClose(fd);
+    if (err < 0) {
+        fprintf(stderr, "Error: Register burst failed (%d).\n", err);
+        return 1;
+    }
+    return 0;
+}
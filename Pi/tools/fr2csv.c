@@ -0,0 +1,80 @@
+// Filename : fr2csv.c
+// Authors : Luis Moreno (s3608255), Luca Provenzano (s3487636)
+// Group : 43
+// License : N.A. or open source license like LGPL
+// Description : Converts a flight recorder ring file or snapshot to CSV
+//==============================================================
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../flight_recorder.h"
+
+/*********************************************
+* @brief Reads a ring file or snapshot and prints its valid records as CSV,
+*        oldest first
+*
+* @param [in] argc argument count
+* @param [in] argv <dump file> [output csv]
+*
+* @return 0: converted; 1: usage or file error
+*********************************************/
+int main(int argc, char *argv[]) {
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s <flight recorder file> [output.csv]\n", argv[0]);
+        return 1;
+    }
+
+    FILE *in = fopen(argv[1], "rb");
+    if (in == NULL) {
+        perror("fopen(input)");
+        return 1;
+    }
+    FILE *out = (argc == 3) ? fopen(argv[2], "w") : stdout;
+    if (out == NULL) {
+        perror("fopen(output)");
+        fclose(in);
+        return 1;
+    }
+
+    FrHeader h;
+    if (fread(&h, sizeof(h), 1, in) != 1 || h.magic != FR_MAGIC ||
+        h.version != FR_VERSION || h.record_size != sizeof(FrRecord) || h.capacity == 0) {
+        fprintf(stderr, "%s: not a flight recorder file (or unsupported version)\n", argv[1]);
+        fclose(in);
+        return 1;
+    }
+
+    FrRecord *ring = (FrRecord *)malloc((size_t)h.capacity * sizeof(FrRecord));
+    if (ring == NULL || fread(ring, sizeof(FrRecord), h.capacity, in) != h.capacity) {
+        fprintf(stderr, "%s: truncated file\n", argv[1]);
+        free(ring);
+        fclose(in);
+        return 1;
+    }
+    fclose(in);
+
+    fprintf(out, "# records %llu..%llu, trigger %s at %llu\n",
+            (unsigned long long)h.first, (unsigned long long)h.head,
+            FrTriggerName(h.trigger_reason), (unsigned long long)h.trigger_index);
+    fprintf(out, "index,t_ns,flags,raw_pitch,raw_yaw,pitch_rad,yaw_rad,pitch_dst_rad,yaw_dst_rad,"
+                 "dt,tilt_out,pan_out,tilt_duty,tilt_dir,pan_duty,pan_dir\n");
+
+    unsigned long long skipped = 0;
+    for (uint64_t i = h.first; i < h.head; i++) {
+        const FrRecord *r = &ring[i % h.capacity];
+        // Slot rewritten after the dump was taken
+        if (r->seq != (uint32_t)i) {
+            skipped++;
+            continue;
+        }
+        fprintf(out, "%llu,%lld,%u,%d,%d,%.6f,%.6f,%.6f,%.6f,%.7f,%.5f,%.5f,%u,%u,%u,%u\n",
+                (unsigned long long)i, (long long)r->t_ns, r->flags, r->raw_pitch, r->raw_yaw,
+                r->pitch_rad, r->yaw_rad, r->pitch_dst_rad, r->yaw_dst_rad, r->dt,
+                r->tilt_out, r->pan_out, r->tilt_duty, r->tilt_dir, r->pan_duty, r->pan_dir);
+    }
+    if (skipped) fprintf(stderr, "%llu inconsistent records skipped\n", skipped);
+
+    free(ring);
+    if (out != stdout) fclose(out);
+    return 0;
+}
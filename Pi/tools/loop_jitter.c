@@ -0,0 +1,99 @@
+// Filename : loop_jitter.c
+// Authors : Luis Moreno (s3608255), Luca Provenzano (s3487636)
+// Group : 43
+// License : N.A. or open source license like LGPL
+// Description : Measures the cadence of the control loop from the FPGA side, with its SPI frame interval histogram
+//==============================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../spi_comm.h"
+
+#define JITTER_DEFAULT_CMD         0x22 // Read of the default loop: 0x40 with --exchange, 0x52 with --fpga-pid
+#define JITTER_DEFAULT_PERIOD_US   100  // 10 kHz loop
+#define JITTER_DEFAULT_BIN_US      2.0
+
+/*********************************************
+* @brief Sets up the FPGA interval histogram for the frames of one command,
+*        lets the control program run for a while and prints what the FPGA
+*        measured: the statistics, then the non-empty bins as CSV. The
+*        intervals are clocked by the FPGA, so the measurement costs the
+*        loop nothing and includes every delay up to the SPI bus.
+*
+* @param [in] argc argument count
+* @param [in] argv [--cmd=N|all] [--period-us=N] [--bin-us=X] [--deadline-us=N] [--spi-crc] <seconds>
+*
+* @return 0: no deadline missed; 1: usage or SPI error; 2: deadlines missed
+*********************************************/
+int main(int argc, char *argv[]) {
+    int cmd = JITTER_DEFAULT_CMD;
+    double period_us = JITTER_DEFAULT_PERIOD_US, bin_us = JITTER_DEFAULT_BIN_US, deadline_us = -1.0;
+    int arg = 1;
+    for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++) {
+        if (strcmp(argv[arg], "--cmd=all") == 0)                cmd = INTERVAL_ALL_CMDS;
+        else if (strncmp(argv[arg], "--cmd=", 6) == 0)          cmd = (int)strtol(argv[arg] + 6, NULL, 0);
+        else if (strncmp(argv[arg], "--period-us=", 12) == 0)   period_us = atof(argv[arg] + 12);
+        else if (strncmp(argv[arg], "--bin-us=", 9) == 0)       bin_us = atof(argv[arg] + 9);
+        else if (strncmp(argv[arg], "--deadline-us=", 14) == 0) deadline_us = atof(argv[arg] + 14);
+        else if (strcmp(argv[arg], "--spi-crc") == 0)           SpiSetChecked(1);
+        else period_us = 0.0; // Forces the usage message
+    }
+    if (arg != argc - 1 || atof(argv[arg]) <= 0.0 || period_us <= 0.0 || bin_us <= 0.0) {
+        fprintf(stderr, "Usage: %s [--cmd=N|all] [--period-us=N] [--bin-us=X] [--deadline-us=N] [--spi-crc] "
+                        "<seconds>\n", argv[0]);
+        return 1;
+    }
+    double seconds = atof(argv[arg]);
+    if (deadline_us < 0.0) deadline_us = 1.5 * period_us;
+
+    // Bins of a power of two FPGA clock cycles, at most bin_us, centred on the period
+    const double cycles_per_us = FPGA_CLK_HZ / 1e6;
+    unsigned width_log2 = 0;
+    while (width_log2 < 23 && (double)(2u << width_log2) <= bin_us * cycles_per_us) width_log2++;
+    double width_cycles = (double)(1u << width_log2);
+    double origin = period_us * cycles_per_us - INTERVAL_BINS / 2 * width_cycles;
+    origin = origin < 0.0 ? 0.0 : (double)(uint32_t)origin;
+    double deadline = deadline_us * cycles_per_us;
+    if (origin > 0xFFFFFF || deadline > 0xFFFFFF) {
+        fprintf(stderr, "Error: Period and deadline up to %.0f us.\n", 0xFFFFFF / cycles_per_us);
+        return 1;
+    }
+
+    int fd = SpiOpen(SPI_CHANNEL, SPI_SPEED_HZ, SPI_MODE);
+    if (fd < 0) return 1;
+
+    if (SetIntervalHistogramCmd(fd, cmd, (uint32_t)origin, width_log2, (uint32_t)deadline) < 0) {
+        fprintf(stderr, "Error: Failed to set up the interval histogram.\n");
+        SpiClose(fd);
+        return 1;
+    }
+    const struct timespec wait = { (time_t)seconds, (long)((seconds - (double)(time_t)seconds) * 1e9) };
+    nanosleep(&wait, NULL);
+
+    IntervalHistogram hist;
+    int err = ReadIntervalHistogramCmd(fd, &hist);
+    SpiClose(fd);
+    if (err < 0) {
+        fprintf(stderr, "Error: Failed to read the interval histogram (%d).\n", err);
+        return 1;
+    }
+
+    if (hist.count == 0) {
+        fprintf(stderr, "No interval timed: is the control program running with that command?\n");
+        return 1;
+    }
+    fprintf(stderr, "%u intervals, min %.2f us, max %.2f us, %u over the %.1f us deadline\n", hist.count,
+            hist.min / cycles_per_us, hist.max / cycles_per_us, hist.missed, deadline_us);
+    printf("from_us,to_us,count\n");
+    for (unsigned b = 0; b < INTERVAL_BINS; b++) {
+        if (hist.bins[b] == 0) continue;
+        // The first and last bins also hold the intervals below and above them
+        double from = origin + b * width_cycles, to = from + width_cycles;
+        if (b == 0 && hist.min < from) from = hist.min;
+        if (b == INTERVAL_BINS - 1 && hist.max >= to) to = hist.max + 1.0;
+        printf("%.2f,%.2f,%u\n", from / cycles_per_us, to / cycles_per_us, hist.bins[b]);
+    }
+    return hist.missed > 0 ? 2 : 0;
+}
@@ -0,0 +1,83 @@
+// Filename : pid_vectors.c
+// Authors : Luis Moreno (s3608255), Luca Provenzano (s3487636)
+// Group : 43
+// License : N.A. or open source license like LGPL
+// Description : Writes the test vectors of the PID.v testbench from the bit-exact model (fpga_pid.c)
+//==============================================================
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../fpga_pid.h"
+#include "../sim/sim_plant.h"
+
+#define PID_PERIOD_NS (1000000000 / FPGA_PID_HZ)
+#define DUTY_PER_UNIT 819.0     // motor_control.cpp MAX_SAFE_DUTY
+
+/*********************************************
+* @brief Runs the pitch loop of the simulated gimbal through setpoint steps
+*        and writes, for every update, the inputs of PID.v and the output
+*        the model gives. Gains file: a, b, c, d, limit, one per line.
+*        Vectors file: {position, setpoint, 3'b0, dir, duty[11:0]}, 80 bits
+*        per line.
+*
+* @param [in] argc argument count
+* @param [in] argv <gains.hex> <vectors.hex> [updates]
+*
+* @return 0: written; 1: usage or file error
+*********************************************/
+int main(int argc, char *argv[]) {
+    if (argc < 3 || argc > 4) {
+        fprintf(stderr, "Usage: %s <gains.hex> <vectors.hex> [updates]\n", argv[0]);
+        return 1;
+    }
+    int updates = (argc == 4) ? atoi(argv[3]) : 4000;
+
+    SimAxisParams pitch_p, yaw_p;
+    SimPlant plant;
+    SimAxisDefaults(&pitch_p, &yaw_p);
+    SimPlantInit(&plant, &pitch_p, &yaw_p, 0.5 * pitch_p.range_rad, 0.5 * yaw_p.range_rad, 0);
+
+    PidParams params, unused;
+    FpgaPidGains g;
+    FpgaPid pid;
+    FpgaPidDefaultParams(&params, &unused);
+    if (FpgaPidGainsFrom(&g, &params, 1.0 / FPGA_PID_HZ, 1.0 / pitch_p.counts_per_rad, DUTY_PER_UNIT) < 0) {
+        fprintf(stderr, "Gains out of range\n");
+        return 1;
+    }
+    FpgaPidReset(&pid, &g);
+
+    FILE *gains = fopen(argv[1], "w");
+    FILE *vectors = fopen(argv[2], "w");
+    if (gains == NULL || vectors == NULL) {
+        perror("fopen");
+        if (gains) fclose(gains);
+        if (vectors) fclose(vectors);
+        return 1;
+    }
+    fprintf(gains, "%08X\n%08X\n%08X\n%08X\n%08X\n", (uint32_t)g.a, (uint32_t)g.b, (uint32_t)g.c, g.d,
+            (uint32_t)g.limit);
+
+    // Steps of 0.1 to 0.4 rad both ways, so both the limit and the small
+    // signal range are covered
+    const double steps_rad[] = { 0.1, -0.3, 0.4, 0.0, -0.2 };
+    const int n_steps = (int)(sizeof(steps_rad) / sizeof(steps_rad[0]));
+    plant.pitch.enable = 1;
+    for (int i = 0; i < updates; i++) {
+        int32_t position = SimAxisCounts(&plant.pitch);
+        int32_t setpoint = (int32_t)(steps_rad[(i * n_steps) / updates] * pitch_p.counts_per_rad);
+        uint8_t dir;
+        uint16_t duty = FpgaPidStep(&pid, position, setpoint, &dir);
+        fprintf(vectors, "%08X%08X%04X\n", (uint32_t)position, (uint32_t)setpoint,
+                (unsigned)((dir << 12) | duty));
+
+        plant.pitch.duty = duty;
+        plant.pitch.dir  = dir;
+        SimPlantAdvance(&plant, plant.t_ns + PID_PERIOD_NS);
+    }
+
+    fclose(gains);
+    fclose(vectors);
+    printf("%d vectors, limit %u\n", updates, g.limit);
+    return 0;
+}
@@ -0,0 +1,189 @@
+// Filename : pwm_playback.c
+// Authors : Luis Moreno (s3608255), Luca Provenzano (s3487636)
+// Group : 43
+// License : N.A. or open source license like LGPL
+// Description : Plays a PWM profile through the FPGA PWM queue, so that its steps keep the FPGA timing
+//==============================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../spi_comm.h"
+
+#define PLAYBACK_DEFAULT_STEP_US    1000
+#define PLAYBACK_DEFAULT_LEAD_MS    20
+#define PLAYBACK_DEFAULT_TIMEOUT_MS 20 // More than the push period
+#define PLAYBACK_PUSH_MS            5
+#define PLAYBACK_DRAIN_MARGIN_MS    200 // After the last step is due, before the queue is given up
+
+/*********************************************
+* @brief Milliseconds elapsed since a CLOCK_MONOTONIC time
+*
+* @param [in] since start time
+*
+* @return elapsed time in ms
+*********************************************/
+static double ElapsedMs(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - since->tv_sec) * 1e3 + (double)(now.tv_nsec - since->tv_nsec) / 1e6;
+}
+
+/*********************************************
+* @brief PWM status of a signed duty cycle: negative towards decreasing
+*        counts, 0 braked
+*
+* @param [in] duty signed duty cycle, clamped to 12 bits
+*
+* @return PWM status
+*********************************************/
+static PwmStatus SignedPwm(long duty) {
+    PwmStatus s;
+    long mag = duty < 0 ? -duty : duty;
+    s.enable = duty != 0;
+    s.dir    = duty < 0;
+    s.duty   = (uint16_t)(mag > 0xFFF ? 0xFFF : mag);
+    return s;
+}
+
+/*********************************************
+* @brief Reads a profile of "pitch,yaw" signed duty cycles, one step per
+*        line; lines that do not start with a number are skipped
+*
+* @param [in]  in   CSV input
+* @param [out] n    number of steps
+*
+* @return steps, with their at still to be set; NULL: empty or out of memory
+*********************************************/
+static PwmQueueEntry *ReadProfile(FILE *in, unsigned *n) {
+    PwmQueueEntry *steps = NULL;
+    unsigned size = 0;
+    char line[128];
+    long pitch, yaw;
+    *n = 0;
+    while (fgets(line, sizeof(line), in) != NULL) {
+        if (sscanf(line, "%ld,%ld", &pitch, &yaw) != 2) continue; // Header
+        if (*n == size) {
+            size = size ? 2 * size : 1024;
+            PwmQueueEntry *grown = realloc(steps, size * sizeof(*steps));
+            if (grown == NULL) {
+                free(steps);
+                return NULL;
+            }
+            steps = grown;
+        }
+        steps[*n].pitch = SignedPwm(pitch);
+        steps[*n].yaw   = SignedPwm(yaw);
+        (*n)++;
+    }
+    if (*n == 0) {
+        free(steps);
+        return NULL;
+    }
+    return steps;
+}
+
+/*********************************************
+* @brief Schedules a PWM profile from a short lead on and keeps the FPGA
+*        PWM queue ahead of it, every few ms in one SPI burst. The steps
+*        are applied on PWM period ends at their FPGA clock cycle, so
+*        their timing does not depend on the scheduling of this process.
+*        Both axes are braked at the end, also when the queue stops
+*        advancing and the profile is given up.
+*
+* @param [in] argc argument count
+* @param [in] argv [--step-us=N] [--lead-ms=N] [--timeout-ms=N] [--hold] [--spi-crc] [profile.csv]
+*
+* @return 0: played without underrun; 1: usage or SPI error, or the queue stalled; 2: underruns
+*********************************************/
+int main(int argc, char *argv[]) {
+    unsigned step_us = PLAYBACK_DEFAULT_STEP_US, lead_ms = PLAYBACK_DEFAULT_LEAD_MS;
+    unsigned timeout_ms = PLAYBACK_DEFAULT_TIMEOUT_MS;
+    uint8_t flags = PWM_QUEUE_BRAKE;
+    int arg = 1;
+    for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++) {
+        if (strncmp(argv[arg], "--step-us=", 10) == 0)         step_us = (unsigned)atoi(argv[arg] + 10);
+        else if (strncmp(argv[arg], "--lead-ms=", 10) == 0)    lead_ms = (unsigned)atoi(argv[arg] + 10);
+        else if (strncmp(argv[arg], "--timeout-ms=", 13) == 0) timeout_ms = (unsigned)atoi(argv[arg] + 13);
+        else if (strcmp(argv[arg], "--hold") == 0)             flags = 0;
+        else if (strcmp(argv[arg], "--spi-crc") == 0)          SpiSetChecked(1);
+        else step_us = 0; // Forces the usage message
+    }
+    // At least one PWM period per step, and a timeout that fits the 24-bit register
+    if (argc - arg > 1 || step_us < 1000000 / FPGA_PWM_HZ || step_us > 1000000 ||
+        (uint64_t)timeout_ms * (FPGA_CLK_HZ / 1000) > 0xFFFFFF) {
+        fprintf(stderr, "Usage: %s [--step-us=N] [--lead-ms=N] [--timeout-ms=N] [--hold] [--spi-crc] [profile.csv]\n",
+                argv[0]);
+        return 1;
+    }
+    FILE *in = (argc - arg == 1) ? fopen(argv[arg], "r") : stdin;
+    if (in == NULL) {
+        perror("fopen(profile)");
+        return 1;
+    }
+    unsigned n;
+    PwmQueueEntry *steps = ReadProfile(in, &n);
+    if (in != stdin) fclose(in);
+    if (steps == NULL) {
+        fprintf(stderr, "Error: Empty profile.\n");
+        return 1;
+    }
+
+    int fd = SpiOpen(SPI_CHANNEL, SPI_SPEED_HZ, SPI_MODE);
+    if (fd < 0) {
+        free(steps);
+        return 1;
+    }
+
+    PwmQueue q;
+    int32_t pitch, yaw;
+    uint32_t stamp;
+    if (PwmQueueStart(&q, fd, flags, timeout_ms * (FPGA_CLK_HZ / 1000)) < 0 ||
+        ReadPositionStampedCmd(fd, UnitAll, &pitch, &yaw, &stamp) < 0) {
+        fprintf(stderr, "Error: Failed to start the FPGA PWM queue.\n");
+        SpiClose(fd);
+        free(steps);
+        return 1;
+    }
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint32_t first_at = stamp + lead_ms * (FPGA_CLK_HZ / 1000);
+    for (unsigned k = 0; k < n; k++) steps[k].at = first_at + (uint32_t)((uint64_t)k * step_us * (FPGA_CLK_HZ / 1000000));
+
+    // The last step is due after lead_ms + (n - 1) steps; a queue that has
+    // not played it well after that has stopped
+    const double limit_ms = lead_ms + (double)n * step_us / 1000.0 + PLAYBACK_DRAIN_MARGIN_MS;
+    uint64_t frames = 0, failed = 0;
+    unsigned sent = 0;
+    uint32_t regs[2] = { 0, 0 };   // REG_QUEUE, REG_QUEUE_UNDERRUNS
+    int have_regs = 0, played = 0;
+    const struct timespec push = { 0, PLAYBACK_PUSH_MS * 1000000L };
+    while (sent < n && ElapsedMs(&start) < limit_ms) {
+        int taken = PwmQueuePush(&q, fd, &steps[sent], n - sent);
+        frames++;
+        if (taken < 0) failed++;   // Sent again on the next push
+        else sent += (unsigned)taken;
+        nanosleep(&push, NULL);
+    }
+    // Until the last step is applied, before the underrun that follows it
+    while (sent == n && !played && ElapsedMs(&start) < limit_ms) {
+        nanosleep(&push, NULL);
+        if (ReadRegsCmd(fd, REG_QUEUE, 2, regs) < 0) continue; // Failed read: keep the last one
+        have_regs = 1;
+        played = (uint16_t)regs[0] == q.next;
+    }
+    if (have_regs) q.underrun_total += (uint8_t)(regs[1] - q.underruns);
+    SendAllPwmCmd(fd, 0, 0, 0, 0, 0, 0);
+    SpiClose(fd);
+    free(steps);
+
+    fprintf(stderr, "%u steps of %u us in %llu frames (%llu failed), %llu underruns\n", n, step_us,
+            (unsigned long long)frames, (unsigned long long)failed, (unsigned long long)q.underrun_total);
+    if (!played) {
+        fprintf(stderr, "Error: The FPGA PWM queue stopped: %u of %u steps queued, %u applied.\n", sent, n,
+                have_regs ? (unsigned)(uint16_t)regs[0] : 0u);
+        return 1;
+    }
+    return q.underrun_total > 0 ? 2 : 0;
+}
@@ -0,0 +1,84 @@
+// Filename : spi_qualify.c
+// Authors : Luis Moreno (s3608255), Luca Provenzano (s3487636)
+// Group : 43
+// License : N.A. or open source license like LGPL
+// Description : Measures the checked frame error rate of the FPGA link at several SPI clocks
+//==============================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../spi_comm.h"
+
+#define QUALIFY_DEFAULT_FRAMES 100000
+
+/*********************************************
+* @brief Runs read-only checked commands (the PWM is left untouched) at
+*        each clock and prints the errors seen. A clock passes when no
+*        frame failed a check; the error rate is then below 3/frames
+*        with 95% confidence.
+*
+* @param [in] argc argument count
+* @param [in] argv [--frames=N] <hz> [hz ...]
+*
+* @return 0: all clocks passed; 1: usage or SPI error; 2: some clock failed
+*********************************************/
+int main(int argc, char *argv[]) {
+    unsigned frames = QUALIFY_DEFAULT_FRAMES, max_hz = 0;
+    int first_rate = 1;
+    if (argc > 1 && strncmp(argv[1], "--frames=", 9) == 0) {
+        frames = (unsigned)atoi(argv[1] + 9);
+        first_rate = 2;
+    }
+    for (int i = first_rate; i < argc; i++) {
+        if (atoi(argv[i]) <= 0) first_rate = argc; // Forces the usage message
+        else if ((unsigned)atoi(argv[i]) > max_hz) max_hz = (unsigned)atoi(argv[i]);
+    }
+    if (first_rate >= argc || frames == 0) {
+        fprintf(stderr, "Usage: %s [--frames=N] <hz> [hz ...]\n", argv[0]);
+        return 1;
+    }
+
+    int fd = SpiOpen(SPI_CHANNEL, max_hz, SPI_MODE);
+    if (fd < 0) return 1;
+    SpiSetChecked(1);
+
+    int result = 0;
+    printf("%10s %8s %8s %8s %8s %8s %10s\n", "clock_hz", "frames", "crc", "nack", "bad_ack", "failed", "error_rate");
+    for (int i = first_rate; i < argc; i++) {
+        unsigned hz = (unsigned)atoi(argv[i]);
+        SpiSetSpeed(hz);
+        SpiResetLinkStats();
+
+        // The three read shapes used by the tracker: 9, 10 and 5 byte commands
+        int32_t pitch, yaw;
+        uint8_t pitch_motion, yaw_motion;
+        PwmStatus pitch_status, yaw_status;
+        for (unsigned n = 0; n < frames; n++) {
+            int err;
+            switch (n % 3) {
+            case 0:  err = ReadPositionCmd(fd, UnitAll, &pitch, &yaw); break;
+            case 1:  err = ReadMotionCmd(fd, &pitch, &yaw, &pitch_motion, &yaw_motion); break;
+            default: err = CheckPwmStatus(fd, &pitch_status, &yaw_status); break;
+            }
+            if (err < 0 && err != SPI_ERR_CHECK) {
+                fprintf(stderr, "Error: SPI transfer failed at %u Hz (%d).\n", hz, err);
+                SpiClose(fd);
+                return 1;
+            }
+        }
+
+        SpiLinkStats link;
+        SpiGetLinkStats(&link);
+        uint64_t bad = link.crc_errors + link.nacks + link.ack_errors;
+        printf("%10u %8llu %8llu %8llu %8llu %8llu %10.2e %s\n", hz, (unsigned long long)link.frames,
+               (unsigned long long)link.crc_errors, (unsigned long long)link.nacks,
+               (unsigned long long)link.ack_errors, (unsigned long long)link.failures,
+               bad > 0 ? (double)bad / (double)link.frames : 3.0 / (double)link.frames,
+               bad > 0 ? "FAIL" : "pass (< bound)");
+        if (bad > 0) result = 2;
+    }
+
+    SpiClose(fd);
+    return result;
+}
@@ -0,0 +1,354 @@
+// Filename : trajectory.c
+// Authors : Luis Moreno (s3608255), Luca Provenzano (s3487636)
+// Group : 43
+// License : N.A. or open source license like LGPL
+// Description : Jerk-limited (double S) online trajectory generator, replanned on every vision update
+//==============================================================
+#include "trajectory.h"
+#include <math.h>
+#include <string.h>
+
+#define TRAJ_GAMMA       0.99  // Acceleration reduction per iteration when a_max cannot be reached
+#define TRAJ_MAX_ITER    500
+#define TRAJ_EPS         1e-9
+
+/*********************************************
+* @brief Plans a double S profile between two points, with the initial
+*        velocity given and the final velocity 0. The motion must be
+*        feasible (checked by the caller).
+*
+* @param [out] s   segment
+* @param [in]  lim limits
+* @param [in]  q0  initial position
+* @param [in]  q1  final position
+* @param [in]  v0  initial velocity
+*
+* @return 0: planned; -1: no valid profile
+*********************************************/
+static int PlanSegment(TrajSegment *s, const TrajLimits *lim, double q0, double q1, double v0) {
+    memset(s, 0, sizeof(*s));
+    s->sigma = (q1 >= q0) ? 1.0 : -1.0;
+    s->q0 = s->sigma * q0;
+    s->q1 = s->sigma * q1;
+    s->v0 = s->sigma * v0;
+    s->v1 = 0.0;
+    s->j_max = lim->j_max;
+
+    double h = s->q1 - s->q0, v_max = lim->v_max, a_max = lim->a_max, j = lim->j_max;
+    v0 = s->v0;
+    if (h < TRAJ_EPS && fabs(v0) < TRAJ_EPS) return 0; // Already there
+
+    double Ta, Tv, Td, Tj1, Tj2;
+
+    // Assume v_max and a_max are reached
+    if ((v_max - v0) * j < a_max * a_max) {
+        Tj1 = sqrt(fmax(v_max - v0, 0.0) / j);
+        Ta  = 2.0 * Tj1;
+    } else {
+        Tj1 = a_max / j;
+        Ta  = Tj1 + (v_max - v0) / a_max;
+    }
+    if (v_max * j < a_max * a_max) {
+        Tj2 = sqrt(v_max / j);
+        Td  = 2.0 * Tj2;
+    } else {
+        Tj2 = a_max / j;
+        Td  = Tj2 + v_max / a_max;
+    }
+    Tv = h / v_max - Ta / 2.0 * (1.0 + v0 / v_max) - Td / 2.0;
+
+    if (Tv < 0.0) {
+        // v_max is not reached, shrink a_max until both phases fit
+        Tv = 0.0;
+        double a = a_max;
+        int iter = 0;
+        for (;;) {
+            Tj1 = Tj2 = a / j;
+            double delta = pow(a, 4) / (j * j) + 2.0 * v0 * v0 + a * (4.0 * h - 2.0 * a / j * v0);
+            Ta = (a * a / j - 2.0 * v0 + sqrt(delta)) / (2.0 * a);
+            Td = (a * a / j + sqrt(delta)) / (2.0 * a);
+
+            if (Ta < 0.0) {
+                // Only a deceleration phase
+                Ta = 0.0;
+                Tj1 = 0.0;
+                if (v0 <= 0.0) return -1;
+                Td = 2.0 * h / v0;
+                Tj2 = (j * h - sqrt(j * (j * h * h - v0 * v0 * v0))) / (j * v0);
+                break;
+            }
+            if (Ta >= 2.0 * Tj1 && Td >= 2.0 * Tj2) break;
+            if (++iter >= TRAJ_MAX_ITER) return -1;
+            a *= TRAJ_GAMMA;
+        }
+    }
+    if (!(Ta >= 0.0 && Td >= 0.0 && Tj1 >= 0.0 && Tj2 >= 0.0) || !isfinite(Ta + Td + Tj1 + Tj2)) return -1;
+
+    s->Ta = Ta; s->Tv = Tv; s->Td = Td; s->Tj1 = Tj1; s->Tj2 = Tj2;
+    s->T = Ta + Tv + Td;
+    s->a_lim_a = j * Tj1;
+    s->a_lim_d = -j * Tj2;
+    s->v_lim = v0 + (Ta - Tj1) * s->a_lim_a;
+    return 0;
+}
+
+/*********************************************
+* @brief Plans the shortest jerk-limited stop from velocity v0 (a pure
+*        deceleration phase)
+*
+* @param [out] s   segment
+* @param [in]  lim limits
+* @param [in]  q0  initial position
+* @param [in]  v0  initial velocity
+*
+* @return None.
+*********************************************/
+static void PlanBrake(TrajSegment *s, const TrajLimits *lim, double q0, double v0) {
+    memset(s, 0, sizeof(*s));
+    double j = lim->j_max, a_max = lim->a_max, dv = fabs(v0);
+
+    s->sigma = (v0 >= 0.0) ? 1.0 : -1.0;
+    s->j_max = j;
+    if (dv * j < a_max * a_max) {
+        s->Tj2 = sqrt(dv / j);
+        s->Td  = 2.0 * s->Tj2;
+    } else {
+        s->Tj2 = a_max / j;
+        s->Td  = s->Tj2 + dv / a_max;
+    }
+    s->T = s->Td;
+    s->v0 = s->v_lim = dv;
+    s->q0 = s->sigma * q0;
+    s->q1 = s->q0 + dv * s->Td / 2.0;
+    s->a_lim_d = -j * s->Tj2;
+}
+
+/*********************************************
+* @brief Plans the jerk phase that brings the acceleration a0 to 0
+*
+* @param [out] r   ramp
+* @param [in]  lim limits
+* @param [in]  q0  initial position
+* @param [in]  v0  initial velocity
+* @param [in]  a0  initial acceleration
+*
+* @return None.
+*********************************************/
+static void PlanRamp(TrajRamp *r, const TrajLimits *lim, double q0, double v0, double a0) {
+    r->q0 = q0;
+    r->v0 = v0;
+    r->a0 = a0;
+    r->j  = (a0 > 0.0) ? -lim->j_max : lim->j_max;
+    r->T  = fabs(a0) / lim->j_max;
+}
+
+/*********************************************
+* @brief Evaluates a ramp at time t, in closed form
+*
+* @param [in]  r ramp
+* @param [in]  t time from the ramp start, up to r->T
+* @param [out] q position
+* @param [out] v velocity
+* @param [out] a acceleration
+*
+* @return None.
+*********************************************/
+static void EvalRamp(const TrajRamp *r, double t, double *q, double *v, double *a) {
+    *q = r->q0 + r->v0 * t + r->a0 * t * t / 2.0 + r->j * t * t * t / 6.0;
+    *v = r->v0 + r->a0 * t + r->j * t * t / 2.0;
+    *a = r->a0 + r->j * t;
+}
+
+/*********************************************
+* @brief Evaluates a segment at time t, in closed form
+*
+* @param [in]  s segment
+* @param [in]  t time from the segment start
+* @param [out] q position
+* @param [out] v velocity
+* @param [out] a acceleration
+*
+* @return None.
+*********************************************/
+static void EvalSegment(const TrajSegment *s, double t, double *q, double *v, double *a) {
+    double j = s->j_max, T = s->T;
+    double pq, pv, pa;
+
+    if (t <= 0.0) {
+        pq = s->q0; pv = s->v0; pa = 0.0;
+    } else if (t >= T) {
+        pq = s->q1; pv = s->v1; pa = 0.0;
+    } else if (t < s->Tj1) {
+        pq = s->q0 + s->v0 * t + j * t * t * t / 6.0;
+        pv = s->v0 + j * t * t / 2.0;
+        pa = j * t;
+    } else if (t < s->Ta - s->Tj1) {
+        pq = s->q0 + s->v0 * t + s->a_lim_a / 6.0 * (3.0 * t * t - 3.0 * s->Tj1 * t + s->Tj1 * s->Tj1);
+        pv = s->v0 + s->a_lim_a * (t - s->Tj1 / 2.0);
+        pa = s->a_lim_a;
+    } else if (t < s->Ta) {
+        double r = s->Ta - t;
+        pq = s->q0 + (s->v_lim + s->v0) * s->Ta / 2.0 - s->v_lim * r + j * r * r * r / 6.0;
+        pv = s->v_lim - j * r * r / 2.0;
+        pa = j * r;
+    } else if (t < s->Ta + s->Tv) {
+        pq = s->q0 + (s->v_lim + s->v0) * s->Ta / 2.0 + s->v_lim * (t - s->Ta);
+        pv = s->v_lim;
+        pa = 0.0;
+    } else {
+        double td = t - T + s->Td;
+        double base = s->q1 - (s->v_lim + s->v1) * s->Td / 2.0 + s->v_lim * td;
+        if (td < s->Tj2) {
+            pq = base - j * td * td * td / 6.0;
+            pv = s->v_lim - j * td * td / 2.0;
+            pa = -j * td;
+        } else if (t < T - s->Tj2) {
+            pq = base + s->a_lim_d / 6.0 * (3.0 * td * td - 3.0 * s->Tj2 * td + s->Tj2 * s->Tj2);
+            pv = s->v_lim + s->a_lim_d * (td - s->Tj2 / 2.0);
+            pa = s->a_lim_d;
+        } else {
+            double r = T - t;
+            pq = s->q1 - s->v1 * r - j * r * r * r / 6.0;
+            pv = s->v1 + j * r * r / 2.0;
+            pa = -j * r;
+        }
+    }
+    *q = s->sigma * pq;
+    *v = s->sigma * pv;
+    *a = s->sigma * pa;
+}
+
+/*********************************************
+* @brief Initializes the generator at rest
+*
+* @param [out] tr  trajectory
+* @param [in]  lim kinematic limits
+* @param [in]  q   initial position
+*
+* @return None.
+*********************************************/
+void TrajInit(Trajectory *tr, const TrajLimits *lim, double q) {
+    memset(tr, 0, sizeof(*tr));
+    tr->lim = *lim;
+    tr->q = tr->goal = q;
+}
+
+/*********************************************
+* @brief Plans from a state at rest acceleration (q0, v0, a = 0), braking
+*        first if the goal is too close to be reached without overshoot
+*
+* @param [inout] tr trajectory, seg and n are set
+* @param [in]    q0 initial position
+* @param [in]    v0 initial velocity
+* @param [in]    q1 goal
+*
+* @return 1: braking segment added; 0: single profile
+*********************************************/
+static int PlanFromZeroAcceleration(Trajectory *tr, double q0, double v0, double q1) {
+    const TrajLimits *lim = &tr->lim;
+
+    // Feasibility (B&M eq. 3.17-3.18): can the axis stop before q1?
+    double sigma = (q1 >= q0) ? 1.0 : -1.0;
+    double h = sigma * (q1 - q0), vs = sigma * v0;
+    double dv = fabs(vs);
+    double Tj = fmin(sqrt(dv / lim->j_max), lim->a_max / lim->j_max);
+    double stop = (Tj < lim->a_max / lim->j_max) ? Tj * vs : 0.5 * vs * (Tj + dv / lim->a_max);
+
+    if (vs > lim->v_max + TRAJ_EPS || (vs > 0.0 && h < stop) || PlanSegment(&tr->seg[0], lim, q0, q1, v0) != 0) {
+        // Stop first, then a rest-to-rest profile from where the axis stopped
+        PlanBrake(&tr->seg[0], lim, q0, v0);
+        double qs = tr->seg[0].sigma * tr->seg[0].q1;
+        if (PlanSegment(&tr->seg[1], lim, qs, q1, 0.0) != 0) {
+            PlanSegment(&tr->seg[1], lim, qs, qs, 0.0);
+        }
+        tr->n = 2;
+        return 1;
+    }
+    tr->n = 1;
+    return 0;
+}
+
+/*********************************************
+* @brief Replans from the current reference to a new goal, keeping its
+*        position, velocity and acceleration. An acceleration towards the
+*        goal is continued: the reference lies on the first jerk phase of
+*        a profile started earlier at zero acceleration, and the new plan
+*        is that profile entered at the current point. Otherwise (or when
+*        that profile accelerates less than the reference already does) the
+*        acceleration first ramps to 0 at the jerk limit. If the goal is
+*        then too close to be reached without overshoot, the axis brakes to
+*        rest and moves back to it.
+*
+* @param [inout] tr trajectory
+* @param [in]    q1 new goal
+*
+* @return 1: braking segment added; 0: single profile
+*********************************************/
+int TrajPlan(Trajectory *tr, double q1) {
+    const TrajLimits *lim = &tr->lim;
+    double q0 = tr->q, v0 = tr->v, a0 = tr->a;
+    double j = lim->j_max;
+    tr->goal = q1;
+    tr->t = 0.0;
+    tr->ramp.T = 0.0;
+
+    if (fabs(a0) < TRAJ_EPS) return PlanFromZeroAcceleration(tr, q0, v0, q1);
+
+    // Back along the jerk phase to the point where the acceleration was 0
+    double sigma = (a0 > 0.0) ? 1.0 : -1.0;
+    double tau = fabs(a0) / j;
+    double qv = q0 - v0 * tau + a0 * tau * tau / 2.0 - sigma * j * tau * tau * tau / 6.0;
+    double vv = v0 - a0 * tau / 2.0;
+    if (sigma * (q1 - q0) > 0.0 && PlanFromZeroAcceleration(tr, qv, vv, q1) == 0 &&
+        tr->seg[0].sigma == sigma && tr->seg[0].Tj1 >= tau - TRAJ_EPS && tr->seg[0].Ta >= 2.0 * tau) {
+        tr->t = tau;
+        return 0;
+    }
+
+    // Ramp the acceleration to 0, then plan from the end of the ramp
+    PlanRamp(&tr->ramp, lim, q0, v0, a0);
+    double qr, vr, ar;
+    EvalRamp(&tr->ramp, tr->ramp.T, &qr, &vr, &ar);
+    return PlanFromZeroAcceleration(tr, qr, vr, q1);
+}
+
+/*********************************************
+* @brief Advances the trajectory and evaluates the reference
+*
+* @param [inout] tr trajectory
+* @param [in]    dt time step [s]
+*
+* @return None.
+*********************************************/
+void TrajStep(Trajectory *tr, double dt) {
+    tr->t += dt;
+    if (tr->n == 0) {
+        tr->v = tr->a = 0.0;
+        return;
+    }
+    double t = tr->t;
+    if (t < tr->ramp.T) {
+        EvalRamp(&tr->ramp, t, &tr->q, &tr->v, &tr->a);
+        return;
+    }
+    t -= tr->ramp.T;
+    const TrajSegment *s = &tr->seg[0];
+    if (tr->n == 2 && t >= s->T) {
+        t -= s->T;
+        s = &tr->seg[1];
+    }
+    EvalSegment(s, t, &tr->q, &tr->v, &tr->a);
+}
+
+/*********************************************
+* @brief Time left until the goal is reached
+*
+* @param [in] tr trajectory
+*
+* @return remaining time [s]
+*********************************************/
+double TrajRemaining(const Trajectory *tr) {
+    double total = tr->ramp.T;
+    for (int i = 0; i < tr->n; i++) total += tr->seg[i].T;
+    return fmax(total - tr->t, 0.0);
+}
@@ -0,0 +1,73 @@
+// Filename : trajectory.h
+// Authors : Luis Moreno (s3608255), Luca Provenzano (s3487636)
+// Group : 43
+// License : N.A. or open source license like LGPL
+// Description : header file for the jerk-limited (double S) online trajectory generator
+//==============================================================
+
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Kinematic limits of an axis.
+typedef struct TrajLimits {
+    double v_max;   // [rad/s]
+    double a_max;   // [rad/s^2]
+    double j_max;   // [rad/s^3]
+} TrajLimits;
+
+// One double S profile, stored in the frame where the motion is positive
+// (sigma gives the real direction). Biagiotti & Melchiorri, "Trajectory
+// Planning for Automatic Machines and Robots", sec. 3.4.
+typedef struct TrajSegment {
+    double sigma;           // +1 or -1
+    double q0, q1, v0, v1;  // Boundary conditions, in the positive frame
+    double v_lim;           // Cruise velocity reached
+    double a_lim_a;         // Acceleration reached in the acceleration phase
+    double a_lim_d;         // Acceleration reached in the deceleration phase (<= 0)
+    double Ta, Tv, Td;      // Acceleration, constant velocity and deceleration times
+    double Tj1, Tj2;        // Jerk times of the acceleration and deceleration phases
+    double j_max;
+    double T;               // Total duration
+} TrajSegment;
+
+// Constant jerk phase that brings the acceleration of the reference to 0.
+typedef struct TrajRamp {
+    double q0, v0, a0;      // Reference when the ramp starts
+    double j;               // Jerk, of the sign opposite to a0
+    double T;               // Duration, 0 if there is no ramp
+} TrajRamp;
+
+typedef struct Trajectory {
+    TrajLimits lim;
+    TrajRamp ramp;          // Optional ramp of the acceleration to 0
+    TrajSegment seg[2];     // Optional braking segment, then the profile to the goal
+    int n;                  // Segments in use
+    double t;               // Time since the start of the plan (may start past 0)
+    double goal;            // Destination of the last plan
+
+    // Reference at the current time
+    double q, v, a;
+} Trajectory;
+
+// Starts at rest at position q.
+void TrajInit(Trajectory *tr, const TrajLimits *lim, double q);
+
+// Replans from the current reference (q, v, a) to q1, ending at rest.
+// Returns 1 if the goal was too close to stop on and a braking segment was added, 0 otherwise.
+int TrajPlan(Trajectory *tr, double q1);
+
+// Advances the time by dt and evaluates the reference, in O(1).
+void TrajStep(Trajectory *tr, double dt);
+
+// Remaining time to reach the goal.
+double TrajRemaining(const Trajectory *tr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif